@@ -0,0 +1,1454 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: End to end firmware update benchmark. For each combination
+ * 				of image size, baud rate, packet size and error rate the
+ * 				simulator is started over blank flash, an image is
+ * 				uploaded through its pseudo terminal and the simulator's
+ * 				statistics are merged with the times measured here. The
+ * 				update is then checked by comparing the saved flash with
+ * 				the image and restarting the simulator, which must start
+ * 				the application.
+ *
+ * 				Usage: xmodem_bench [-S sim] [-s sizes] [-b bauds]
+ * 				                    [-p packets] [-e errors] [-r runs]
+ * 				                    [-d drop] [-k lost] [-g noise] [-l line]
+ * 				                    [-x seed] [-G] [-W] [-L latency] [-T limit]
+ * 				                    [-o] [-n] [-j] [-h]
+ *
+ * 				-S  Simulator to run (default ./lpc11xx_sim).
+ * 				-s  Comma separated image sizes in bytes.
+ * 				-b  Comma separated baud rates, rates other than 9600 are
+ * 				    negotiated before the first packet.
+ * 				-p  Comma separated packet payload sizes (128 or 1024).
+ * 				-e  Comma separated probabilities of corrupting a packet.
+ * 				-d  Probability of dropping one character of a packet,
+ * 				    which the bootloader must notice by timing out.
+ * 				-k  Probability of ignoring an ACK and sending the packet
+ * 				    again, as if the ACK was lost. The repeat must be
+ * 				    acknowledged without being programmed twice.
+ * 				-g  Probability of sending a burst of random characters
+ * 				    (line noise) before a packet. The bootloader must
+ * 				    find the packet's header after it. The burst never
+ * 				    starts with EOT, which would end the transfer.
+ * 				-l  Probability of a character reaching the bootloader
+ * 				    with a framing error (simulator -e). The packet
+ * 				    must be NAKed without its CRC being checked.
+ * 				-r  Number of runs of each combination.
+ * 				-x  Random number seed, runs are repeatable for a seed.
+ * 				-G  Stream, sending packets without waiting for ACKs. Any
+ * 				    error the bootloader detects cancels the update.
+ * 				-W  Send through a sliding window of the size offered by
+ * 				    the bootloader, resending only the packets it NAKs, or
+ * 				    the oldest if nothing is heard for a little longer than
+ * 				    the window takes to send.
+ * 				-L  Microseconds by which each response to a packet or EOT
+ * 				    is delayed, as by a USB serial adapter's latency timer.
+ * 				-T  Milliseconds any one update may take, longer runs count
+ * 				    as failures. Catches recovery that falls back on the
+ * 				    full response timeout, see the bench-lossy make target.
+ * 				-o  Update over flash holding old data rather than blank
+ * 				    flash, so that sectors must be erased.
+ * 				-n  Do not simulate flash erase and program times.
+ * 				-j  Print JSON lines instead of CSV.
+ * 				-h  Print the usage line and exit.
+ *
+ * 				Times are in microseconds. rtt is measured from writing a
+ * 				packet to receiving its response (in a window, the ACK
+ * 				that covers it), turnaround is rtt less the time taken to
+ * 				transmit the packet at the baud rate.
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+
+/* XMODEM-1K protocol characters, as xmodem1k.c */
+#define SOH							0x01
+#define STX							0x02
+#define EOT							0x04
+#define ACK							0x06
+#define NAK							0x15
+#define CAN							0x18
+#define POLL						0x43
+#define BAUD_QUERY					0x42
+#define STREAM_POLL					0x47
+#define WINDOW_QUERY				0x57
+#define PAD_CHAR					0x1A
+
+/* Simulated flash layout, as main.c */
+#define FLASH_SIZE					0x8000UL
+#define APP_START_ADDR				0x1000UL
+#define APP_MAX_LEN					(FLASH_SIZE - APP_START_ADDR - 16)
+
+/* Simulator exit status, as sim.h */
+#define SIM_EXIT_APP_STARTED		0
+#define SIM_EXIT_RESET				2
+
+/* Rate the bootloader starts at */
+#define START_BAUD_RATE				9600
+
+/* Longest wait for any response, longer than the bootloader's poll period */
+#define RESPONSE_TIMEOUT_ms			10000
+
+/* Time allowed in a window beyond the packets on the line, before the
+   oldest outstanding packet is sent again, as WINDOW_SLACK_ms in the
+   uploader's session */
+#define WINDOW_SLACK_ms				250
+
+/* Give up on a packet after this many consecutive NAKs */
+#define MAX_RETRIES					10
+
+/* Longest burst of line noise sent before a packet */
+#define MAX_NOISE_LEN				16
+
+#define MAX_LIST					16
+
+typedef struct
+{
+	uint32_t u32Size;
+	uint32_t u32Baud;
+	uint32_t u32Packet;
+	double dErrorRate;
+	uint32_t u32Run;
+	uint32_t u32Window;					/* Agreed with the bootloader, 0 if none */
+
+	/* Measured here */
+	int iOk;
+	uint32_t u32Packets;
+	uint32_t u32Retries;
+	uint64_t u64Total_us;				/* First poll to EOT acknowledged */
+	uint64_t u64Transfer_us;			/* First packet to EOT acknowledged */
+	uint64_t u64RttMean_us;
+	uint64_t u64RttP95_us;
+	uint64_t u64RttMax_us;
+	uint64_t u64TurnaroundMean_us;
+	int iVerified;
+
+	/* Reported by the simulator */
+	uint64_t u64UartDropped;
+	uint64_t u64UartWait_us;
+	uint64_t u64Crc_us;
+	uint64_t u64Copy_us;
+	uint64_t u64Compare_us;
+	uint64_t u64Erase_us;
+	uint64_t u64Blank_us;
+} tResult;
+
+static const char *pcSim = "./lpc11xx_sim";
+static double dDropRate = 0.0;
+static double dAckLossRate = 0.0;
+static double dNoiseRate = 0.0;
+static double dLineErrorRate = 0.0;
+static int iStream = 0;
+static int iWindow = 0;
+static uint32_t u32Latency_us = 0;
+static uint32_t u32TimeLimit_ms = 0;
+static int iNoFlashTiming = 0;
+static int iOldFlash = 0;
+static int iJson = 0;
+static char acFlashFile[64];
+static char acStatsFile[64];
+
+/* Local functions */
+static uint64_t u64Now_us(void);
+static uint16_t u16Crc16(const uint8_t *pu8Data, uint32_t u32Len, uint16_t u16CRC);
+static uint32_t u32ParseList(const char *pcList, double *pdValues);
+static speed_t sBaudConstant(uint32_t u32Baud);
+static int iSetBaud(int iFd, uint32_t u32Baud);
+static int iReadByte(int iFd, uint8_t *pu8Data, int iTimeout_ms);
+static int iWaitFor(int iFd, uint8_t u8Wanted, int iTimeout_ms);
+static int iWaitForAck(int iFd, int iTimeout_ms);
+static pid_t sStartSim(int *piFd);
+static int iStopSim(pid_t sPid, int iFd, int iTimeout_ms);
+static int iNegotiate(int iFd, uint32_t u32Baud);
+static int iQueryWindow(int iFd, uint32_t *pu32Window);
+static int iSendPacket(int iFd, const tResult *psResult, const uint8_t *pu8Image, uint32_t u32Offset, uint8_t u8Seq);
+static uint32_t u32SendWindowed(int iFd, tResult *psResult, const uint8_t *pu8Image,
+								uint64_t *pu64Rtt_us, uint32_t *pu32Rtts, uint32_t u32MaxRtts);
+static int iWaitForEnd(int iFd, uint8_t u8EndSeq);
+static void vMakeImage(uint8_t *pu8Image, uint32_t u32Size);
+static void vRunOne(tResult *psResult);
+static void vReadStats(tResult *psResult);
+static void vPrintResult(const tResult *psResult, int iHeader);
+static int iCompareU64(const void *pv1, const void *pv2);
+
+/*****************************************************************************
+ ** Function name:	main
+ **
+ ** Descriptions:	Runs every combination of the benchmark parameters.
+ **
+ ** Parameters:	    Command line.
+ **
+ ** Returned value: 0 if every update succeeded, otherwise 1.
+ **
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+	double adSizes[MAX_LIST] = {4096, 16384, APP_MAX_LEN};
+	double adBauds[MAX_LIST] = {9600, 115200};
+	double adPackets[MAX_LIST] = {128, 1024};
+	double adErrors[MAX_LIST] = {0, 0.02};
+	uint32_t u32Sizes = 3, u32Bauds = 2, u32Packets = 2, u32Errors = 2;
+	uint32_t u32Runs = 1;
+	unsigned int uSeed = 1;
+	uint32_t s, b, p, e, r;
+	int iOpt;
+	int iFailed = 0;
+	int iHeader = 1;
+
+	while ((iOpt = getopt(argc, argv, "S:s:b:p:e:d:k:g:l:r:x:GWL:T:onjh")) != -1)
+	{
+		switch (iOpt)
+		{
+			case 'S': pcSim = optarg; break;
+			case 's': u32Sizes = u32ParseList(optarg, adSizes); break;
+			case 'b': u32Bauds = u32ParseList(optarg, adBauds); break;
+			case 'p': u32Packets = u32ParseList(optarg, adPackets); break;
+			case 'e': u32Errors = u32ParseList(optarg, adErrors); break;
+			case 'd': dDropRate = strtod(optarg, NULL); break;
+			case 'k': dAckLossRate = strtod(optarg, NULL); break;
+			case 'g': dNoiseRate = strtod(optarg, NULL); break;
+			case 'l': dLineErrorRate = strtod(optarg, NULL); break;
+			case 'r': u32Runs = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'x': uSeed = (unsigned int)strtoul(optarg, NULL, 0); break;
+			case 'G': iStream = 1; break;
+			case 'W': iWindow = 1; break;
+			case 'L': u32Latency_us = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'T': u32TimeLimit_ms = (uint32_t)strtoul(optarg, NULL, 0); break;
+			case 'o': iOldFlash = 1; break;
+			case 'n': iNoFlashTiming = 1; break;
+			case 'j': iJson = 1; break;
+			default:
+				fprintf((iOpt == 'h') ? stdout : stderr,
+						"usage: %s [-S sim] [-s sizes] [-b bauds] [-p packets] [-e errors] [-d drop] [-k lost] [-g noise] "
+						"[-l line] [-r runs] [-x seed] [-G] [-W] [-L latency] [-T limit] [-o] [-n] [-j] [-h]\n", argv[0]);
+				return (iOpt == 'h') ? 0 : 1;
+		}
+	}
+
+	if ((iStream != 0) && (iWindow != 0))
+	{
+		fprintf(stderr, "bench: -G and -W cannot be combined\n");
+		return 1;
+	}
+	for (s = 0; s < u32Sizes; s++)
+	{
+		if ((adSizes[s] < 8) || (adSizes[s] > APP_MAX_LEN))
+		{
+			fprintf(stderr, "bench: image size must be 8 to %lu bytes\n", (unsigned long)APP_MAX_LEN);
+			return 1;
+		}
+	}
+	for (p = 0; p < u32Packets; p++)
+	{
+		if ((adPackets[p] != 128) && (adPackets[p] != 1024))
+		{
+			fprintf(stderr, "bench: packet size must be 128 or 1024\n");
+			return 1;
+		}
+	}
+	for (b = 0; b < u32Bauds; b++)
+	{
+		if (sBaudConstant((uint32_t)adBauds[b]) == B0)
+		{
+			fprintf(stderr, "bench: unsupported baud rate %.0f\n", adBauds[b]);
+			return 1;
+		}
+	}
+
+	snprintf(acFlashFile, sizeof(acFlashFile), "/tmp/xmodem_bench_%d.bin", (int)getpid());
+	snprintf(acStatsFile, sizeof(acStatsFile), "/tmp/xmodem_bench_%d.json", (int)getpid());
+	srand(uSeed);
+	signal(SIGPIPE, SIG_IGN);
+
+	for (s = 0; s < u32Sizes; s++)
+	{
+		for (b = 0; b < u32Bauds; b++)
+		{
+			for (p = 0; p < u32Packets; p++)
+			{
+				for (e = 0; e < u32Errors; e++)
+				{
+					for (r = 0; r < u32Runs; r++)
+					{
+						tResult sResult;
+
+						memset(&sResult, 0, sizeof(sResult));
+						sResult.u32Size = (uint32_t)adSizes[s];
+						sResult.u32Baud = (uint32_t)adBauds[b];
+						sResult.u32Packet = (uint32_t)adPackets[p];
+						sResult.dErrorRate = adErrors[e];
+						sResult.u32Run = r;
+
+						vRunOne(&sResult);
+						vPrintResult(&sResult, iHeader);
+						iHeader = 0;
+
+						if ((sResult.iOk == 0) || (sResult.iVerified == 0))
+						{
+							iFailed = 1;
+						}
+						else if ((u32TimeLimit_ms != 0) && (sResult.u64Total_us > (u32TimeLimit_ms * 1000ULL)))
+						{
+							fprintf(stderr, "bench: run %u took %llums, limit %ums\n", r,
+									(unsigned long long)(sResult.u64Total_us / 1000), u32TimeLimit_ms);
+							iFailed = 1;
+						}
+					}
+				}
+			}
+		}
+	}
+
+	unlink(acFlashFile);
+	unlink(acStatsFile);
+	return iFailed;
+}
+
+/*****************************************************************************
+ ** Function name:	vRunOne
+ **
+ ** Descriptions:	Performs and verifies one update.
+ **
+ ** Parameters:	    psResult - Parameters of the run, filled in with its
+ ** 				results.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vRunOne(tResult *psResult)
+{
+	static uint8_t au8Image[FLASH_SIZE];
+	static uint8_t au8Flash[FLASH_SIZE];
+	static uint64_t au64Rtt_us[2 * (FLASH_SIZE / 128) * MAX_RETRIES];
+	uint32_t u32Rtts = 0;
+	uint32_t u32Offset;
+	uint32_t u32Retries;
+	uint64_t u64Rtt_us = 0;
+	uint64_t u64Wire_us;
+	uint64_t u64Start_us;
+	uint64_t u64FirstPacket_us;
+	uint8_t u8Seq = 1;
+	uint8_t u8Response;
+	int iFd;
+	int iStatus;
+	pid_t sPid;
+	FILE *psFile;
+
+	vMakeImage(au8Image, psResult->u32Size);
+	unlink(acFlashFile);
+	unlink(acStatsFile);
+
+	/* Old data without an image header, the bootloader waits for an update */
+	if (iOldFlash != 0)
+	{
+		uint32_t i;
+
+		memset(au8Flash, 0xFF, FLASH_SIZE);
+		for (i = APP_START_ADDR; i < (FLASH_SIZE - 16); i++)
+		{
+			au8Flash[i] = (uint8_t)rand();
+		}
+		psFile = fopen(acFlashFile, "wb");
+		if ((psFile == NULL) || (fwrite(au8Flash, 1, FLASH_SIZE, psFile) != FLASH_SIZE))
+		{
+			fprintf(stderr, "bench: cannot write %s\n", acFlashFile);
+			if (psFile != NULL)
+			{
+				fclose(psFile);
+			}
+			return;
+		}
+		fclose(psFile);
+	}
+
+	/* Update over blank flash, the bootloader polls straight away */
+	sPid = sStartSim(&iFd);
+	if (sPid < 0)
+	{
+		return;
+	}
+	if (iWaitFor(iFd, POLL, RESPONSE_TIMEOUT_ms) != 0)
+	{
+		fprintf(stderr, "bench: no poll from bootloader\n");
+		iStopSim(sPid, iFd, 0);
+		return;
+	}
+	u64Start_us = u64Now_us();
+
+	if ((psResult->u32Baud != START_BAUD_RATE) && (iNegotiate(iFd, psResult->u32Baud) != 0))
+	{
+		fprintf(stderr, "bench: baud rate negotiation failed\n");
+		iStopSim(sPid, iFd, 0);
+		return;
+	}
+
+	/* The bootloader erases ahead of the image before polling to stream */
+	u8Response = STREAM_POLL;
+	if ((iStream != 0) &&
+		((write(iFd, &u8Response, 1) != 1) || (iWaitFor(iFd, STREAM_POLL, RESPONSE_TIMEOUT_ms) != 0)))
+	{
+		fprintf(stderr, "bench: streaming refused\n");
+		iStopSim(sPid, iFd, 0);
+		return;
+	}
+	if ((iWindow != 0) && (iQueryWindow(iFd, &psResult->u32Window) != 0))
+	{
+		fprintf(stderr, "bench: window refused\n");
+		iStopSim(sPid, iFd, 0);
+		return;
+	}
+
+	/* 10 bits per character */
+	u64Wire_us = ((uint64_t)(psResult->u32Packet + 5) * 10 * 1000000) / psResult->u32Baud;
+	u64FirstPacket_us = u64Now_us();
+	u32Offset = 0;
+	u32Retries = 0;
+	if (psResult->u32Window != 0)
+	{
+		u32Offset = u32SendWindowed(iFd, psResult, au8Image, au64Rtt_us, &u32Rtts,
+									sizeof(au64Rtt_us) / sizeof(au64Rtt_us[0]));
+	}
+	while ((psResult->u32Window == 0) && (u32Offset < psResult->u32Size))
+	{
+		uint32_t u32Len = psResult->u32Size - u32Offset;
+
+		if (u32Len > psResult->u32Packet)
+		{
+			u32Len = psResult->u32Packet;
+		}
+		u64Rtt_us = u64Now_us();
+		if (iSendPacket(iFd, psResult, au8Image, u32Offset, u8Seq) != 0)
+		{
+			break;
+		}
+		if ((iStream != 0) && (u8Seq == 1) && (psResult->u32Baud != START_BAUD_RATE))
+		{
+			/* The first packet at a new rate is acknowledged, wait for it
+			   so that it is not taken for the acknowledgement of EOT. A
+			   damaged one is NAKed and goes again at the new rate. */
+			do
+			{
+				if (iReadByte(iFd, &u8Response, RESPONSE_TIMEOUT_ms) != 0)
+				{
+					u8Response = 0;
+				}
+			} while ((u8Response == POLL) || (u8Response == STREAM_POLL));
+			if ((u8Response == NAK) && (++u32Retries < MAX_RETRIES))
+			{
+				psResult->u32Retries++;
+				continue;
+			}
+			if (u8Response != ACK)
+			{
+				fprintf(stderr, "bench: first packet at %u baud not acknowledged\n", psResult->u32Baud);
+				break;
+			}
+			u32Retries = 0;
+			au64Rtt_us[u32Rtts++] = u64Now_us() - u64Rtt_us;
+			psResult->u32Packets++;
+			u32Offset += u32Len;
+			u8Seq++;
+			continue;
+		}
+		if (iStream != 0)
+		{
+			/* No other packet is acknowledged, the bootloader cancels if
+			   anything goes wrong */
+			u8Response = 0;
+			while ((u8Response != CAN) && (iReadByte(iFd, &u8Response, 0) == 0))
+			{
+			}
+			if (u8Response == CAN)
+			{
+				fprintf(stderr, "bench: cancelled by bootloader after packet %u\n", u8Seq);
+				break;
+			}
+			psResult->u32Packets++;
+			u32Offset += u32Len;
+			u8Seq++;
+			continue;
+		}
+		do
+		{
+			uint64_t u64Waited_us = u64Now_us() - u64Rtt_us;
+
+			if ((u64Waited_us >= (RESPONSE_TIMEOUT_ms * 1000ULL)) ||
+				(iReadByte(iFd, &u8Response, (int)(RESPONSE_TIMEOUT_ms - (u64Waited_us / 1000))) != 0))
+			{
+				u8Response = 0;
+			}
+		} while (u8Response == POLL);
+		if ((u8Response != 0) && (u32Latency_us != 0))
+		{
+			usleep(u32Latency_us);
+		}
+		u64Rtt_us = u64Now_us() - u64Rtt_us;
+		au64Rtt_us[u32Rtts++] = u64Rtt_us;
+		psResult->u32Packets++;
+
+		if ((u8Response == ACK) && ((double)rand() / ((double)RAND_MAX + 1.0) < dAckLossRate) &&
+			(++u32Retries < MAX_RETRIES) && (u32Rtts < (sizeof(au64Rtt_us) / sizeof(au64Rtt_us[0]))))
+		{
+			/* Pretend the ACK was lost, the same packet goes again */
+			psResult->u32Retries++;
+		}
+		else if (u8Response == ACK)
+		{
+			u32Offset += u32Len;
+			u8Seq++;
+			u32Retries = 0;
+		}
+		else if ((u8Response == NAK) && (++u32Retries < MAX_RETRIES) && (u32Rtts < (sizeof(au64Rtt_us) / sizeof(au64Rtt_us[0]))))
+		{
+			psResult->u32Retries++;
+		}
+		else if ((u8Response == 0) && (u8Seq == 1) && (psResult->u32Baud != START_BAUD_RATE) && (++u32Retries < MAX_RETRIES) &&
+				 (iSetBaud(iFd, START_BAUD_RATE) == 0) && (iWaitFor(iFd, POLL, RESPONSE_TIMEOUT_ms) == 0) &&
+				 (iNegotiate(iFd, psResult->u32Baud) == 0))
+		{
+			/* A corrupt first packet at the negotiated rate is NAKed, one
+			   that is not answered means the bootloader has given up and
+			   returned to the starting rate, so negotiate again */
+			psResult->u32Retries++;
+		}
+		else
+		{
+			fprintf(stderr, "bench: packet %u response 0x%02X\n", u8Seq, u8Response);
+			break;
+		}
+	}
+
+	if (u32Offset >= psResult->u32Size)
+	{
+		/* In a window EOT is acknowledged with the number after the last
+		   packet. When streaming the bootloader may still be receiving the
+		   packets ahead of EOT, and cancels if any of them is bad. */
+		uint8_t u8EndSeq = (uint8_t)(((psResult->u32Size + psResult->u32Packet - 1) / psResult->u32Packet) + 1);
+		int iEndTimeout_ms = RESPONSE_TIMEOUT_ms;
+
+		if (iStream != 0)
+		{
+			iEndTimeout_ms += (int)((psResult->u32Packets * u64Wire_us) / 1000);
+		}
+
+		u8Response = EOT;
+		if ((write(iFd, &u8Response, 1) == 1) &&
+			(((psResult->u32Window == 0) && (iWaitForAck(iFd, iEndTimeout_ms) == 0)) ||
+			 ((psResult->u32Window != 0) && (iWaitForEnd(iFd, u8EndSeq) == 0))))
+		{
+			uint64_t u64End_us;
+
+			if (u32Latency_us != 0)
+			{
+				usleep(u32Latency_us);
+			}
+			u64End_us = u64Now_us();
+
+			psResult->u64Total_us = u64End_us - u64Start_us;
+			psResult->u64Transfer_us = u64End_us - u64FirstPacket_us;
+			psResult->iOk = 1;
+		}
+	}
+
+	/* The bootloader resets once the update is complete */
+	iStatus = iStopSim(sPid, iFd, psResult->iOk ? RESPONSE_TIMEOUT_ms : 0);
+	if (iStatus != SIM_EXIT_RESET)
+	{
+		psResult->iOk = 0;
+	}
+	vReadStats(psResult);
+
+	if (u32Rtts != 0)
+	{
+		uint64_t u64Sum = 0;
+		uint32_t i;
+
+		for (i = 0; i < u32Rtts; i++)
+		{
+			u64Sum += au64Rtt_us[i];
+		}
+		psResult->u64RttMean_us = u64Sum / u32Rtts;
+		psResult->u64TurnaroundMean_us = (psResult->u64RttMean_us > u64Wire_us) ? (psResult->u64RttMean_us - u64Wire_us) : 0;
+		qsort(au64Rtt_us, u32Rtts, sizeof(au64Rtt_us[0]), iCompareU64);
+		psResult->u64RttP95_us = au64Rtt_us[((u32Rtts * 95) + 99) / 100 - 1];
+		psResult->u64RttMax_us = au64Rtt_us[u32Rtts - 1];
+	}
+
+	if (psResult->iOk == 0)
+	{
+		return;
+	}
+
+	/* The flash must hold the image and the bootloader must now start it */
+	psFile = fopen(acFlashFile, "rb");
+	if (psFile != NULL)
+	{
+		if ((fread(au8Flash, 1, FLASH_SIZE, psFile) == FLASH_SIZE) &&
+			(memcmp(&au8Flash[APP_START_ADDR], au8Image, psResult->u32Size) == 0))
+		{
+			sPid = sStartSim(NULL);
+			if (sPid >= 0)
+			{
+				psResult->iVerified = (iStopSim(sPid, -1, RESPONSE_TIMEOUT_ms) == SIM_EXIT_APP_STARTED);
+			}
+		}
+		fclose(psFile);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	iNegotiate
+ **
+ ** Descriptions:	Selects a baud rate as described in xmodem1k.c and waits
+ ** 				for the bootloader to poll at the new rate.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				u32Baud - Rate to select.
+ **
+ ** Returned value: 0 on success, otherwise -1.
+ **
+ *****************************************************************************/
+static int iNegotiate(int iFd, uint32_t u32Baud)
+{
+	uint8_t au8Frame[1 + (4 * 255)];
+	uint8_t au8CRC[2];
+	uint8_t au8Select[2];
+	uint32_t u32Count;
+	uint32_t i;
+	uint8_t u8Data = BAUD_QUERY;
+
+	if ((write(iFd, &u8Data, 1) != 1) || (iWaitFor(iFd, BAUD_QUERY, RESPONSE_TIMEOUT_ms) != 0) ||
+		(iReadByte(iFd, &au8Frame[0], RESPONSE_TIMEOUT_ms) != 0))
+	{
+		return -1;
+	}
+	u32Count = au8Frame[0];
+	for (i = 0; i < (4 * u32Count); i++)
+	{
+		if (iReadByte(iFd, &au8Frame[1 + i], RESPONSE_TIMEOUT_ms) != 0)
+		{
+			return -1;
+		}
+	}
+	if ((iReadByte(iFd, &au8CRC[0], RESPONSE_TIMEOUT_ms) != 0) ||
+		(iReadByte(iFd, &au8CRC[1], RESPONSE_TIMEOUT_ms) != 0) ||
+		(u16Crc16(au8Frame, 1 + (4 * u32Count), 0) != (((uint16_t)au8CRC[0] << 8) | au8CRC[1])))
+	{
+		return -1;
+	}
+
+	for (i = 0; i < u32Count; i++)
+	{
+		uint32_t u32Rate = au8Frame[1 + (4 * i)] | ((uint32_t)au8Frame[2 + (4 * i)] << 8) |
+						   ((uint32_t)au8Frame[3 + (4 * i)] << 16) | ((uint32_t)au8Frame[4 + (4 * i)] << 24);
+
+		if (u32Rate == u32Baud)
+		{
+			break;
+		}
+	}
+	if (i == u32Count)
+	{
+		fprintf(stderr, "bench: bootloader does not offer %u baud\n", u32Baud);
+		return -1;
+	}
+
+	au8Select[0] = (uint8_t)i;
+	au8Select[1] = (uint8_t)~i;
+	if ((write(iFd, au8Select, 2) != 2) || (iWaitFor(iFd, ACK, RESPONSE_TIMEOUT_ms) != 0) ||
+		(iSetBaud(iFd, u32Baud) != 0))
+	{
+		return -1;
+	}
+	return iWaitFor(iFd, POLL, RESPONSE_TIMEOUT_ms);
+}
+
+/*****************************************************************************
+ ** Function name:	iQueryWindow
+ **
+ ** Descriptions:	Asks the bootloader for a sliding window as described in
+ ** 				xmodem1k.c.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				pu32Window - Returns the number of packets that may be
+ ** 				outstanding.
+ **
+ ** Returned value: 0 on success, otherwise -1.
+ **
+ *****************************************************************************/
+static int iQueryWindow(int iFd, uint32_t *pu32Window)
+{
+	uint8_t au8Reply[2];
+	uint8_t u8Data = WINDOW_QUERY;
+
+	if ((write(iFd, &u8Data, 1) != 1) || (iWaitFor(iFd, WINDOW_QUERY, RESPONSE_TIMEOUT_ms) != 0) ||
+		(iReadByte(iFd, &au8Reply[0], RESPONSE_TIMEOUT_ms) != 0) ||
+		(iReadByte(iFd, &au8Reply[1], RESPONSE_TIMEOUT_ms) != 0) ||
+		((au8Reply[0] ^ au8Reply[1]) != 0xFF) || (au8Reply[0] == 0))
+	{
+		return -1;
+	}
+	*pu32Window = au8Reply[0];
+	return 0;
+}
+
+/*****************************************************************************
+ ** Function name:	iSendPacket
+ **
+ ** Descriptions:	Sends part of the image as a packet, with the errors
+ ** 				selected for the run: a corrupt payload character, a
+ ** 				dropped character and line noise ahead of the packet.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				psResult - Parameters of the run.
+ ** 				pu8Image - Image.
+ ** 				u32Offset - Offset of the packet's data in the image.
+ ** 				u8Seq - Packet number.
+ **
+ ** Returned value: 0 on success, otherwise -1.
+ **
+ *****************************************************************************/
+static int iSendPacket(int iFd, const tResult *psResult, const uint8_t *pu8Image, uint32_t u32Offset, uint8_t u8Seq)
+{
+	uint8_t au8Packet[3 + 1024 + 2];
+	uint8_t au8Noise[MAX_NOISE_LEN];
+	uint32_t u32Len = psResult->u32Size - u32Offset;
+	uint32_t u32PacketLen;
+	uint16_t u16CRC;
+
+	if (u32Len > psResult->u32Packet)
+	{
+		u32Len = psResult->u32Packet;
+	}
+	au8Packet[0] = (psResult->u32Packet == 1024) ? STX : SOH;
+	au8Packet[1] = u8Seq;
+	au8Packet[2] = (uint8_t)~u8Seq;
+	memcpy(&au8Packet[3], &pu8Image[u32Offset], u32Len);
+	memset(&au8Packet[3 + u32Len], PAD_CHAR, psResult->u32Packet - u32Len);
+	u16CRC = u16Crc16(&au8Packet[3], psResult->u32Packet, 0);
+	au8Packet[3 + psResult->u32Packet] = (uint8_t)(u16CRC >> 8);
+	au8Packet[4 + psResult->u32Packet] = (uint8_t)u16CRC;
+
+	/* Corrupt one payload character, the bootloader must NAK */
+	if ((double)rand() / ((double)RAND_MAX + 1.0) < psResult->dErrorRate)
+	{
+		au8Packet[3 + (rand() % psResult->u32Packet)] ^= 0x01;
+	}
+	u32PacketLen = psResult->u32Packet + 5;
+	if ((double)rand() / ((double)RAND_MAX + 1.0) < dDropRate)
+	{
+		uint32_t u32Drop = 1 + (rand() % (u32PacketLen - 1));
+
+		memmove(&au8Packet[u32Drop], &au8Packet[u32Drop + 1], u32PacketLen - u32Drop - 1);
+		u32PacketLen--;
+	}
+
+	if ((double)rand() / ((double)RAND_MAX + 1.0) < dNoiseRate)
+	{
+		uint32_t u32NoiseLen = 1 + (rand() % MAX_NOISE_LEN);
+		uint32_t i;
+
+		for (i = 0; i < u32NoiseLen; i++)
+		{
+			au8Noise[i] = (uint8_t)rand();
+		}
+		if (au8Noise[0] == EOT)
+		{
+			au8Noise[0] = ~EOT;
+		}
+		if (write(iFd, au8Noise, u32NoiseLen) != (ssize_t)u32NoiseLen)
+		{
+			return -1;
+		}
+	}
+	return (write(iFd, au8Packet, u32PacketLen) == (ssize_t)u32PacketLen) ? 0 : -1;
+}
+
+/*****************************************************************************
+ ** Function name:	u32SendWindowed
+ **
+ ** Descriptions:	Sends the image through the agreed sliding window,
+ ** 				keeping that many packets unacknowledged. Packets the
+ ** 				bootloader NAKs are sent again ahead of new ones, and the
+ ** 				oldest is sent again if nothing is heard for half as long
+ ** 				again as the window takes on the line plus
+ ** 				WINDOW_SLACK_ms. The first packet at a negotiated rate is
+ ** 				sent alone, if it is not acknowledged in that time, or the
+ ** 				bootloader polls at the starting rate instead, the rate is
+ ** 				negotiated again.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				psResult - Parameters of the run, packet and retry
+ ** 				counts are updated.
+ ** 				pu8Image - Image.
+ ** 				pu64Rtt_us - Round trip times, one is added for each ACK.
+ ** 				pu32Rtts - Number of round trip times.
+ ** 				u32MaxRtts - Size of the round trip time array.
+ **
+ ** Returned value: Number of image bytes acknowledged.
+ **
+ *****************************************************************************/
+static uint32_t u32SendWindowed(int iFd, tResult *psResult, const uint8_t *pu8Image,
+								uint64_t *pu64Rtt_us, uint32_t *pu32Rtts, uint32_t u32MaxRtts)
+{
+	static uint64_t au64Sent_us[FLASH_SIZE / 128];
+	static uint8_t au8Resend[FLASH_SIZE / 128];
+	uint32_t u32Count = (psResult->u32Size + psResult->u32Packet - 1) / psResult->u32Packet;
+	uint32_t u32Limit = (psResult->u32Baud != START_BAUD_RATE) ? 1 : psResult->u32Window;
+	uint32_t u32Base = 0;				/* Oldest packet not acknowledged */
+	uint32_t u32Next = 0;				/* First packet not yet sent */
+	uint32_t u32Retries = 0;
+	uint8_t au8Response[2];
+	uint32_t u32Have = 0;
+	uint64_t u64Waiting_us = 0;			/* Last packet sent or response used */
+	uint64_t u64Timeout_ms = ((uint64_t)psResult->u32Window * (psResult->u32Packet + 5) * 10 * 1000) / psResult->u32Baud;
+
+	u64Timeout_ms = ((u64Timeout_ms * 3) / 2) + WINDOW_SLACK_ms + (u32Latency_us / 1000);
+	if (u64Timeout_ms > RESPONSE_TIMEOUT_ms)
+	{
+		u64Timeout_ms = RESPONSE_TIMEOUT_ms;
+	}
+
+	memset(au8Resend, 0, sizeof(au8Resend));
+	while (u32Base < u32Count)
+	{
+		uint32_t u32Send = u32Count;
+		uint32_t u32Idx;
+		uint64_t u64Waited_us;
+		uint8_t u8Data;
+		int iTimedOut;
+		int iPolled;
+
+		/* Packets asked for again go first, then new ones while the window
+		   has room */
+		for (u32Idx = u32Base; (u32Idx < u32Next) && (u32Send == u32Count); u32Idx++)
+		{
+			if (au8Resend[u32Idx] != 0)
+			{
+				u32Send = u32Idx;
+			}
+		}
+		if ((u32Send == u32Count) && (u32Next < u32Count) && (u32Next < (u32Base + u32Limit)))
+		{
+			u32Send = u32Next++;
+		}
+		if (u32Send < u32Count)
+		{
+			au8Resend[u32Send] = 0;
+			au64Sent_us[u32Send] = u64Now_us();
+			u64Waiting_us = au64Sent_us[u32Send];
+			psResult->u32Packets++;
+			if (iSendPacket(iFd, psResult, pu8Image, u32Send * psResult->u32Packet, (uint8_t)(u32Send + 1)) != 0)
+			{
+				break;
+			}
+			continue;
+		}
+
+		/* Characters that are not responses do not extend the wait. A poll
+		   while the first packet at a negotiated rate is outstanding is
+		   the bootloader already back at the starting rate. */
+		u64Waited_us = u64Now_us() - u64Waiting_us;
+		iTimedOut = (u64Waited_us >= (u64Timeout_ms * 1000)) ||
+					(iReadByte(iFd, &u8Data, (int)(u64Timeout_ms - (u64Waited_us / 1000))) != 0);
+		iPolled = (iTimedOut == 0) && (u8Data == POLL) && (u32Have == 0) && (u32Base == 0) && (u32Limit == 1) &&
+				  (psResult->u32Baud != START_BAUD_RATE);
+		if ((iTimedOut != 0) || (iPolled != 0))
+		{
+			u32Have = 0;
+			u64Waiting_us = u64Now_us();
+			if ((u32Base == 0) && (u32Limit == 1) && (psResult->u32Baud != START_BAUD_RATE) && (++u32Retries < MAX_RETRIES) &&
+				(iSetBaud(iFd, START_BAUD_RATE) == 0) && ((iPolled != 0) || (iWaitFor(iFd, POLL, RESPONSE_TIMEOUT_ms) == 0)) &&
+				(iNegotiate(iFd, psResult->u32Baud) == 0) && (iQueryWindow(iFd, &psResult->u32Window) == 0))
+			{
+				/* A corrupt first packet at the negotiated rate is NAKed, one
+				   that is not answered means the bootloader has given up and
+				   returned to the starting rate, so negotiate again */
+				psResult->u32Retries++;
+				u32Next = 0;
+			}
+			else if ((u32Limit != 1) && (++u32Retries < MAX_RETRIES))
+			{
+				psResult->u32Retries++;
+				au8Resend[u32Base] = 1;
+			}
+			else
+			{
+				fprintf(stderr, "bench: packet %u not acknowledged\n", u32Base + 1);
+				break;
+			}
+			continue;
+		}
+
+		/* Responses are ACK or NAK followed by a packet number */
+		if (u32Have == 0)
+		{
+			if (u8Data == CAN)
+			{
+				fprintf(stderr, "bench: cancelled by bootloader at packet %u\n", u32Base + 1);
+				break;
+			}
+			if ((u8Data == ACK) || (u8Data == NAK))
+			{
+				au8Response[u32Have++] = u8Data;
+			}
+			continue;
+		}
+		au8Response[1] = u8Data;
+		u32Have = 0;
+		if (u32Latency_us != 0)
+		{
+			usleep(u32Latency_us);
+		}
+		u64Waiting_us = u64Now_us();
+
+		/* Ignore responses to packets that are no longer outstanding */
+		u32Idx = u32Base + (uint8_t)(au8Response[1] - (uint8_t)(u32Base + 1));
+		if (u32Idx >= u32Next)
+		{
+			continue;
+		}
+
+		if ((au8Response[0] == ACK) && ((double)rand() / ((double)RAND_MAX + 1.0) < dAckLossRate))
+		{
+			/* Pretend the ACK was lost, the packet goes again and must be
+			   acknowledged without being programmed twice */
+			psResult->u32Retries++;
+			au8Resend[u32Idx] = 1;
+		}
+		else if (au8Response[0] == ACK)
+		{
+			if (*pu32Rtts < u32MaxRtts)
+			{
+				pu64Rtt_us[(*pu32Rtts)++] = u64Now_us() - au64Sent_us[u32Idx];
+			}
+			u32Base = u32Idx + 1;
+			u32Limit = psResult->u32Window;
+			u32Retries = 0;
+		}
+		else if (++u32Retries < MAX_RETRIES)
+		{
+			psResult->u32Retries++;
+			au8Resend[u32Idx] = 1;
+		}
+		else
+		{
+			fprintf(stderr, "bench: packet %u NAKed %u times\n", u32Idx + 1, u32Retries);
+			break;
+		}
+	}
+
+	return (u32Base < u32Count) ? (u32Base * psResult->u32Packet) : psResult->u32Size;
+}
+
+/*****************************************************************************
+ ** Function name:	iWaitForEnd
+ **
+ ** Descriptions:	Waits for the acknowledgement of EOT in a sliding window,
+ ** 				ignoring responses to packets that were sent again.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				u8EndSeq - Number following the last packet.
+ **
+ ** Returned value: 0 on success, otherwise -1.
+ **
+ *****************************************************************************/
+static int iWaitForEnd(int iFd, uint8_t u8EndSeq)
+{
+	uint8_t au8Response[2] = {0, 0};
+
+	while ((au8Response[0] != ACK) || (au8Response[1] != u8EndSeq))
+	{
+		if ((iReadByte(iFd, &au8Response[0], RESPONSE_TIMEOUT_ms) != 0) ||
+			(iReadByte(iFd, &au8Response[1], RESPONSE_TIMEOUT_ms) != 0))
+		{
+			return -1;
+		}
+	}
+	return 0;
+}
+
+/*****************************************************************************
+ ** Function name:	sStartSim
+ **
+ ** Descriptions:	Starts the simulator on the benchmark's flash file and
+ ** 				opens its pseudo terminal at the bootloader's start rate.
+ **
+ ** Parameters:	    piFd - Returns the pseudo terminal, or NULL to run the
+ ** 				simulator without opening it.
+ **
+ ** Returned value: Simulator process, or -1 on failure.
+ **
+ *****************************************************************************/
+static pid_t sStartSim(int *piFd)
+{
+	char acPty[256];
+	int aiPipe[2];
+	pid_t sPid;
+	FILE *psFile;
+
+	if (pipe(aiPipe) != 0)
+	{
+		return -1;
+	}
+	sPid = fork();
+	if (sPid == 0)
+	{
+		char acLineErrors[32];
+		const char *apcArgs[] = {pcSim, "-q", "-f", acFlashFile, "-j", acStatsFile, "-s",
+								 "-e", acLineErrors, iNoFlashTiming ? "-n" : NULL, NULL};
+
+		/* The simulator's messages are summarised in the results */
+		int iNull = open("/dev/null", O_WRONLY);
+
+		snprintf(acLineErrors, sizeof(acLineErrors), "%g", dLineErrorRate);
+
+		if (piFd == NULL)
+		{
+			dup2(iNull, aiPipe[1]);
+		}
+		dup2(aiPipe[1], STDOUT_FILENO);
+		dup2(iNull, STDERR_FILENO);
+		close(aiPipe[0]);
+		close(aiPipe[1]);
+		execv(pcSim, (char * const *)apcArgs);
+		_exit(127);
+	}
+	close(aiPipe[1]);
+	if ((sPid < 0) || (piFd == NULL))
+	{
+		close(aiPipe[0]);
+		return sPid;
+	}
+
+	/* The simulator prints the pseudo terminal name on startup */
+	psFile = fdopen(aiPipe[0], "r");
+	if ((psFile == NULL) || (fgets(acPty, sizeof(acPty), psFile) == NULL))
+	{
+		if (psFile != NULL)
+		{
+			fclose(psFile);
+		}
+		iStopSim(sPid, -1, 0);
+		return -1;
+	}
+	fclose(psFile);
+	acPty[strcspn(acPty, "\r\n")] = '\0';
+
+	*piFd = open(acPty, O_RDWR | O_NOCTTY);
+	if ((*piFd < 0) || (iSetBaud(*piFd, START_BAUD_RATE) != 0))
+	{
+		fprintf(stderr, "bench: cannot open %s\n", acPty);
+		iStopSim(sPid, *piFd, 0);
+		return -1;
+	}
+	return sPid;
+}
+
+/*****************************************************************************
+ ** Function name:	iStopSim
+ **
+ ** Descriptions:	Waits for the simulator to exit, stopping it if it has
+ ** 				not done so in time. A stopped simulator still saves its
+ ** 				statistics.
+ **
+ ** Parameters:	    sPid - Simulator process.
+ ** 				iFd - Pseudo terminal to close, or -1.
+ ** 				iTimeout_ms - Time allowed for the simulator to exit.
+ **
+ ** Returned value: Simulator exit status, or -1 if it was killed.
+ **
+ *****************************************************************************/
+static int iStopSim(pid_t sPid, int iFd, int iTimeout_ms)
+{
+	uint64_t u64End_us = u64Now_us() + ((uint64_t)iTimeout_ms * 1000);
+	int iStatus = 0;
+	pid_t sDone;
+
+	do
+	{
+		sDone = waitpid(sPid, &iStatus, WNOHANG);
+		if (sDone == 0)
+		{
+			usleep(1000);
+		}
+	} while ((sDone == 0) && (u64Now_us() < u64End_us));
+
+	if (sDone == 0)
+	{
+		kill(sPid, SIGTERM);
+		u64End_us = u64Now_us() + 1000000;
+		while ((waitpid(sPid, &iStatus, WNOHANG) == 0) && (u64Now_us() < u64End_us))
+		{
+			usleep(1000);
+		}
+		kill(sPid, SIGKILL);
+		waitpid(sPid, &iStatus, 0);
+		iStatus = -1;
+	}
+	else
+	{
+		iStatus = WIFEXITED(iStatus) ? WEXITSTATUS(iStatus) : -1;
+	}
+
+	if (iFd >= 0)
+	{
+		close(iFd);
+	}
+	return iStatus;
+}
+
+/*****************************************************************************
+ ** Function name:	vReadStats
+ **
+ ** Descriptions:	Reads the statistics the simulator saved on exit. The
+ ** 				file holds one "name": value member per line.
+ **
+ ** Parameters:	    psResult - Result to add the statistics to.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vReadStats(tResult *psResult)
+{
+	char acLine[128];
+	char acName[64];
+	unsigned long long ullValue;
+	uint64_t u64CrcCalc_us = 0;
+	uint64_t u64CrcUpdate_us = 0;
+	FILE *psFile = fopen(acStatsFile, "r");
+
+	if (psFile == NULL)
+	{
+		return;
+	}
+	while (fgets(acLine, sizeof(acLine), psFile) != NULL)
+	{
+		if (sscanf(acLine, " \"%63[^\"]\": %llu", acName, &ullValue) != 2)
+		{
+			continue;
+		}
+		if (strcmp(acName, "uart_rx_dropped") == 0) psResult->u64UartDropped = ullValue;
+		else if (strcmp(acName, "uart_rx_wait_us") == 0) psResult->u64UartWait_us = ullValue;
+		else if (strcmp(acName, "crc_calc_us") == 0) u64CrcCalc_us = ullValue;
+		else if (strcmp(acName, "crc_update_us") == 0) u64CrcUpdate_us = ullValue;
+		else if (strcmp(acName, "iap_copy_us") == 0) psResult->u64Copy_us = ullValue;
+		else if (strcmp(acName, "iap_compare_us") == 0) psResult->u64Compare_us = ullValue;
+		else if (strcmp(acName, "iap_erase_us") == 0) psResult->u64Erase_us = ullValue;
+		else if (strcmp(acName, "iap_blank_us") == 0) psResult->u64Blank_us = ullValue;
+	}
+	psResult->u64Crc_us = u64CrcCalc_us + u64CrcUpdate_us;
+	fclose(psFile);
+}
+
+/*****************************************************************************
+ ** Function name:	vPrintResult
+ **
+ ** Descriptions:	Prints the result of a run as CSV or a JSON line.
+ **
+ ** Parameters:	    psResult - Result to print.
+ ** 				iHeader - Non zero to print the CSV header first.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vPrintResult(const tResult *psResult, int iHeader)
+{
+	double dThroughput = (psResult->u64Transfer_us != 0) ?
+						 ((double)psResult->u32Size * 1000000.0) / (double)psResult->u64Transfer_us : 0.0;
+
+	if (iJson != 0)
+	{
+		printf("{\"size\": %u, \"baud\": %u, \"packet\": %u, \"error_rate\": %g, \"drop_rate\": %g, \"ack_loss_rate\": %g, \"noise_rate\": %g, \"line_error_rate\": %g, \"stream\": %d, \"window\": %u, \"latency_us\": %u, \"run\": %u, "
+			   "\"ok\": %d, \"verified\": %d, \"packets\": %u, \"retries\": %u, "
+			   "\"total_us\": %llu, \"transfer_us\": %llu, \"throughput_Bps\": %.1f, "
+			   "\"rtt_mean_us\": %llu, \"rtt_p95_us\": %llu, \"rtt_max_us\": %llu, \"turnaround_mean_us\": %llu, "
+			   "\"uart_dropped\": %llu, \"uart_wait_us\": %llu, \"crc_us\": %llu, \"iap_copy_us\": %llu, \"iap_compare_us\": %llu, "
+			   "\"iap_erase_us\": %llu, \"iap_blank_us\": %llu}\n",
+			   psResult->u32Size, psResult->u32Baud, psResult->u32Packet, psResult->dErrorRate, dDropRate, dAckLossRate, dNoiseRate, dLineErrorRate, iStream, psResult->u32Window, u32Latency_us, psResult->u32Run,
+			   psResult->iOk, psResult->iVerified, psResult->u32Packets, psResult->u32Retries,
+			   (unsigned long long)psResult->u64Total_us, (unsigned long long)psResult->u64Transfer_us, dThroughput,
+			   (unsigned long long)psResult->u64RttMean_us, (unsigned long long)psResult->u64RttP95_us,
+			   (unsigned long long)psResult->u64RttMax_us, (unsigned long long)psResult->u64TurnaroundMean_us,
+			   (unsigned long long)psResult->u64UartDropped, (unsigned long long)psResult->u64UartWait_us, (unsigned long long)psResult->u64Crc_us,
+			   (unsigned long long)psResult->u64Copy_us, (unsigned long long)psResult->u64Compare_us,
+			   (unsigned long long)psResult->u64Erase_us, (unsigned long long)psResult->u64Blank_us);
+	}
+	else
+	{
+		if (iHeader != 0)
+		{
+			printf("size,baud,packet,error_rate,drop_rate,ack_loss_rate,noise_rate,line_error_rate,stream,window,latency_us,run,ok,verified,packets,retries,total_us,transfer_us,throughput_Bps,"
+				   "rtt_mean_us,rtt_p95_us,rtt_max_us,turnaround_mean_us,uart_dropped,uart_wait_us,crc_us,iap_copy_us,"
+				   "iap_compare_us,iap_erase_us,iap_blank_us\n");
+		}
+		printf("%u,%u,%u,%g,%g,%g,%g,%g,%d,%u,%u,%u,%d,%d,%u,%u,%llu,%llu,%.1f,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu,%llu\n",
+			   psResult->u32Size, psResult->u32Baud, psResult->u32Packet, psResult->dErrorRate, dDropRate, dAckLossRate, dNoiseRate, dLineErrorRate, iStream, psResult->u32Window, u32Latency_us, psResult->u32Run,
+			   psResult->iOk, psResult->iVerified, psResult->u32Packets, psResult->u32Retries,
+			   (unsigned long long)psResult->u64Total_us, (unsigned long long)psResult->u64Transfer_us, dThroughput,
+			   (unsigned long long)psResult->u64RttMean_us, (unsigned long long)psResult->u64RttP95_us,
+			   (unsigned long long)psResult->u64RttMax_us, (unsigned long long)psResult->u64TurnaroundMean_us,
+			   (unsigned long long)psResult->u64UartDropped, (unsigned long long)psResult->u64UartWait_us, (unsigned long long)psResult->u64Crc_us,
+			   (unsigned long long)psResult->u64Copy_us, (unsigned long long)psResult->u64Compare_us,
+			   (unsigned long long)psResult->u64Erase_us, (unsigned long long)psResult->u64Blank_us);
+	}
+	fflush(stdout);
+}
+
+/*****************************************************************************
+ ** Function name:	vMakeImage
+ **
+ ** Descriptions:	Fills an image with random data behind a vector table
+ ** 				the bootloader will accept.
+ **
+ ** Parameters:	    pu8Image - Image buffer.
+ ** 				u32Size - Image size in bytes.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vMakeImage(uint8_t *pu8Image, uint32_t u32Size)
+{
+	uint32_t u32Entry = (APP_START_ADDR + (u32Size / 2)) | 1;
+	uint32_t i;
+
+	for (i = 0; i < u32Size; i++)
+	{
+		pu8Image[i] = (uint8_t)rand();
+	}
+
+	/* Initial stack pointer at the top of RAM and a thumb reset vector */
+	pu8Image[0] = 0x00; pu8Image[1] = 0x20; pu8Image[2] = 0x00; pu8Image[3] = 0x10;
+	pu8Image[4] = (uint8_t)u32Entry; pu8Image[5] = (uint8_t)(u32Entry >> 8);
+	pu8Image[6] = 0x00; pu8Image[7] = 0x00;
+}
+
+/*****************************************************************************
+ ** Function name:	iReadByte
+ **
+ ** Descriptions:	Reads a character with a timeout.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				pu8Data - Returns the character.
+ ** 				iTimeout_ms - Time to wait.
+ **
+ ** Returned value: 0 if a character was read, otherwise -1.
+ **
+ *****************************************************************************/
+static int iReadByte(int iFd, uint8_t *pu8Data, int iTimeout_ms)
+{
+	struct pollfd sPoll = {iFd, POLLIN, 0};
+
+	if ((poll(&sPoll, 1, iTimeout_ms) == 1) && (read(iFd, pu8Data, 1) == 1))
+	{
+		return 0;
+	}
+	return -1;
+}
+
+/*****************************************************************************
+ ** Function name:	iWaitFor
+ **
+ ** Descriptions:	Discards characters until the one wanted is read.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				u8Wanted - Character to wait for.
+ ** 				iTimeout_ms - Time to wait, polls from the bootloader do
+ ** 				not extend it.
+ **
+ ** Returned value: 0 if the character was read, otherwise -1.
+ **
+ *****************************************************************************/
+static int iWaitFor(int iFd, uint8_t u8Wanted, int iTimeout_ms)
+{
+	uint64_t u64End_us = u64Now_us() + ((uint64_t)iTimeout_ms * 1000);
+	uint64_t u64Now;
+	uint8_t u8Data;
+
+	do
+	{
+		u64Now = u64Now_us();
+		if ((u64Now >= u64End_us) || (iReadByte(iFd, &u8Data, (int)((u64End_us - u64Now + 999) / 1000)) != 0))
+		{
+			return -1;
+		}
+	} while (u8Data != u8Wanted);
+	return 0;
+}
+
+/*****************************************************************************
+ ** Function name:	iWaitForAck
+ **
+ ** Descriptions:	Waits for ACK, discarding polls from the bootloader.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				iTimeout_ms - Time to wait, polls do not extend it.
+ **
+ ** Returned value: 0 if ACK was read, -1 on any other response (CAN when
+ ** 				the bootloader has cancelled) or timeout.
+ **
+ *****************************************************************************/
+static int iWaitForAck(int iFd, int iTimeout_ms)
+{
+	uint64_t u64End_us = u64Now_us() + ((uint64_t)iTimeout_ms * 1000);
+	uint64_t u64Now;
+	uint8_t u8Data;
+
+	do
+	{
+		u64Now = u64Now_us();
+		if ((u64Now >= u64End_us) || (iReadByte(iFd, &u8Data, (int)((u64End_us - u64Now + 999) / 1000)) != 0))
+		{
+			return -1;
+		}
+	} while ((u8Data == POLL) || (u8Data == STREAM_POLL));
+	return (u8Data == ACK) ? 0 : -1;
+}
+
+/*****************************************************************************
+ ** Function name:	iSetBaud
+ **
+ ** Descriptions:	Puts the pseudo terminal in raw mode at a baud rate. The
+ ** 				change is made immediately, as flushing input could lose
+ ** 				a poll.
+ **
+ ** Parameters:	    iFd - Pseudo terminal.
+ ** 				u32Baud - Baud rate.
+ **
+ ** Returned value: 0 on success, otherwise -1.
+ **
+ *****************************************************************************/
+static int iSetBaud(int iFd, uint32_t u32Baud)
+{
+	struct termios sTermios;
+
+	if (tcgetattr(iFd, &sTermios) != 0)
+	{
+		return -1;
+	}
+	cfmakeraw(&sTermios);
+	cfsetispeed(&sTermios, sBaudConstant(u32Baud));
+	cfsetospeed(&sTermios, sBaudConstant(u32Baud));
+	return tcsetattr(iFd, TCSANOW, &sTermios);
+}
+
+/*****************************************************************************
+ ** Function name:	sBaudConstant
+ **
+ ** Descriptions:	Converts a baud rate to its termios constant.
+ **
+ ** Parameters:	    u32Baud - Baud rate.
+ **
+ ** Returned value: termios constant, or B0 if the rate is not supported.
+ **
+ *****************************************************************************/
+static speed_t sBaudConstant(uint32_t u32Baud)
+{
+	switch (u32Baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 921600: return B921600;
+		default: return B0;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	u32ParseList
+ **
+ ** Descriptions:	Parses a comma separated list of numbers.
+ **
+ ** Parameters:	    pcList - List to parse.
+ ** 				pdValues - Returns up to MAX_LIST values.
+ **
+ ** Returned value: Number of values.
+ **
+ *****************************************************************************/
+static uint32_t u32ParseList(const char *pcList, double *pdValues)
+{
+	uint32_t u32Count = 0;
+	char *pcEnd;
+
+	while ((*pcList != '\0') && (u32Count < MAX_LIST))
+	{
+		pdValues[u32Count++] = strtod(pcList, &pcEnd);
+		pcList = (*pcEnd == ',') ? (pcEnd + 1) : pcEnd;
+		if (pcEnd == pcList)
+		{
+			break;
+		}
+	}
+	return u32Count;
+}
+
+/*****************************************************************************
+ ** Function name:	u16Crc16
+ **
+ ** Descriptions:	CRC-16 (CCITT polynomial, as crc.c) of a buffer.
+ **
+ *****************************************************************************/
+static uint16_t u16Crc16(const uint8_t *pu8Data, uint32_t u32Len, uint16_t u16CRC)
+{
+	uint32_t i;
+
+	while (u32Len-- != 0)
+	{
+		u16CRC ^= (uint16_t)(*pu8Data++) << 8;
+		for (i = 0; i < 8; i++)
+		{
+			u16CRC = (u16CRC & 0x8000) ? (uint16_t)((u16CRC << 1) ^ 0x1021) : (uint16_t)(u16CRC << 1);
+		}
+	}
+	return u16CRC;
+}
+
+/*****************************************************************************
+ ** Function name:	u64Now_us
+ **
+ ** Descriptions:	Monotonic time in microseconds.
+ **
+ *****************************************************************************/
+static uint64_t u64Now_us(void)
+{
+	struct timespec sTime;
+
+	clock_gettime(CLOCK_MONOTONIC, &sTime);
+	return ((uint64_t)sTime.tv_sec * 1000000) + ((uint64_t)sTime.tv_nsec / 1000);
+}
+
+/*****************************************************************************
+ ** Function name:	iCompareU64
+ **
+ ** Descriptions:	qsort() comparison of 64-bit values.
+ **
+ *****************************************************************************/
+static int iCompareU64(const void *pv1, const void *pv2)
+{
+	uint64_t u64A = *(const uint64_t *)pv1;
+	uint64_t u64B = *(const uint64_t *)pv2;
+
+	return (u64A > u64B) - (u64A < u64B);
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
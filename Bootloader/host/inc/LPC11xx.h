@@ -0,0 +1,47 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Stand-in for the CMSIS device header in the host build.
+ * 				Provides only what the sources built for the host use, the
+ * 				UART and timer drivers are replaced by simulated versions
+ * 				so their registers are not needed.
+ *
+ *****************************************************************************/
+#ifndef __LPC11xx_H__
+#define __LPC11xx_H__
+
+#include <stdint.h>
+#include "sim.h"
+
+#define __I		volatile const
+#define __O		volatile
+#define __IO	volatile
+
+typedef enum IRQn
+{
+	UART_IRQn = 21
+} IRQn_Type;
+
+typedef struct
+{
+	__IO uint32_t SYSMEMREMAP;
+	__IO uint32_t SYSAHBCLKCTRL;
+	__IO uint32_t SYSAHBCLKDIV;
+	__IO uint32_t UARTCLKDIV;
+} LPC_SYSCON_TypeDef;
+
+extern LPC_SYSCON_TypeDef sSimSYSCON;
+#define LPC_SYSCON			(&sSimSYSCON)
+
+extern uint32_t SystemCoreClock;
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+void NVIC_SystemReset(void);
+
+#endif /* end __LPC11xx_H__ */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
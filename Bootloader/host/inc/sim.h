@@ -0,0 +1,61 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Interface between the bootloader sources and the simulated
+ * 				LPC11xx peripherals used by the host (x86 Linux) build.
+ *
+ *****************************************************************************/
+#ifndef __SIM_H
+#define __SIM_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/* Simulated on-chip flash, 8 sectors of 4K */
+#define SIM_FLASH_SIZE						0x8000UL
+#define SIM_FLASH_SECTOR_SIZE				0x1000UL
+#define SIM_FLASH_SECTOR_COUNT				(SIM_FLASH_SIZE / SIM_FLASH_SECTOR_SIZE)
+
+/* Exit status of the simulator */
+#define SIM_EXIT_APP_STARTED				0		/* Bootloader jumped to the application */
+#define SIM_EXIT_ERROR						1		/* Simulator failure */
+#define SIM_EXIT_RESET						2		/* Bootloader requested a reset */
+
+extern uint8_t au8SimFlash[SIM_FLASH_SIZE];
+
+/* Flash is not mapped at its device address on the host, reads go through
+   the simulated flash array and IAP commands to the simulated ROM */
+#define IAP_FLASH_PTR(addr)					((const void *)&au8SimFlash[(addr)])
+#define IAP_EXECUTE_CMD(a, b)				vSimIAP_Execute((a), (b))
+
+/* Everything runs from host memory, no code needs to be copied to RAM */
+#define BOOTLOADER_RAMFUNC
+
+/* The application cannot run on the host, starting it ends the simulation */
+#define BOOTLOADER_START_APP(pu32Vectors)	vSimStartApp(pu32Vectors)
+
+/* No interrupts are taken, so there is no entry latency to time */
+#define PROFILE_IRQ_LATENCY					0
+
+void vSimIAP_Execute(uint32_t *pu32Command, uint32_t *pu32Result);
+void vSimIAP_Report(FILE *psFile, int iJson);
+void vSimUART_Report(FILE *psFile, int iJson);
+void vSimCRC_Report(FILE *psFile, int iJson);
+uint64_t u64SimTime_ns(void);
+void vSimDelay_ns(uint64_t u64Delay_ns);
+void vSimExit(int iStatus, const char *pcReason);
+void vSimStartApp(const uint32_t *pu32Vectors);
+
+/* Simulator options, set from the command line */
+extern int iSimPtyMaster;
+extern int iSimPtySlave;
+extern int iSimFlashTiming;
+extern int iSimStrictBaud;
+extern double dSimLineErrorRate;
+
+#endif /* end __SIM_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
@@ -0,0 +1,90 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Measures the time the bootloader spends calculating CRCs.
+ * 				The CRC functions are wrapped at link time (ld --wrap) so
+ * 				crc.c is built unchanged. Whole buffer calculations are
+ * 				timed directly, the per character updates made while
+ * 				packets arrive are too short to time individually so are
+ * 				counted and costed with a calibration loop.
+ *
+ *****************************************************************************/
+#include "sim.h"
+#include "crc.h"
+
+/* Number of updates timed to calibrate the per character cost */
+#define CRC_CALIBRATION_BYTES		1000000UL
+
+uint16_t __real_u16CRC_Calc16(const uint8_t *pu8Data, int16_t u16Len);
+uint16_t __real_u16CRC_Update16(uint16_t u16CRC, uint8_t u8Data);
+uint16_t __wrap_u16CRC_Calc16(const uint8_t *pu8Data, int16_t u16Len);
+uint16_t __wrap_u16CRC_Update16(uint16_t u16CRC, uint8_t u8Data);
+
+static uint64_t u64CalcBytes = 0;
+static uint64_t u64CalcTime_ns = 0;
+static uint64_t u64UpdateBytes = 0;
+
+/*****************************************************************************
+ ** Function name:	__wrap_u16CRC_Calc16
+ **
+ ** Descriptions:	Times u16CRC_Calc16().
+ **
+ *****************************************************************************/
+uint16_t __wrap_u16CRC_Calc16(const uint8_t *pu8Data, int16_t u16Len)
+{
+	uint64_t u64Start_ns = u64SimTime_ns();
+	uint16_t u16CRC = __real_u16CRC_Calc16(pu8Data, u16Len);
+
+	u64CalcTime_ns += u64SimTime_ns() - u64Start_ns;
+	u64CalcBytes += (uint16_t)u16Len;
+	return u16CRC;
+}
+
+/*****************************************************************************
+ ** Function name:	__wrap_u16CRC_Update16
+ **
+ ** Descriptions:	Counts calls to u16CRC_Update16().
+ **
+ *****************************************************************************/
+uint16_t __wrap_u16CRC_Update16(uint16_t u16CRC, uint8_t u8Data)
+{
+	u64UpdateBytes++;
+	return __real_u16CRC_Update16(u16CRC, u8Data);
+}
+
+/*****************************************************************************
+ ** Function name:	vSimCRC_Report
+ **
+ ** Descriptions:	Prints CRC statistics.
+ **
+ ** Parameters:	    psFile - Output file.
+ ** 				iJson - Non zero to print members of a JSON object.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vSimCRC_Report(FILE *psFile, int iJson)
+{
+	uint32_t i;
+	volatile uint16_t u16CRC = 0;
+	uint64_t u64Start_ns = u64SimTime_ns();
+	unsigned long long ullUpdate_us;
+
+	for (i = 0; i < CRC_CALIBRATION_BYTES; i++)
+	{
+		u16CRC = __real_u16CRC_Update16(u16CRC, (uint8_t)i);
+	}
+	ullUpdate_us = ((u64SimTime_ns() - u64Start_ns) * u64UpdateBytes) / (CRC_CALIBRATION_BYTES * 1000ULL);
+
+	fprintf(psFile, (iJson != 0) ?
+			"\"crc_calc_bytes\": %llu,\n\"crc_calc_us\": %llu,\n\"crc_update_bytes\": %llu,\n\"crc_update_us\": %llu,\n" :
+			"sim: crc calc bytes %llu time_us %llu update bytes %llu time_us %llu\n",
+			(unsigned long long)u64CalcBytes, (unsigned long long)(u64CalcTime_ns / 1000),
+			(unsigned long long)u64UpdateBytes, ullUpdate_us);
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
@@ -0,0 +1,363 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Host simulation of the IAP boot ROM commands over a 32K
+ * 				flash array. Parameter checks, the prepare/erase/program
+ * 				sequencing and the erase and program times of the LPC111x
+ * 				are reproduced.
+ *
+ *****************************************************************************/
+#include <stdio.h>
+#include "sim.h"
+#include "IAP.h"
+
+/* IAP Command Definitions */
+#define	IAP_CMD_PREPARE_SECTORS			50
+#define	IAP_CMD_COPY_RAM_TO_FLASH		51
+#define	IAP_CMD_ERASE_SECTORS			52
+#define	IAP_CMD_BLANK_CHECK_SECTORS		53
+#define	IAP_CMD_READ_PART_ID			54
+#define	IAP_CMD_READ_BOOT_ROM_VERSION	55
+#define	IAP_CMD_COMPARE					56
+#define	IAP_CMD_REINVOKE_ISP			57
+
+/* Flash timings from the LPC111x data sheet (typical values) */
+#define SIM_SECTOR_ERASE_TIME_ns		100000000ULL
+#define SIM_PAGE_PROGRAM_TIME_ns		1000000ULL
+
+/* Part ID reported, LPC1114FBD48/302 */
+#define SIM_PART_ID						0x0444102BUL
+
+uint8_t au8SimFlash[SIM_FLASH_SIZE];
+
+/* Sectors prepared for the next erase or copy, the ROM clears this after
+   every erase or copy command */
+static uint32_t u32PreparedSectors = 0;
+
+/* Statistics, count and total time of each command */
+static struct
+{
+	const char *pcName;
+	uint64_t u64Count;
+	uint64_t u64Bytes;
+	uint64_t u64Time_ns;
+} asStats[] =
+{
+	{"prepare", 0, 0, 0},
+	{"copy", 0, 0, 0},
+	{"erase", 0, 0, 0},
+	{"blank", 0, 0, 0},
+	{"partid", 0, 0, 0},
+	{"bootver", 0, 0, 0},
+	{"compare", 0, 0, 0},
+	{"isp", 0, 0, 0},
+};
+
+/* Local functions */
+static uint32_t u32SimIAP_SectorRange(uint32_t u32Start, uint32_t u32End);
+static const uint8_t *pu8SimIAP_Map(uint32_t u32Addr, uint32_t u32Len);
+
+/*****************************************************************************
+** Function name:	vSimIAP_Execute
+**
+** Description:		Executes an IAP command.
+**
+** Parameters:		pu32Command - Command code and parameters.
+** 					pu32Result - Status code and results.
+**
+** Returned value:	None
+**
+******************************************************************************/
+void vSimIAP_Execute(uint32_t *pu32Command, uint32_t *pu32Result)
+{
+	uint32_t i;
+	uint32_t u32Status = IAP_STA_CMD_SUCCESS;
+	uint32_t u32Cmd = pu32Command[0];
+	uint64_t u64Start_ns = u64SimTime_ns();
+	uint64_t u64Busy_ns = 0;
+	uint64_t u64Bytes = 0;
+
+	switch (u32Cmd)
+	{
+		case IAP_CMD_PREPARE_SECTORS:
+		{
+			u32Status = u32SimIAP_SectorRange(pu32Command[1], pu32Command[2]);
+			if (u32Status == IAP_STA_CMD_SUCCESS)
+			{
+				for (i = pu32Command[1]; i <= pu32Command[2]; i++)
+				{
+					u32PreparedSectors |= (1UL << i);
+				}
+			}
+		}
+		break;
+
+		case IAP_CMD_COPY_RAM_TO_FLASH:
+		{
+			uint32_t u32Dst = pu32Command[1];
+			const uint8_t *pu8Src = (const uint8_t *)(uintptr_t)pu32Command[2];
+			uint32_t u32Len = pu32Command[3];
+
+			if ((u32Dst % IAP_FLASH_PAGE_SIZE_BYTES) != 0)
+			{
+				u32Status = IAP_STA_DST_ADDR_ERROR;
+			}
+			else if ((pu32Command[2] & 0x03) != 0)
+			{
+				u32Status = IAP_STA_SRC_ADDR_ERROR;
+			}
+			else if ((u32Len != 256) && (u32Len != 512) && (u32Len != 1024) && (u32Len != 4096))
+			{
+				u32Status = IAP_STA_COUNT_ERROR;
+			}
+			else if ((u32Dst + u32Len) > SIM_FLASH_SIZE)
+			{
+				u32Status = IAP_STA_DST_ADDR_NOT_MAPPED;
+			}
+			else
+			{
+				for (i = u32Dst / SIM_FLASH_SECTOR_SIZE; i <= (u32Dst + u32Len - 1) / SIM_FLASH_SECTOR_SIZE; i++)
+				{
+					if ((u32PreparedSectors & (1UL << i)) == 0)
+					{
+						u32Status = IAP_STA_SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION;
+					}
+				}
+			}
+
+			if (u32Status == IAP_STA_CMD_SUCCESS)
+			{
+				/* Programming can only clear bits */
+				for (i = 0; i < u32Len; i++)
+				{
+					au8SimFlash[u32Dst + i] &= pu8Src[i];
+				}
+				u64Busy_ns = (u32Len / IAP_FLASH_PAGE_SIZE_BYTES) * SIM_PAGE_PROGRAM_TIME_ns;
+				u64Bytes = u32Len;
+			}
+			u32PreparedSectors = 0;
+		}
+		break;
+
+		case IAP_CMD_ERASE_SECTORS:
+		{
+			u32Status = u32SimIAP_SectorRange(pu32Command[1], pu32Command[2]);
+			for (i = pu32Command[1]; (u32Status == IAP_STA_CMD_SUCCESS) && (i <= pu32Command[2]); i++)
+			{
+				if ((u32PreparedSectors & (1UL << i)) == 0)
+				{
+					u32Status = IAP_STA_SECTOR_NOT_PREPARED_FOR_WRITE_OPERATION;
+				}
+			}
+
+			if (u32Status == IAP_STA_CMD_SUCCESS)
+			{
+				for (i = pu32Command[1] * SIM_FLASH_SECTOR_SIZE; i < (pu32Command[2] + 1) * SIM_FLASH_SECTOR_SIZE; i++)
+				{
+					au8SimFlash[i] = 0xFF;
+				}
+				u64Busy_ns = (pu32Command[2] - pu32Command[1] + 1) * SIM_SECTOR_ERASE_TIME_ns;
+				u64Bytes = (pu32Command[2] - pu32Command[1] + 1) * SIM_FLASH_SECTOR_SIZE;
+			}
+			u32PreparedSectors = 0;
+		}
+		break;
+
+		case IAP_CMD_BLANK_CHECK_SECTORS:
+		{
+			u32Status = u32SimIAP_SectorRange(pu32Command[1], pu32Command[2]);
+			if (u32Status == IAP_STA_CMD_SUCCESS)
+			{
+				for (i = pu32Command[1] * SIM_FLASH_SECTOR_SIZE; i < (pu32Command[2] + 1) * SIM_FLASH_SECTOR_SIZE; i += 4)
+				{
+					const uint32_t *pu32Word = (const uint32_t *)&au8SimFlash[i];
+
+					if (*pu32Word != 0xFFFFFFFFUL)
+					{
+						u32Status = IAP_STA_SECTOR_NOT_BLANK;
+						pu32Result[1] = i;
+						pu32Result[2] = *pu32Word;
+						break;
+					}
+				}
+			}
+		}
+		break;
+
+		case IAP_CMD_READ_PART_ID:
+		{
+			pu32Result[1] = SIM_PART_ID;
+		}
+		break;
+
+		case IAP_CMD_READ_BOOT_ROM_VERSION:
+		{
+			pu32Result[1] = (5 << 8) | 2;
+		}
+		break;
+
+		case IAP_CMD_COMPARE:
+		{
+			uint32_t u32Len = pu32Command[3];
+			const uint8_t *pu8Dst = pu8SimIAP_Map(pu32Command[1], u32Len);
+			const uint8_t *pu8Src = pu8SimIAP_Map(pu32Command[2], u32Len);
+
+			if ((pu32Command[1] & 0x03) != 0)
+			{
+				u32Status = IAP_STA_DST_ADDR_ERROR;
+			}
+			else if ((pu32Command[2] & 0x03) != 0)
+			{
+				u32Status = IAP_STA_SRC_ADDR_ERROR;
+			}
+			else if ((u32Len & 0x03) != 0)
+			{
+				u32Status = IAP_STA_COUNT_ERROR;
+			}
+			else if ((pu8Dst == NULL) || (pu8Src == NULL))
+			{
+				u32Status = IAP_STA_DST_ADDR_NOT_MAPPED;
+			}
+			else
+			{
+				for (i = 0; i < u32Len; i += 4)
+				{
+					if ((*(const uint32_t *)&pu8Dst[i]) != (*(const uint32_t *)&pu8Src[i]))
+					{
+						u32Status = IAP_STA_COMPARE_ERROR;
+						pu32Result[1] = i;
+						break;
+					}
+				}
+				u64Bytes = u32Len;
+			}
+		}
+		break;
+
+		case IAP_CMD_REINVOKE_ISP:
+		{
+			vSimExit(SIM_EXIT_RESET, "ISP reinvoked");
+		}
+		break;
+
+		default:
+		{
+			u32Status = IAP_STA_INVALID_COMMAND;
+		}
+		break;
+	}
+
+	if ((iSimFlashTiming != 0) && (u64Busy_ns != 0))
+	{
+		/* The CPU is stalled until the operation completes */
+		vSimDelay_ns(u64Busy_ns);
+	}
+
+	if ((u32Cmd >= IAP_CMD_PREPARE_SECTORS) && (u32Cmd <= IAP_CMD_REINVOKE_ISP))
+	{
+		asStats[u32Cmd - IAP_CMD_PREPARE_SECTORS].u64Count++;
+		asStats[u32Cmd - IAP_CMD_PREPARE_SECTORS].u64Bytes += u64Bytes;
+		asStats[u32Cmd - IAP_CMD_PREPARE_SECTORS].u64Time_ns += u64SimTime_ns() - u64Start_ns;
+	}
+
+	pu32Result[0] = u32Status;
+}
+
+/*****************************************************************************
+** Function name:	vSimIAP_Report
+**
+** Description:		Prints IAP command statistics.
+**
+** Parameters:		psFile - Output file.
+** 					iJson - Non zero to print members of a JSON object.
+**
+** Returned value:	None
+**
+******************************************************************************/
+void vSimIAP_Report(FILE *psFile, int iJson)
+{
+	uint32_t i;
+
+	for (i = 0; i < (sizeof(asStats) / sizeof(asStats[0])); i++)
+	{
+		const char *pcName = asStats[i].pcName;
+		unsigned long long ullCount = asStats[i].u64Count;
+		unsigned long long ullBytes = asStats[i].u64Bytes;
+		unsigned long long ullTime_us = asStats[i].u64Time_ns / 1000;
+
+		if (iJson != 0)
+		{
+			fprintf(psFile, "\"iap_%s_count\": %llu,\n\"iap_%s_bytes\": %llu,\n\"iap_%s_us\": %llu,\n",
+					pcName, ullCount, pcName, ullBytes, pcName, ullTime_us);
+		}
+		else if (ullCount != 0)
+		{
+			fprintf(psFile, "sim: iap %-8s count %llu bytes %llu time_us %llu\n",
+					pcName, ullCount, ullBytes, ullTime_us);
+		}
+	}
+}
+
+/*****************************************************************************
+** Function name:	u32SimIAP_SectorRange
+**
+** Description:		Validates a range of sector numbers.
+**
+** Parameters:		u32Start - Number of first sector.
+** 					u32End - Number of last sector.
+**
+** Returned value:	IAP status code.
+**
+******************************************************************************/
+static uint32_t u32SimIAP_SectorRange(uint32_t u32Start, uint32_t u32End)
+{
+	uint32_t u32Status = IAP_STA_CMD_SUCCESS;
+
+	if (u32End >= SIM_FLASH_SECTOR_COUNT)
+	{
+		u32Status = IAP_STA_INVALID_SECTOR;
+	}
+	else if (u32End < u32Start)
+	{
+		u32Status = IAP_STA_INVALD_PARAM;
+	}
+	return u32Status;
+}
+
+/*****************************************************************************
+** Function name:	pu8SimIAP_Map
+**
+** Description:		Converts a device address passed to the ROM into a
+** 					host pointer. Addresses below the end of flash are flash,
+** 					anything else is host memory (the host build is linked
+** 					so that its data and stack have 32-bit addresses).
+**
+** Parameters:		u32Addr - Device address.
+** 					u32Len - Number of bytes to be accessed.
+**
+** Returned value:	Host pointer, or NULL if the range is not mapped.
+**
+******************************************************************************/
+static const uint8_t *pu8SimIAP_Map(uint32_t u32Addr, uint32_t u32Len)
+{
+	const uint8_t *pu8Ptr = NULL;
+
+	if (u32Addr < SIM_FLASH_SIZE)
+	{
+		if ((u32Addr + u32Len) <= SIM_FLASH_SIZE)
+		{
+			pu8Ptr = &au8SimFlash[u32Addr];
+		}
+	}
+	else
+	{
+		pu8Ptr = (const uint8_t *)(uintptr_t)u32Addr;
+	}
+	return pu8Ptr;
+}
+
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
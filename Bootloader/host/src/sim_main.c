@@ -0,0 +1,433 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Host (x86 Linux) simulator entry point. Creates the pseudo
+ * 				terminal standing in for UART0, loads the simulated flash
+ * 				and runs the bootloader's main() on a stack with a 32-bit
+ * 				address, as the bootloader passes RAM addresses to the
+ * 				IAP commands as 32-bit values.
+ *
+ * 				Usage: lpc11xx_sim [-f flash.bin] [-l link] [-j stats.json]
+ * 				                   [-n] [-s] [-e rate] [-q] [-h]
+ *
+ * 				-f  File holding the 32K flash contents, loaded at start
+ * 				    (if present) and saved on exit.
+ * 				-l  Create a symbolic link to the pseudo terminal.
+ * 				-j  Write statistics to a file as a JSON object on exit.
+ * 				-n  Do not simulate flash erase and program times.
+ * 				-s  Corrupt received characters while the host side of the
+ * 				    pseudo terminal is set to a different baud rate.
+ * 				-e  Probability of a received character having a framing
+ * 				    error, which also corrupts it.
+ * 				-q  Do not print statistics on exit.
+ * 				-h  Print the usage line and exit.
+ *
+ * 				The pseudo terminal name is printed on stdout. The exit
+ * 				status is SIM_EXIT_APP_STARTED when the bootloader starts
+ * 				the application and SIM_EXIT_RESET when it resets the
+ * 				device (e.g. after an update).
+ *
+ *****************************************************************************/
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <termios.h>
+#include <time.h>
+#include <ucontext.h>
+#include <unistd.h>
+#include "LPC11xx.h"
+
+/* Stack the bootloader runs on */
+#define SIM_STACK_SIZE				(256 * 1024)
+
+/* Spin rather than sleep for the last part of a delay, sleeps overshoot */
+#define SIM_SPIN_TIME_ns			100000ULL
+
+/* Time allowed on exit for the host to read the last response, closing the
+   pseudo terminal discards anything it has not read */
+#define SIM_EXIT_DRAIN_ms			2000
+
+/* Bootloader main(), renamed by the build */
+int BootLoader_main(void);
+
+LPC_SYSCON_TypeDef sSimSYSCON = {0x02, 0, 1, 0};
+uint32_t SystemCoreClock = 48000000UL;
+
+int iSimPtyMaster = -1;
+int iSimPtySlave = -1;
+int iSimFlashTiming = 1;
+int iSimStrictBaud = 0;
+double dSimLineErrorRate = 0.0;
+
+static const char *pcFlashFile = NULL;
+static const char *pcLinkName = NULL;
+static const char *pcStatsFile = NULL;
+static int iQuiet = 0;
+static uint64_t u64StartTime_ns = 0;
+static ucontext_t sMainContext;
+static ucontext_t sBootContext;
+
+/* Local functions */
+static void vSimBootLoaderEntry(void);
+static void vSimSignal(int iSignal);
+static void vSimOpenPty(void);
+static void vSimLoadFlash(void);
+static void vSimSaveFlash(void);
+
+/*****************************************************************************
+ ** Function name:	main
+ **
+ ** Descriptions:	Simulator entry point.
+ **
+ ** Parameters:	    Command line.
+ **
+ ** Returned value: Exit status.
+ **
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+	int iOpt;
+	void *pvStack;
+
+	while ((iOpt = getopt(argc, argv, "f:l:j:nse:qh")) != -1)
+	{
+		switch (iOpt)
+		{
+			case 'f': pcFlashFile = optarg; break;
+			case 'l': pcLinkName = optarg; break;
+			case 'j': pcStatsFile = optarg; break;
+			case 'n': iSimFlashTiming = 0; break;
+			case 's': iSimStrictBaud = 1; break;
+			case 'e': dSimLineErrorRate = strtod(optarg, NULL); break;
+			case 'q': iQuiet = 1; break;
+			default:
+				fprintf((iOpt == 'h') ? stdout : stderr,
+						"usage: %s [-f flash.bin] [-l link] [-j stats.json] [-n] [-s] [-e rate] [-q] [-h]\n", argv[0]);
+				return (iOpt == 'h') ? 0 : SIM_EXIT_ERROR;
+		}
+	}
+
+	/* Buffers handed to the IAP commands must have 32-bit addresses */
+	pvStack = mmap(NULL, SIM_STACK_SIZE, PROT_READ | PROT_WRITE,
+				   MAP_PRIVATE | MAP_ANONYMOUS | MAP_32BIT, -1, 0);
+	if ((pvStack == MAP_FAILED) || ((uintptr_t)au8SimFlash > 0xFFFFFFFFUL) || ((uintptr_t)pvStack > 0xFFFFFFFFUL))
+	{
+		fprintf(stderr, "sim: cannot place bootloader memory below 4GB (build with -no-pie)\n");
+		return SIM_EXIT_ERROR;
+	}
+
+	vSimLoadFlash();
+	vSimOpenPty();
+
+	signal(SIGINT, vSimSignal);
+	signal(SIGTERM, vSimSignal);
+
+	/* Run the bootloader from reset */
+	u64StartTime_ns = u64SimTime_ns();
+	getcontext(&sBootContext);
+	sBootContext.uc_stack.ss_sp = pvStack;
+	sBootContext.uc_stack.ss_size = SIM_STACK_SIZE;
+	sBootContext.uc_link = &sMainContext;
+	makecontext(&sBootContext, vSimBootLoaderEntry, 0);
+	swapcontext(&sMainContext, &sBootContext);
+
+	vSimExit(SIM_EXIT_ERROR, "bootloader returned from main");
+	return SIM_EXIT_ERROR;
+}
+
+/*****************************************************************************
+ ** Function name:	u64SimTime_ns
+ **
+ ** Descriptions:	Monotonic time.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Time in nanoseconds.
+ **
+ *****************************************************************************/
+uint64_t u64SimTime_ns(void)
+{
+	struct timespec sNow;
+
+	clock_gettime(CLOCK_MONOTONIC, &sNow);
+	return ((uint64_t)sNow.tv_sec * 1000000000ULL) + (uint64_t)sNow.tv_nsec;
+}
+
+/*****************************************************************************
+ ** Function name:	vSimDelay_ns
+ **
+ ** Descriptions:	Waits for a period of time, accurately enough to pace
+ ** 				characters at 921600 baud.
+ **
+ ** Parameters:	    u64Delay_ns - Delay in nanoseconds.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vSimDelay_ns(uint64_t u64Delay_ns)
+{
+	uint64_t u64End_ns = u64SimTime_ns() + u64Delay_ns;
+
+	if (u64Delay_ns > SIM_SPIN_TIME_ns)
+	{
+		struct timespec sWake;
+		uint64_t u64Wake_ns = u64End_ns - SIM_SPIN_TIME_ns;
+
+		sWake.tv_sec = (time_t)(u64Wake_ns / 1000000000ULL);
+		sWake.tv_nsec = (long)(u64Wake_ns % 1000000000ULL);
+		while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sWake, NULL) == EINTR)
+		{
+		}
+	}
+	while (u64SimTime_ns() < u64End_ns)
+	{
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vSimExit
+ **
+ ** Descriptions:	Ends the simulation, saving the flash contents.
+ **
+ ** Parameters:	    iStatus - Exit status.
+ ** 				pcReason - Description printed on stderr.
+ **
+ ** Returned value: Does not return.
+ **
+ *****************************************************************************/
+void vSimExit(int iStatus, const char *pcReason)
+{
+	int iPending = 0;
+	uint32_t u32Waited_ms = 0;
+
+	/* A UART finishes sending before a reset takes effect */
+	while ((iSimPtySlave >= 0) && (ioctl(iSimPtySlave, FIONREAD, &iPending) == 0) &&
+		   (iPending > 0) && (u32Waited_ms++ < SIM_EXIT_DRAIN_ms))
+	{
+		usleep(1000);
+	}
+
+	fprintf(stderr, "sim: %s\n", pcReason);
+	if (iQuiet == 0)
+	{
+		vSimUART_Report(stderr, 0);
+		vSimIAP_Report(stderr, 0);
+		vSimCRC_Report(stderr, 0);
+	}
+	if (pcStatsFile != NULL)
+	{
+		FILE *psFile = fopen(pcStatsFile, "w");
+
+		if (psFile != NULL)
+		{
+			fprintf(psFile, "{\n");
+			vSimUART_Report(psFile, 1);
+			vSimIAP_Report(psFile, 1);
+			vSimCRC_Report(psFile, 1);
+			fprintf(psFile, "\"elapsed_us\": %llu,\n\"status\": %d\n}\n",
+					(unsigned long long)((u64SimTime_ns() - u64StartTime_ns) / 1000), iStatus);
+			fclose(psFile);
+		}
+	}
+	vSimSaveFlash();
+	if (pcLinkName != NULL)
+	{
+		(void)unlink(pcLinkName);
+	}
+	fflush(NULL);
+	_exit(iStatus);
+}
+
+/*****************************************************************************
+ ** Function name:	NVIC_EnableIRQ, NVIC_DisableIRQ
+ **
+ ** Descriptions:	Not used, the UART receive thread is always active.
+ **
+ *****************************************************************************/
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+	(void)IRQn;
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+	(void)IRQn;
+}
+
+/*****************************************************************************
+ ** Function name:	NVIC_SystemReset
+ **
+ ** Descriptions:	Device reset, ends the simulation.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Does not return.
+ **
+ *****************************************************************************/
+void NVIC_SystemReset(void)
+{
+	vSimExit(SIM_EXIT_RESET, "system reset");
+}
+
+/*****************************************************************************
+ ** Function name:	vSimStartApp
+ **
+ ** Descriptions:	Stands in for the jump to the application, which cannot
+ ** 				run on the host, so ends the simulation.
+ **
+ ** Parameters:	    pu32Vectors - Application vector table.
+ **
+ ** Returned value: Does not return.
+ **
+ *****************************************************************************/
+void vSimStartApp(const uint32_t *pu32Vectors)
+{
+	char acReason[80];
+
+	snprintf(acReason, sizeof(acReason), "application started, sp 0x%08x pc 0x%08x remap %u",
+			 (unsigned)pu32Vectors[0], (unsigned)pu32Vectors[1], (unsigned)sSimSYSCON.SYSMEMREMAP);
+	vSimExit(SIM_EXIT_APP_STARTED, acReason);
+}
+
+/*****************************************************************************
+ ** Function name:	vSimBootLoaderEntry
+ **
+ ** Descriptions:	Runs the bootloader on the simulated device stack.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vSimBootLoaderEntry(void)
+{
+	(void)BootLoader_main();
+}
+
+/*****************************************************************************
+ ** Function name:	vSimSignal
+ **
+ ** Descriptions:	Saves the flash contents when the simulator is stopped.
+ **
+ ** Parameters:	    iSignal - Signal number.
+ **
+ ** Returned value: Does not return.
+ **
+ *****************************************************************************/
+static void vSimSignal(int iSignal)
+{
+	(void)iSignal;
+	vSimExit(SIM_EXIT_ERROR, "stopped");
+}
+
+/*****************************************************************************
+ ** Function name:	vSimOpenPty
+ **
+ ** Descriptions:	Creates the pseudo terminal. The simulator keeps the
+ ** 				slave side open in raw mode so that nothing is echoed and
+ ** 				the master stays usable while no host tool has it open.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vSimOpenPty(void)
+{
+	struct termios sTermios;
+	const char *pcSlave;
+
+	iSimPtyMaster = posix_openpt(O_RDWR | O_NOCTTY);
+	if ((iSimPtyMaster < 0) || (grantpt(iSimPtyMaster) != 0) || (unlockpt(iSimPtyMaster) != 0) ||
+		((pcSlave = ptsname(iSimPtyMaster)) == NULL))
+	{
+		vSimExit(SIM_EXIT_ERROR, "cannot create pseudo terminal");
+		return;
+	}
+
+	iSimPtySlave = open(pcSlave, O_RDWR | O_NOCTTY);
+	if ((iSimPtySlave < 0) || (tcgetattr(iSimPtySlave, &sTermios) != 0))
+	{
+		vSimExit(SIM_EXIT_ERROR, "cannot open pseudo terminal");
+		return;
+	}
+	cfmakeraw(&sTermios);
+	cfsetispeed(&sTermios, B9600);
+	cfsetospeed(&sTermios, B9600);
+	(void)tcsetattr(iSimPtySlave, TCSANOW, &sTermios);
+
+	if (pcLinkName != NULL)
+	{
+		(void)unlink(pcLinkName);
+		if (symlink(pcSlave, pcLinkName) != 0)
+		{
+			fprintf(stderr, "sim: cannot create link %s: %s\n", pcLinkName, strerror(errno));
+			pcLinkName = NULL;
+		}
+	}
+
+	printf("%s\n", pcSlave);
+	fflush(stdout);
+}
+
+/*****************************************************************************
+ ** Function name:	vSimLoadFlash
+ **
+ ** Descriptions:	Loads the flash contents, unused flash is erased.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vSimLoadFlash(void)
+{
+	memset(au8SimFlash, 0xFF, sizeof(au8SimFlash));
+
+	if (pcFlashFile != NULL)
+	{
+		FILE *psFile = fopen(pcFlashFile, "rb");
+
+		if (psFile != NULL)
+		{
+			(void)fread(au8SimFlash, 1, sizeof(au8SimFlash), psFile);
+			fclose(psFile);
+		}
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vSimSaveFlash
+ **
+ ** Descriptions:	Saves the flash contents.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vSimSaveFlash(void)
+{
+	if (pcFlashFile != NULL)
+	{
+		FILE *psFile = fopen(pcFlashFile, "wb");
+
+		if (psFile != NULL)
+		{
+			(void)fwrite(au8SimFlash, 1, sizeof(au8SimFlash), psFile);
+			fclose(psFile);
+		}
+	}
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
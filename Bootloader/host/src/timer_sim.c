@@ -0,0 +1,147 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Host simulation of the timeouts and tick count provided by
+ * 				timer.c.
+ *
+ *****************************************************************************/
+#include "sim.h"
+#include "timer.h"
+
+/* Time at which the running timeout expires, zero when stopped (as the
+   timer is after reset) */
+static uint64_t u64Deadline_ns = 0;
+
+/* End of the current gap and the gap length, see vTimerStartGap() */
+static uint64_t u64GapDeadline_ns = UINT64_MAX;
+static uint64_t u64Gap_ns = 0;
+
+/* Time at which the tick count was started */
+static uint64_t u64TicksStart_ns = 0;
+
+/*****************************************************************************
+ ** Function name:	vTimerStart
+ **
+ ** Descriptions:	Starts a one shot timeout.
+ **
+ ** Parameters:	    u32Periodms - Timeout period in milliseconds.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerStart(uint32_t u32Periodms)
+{
+	u64Deadline_ns = u64SimTime_ns() + ((uint64_t)u32Periodms * 1000000);
+	u64GapDeadline_ns = UINT64_MAX;
+}
+
+/*****************************************************************************
+ ** Function name:	u32TimerExpired
+ **
+ ** Descriptions:	Checks whether the timeout started by vTimerStart() has
+ ** 				expired.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: 1 if the timeout has expired, otherwise 0.
+ **
+ *****************************************************************************/
+uint32_t u32TimerExpired(void)
+{
+	uint64_t u64Now_ns = u64SimTime_ns();
+
+	return ((u64Now_ns >= u64Deadline_ns) || (u64Now_ns >= u64GapDeadline_ns)) ? 1 : 0;
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerStartGap
+ **
+ ** Descriptions:	Starts a one shot timeout that also expires if
+ ** 				vTimerRestartGap() is not called often enough.
+ **
+ ** Parameters:	    u32Periodms - Timeout period in milliseconds.
+ ** 				u32Gapus - Longest gap between restarts in microseconds.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerStartGap(uint32_t u32Periodms, uint32_t u32Gapus)
+{
+	uint64_t u64Now_ns = u64SimTime_ns();
+
+	u64Gap_ns = (uint64_t)u32Gapus * 1000;
+	u64Deadline_ns = u64Now_ns + ((uint64_t)u32Periodms * 1000000);
+	u64GapDeadline_ns = u64Now_ns + u64Gap_ns;
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerRestartGap
+ **
+ ** Descriptions:	Moves the end of the gap on from now, unless the timeout
+ ** 				has already expired (the hardware timer has stopped).
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerRestartGap(void)
+{
+	uint64_t u64Now_ns = u64SimTime_ns();
+
+	if ((u64Now_ns < u64GapDeadline_ns) && (u64Now_ns < u64Deadline_ns))
+	{
+		u64GapDeadline_ns = u64Now_ns + u64Gap_ns;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerTicksStart
+ **
+ ** Descriptions:	Starts the free running tick count.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerTicksStart(void)
+{
+	u64TicksStart_ns = u64SimTime_ns();
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerTicksStop
+ **
+ ** Descriptions:	Stops the free running tick count.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerTicksStop(void)
+{
+	u64TicksStart_ns = 0;
+}
+
+/*****************************************************************************
+ ** Function name:	u32TimerTicks
+ **
+ ** Descriptions:	Reads the free running tick count.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Ticks since vTimerTicksStart() was called.
+ **
+ *****************************************************************************/
+uint32_t u32TimerTicks(void)
+{
+	return (uint32_t)((u64SimTime_ns() - u64TicksStart_ns) / (1000000000ULL / TIMER_TICK_HZ));
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
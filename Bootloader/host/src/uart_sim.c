@@ -0,0 +1,444 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Host simulation of UART0 (uart.c) backed by a pseudo
+ * 				terminal. Characters are paced at the selected baud rate
+ * 				(10 bit times each) in both directions and received
+ * 				characters pass through a ring buffer of the same size as
+ * 				the one filled by the device's interrupt handler, so
+ * 				overruns while flash is busy are reproduced.
+ *
+ *****************************************************************************/
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <termios.h>
+#include <time.h>
+#include <unistd.h>
+#include "sim.h"
+#include "profile.h"
+#include "uart.h"
+
+/* Must match UART_RX_BUFFER_SIZE in uart.c */
+#define UART_RX_BUFFER_SIZE		2048
+#define UART_RX_BUFFER_MASK		(UART_RX_BUFFER_SIZE - 1)
+
+/* Highest rate accepted by u32UARTSetBaudRate(), as on a 48MHz device */
+#define UART_MAX_BAUD_RATE		921600
+
+/* A read that blocks for longer than this found the line idle */
+#define UART_RX_IDLE_TIME_ns	50000ULL
+
+static volatile uint8_t au8RxRingBuffer[UART_RX_BUFFER_SIZE];
+static volatile uint32_t u32RxHead = 0;
+static volatile uint32_t u32RxTail = 0;
+static volatile uint32_t au32RxErrors[UART_ERROR_COUNT];
+
+static volatile uint32_t u32LineBaudRate = 9600;
+static volatile uint32_t u32AutoBaudPending = 0;
+static volatile uint32_t u32AutoBaudDone = 0;
+
+static pthread_t sRxThread;
+static int iRxThreadStarted = 0;
+
+/* Statistics */
+static volatile uint64_t u64RxChars = 0;
+static volatile uint64_t u64RxDropped = 0;
+static volatile uint64_t u64RxGarbled = 0;
+static uint64_t u64TxChars = 0;
+static uint64_t u64RxWait_ns = 0;
+static uint64_t u64TxTime_ns = 0;
+
+/* Line error injection, repeatable from run to run */
+static unsigned int uRxErrorSeed = 1;
+
+/* Local functions */
+static void *pvUARTRxThread(void *pvArg);
+static uint32_t u32UARTHostBaudRate(void);
+static uint64_t u64UARTCharTime_ns(uint32_t u32BaudRate);
+
+/*****************************************************************************
+** Function name:	vUARTInit
+**
+** Descriptions:	Sets the line rate and starts delivering characters from
+** 					the pseudo terminal.
+**
+** Parameters:		u32BaudRate - UART baudrate
+**
+** Returned value:	None
+**
+*****************************************************************************/
+void vUARTInit(uint32_t u32BaudRate)
+{
+	(void)u32UARTSetBaudRate(u32BaudRate);
+
+	u32RxTail = u32RxHead;
+	if (iRxThreadStarted == 0)
+	{
+		if (pthread_create(&sRxThread, NULL, pvUARTRxThread, NULL) != 0)
+		{
+			vSimExit(SIM_EXIT_ERROR, "cannot start UART receive thread");
+		}
+		iRxThreadStarted = 1;
+	}
+}
+
+/*****************************************************************************
+** Function name:	u32UARTSetBaudRate
+**
+** Descriptions:	Change the simulated line rate.
+**
+** Parameters:		u32BaudRate - UART baudrate
+**
+** Returned value:	1 if the rate was set, otherwise 0.
+**
+*****************************************************************************/
+uint32_t u32UARTSetBaudRate(uint32_t u32BaudRate)
+{
+	uint32_t u32Result = u32UARTBaudRateSupported(u32BaudRate);
+
+	if (u32Result != 0)
+	{
+		u32LineBaudRate = u32BaudRate;
+	}
+	return u32Result;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTBaudRateSupported
+**
+** Descriptions:	Check whether a baud rate can be used.
+**
+** Parameters:		u32BaudRate - UART baudrate
+**
+** Returned value:	1 if u32UARTSetBaudRate() would accept the rate, else 0.
+**
+*****************************************************************************/
+uint32_t u32UARTBaudRateSupported(uint32_t u32BaudRate)
+{
+	return ((u32BaudRate >= 300) && (u32BaudRate <= UART_MAX_BAUD_RATE)) ? 1 : 0;
+}
+
+/*****************************************************************************
+** Function name:	vUARTAutoBaudStart
+**
+** Descriptions:	Start measuring the baud rate of the next character. The
+** 					simulated measurement is the rate the host side of the
+** 					pseudo terminal has been configured with.
+**
+** Parameters:		None
+**
+** Returned value:	None
+**
+*****************************************************************************/
+void vUARTAutoBaudStart(void)
+{
+	u32AutoBaudDone = 0;
+	u32AutoBaudPending = 1;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTAutoBaudResult
+**
+** Descriptions:	Check for completion of an auto-baud measurement, the
+** 					timed character is lost.
+**
+** Parameters:		None
+**
+** Returned value:	Measured baud rate, 0 if the measurement has not completed.
+**
+*****************************************************************************/
+uint32_t u32UARTAutoBaudResult(void)
+{
+	uint32_t u32Rate = 0;
+
+	if (u32AutoBaudDone != 0)
+	{
+		u32AutoBaudDone = 0;
+		u32Rate = u32UARTHostBaudRate();
+		u32RxTail = u32RxHead;
+	}
+	return u32Rate;
+}
+
+/*****************************************************************************
+** Function name:	vUARTIRQHandler
+**
+** Descriptions:	Not used, characters are delivered by the receive thread.
+**
+** Parameters:		None
+**
+** Returned value:	None
+**
+*****************************************************************************/
+void vUARTIRQHandler(void)
+{
+}
+
+/*****************************************************************************
+** Function name:	u8UARTReceive
+**
+** Descriptions:	Reads received data from the receive ring buffer
+**
+** Parameters:		pu8Buffer - Pointer to buffer in which received characters
+** 					are to be stored.
+**
+** Returned value:	Number of character read out of receive FIFO.
+**
+*****************************************************************************/
+uint8_t u8UARTReceive(uint8_t *pu8Buffer)
+{
+	uint8_t u8Len = 0;
+	uint32_t u32Tail = u32RxTail;
+
+	if (u32Tail != __atomic_load_n(&u32RxHead, __ATOMIC_ACQUIRE))
+	{
+		*pu8Buffer = au8RxRingBuffer[u32Tail & UART_RX_BUFFER_MASK];
+		__atomic_store_n(&u32RxTail, u32Tail + 1, __ATOMIC_RELEASE);
+		u8Len++;
+	}
+	else
+	{
+		/* The client polls in a tight loop, let the receive thread run */
+		uint64_t u64Start_ns = u64SimTime_ns();
+
+		sched_yield();
+		u64RxWait_ns += u64SimTime_ns() - u64Start_ns;
+	}
+	PROFILE_UART_POLL(u8Len);
+	return u8Len;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTErrorCount
+**
+** Descriptions:	Reads a receive error counter, as uart.c.
+**
+** Parameters:		u32Error - UART_ERROR_ counter.
+**
+** Returned value:	Number of errors since start.
+**
+*****************************************************************************/
+uint32_t u32UARTErrorCount(uint32_t u32Error)
+{
+	return __atomic_load_n(&au32RxErrors[u32Error], __ATOMIC_ACQUIRE);
+}
+
+/*****************************************************************************
+** Function name:	vUARTSend
+**
+** Descriptions:	Send a block of data, returning once the last character
+** 					would have left the transmitter.
+**
+** parameters:		pu8Buffer - Pointer to buffer containing data to be sent.
+** 					u32Len - Number of bytes to send.
+**
+** Returned value:	None
+**
+*****************************************************************************/
+void vUARTSend(uint8_t *pu8Buffer, uint32_t u32Len)
+{
+	uint64_t u64Time_ns = u32Len * u64UARTCharTime_ns(u32LineBaudRate);
+
+	vSimDelay_ns(u64Time_ns);
+	u64TxTime_ns += u64Time_ns;
+
+	while (u32Len != 0)
+	{
+		ssize_t iWritten = write(iSimPtyMaster, pu8Buffer, u32Len);
+
+		if (iWritten < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			vSimExit(SIM_EXIT_ERROR, "write to pseudo terminal failed");
+		}
+		pu8Buffer += iWritten;
+		u32Len -= (uint32_t)iWritten;
+		u64TxChars += (uint64_t)iWritten;
+	}
+}
+
+/*****************************************************************************
+** Function name:	vSimUART_Report
+**
+** Descriptions:	Prints UART statistics. The receive wait is the time spent
+** 					polling an empty receive buffer.
+**
+** Parameters:		psFile - Output file.
+** 					iJson - Non zero to print members of a JSON object.
+**
+** Returned value:	None
+**
+*****************************************************************************/
+void vSimUART_Report(FILE *psFile, int iJson)
+{
+	const char *pcFormat = (iJson != 0) ?
+		"\"uart_rx_chars\": %llu,\n\"uart_tx_chars\": %llu,\n\"uart_rx_dropped\": %llu,\n"
+		"\"uart_rx_garbled\": %llu,\n\"uart_rx_wait_us\": %llu,\n\"uart_tx_us\": %llu,\n" :
+		"sim: uart rx %llu tx %llu dropped %llu garbled %llu rx_wait_us %llu tx_us %llu\n";
+
+	fprintf(psFile, pcFormat,
+			(unsigned long long)u64RxChars, (unsigned long long)u64TxChars,
+			(unsigned long long)u64RxDropped, (unsigned long long)u64RxGarbled,
+			(unsigned long long)(u64RxWait_ns / 1000), (unsigned long long)(u64TxTime_ns / 1000));
+}
+
+/*****************************************************************************
+** Function name:	pvUARTRxThread
+**
+** Descriptions:	Plays the part of the UART receiver and its interrupt
+** 					handler. Each character is made available one character
+** 					time after the previous one, and is dropped if the ring
+** 					buffer is full.
+**
+** Parameters:		pvArg - Not used.
+**
+** Returned value:	Does not return.
+**
+*****************************************************************************/
+static void *pvUARTRxThread(void *pvArg)
+{
+	uint64_t u64NextChar_ns = 0;
+
+	(void)pvArg;
+	while (1)
+	{
+		uint8_t u8Data;
+		uint64_t u64Now_ns;
+		uint64_t u64Read_ns = u64SimTime_ns();
+		ssize_t iRead = read(iSimPtyMaster, &u8Data, 1);
+
+		if (iRead != 1)
+		{
+			if ((iRead < 0) && (errno == EINTR))
+			{
+				continue;
+			}
+			/* Host side closed, wait for it to be reopened */
+			vSimDelay_ns(10000000);
+			continue;
+		}
+
+		/* Characters cannot arrive faster than the line rate. A character
+		   that was already waiting follows the previous one on the line even
+		   if this thread woke late, so sleep overshoot does not accumulate
+		   and the thread can sleep rather than spin (which would compete
+		   with the bootloader for the CPU). */
+		u64Now_ns = u64SimTime_ns();
+		if ((u64NextChar_ns < u64Now_ns) && ((u64Now_ns - u64Read_ns) > UART_RX_IDLE_TIME_ns))
+		{
+			u64NextChar_ns = u64Now_ns;
+		}
+		u64NextChar_ns += u64UARTCharTime_ns(u32LineBaudRate);
+		if (u64NextChar_ns > u64Now_ns)
+		{
+			struct timespec sWake;
+
+			sWake.tv_sec = (time_t)(u64NextChar_ns / 1000000000ULL);
+			sWake.tv_nsec = (long)(u64NextChar_ns % 1000000000ULL);
+			while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &sWake, NULL) == EINTR)
+			{
+			}
+		}
+		u64RxChars++;
+
+		if (u32AutoBaudPending != 0)
+		{
+			/* Character consumed by the auto-baud measurement */
+			u32AutoBaudPending = 0;
+			u32AutoBaudDone = 1;
+			continue;
+		}
+
+		if (((iSimStrictBaud != 0) && (u32UARTHostBaudRate() != u32LineBaudRate)) ||
+			((dSimLineErrorRate > 0.0) && (((double)rand_r(&uRxErrorSeed) / ((double)RAND_MAX + 1.0)) < dSimLineErrorRate)))
+		{
+			/* Rates differ or the line is noisy, the character is not
+			   received correctly and the stop bit is missed */
+			u8Data ^= 0xA5;
+			u64RxGarbled++;
+			__atomic_add_fetch(&au32RxErrors[UART_ERROR_FRAMING], 1, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&au32RxErrors[UART_ERROR_ANY], 1, __ATOMIC_RELEASE);
+		}
+
+		if ((u32RxHead - __atomic_load_n(&u32RxTail, __ATOMIC_ACQUIRE)) < UART_RX_BUFFER_SIZE)
+		{
+			au8RxRingBuffer[u32RxHead & UART_RX_BUFFER_MASK] = u8Data;
+			__atomic_store_n(&u32RxHead, u32RxHead + 1, __ATOMIC_RELEASE);
+		}
+		else
+		{
+			u64RxDropped++;
+			__atomic_add_fetch(&au32RxErrors[UART_ERROR_DROPPED], 1, __ATOMIC_RELEASE);
+			__atomic_add_fetch(&au32RxErrors[UART_ERROR_ANY], 1, __ATOMIC_RELEASE);
+		}
+	}
+	return NULL;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTHostBaudRate
+**
+** Descriptions:	Gets the baud rate the host side of the pseudo terminal
+** 					is configured for.
+**
+** Parameters:		None
+**
+** Returned value:	Baud rate, or 0 if unknown.
+**
+*****************************************************************************/
+static uint32_t u32UARTHostBaudRate(void)
+{
+	static const struct
+	{
+		speed_t tSpeed;
+		uint32_t u32Rate;
+	} asSpeeds[] =
+	{
+		{B1200, 1200}, {B2400, 2400}, {B4800, 4800}, {B9600, 9600},
+		{B19200, 19200}, {B38400, 38400}, {B57600, 57600}, {B115200, 115200},
+		{B230400, 230400}, {B460800, 460800}, {B921600, 921600}
+	};
+	struct termios sTermios;
+	uint32_t u32Rate = 0;
+	uint32_t i;
+
+	if (tcgetattr(iSimPtySlave, &sTermios) == 0)
+	{
+		for (i = 0; i < (sizeof(asSpeeds) / sizeof(asSpeeds[0])); i++)
+		{
+			if (asSpeeds[i].tSpeed == cfgetispeed(&sTermios))
+			{
+				u32Rate = asSpeeds[i].u32Rate;
+			}
+		}
+	}
+	return u32Rate;
+}
+
+/*****************************************************************************
+** Function name:	u64UARTCharTime_ns
+**
+** Descriptions:	Time taken to transfer one character (start bit, 8 data
+** 					bits and stop bit).
+**
+** Parameters:		u32BaudRate - UART baudrate
+**
+** Returned value:	Character time in nanoseconds.
+**
+*****************************************************************************/
+static uint64_t u64UARTCharTime_ns(uint32_t u32BaudRate)
+{
+	return 10000000000ULL / u32BaudRate;
+}
+
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
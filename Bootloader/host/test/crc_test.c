@@ -0,0 +1,221 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Checks that every CRC_TABLE_BITS setting of crc.c gives the
+ * 				same CRC-16/XMODEM as a bit serial reference, over random
+ * 				buffers up to the size of an application image, and times
+ * 				each setting on the host.
+ *
+ * 				crc.c is built once per setting with its functions renamed
+ * 				(see the Makefile), so all three are linked together here.
+ *
+ * 				Host timings only show the relative cost of the settings.
+ * 				The Cortex-M0 figures below are estimates, counted by hand
+ * 				from the instruction timings (single cycle ALU, two cycle
+ * 				loads and three cycle taken branches, no flash wait states
+ * 				at 48MHz with the prefetch buffer), not measurements. The
+ * 				inner loops should take about:
+ * 				  0 - 86 cycles per byte (8 x shift, test, branch)
+ * 				  4 - 26 cycles per byte (2 x shift, lookup, xor)
+ * 				  8 - 15 cycles per byte (1 x shift, lookup, xor)
+ * 				so checking a 20K image at startup would take roughly
+ * 				36ms, 11ms and 6.4ms at 48MHz. To measure them on a device
+ * 				build the bootloader with BOOTLOADER_PROFILE=1, which times
+ * 				u16CRC_Calc16() and the startup check on TMR32B1
+ * 				(PROFILE_CRC_CALC and PROFILE_APP_CHECK in profile.h), and
+ * 				read the counters with xmodem_upload -P.
+ *
+ * 				By these estimates the byte table costs 480 bytes more
+ * 				flash than the nibble table to save under 5ms at startup
+ * 				and a few microseconds per packet, so the nibble table is
+ * 				the better trade where there is room. Bit serial is the
+ * 				default as the bootloader has to fit the first sector (see
+ * 				crc.c).
+ *
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/* Largest buffer checked, the largest application image */
+#define TEST_MAX_LEN			0x7000
+/* Number of random buffers checked for each setting */
+#define TEST_BUFFERS			200
+/* Minimum time spent timing each setting */
+#define TEST_TIMING_ns			200000000ULL
+
+typedef uint16_t (*tCalc16)(const uint8_t *pu8Data, int16_t i16Len);
+typedef uint16_t (*tUpdate16)(uint16_t u16CRC, uint8_t u8Data);
+
+uint16_t u16CRC_Calc16_0(const uint8_t *pu8Data, int16_t i16Len);
+uint16_t u16CRC_Update16_0(uint16_t u16CRC, uint8_t u8Data);
+uint16_t u16CRC_Calc16_4(const uint8_t *pu8Data, int16_t i16Len);
+uint16_t u16CRC_Update16_4(uint16_t u16CRC, uint8_t u8Data);
+uint16_t u16CRC_Calc16_8(const uint8_t *pu8Data, int16_t i16Len);
+uint16_t u16CRC_Update16_8(uint16_t u16CRC, uint8_t u8Data);
+
+static const struct
+{
+	uint32_t u32Bits;
+	tCalc16 pfnCalc16;
+	tUpdate16 pfnUpdate16;
+} asSettings[] =
+{
+	{0, u16CRC_Calc16_0, u16CRC_Update16_0},
+	{4, u16CRC_Calc16_4, u16CRC_Update16_4},
+	{8, u16CRC_Calc16_8, u16CRC_Update16_8},
+};
+
+#define SETTING_COUNT			(sizeof(asSettings) / sizeof(asSettings[0]))
+
+static uint8_t au8Buffer[TEST_MAX_LEN];
+
+/*****************************************************************************
+ ** Function name:	u16ReferenceCRC
+ **
+ ** Descriptions:	Bit serial CRC-16/XMODEM, written independently of crc.c.
+ **
+ *****************************************************************************/
+static uint16_t u16ReferenceCRC(const uint8_t *pu8Data, uint32_t u32Len)
+{
+	uint16_t u16CRC = 0;
+	uint32_t i;
+	uint32_t u32Bit;
+
+	for (i = 0; i < u32Len; i++)
+	{
+		for (u32Bit = 0x80; u32Bit != 0; u32Bit >>= 1)
+		{
+			uint32_t u32Feedback = ((u16CRC & 0x8000) != 0) ^ ((pu8Data[i] & u32Bit) != 0);
+
+			u16CRC = (uint16_t)(u16CRC << 1);
+			if (u32Feedback)
+			{
+				u16CRC ^= 0x1021;
+			}
+		}
+	}
+	return u16CRC;
+}
+
+/*****************************************************************************
+ ** Function name:	u64Time_ns
+ **
+ ** Descriptions:	Monotonic time in nanoseconds.
+ **
+ *****************************************************************************/
+static uint64_t u64Time_ns(void)
+{
+	struct timespec sNow;
+
+	clock_gettime(CLOCK_MONOTONIC, &sNow);
+	return ((uint64_t)sNow.tv_sec * 1000000000ULL) + (uint64_t)sNow.tv_nsec;
+}
+
+/*****************************************************************************
+ ** Function name:	u32CheckSetting
+ **
+ ** Descriptions:	Compares both functions of one setting with the
+ ** 				reference. Returns the number of mismatches.
+ **
+ *****************************************************************************/
+static uint32_t u32CheckSetting(uint32_t u32Setting, const uint8_t *pu8Data, uint32_t u32Len,
+								uint16_t u16Expected)
+{
+	uint32_t u32Errors = 0;
+	uint16_t u16CRC;
+	uint32_t i;
+
+	u16CRC = asSettings[u32Setting].pfnCalc16(pu8Data, (int16_t)u32Len);
+	if (u16CRC != u16Expected)
+	{
+		printf("CRC_TABLE_BITS=%u: u16CRC_Calc16 of %u bytes gave %04X, expected %04X\n",
+			   asSettings[u32Setting].u32Bits, u32Len, u16CRC, u16Expected);
+		u32Errors++;
+	}
+
+	u16CRC = 0;
+	for (i = 0; i < u32Len; i++)
+	{
+		u16CRC = asSettings[u32Setting].pfnUpdate16(u16CRC, pu8Data[i]);
+	}
+	if (u16CRC != u16Expected)
+	{
+		printf("CRC_TABLE_BITS=%u: u16CRC_Update16 of %u bytes gave %04X, expected %04X\n",
+			   asSettings[u32Setting].u32Bits, u32Len, u16CRC, u16Expected);
+		u32Errors++;
+	}
+	return u32Errors;
+}
+
+int main(void)
+{
+	static const uint8_t au8Check[] = "123456789";
+	uint32_t u32Errors = 0;
+	uint32_t u32Setting;
+	uint32_t u32Buffer;
+	uint32_t i;
+
+	/* Published check value of CRC-16/XMODEM */
+	if (u16ReferenceCRC(au8Check, 9) != 0x31C3)
+	{
+		printf("Reference CRC of \"123456789\" is not 31C3\n");
+		return 1;
+	}
+
+	srand(1);
+	for (u32Buffer = 0; u32Buffer < TEST_BUFFERS; u32Buffer++)
+	{
+		/* Always include the empty, single byte and largest buffers */
+		uint32_t u32Len;
+		uint16_t u16Expected;
+
+		if (u32Buffer < 3)
+		{
+			u32Len = (u32Buffer == 2) ? TEST_MAX_LEN : u32Buffer;
+		}
+		else
+		{
+			u32Len = (uint32_t)rand() % (TEST_MAX_LEN + 1);
+		}
+		for (i = 0; i < u32Len; i++)
+		{
+			au8Buffer[i] = (uint8_t)rand();
+		}
+		u16Expected = u16ReferenceCRC(au8Buffer, u32Len);
+		for (u32Setting = 0; u32Setting < SETTING_COUNT; u32Setting++)
+		{
+			u32Errors += u32CheckSetting(u32Setting, au8Buffer, u32Len, u16Expected);
+		}
+	}
+	for (u32Setting = 0; u32Setting < SETTING_COUNT; u32Setting++)
+	{
+		u32Errors += u32CheckSetting(u32Setting, au8Check, 9, 0x31C3);
+	}
+
+	/* Time each setting over the largest buffer */
+	for (u32Setting = 0; u32Setting < SETTING_COUNT; u32Setting++)
+	{
+		volatile uint16_t u16Sink = 0;
+		uint64_t u64Bytes = 0;
+		uint64_t u64Start_ns = u64Time_ns();
+		uint64_t u64Elapsed_ns;
+
+		do
+		{
+			u16Sink ^= asSettings[u32Setting].pfnCalc16(au8Buffer, TEST_MAX_LEN);
+			u64Bytes += TEST_MAX_LEN;
+			u64Elapsed_ns = u64Time_ns() - u64Start_ns;
+		}
+		while (u64Elapsed_ns < TEST_TIMING_ns);
+		printf("CRC_TABLE_BITS=%u: %.2f ns/byte on this host\n",
+			   asSettings[u32Setting].u32Bits, (double)u64Elapsed_ns / (double)u64Bytes);
+	}
+
+	printf("crc_test: %u buffers, %s\n", TEST_BUFFERS, u32Errors ? "FAILED" : "ok");
+	return u32Errors ? 1 : 0;
+}
@@ -0,0 +1,188 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Checks that patches generated by the uploader (au8Delta in
+ * 				uploader/xmodem_pack.cpp) are applied by the bootloader
+ * 				(main.c, built through main_shim.c) as they are sent, in
+ * 				1K packets padded with PAD_CHAR:
+ * 				  - against the right base the new image is programmed
+ * 				    byte for byte,
+ * 				  - against the wrong base the patch is refused at its
+ * 				    first packet and flash is left as it was,
+ * 				  - a patch whose image runs into the scratch sector is
+ * 				    refused in the same way,
+ * 				  - a patch is refused once a stream has erased the base.
+ *
+ *****************************************************************************/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "main_shim.h"
+#include "../uploader/xmodem_pack.h"
+#include "../uploader/xmodem_protocol.h"
+
+using namespace xmodem;
+
+/* Installed image, and where the new one differs from it */
+#define TEST_BASE_LEN			0x4C00
+#define TEST_CHANGE_OFFSET		0x0800
+#define TEST_CHANGE_LEN			16
+#define TEST_INSERT_OFFSET		0x1800
+#define TEST_INSERT_LEN			40
+
+/* Packet buffer, static so that it has a 32-bit address (see Makefile) */
+static uint8_t au8Packet[LONG_PAYLOAD_LEN] __attribute__ ((aligned(4)));
+
+/*****************************************************************************
+ ** Function name:	au8Image
+ **
+ ** Descriptions:	Repeatable test image, runs of a few byte patterns as
+ ** 				in code, so that a patch holds both copies and literals.
+ **
+ *****************************************************************************/
+static std::vector<uint8_t> au8Image(size_t uLen, uint32_t u32Seed)
+{
+	std::vector<uint8_t> au8Data(uLen);
+	uint32_t u32State = u32Seed;
+
+	for (size_t i = 0; i < uLen; i++)
+	{
+		u32State = (u32State * 1103515245UL) + 12345UL;
+		au8Data[i] = (uint8_t)((i % 7) + ((u32State >> 16) & 0x03));
+	}
+	return au8Data;
+}
+
+/*****************************************************************************
+ ** Function name:	vInstall
+ **
+ ** Descriptions:	Starts an update with an image already in flash.
+ **
+ *****************************************************************************/
+static void vInstall(const std::vector<uint8_t> &au8Base)
+{
+	vShim_Reset();
+	memcpy(&au8SimFlash[u32ShimAppStartAddr], au8Base.data(), au8Base.size());
+}
+
+/*****************************************************************************
+ ** Function name:	bSend
+ **
+ ** Descriptions:	Passes data to the bootloader in 1K packets, then ends
+ ** 				the transfer.
+ **
+ ** Returned value: true if every packet and the end were accepted.
+ **
+ *****************************************************************************/
+static bool bSend(const std::vector<uint8_t> &au8Data, size_t &uPackets)
+{
+	bool bAccepted = true;
+
+	uPackets = 0;
+	for (size_t uOffset = 0; bAccepted && (uOffset < au8Data.size()); uOffset += LONG_PAYLOAD_LEN)
+	{
+		size_t uLen = std::min((size_t)LONG_PAYLOAD_LEN, au8Data.size() - uOffset);
+
+		memset(au8Packet, PAD_CHAR, sizeof(au8Packet));
+		memcpy(au8Packet, &au8Data[uOffset], uLen);
+		bAccepted = (u32Shim_ProgramFlash(au8Packet, LONG_PAYLOAD_LEN) != 0);
+		uPackets++;
+	}
+	return bAccepted && (u32Shim_ProgramFlash(NULL, 0) != 0);
+}
+
+/*****************************************************************************
+ ** Function name:	bRefused
+ **
+ ** Descriptions:	Checks that a patch is refused at its first packet,
+ ** 				leaving flash as it was.
+ **
+ *****************************************************************************/
+static bool bRefused(const char *pcCase, const std::vector<uint8_t> &au8Patch)
+{
+	std::vector<uint8_t> au8Before(&au8SimFlash[0], &au8SimFlash[u32ShimFlashSize]);
+	size_t uPackets;
+	bool bOk = true;
+
+	if (bSend(au8Patch, uPackets) || (uPackets != 1))
+	{
+		printf("delta_test: %s, not refused at the first packet\n", pcCase);
+		bOk = false;
+	}
+	else if (memcmp(au8Before.data(), au8SimFlash, u32ShimFlashSize) != 0)
+	{
+		printf("delta_test: %s, flash changed\n", pcCase);
+		bOk = false;
+	}
+	return bOk;
+}
+
+int main(void)
+{
+	std::vector<uint8_t> au8Base = au8Image(TEST_BASE_LEN, 1);
+	std::vector<uint8_t> au8New = au8Base;
+	std::vector<uint8_t> au8Wrong;
+	std::vector<uint8_t> au8Large;
+	std::vector<uint8_t> au8Patch;
+	size_t uPackets;
+	int iFailures = 0;
+
+	/* A few bytes changed, then some inserted so that the rest moves */
+	for (size_t i = 0; i < TEST_CHANGE_LEN; i++)
+	{
+		au8New[TEST_CHANGE_OFFSET + i] ^= 0x5A;
+	}
+	std::vector<uint8_t> au8Insert = au8Image(TEST_INSERT_LEN, 2);
+	au8New.insert(au8New.begin() + TEST_INSERT_OFFSET, au8Insert.begin(), au8Insert.end());
+	au8Patch = au8Delta(au8Base.data(), au8Base.size(), au8New.data(), au8New.size());
+
+	/* Right base */
+	vInstall(au8Base);
+	if (!bSend(au8Patch, uPackets))
+	{
+		printf("delta_test: right base, patch refused at packet %zu\n", uPackets);
+		iFailures++;
+	}
+	else if (memcmp(&au8SimFlash[u32ShimAppStartAddr], au8New.data(), au8New.size()) != 0)
+	{
+		printf("delta_test: right base, patched image differs\n");
+		iFailures++;
+	}
+
+	/* Wrong base, one byte differs from the one the patch was made for */
+	au8Wrong = au8Base;
+	au8Wrong[TEST_BASE_LEN / 2] ^= 0x01;
+	vInstall(au8Wrong);
+	iFailures += bRefused("wrong base", au8Patch) ? 0 : 1;
+
+	/* New image running into the scratch sector */
+	au8Large = au8Image(u32ShimDeltaMaxLen + LONG_PAYLOAD_LEN, 3);
+	memcpy(au8Large.data(), au8Base.data(), au8Base.size());
+	vInstall(au8Base);
+	iFailures += bRefused("image into the scratch sector",
+						  au8Delta(au8Base.data(), au8Base.size(), au8Large.data(), au8Large.size())) ? 0 : 1;
+
+	/* Base erased ahead of a stream */
+	vInstall(au8Base);
+	if (u32Shim_PrepareStream() == 0)
+	{
+		printf("delta_test: stream refused\n");
+		iFailures++;
+	}
+	else if (bSend(au8Patch, uPackets) || (uPackets != 1))
+	{
+		printf("delta_test: after a stream erase, not refused at the first packet\n");
+		iFailures++;
+	}
+
+	printf("delta_test: %zu byte patch of a %zu byte image, %s\n", au8Patch.size(), au8New.size(),
+		   (iFailures == 0) ? "ok" : "FAILED");
+	return (iFailures == 0) ? 0 : 1;
+}
+
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
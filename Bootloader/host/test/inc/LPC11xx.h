@@ -0,0 +1,71 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Stand-in for the CMSIS device header in the host unit tests.
+ * 				Unlike the simulator's, it provides the UART registers so
+ * 				that the device UART driver can be built and its register
+ * 				settings checked. The registers are plain memory.
+ *
+ *****************************************************************************/
+#ifndef __LPC11xx_H__
+#define __LPC11xx_H__
+
+#include <stdint.h>
+
+#define __I		volatile const
+#define __O		volatile
+#define __IO	volatile
+
+typedef enum IRQn
+{
+	UART_IRQn = 21
+} IRQn_Type;
+
+/* DLL/RBR/THR and DLM/IER share addresses on the device, they are kept
+   apart here as the tests only look at the divisor latch values written */
+typedef struct
+{
+	__IO uint32_t RBR;
+	__IO uint32_t THR;
+	__IO uint32_t DLL;
+	__IO uint32_t DLM;
+	__IO uint32_t IER;
+	__IO uint32_t IIR;
+	__IO uint32_t FCR;
+	__IO uint32_t LCR;
+	__IO uint32_t LSR;
+	__IO uint32_t ACR;
+	__IO uint32_t FDR;
+} LPC_UART_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t SYSAHBCLKCTRL;
+	__IO uint32_t SYSAHBCLKDIV;
+	__IO uint32_t UARTCLKDIV;
+} LPC_SYSCON_TypeDef;
+
+typedef struct
+{
+	__IO uint32_t PIO1_6;
+	__IO uint32_t PIO1_7;
+} LPC_IOCON_TypeDef;
+
+extern LPC_UART_TypeDef sTestUART;
+extern LPC_SYSCON_TypeDef sTestSYSCON;
+extern LPC_IOCON_TypeDef sTestIOCON;
+#define LPC_UART			(&sTestUART)
+#define LPC_SYSCON			(&sTestSYSCON)
+#define LPC_IOCON			(&sTestIOCON)
+
+extern uint32_t SystemCoreClock;
+
+void NVIC_EnableIRQ(IRQn_Type IRQn);
+void NVIC_DisableIRQ(IRQn_Type IRQn);
+
+#endif /* end __LPC11xx_H__ */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
@@ -0,0 +1,316 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Checks that compressed images are unpacked by the bootloader
+ * 				(main.c, built through main_shim.c) as they are sent, in
+ * 				1K packets padded with PAD_CHAR:
+ * 				  - an image packed by the uploader (au8Pack in
+ * 				    uploader/xmodem_pack.cpp) is programmed byte for byte,
+ * 				  - matches reaching back across a 1K block boundary, and
+ * 				    matches straddling one, read the right history,
+ * 				  - a truncated stream is refused at its end,
+ * 				  - a stream whose header does not fit, or whose matches
+ * 				    reach before the image or beyond its end, is refused,
+ * 				  - nothing is programmed beyond the length in the header.
+ *
+ *****************************************************************************/
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include "main_shim.h"
+#include "../uploader/xmodem_pack.h"
+#include "../uploader/xmodem_protocol.h"
+
+using namespace xmodem;
+
+/* Image unpacked across several flash blocks, and the block size */
+#define TEST_IMAGE_LEN			0x2A00
+#define TEST_BLOCK_LEN			1024
+
+/* Packet buffer, static so that it has a 32-bit address (see Makefile) */
+static uint8_t au8Packet[LONG_PAYLOAD_LEN] __attribute__ ((aligned(4)));
+
+/* Compressed stream written item by item, with the image it unpacks to */
+struct Stream
+{
+	std::vector<uint8_t> au8Packed;
+	std::vector<uint8_t> au8Image;
+	size_t uFlagsPos = 0;
+	uint32_t u32Items = 8;
+};
+
+/*****************************************************************************
+ ** Function name:	vHeader
+ **
+ ** Descriptions:	Starts a stream with its unpacked length.
+ **
+ *****************************************************************************/
+static void vHeader(Stream &rStream, uint32_t u32Len)
+{
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		rStream.au8Packed.push_back((uint8_t)(u32Len >> (8 * i)));
+	}
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		rStream.au8Packed.push_back((uint8_t)(LZSS_MAGIC >> (8 * i)));
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vItem
+ **
+ ** Descriptions:	Starts an item, with a new flags byte every eight.
+ **
+ *****************************************************************************/
+static void vItem(Stream &rStream, bool bLiteral)
+{
+	if (rStream.u32Items == 8)
+	{
+		rStream.uFlagsPos = rStream.au8Packed.size();
+		rStream.au8Packed.push_back(0);
+		rStream.u32Items = 0;
+	}
+	if (bLiteral)
+	{
+		rStream.au8Packed[rStream.uFlagsPos] |= (uint8_t)(1 << rStream.u32Items);
+	}
+	rStream.u32Items++;
+}
+
+/*****************************************************************************
+ ** Function name:	vLiterals
+ **
+ ** Descriptions:	Adds literal bytes, a repeatable pattern.
+ **
+ *****************************************************************************/
+static void vLiterals(Stream &rStream, size_t uCount)
+{
+	for (size_t i = 0; i < uCount; i++)
+	{
+		uint8_t u8Data = (uint8_t)((rStream.au8Image.size() * 7) ^ (rStream.au8Image.size() >> 8));
+
+		vItem(rStream, true);
+		rStream.au8Packed.push_back(u8Data);
+		rStream.au8Image.push_back(u8Data);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vMatch
+ **
+ ** Descriptions:	Adds a match, a copy of earlier bytes.
+ **
+ *****************************************************************************/
+static void vMatch(Stream &rStream, size_t uDistance, size_t uCount)
+{
+	uint32_t u32Code = (uint32_t)(uDistance - 1) | ((uint32_t)(uCount - LZSS_MIN_MATCH) << 10);
+
+	vItem(rStream, false);
+	rStream.au8Packed.push_back((uint8_t)u32Code);
+	rStream.au8Packed.push_back((uint8_t)(u32Code >> 8));
+	for (size_t i = 0; i < uCount; i++)
+	{
+		/* Bytes before the image stand in for a match that is refused */
+		size_t uSource = rStream.au8Image.size() - std::min(uDistance, rStream.au8Image.size());
+
+		rStream.au8Image.push_back(rStream.au8Image.empty() ? 0 : rStream.au8Image[uSource]);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	uPackets
+ **
+ ** Descriptions:	Number of packets the stream so far takes.
+ **
+ *****************************************************************************/
+static size_t uPackets(const Stream &rStream)
+{
+	return (rStream.au8Packed.size() + LONG_PAYLOAD_LEN - 1) / LONG_PAYLOAD_LEN;
+}
+
+/*****************************************************************************
+ ** Function name:	bSend
+ **
+ ** Descriptions:	Passes data to the bootloader in 1K packets, then ends
+ ** 				the transfer.
+ **
+ ** Returned value: true if every packet and the end were accepted.
+ **
+ *****************************************************************************/
+static bool bSend(const std::vector<uint8_t> &au8Data, size_t &uPackets)
+{
+	bool bAccepted = true;
+
+	uPackets = 0;
+	for (size_t uOffset = 0; bAccepted && (uOffset < au8Data.size()); uOffset += LONG_PAYLOAD_LEN)
+	{
+		size_t uLen = std::min((size_t)LONG_PAYLOAD_LEN, au8Data.size() - uOffset);
+
+		memset(au8Packet, PAD_CHAR, sizeof(au8Packet));
+		memcpy(au8Packet, &au8Data[uOffset], uLen);
+		bAccepted = (u32Shim_ProgramFlash(au8Packet, LONG_PAYLOAD_LEN) != 0);
+		uPackets++;
+	}
+	return bAccepted && (u32Shim_ProgramFlash(NULL, 0) != 0);
+}
+
+/*****************************************************************************
+ ** Function name:	bErased
+ **
+ ** Descriptions:	Checks that flash from an address on is still erased.
+ **
+ *****************************************************************************/
+static bool bErased(uint32_t u32Addr)
+{
+	return std::all_of(&au8SimFlash[u32Addr], &au8SimFlash[u32ShimFlashSize], [](uint8_t u8Data) { return u8Data == 0xFF; });
+}
+
+/*****************************************************************************
+ ** Function name:	bUnpacked
+ **
+ ** Descriptions:	Checks that a stream is accepted, programs its image byte
+ ** 				for byte and leaves the flash after it erased.
+ **
+ *****************************************************************************/
+static bool bUnpacked(const char *pcCase, const std::vector<uint8_t> &au8Packed, const std::vector<uint8_t> &au8Image)
+{
+	size_t uPackets;
+	bool bOk = true;
+
+	vShim_Reset();
+	if (!bSend(au8Packed, uPackets))
+	{
+		printf("lzss_test: %s, refused at packet %zu\n", pcCase, uPackets);
+		bOk = false;
+	}
+	else if (memcmp(&au8SimFlash[u32ShimAppStartAddr], au8Image.data(), au8Image.size()) != 0)
+	{
+		printf("lzss_test: %s, unpacked image differs\n", pcCase);
+		bOk = false;
+	}
+	else if (!bErased(u32ShimAppStartAddr + (uint32_t)au8Image.size()))
+	{
+		printf("lzss_test: %s, programmed beyond the image\n", pcCase);
+		bOk = false;
+	}
+	return bOk;
+}
+
+/*****************************************************************************
+ ** Function name:	bRefused
+ **
+ ** Descriptions:	Checks that a stream is refused by the packet it goes
+ ** 				wrong in, or at its end, without anything programmed
+ ** 				beyond the length in its header (and in flash at all,
+ ** 				if that length does not fit).
+ **
+ *****************************************************************************/
+static bool bRefused(const char *pcCase, const std::vector<uint8_t> &au8Packed, size_t uPacket, uint32_t u32Len)
+{
+	uint32_t u32End = u32ShimAppStartAddr + ((u32Len > MAX_IMAGE_LEN) ? 0 : u32Len);
+	size_t uPackets;
+	bool bOk = true;
+
+	vShim_Reset();
+	if (bSend(au8Packed, uPackets) || (uPackets != uPacket))
+	{
+		printf("lzss_test: %s, not refused at packet %zu\n", pcCase, uPacket);
+		bOk = false;
+	}
+	else if (!bErased(u32End))
+	{
+		printf("lzss_test: %s, programmed beyond the header's length\n", pcCase);
+		bOk = false;
+	}
+	return bOk;
+}
+
+int main(void)
+{
+	std::vector<uint8_t> au8Image(TEST_IMAGE_LEN);
+	std::vector<uint8_t> au8Packed;
+	std::vector<uint8_t> au8Truncated;
+	Stream sBoundary;
+	Stream sShort;
+	Stream sBefore;
+	Stream sBeyond;
+	Stream sTooLong;
+	size_t uBadPacket;
+	int iFailures = 0;
+
+	/* Code-like image: runs of a few byte patterns, with blocks of it
+	   repeated just under 1K further on, across block boundaries */
+	uint32_t u32State = 1;
+	for (size_t i = 0; i < au8Image.size(); i++)
+	{
+		u32State = (u32State * 1103515245UL) + 12345UL;
+		au8Image[i] = (uint8_t)((i % 7) + ((u32State >> 16) & 0x0F));
+		if (((i % TEST_BLOCK_LEN) >= 0x300) && (i >= (TEST_BLOCK_LEN - 0x20)))
+		{
+			au8Image[i] = au8Image[i - (TEST_BLOCK_LEN - 0x20)];
+		}
+	}
+	au8Packed = au8Pack(au8Image.data(), au8Image.size());
+	if (au8Packed.size() >= au8Image.size())
+	{
+		printf("lzss_test: round trip, %zu bytes packed into %zu\n", au8Image.size(), au8Packed.size());
+		iFailures++;
+	}
+	iFailures += bUnpacked("round trip", au8Packed, au8Image) ? 0 : 1;
+
+	/* Matches from the block being gathered into the one programmed before
+	   it, as far back as a match reaches, and running on into the next */
+	vHeader(sBoundary, 3 * TEST_BLOCK_LEN);
+	vLiterals(sBoundary, TEST_BLOCK_LEN - 30);
+	vMatch(sBoundary, TEST_BLOCK_LEN - 100, LZSS_MAX_MATCH);
+	vLiterals(sBoundary, (2 * TEST_BLOCK_LEN) - 10 - sBoundary.au8Image.size());
+	vMatch(sBoundary, LZSS_MAX_DISTANCE, LZSS_MAX_MATCH);
+	vMatch(sBoundary, 1, LZSS_MAX_MATCH);
+	vLiterals(sBoundary, (3 * TEST_BLOCK_LEN) - sBoundary.au8Image.size());
+	iFailures += bUnpacked("matches across block boundaries", sBoundary.au8Packed, sBoundary.au8Image) ? 0 : 1;
+
+	/* Packets missing from the end, the items after the length are ignored */
+	au8Truncated.assign(au8Packed.begin(), au8Packed.end() - (au8Packed.size() % LONG_PAYLOAD_LEN) - 1);
+	iFailures += bRefused("truncated", au8Truncated, (au8Truncated.size() + LONG_PAYLOAD_LEN - 1) / LONG_PAYLOAD_LEN,
+						  (uint32_t)au8Image.size()) ? 0 : 1;
+	vHeader(sShort, 100);
+	vLiterals(sShort, 150);
+	sShort.au8Image.resize(100);
+	iFailures += bUnpacked("items beyond the length", sShort.au8Packed, sShort.au8Image) ? 0 : 1;
+
+	/* Corrupt streams, refused in the packet holding the bad item rather
+	   than at the end, items follow it to fill further packets */
+	vHeader(sBefore, 2 * TEST_BLOCK_LEN);
+	vLiterals(sBefore, 10);
+	vMatch(sBefore, 20, LZSS_MIN_MATCH);
+	uBadPacket = uPackets(sBefore);
+	vLiterals(sBefore, TEST_BLOCK_LEN);
+	iFailures += bRefused("match before the image", sBefore.au8Packed, uBadPacket, 2 * TEST_BLOCK_LEN) ? 0 : 1;
+	vHeader(sBeyond, (2 * TEST_BLOCK_LEN) - 2);
+	vLiterals(sBeyond, (2 * TEST_BLOCK_LEN) - 4);
+	vMatch(sBeyond, 50, 10);
+	uBadPacket = uPackets(sBeyond);
+	vLiterals(sBeyond, TEST_BLOCK_LEN);
+	iFailures += bRefused("match beyond the image", sBeyond.au8Packed, uBadPacket, (2 * TEST_BLOCK_LEN) - 2) ? 0 : 1;
+
+	/* An image that would run into the image header at the end of flash */
+	vHeader(sTooLong, MAX_IMAGE_LEN + 1);
+	vLiterals(sTooLong, 1);
+	while (sTooLong.au8Image.size() < (MAX_IMAGE_LEN + 1))
+	{
+		vMatch(sTooLong, 1, std::min(LZSS_MAX_MATCH, MAX_IMAGE_LEN + 1 - sTooLong.au8Image.size()));
+	}
+	iFailures += bRefused("image into the header", sTooLong.au8Packed, 1, MAX_IMAGE_LEN + 1) ? 0 : 1;
+
+	printf("lzss_test: %zu byte image packed into %zu, %s\n", au8Image.size(), au8Packed.size(),
+		   (iFailures == 0) ? "ok" : "FAILED");
+	return (iFailures == 0) ? 0 : 1;
+}
+
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
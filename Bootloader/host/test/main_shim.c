@@ -0,0 +1,132 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Builds the bootloader's main.c for the host unit tests. The
+ * 				source is included unchanged, as the simulator builds it,
+ * 				so that its static functions can be reached. Flash is the
+ * 				simulator's (iap_sim.c, without erase and program times),
+ * 				the peripherals main() would use are stubs that are never
+ * 				called.
+ *
+ *****************************************************************************/
+#include <stdlib.h>
+#include <string.h>
+#include "main.c"
+#include "main_shim.h"
+
+const uint32_t u32ShimFlashSize = SIM_FLASH_SIZE;
+const uint32_t u32ShimAppStartAddr = APP_START_ADDR;
+#if BOOTLOADER_DELTA
+const uint32_t u32ShimDeltaMaxLen = DELTA_MAX_LEN;
+#else
+const uint32_t u32ShimDeltaMaxLen = 0;
+#endif
+
+/* Simulator and device stand-ins */
+LPC_SYSCON_TypeDef sSimSYSCON;
+uint32_t SystemCoreClock = 48000000UL;
+int iSimFlashTiming = 0;
+
+uint64_t u64SimTime_ns(void)
+{
+	return 0;
+}
+
+void vSimDelay_ns(uint64_t u64Delay_ns)
+{
+	(void)u64Delay_ns;
+}
+
+void vSimExit(int iStatus, const char *pcReason)
+{
+	fprintf(stderr, "main_shim: unexpected exit %d (%s)\n", iStatus, pcReason);
+	exit(1);
+}
+
+void NVIC_SystemReset(void)
+{
+	vSimExit(SIM_EXIT_RESET, "reset");
+}
+
+void vSimStartApp(const uint32_t *pu32Vectors)
+{
+	(void)pu32Vectors;
+	vSimExit(SIM_EXIT_APP_STARTED, "application started");
+}
+
+void vUARTIRQHandler(void)
+{
+}
+
+uint32_t u32Xmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len),
+							uint32_t (*pu32Xmodem1kRxHeaderCallback)(const char *pcName, uint32_t u32Size),
+							uint32_t (*pu32Xmodem1kStreamCallback)(void),
+							uint32_t u32BaudRate)
+{
+	(void)pu32Xmodem1kRxPacketCallback;
+	(void)pu32Xmodem1kRxHeaderCallback;
+	(void)pu32Xmodem1kStreamCallback;
+	(void)u32BaudRate;
+	return 0;
+}
+
+/*****************************************************************************
+ ** Function name:	vShim_Reset
+ **
+ ** Descriptions:	Returns main.c to its state at reset, ahead of an
+ ** 				update, with all of flash erased.
+ **
+ *****************************************************************************/
+void vShim_Reset(void)
+{
+	memset(au8SimFlash, 0xFF, SIM_FLASH_SIZE);
+	u32NextFlashWriteAddr = APP_START_ADDR;
+	u32ImageSize = 0;
+	u32ErasedSectors = 0;
+#if BOOTLOADER_LZSS
+	u32PackedImageLen = 0;
+	u32LzssFlags = 1;
+	u32LzssMatch = 0;
+#endif
+#if BOOTLOADER_DELTA
+	u32PatchedImageLen = 0;
+	u32DeltaBaseLen = 0;
+	u16DeltaCRC = 0;
+	u32DeltaLiterals = 0;
+	u32DeltaCmdLen = 0;
+#endif
+}
+
+/*****************************************************************************
+ ** Function name:	u32Shim_ProgramFlash
+ **
+ ** Descriptions:	Passes a packet to u32BootLoader_ProgramFlash, as the
+ ** 				XMODEM client does.
+ **
+ *****************************************************************************/
+uint32_t u32Shim_ProgramFlash(uint8_t *pu8Data, uint16_t u16Len)
+{
+	return u32BootLoader_ProgramFlash(pu8Data, u16Len);
+}
+
+/*****************************************************************************
+ ** Function name:	u32Shim_PrepareStream
+ **
+ ** Descriptions:	Calls u32BootLoader_PrepareStream, as the XMODEM client
+ ** 				does when the server asks to stream.
+ **
+ *****************************************************************************/
+uint32_t u32Shim_PrepareStream(void)
+{
+#if XMODEM_STREAMING || XMODEM_WINDOW
+	return u32BootLoader_PrepareStream();
+#else
+	return 0;
+#endif
+}
+
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
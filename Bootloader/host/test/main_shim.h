@@ -0,0 +1,36 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Entry points into the bootloader's main.c for the host unit
+ * 				tests, see main_shim.c.
+ *
+ *****************************************************************************/
+#ifndef __MAIN_SHIM_H
+#define __MAIN_SHIM_H
+
+#include <stdint.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/* Simulated flash, as sim.h, and the application area in it, as main.c */
+extern uint8_t au8SimFlash[];
+extern const uint32_t u32ShimFlashSize;
+extern const uint32_t u32ShimAppStartAddr;
+extern const uint32_t u32ShimDeltaMaxLen;
+
+void vShim_Reset(void);
+uint32_t u32Shim_ProgramFlash(uint8_t *pu8Data, uint16_t u16Len);
+uint32_t u32Shim_PrepareStream(void);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* end __MAIN_SHIM_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
@@ -0,0 +1,165 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Checks the divisor latch and fractional divider settings
+ * 				uart.c chooses for every baud rate the bootloader can
+ * 				negotiate. uart.c is built unchanged against the register
+ * 				stand-ins in test/inc, each rate is set and the registers
+ * 				read back, tabulated and checked:
+ * 				  - the rate is accepted and within 1.5% of that requested,
+ * 				  - MULVAL and DIVADDVAL are legal, with a divisor latch of
+ * 				    at least 3 when the fractional divider is in use,
+ * 				  - no legal setting is closer (exhaustive search).
+ *
+ *****************************************************************************/
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include "LPC11xx.h"
+#include "uart.h"
+
+/* UART clock used by the bootloader, the 12MHz IRC through the PLL */
+#define TEST_PCLK_HZ			48000000UL
+/* Largest acceptable error, as UART_MAX_BAUD_ERROR_PPT in uart.c */
+#define TEST_MAX_ERROR_PERCENT	1.5
+/* Allowance for the integer arithmetic in uart.c when comparing its choice
+   with the exhaustive search */
+#define TEST_SEARCH_SLACK_PERCENT	0.01
+
+/* Rates offered when negotiating, as au32BaudRates in xmodem1k.c */
+static const uint32_t au32BaudRates[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+
+#define BAUD_RATE_COUNT			(sizeof(au32BaudRates) / sizeof(au32BaudRates[0]))
+
+LPC_UART_TypeDef sTestUART;
+LPC_SYSCON_TypeDef sTestSYSCON;
+LPC_IOCON_TypeDef sTestIOCON;
+uint32_t SystemCoreClock;
+
+void NVIC_EnableIRQ(IRQn_Type IRQn)
+{
+	(void)IRQn;
+}
+
+void NVIC_DisableIRQ(IRQn_Type IRQn)
+{
+	(void)IRQn;
+}
+
+/*****************************************************************************
+ ** Function name:	dRate
+ **
+ ** Descriptions:	Baud rate generated by a divider setting.
+ **
+ *****************************************************************************/
+static double dRate(uint32_t u32DL, uint32_t u32MulVal, uint32_t u32DivAddVal)
+{
+	return (double)TEST_PCLK_HZ /
+		   (16.0 * u32DL * (1.0 + ((double)u32DivAddVal / (double)u32MulVal)));
+}
+
+/*****************************************************************************
+ ** Function name:	dBestError
+ **
+ ** Descriptions:	Smallest error, in percent, of any legal setting.
+ **
+ *****************************************************************************/
+static double dBestError(uint32_t u32BaudRate)
+{
+	double dBest = 100.0;
+	uint32_t u32MulVal;
+	uint32_t u32DivAddVal;
+	uint32_t u32DL;
+
+	for (u32MulVal = 1; u32MulVal <= 15; u32MulVal++)
+	{
+		for (u32DivAddVal = 0; u32DivAddVal < u32MulVal; u32DivAddVal++)
+		{
+			for (u32DL = (u32DivAddVal != 0) ? 3 : 1; u32DL <= 0xFFFF; u32DL++)
+			{
+				double dError = fabs(dRate(u32DL, u32MulVal, u32DivAddVal) - u32BaudRate) * 100.0 / u32BaudRate;
+
+				if (dError < dBest)
+				{
+					dBest = dError;
+				}
+			}
+		}
+	}
+	return dBest;
+}
+
+int main(void)
+{
+	uint32_t u32Errors = 0;
+	uint32_t i;
+
+	SystemCoreClock = TEST_PCLK_HZ;
+	sTestSYSCON.SYSAHBCLKDIV = 1;
+	/* Transmitter idle and receive FIFO empty, so nothing waits */
+	sTestUART.LSR = 0x60;
+	vUARTInit(9600);
+
+	printf("PCLK %luHz\n", TEST_PCLK_HZ);
+	printf("  Baud    DLL  DLM  DIVADDVAL  MULVAL   Actual    Error\n");
+	for (i = 0; i < BAUD_RATE_COUNT; i++)
+	{
+		uint32_t u32BaudRate = au32BaudRates[i];
+		uint32_t u32DL;
+		uint32_t u32MulVal;
+		uint32_t u32DivAddVal;
+		double dActual;
+		double dError;
+		double dBest;
+
+		sTestUART.DLL = 0;
+		sTestUART.DLM = 0;
+		sTestUART.FDR = 0;
+		if (u32UARTSetBaudRate(u32BaudRate) == 0)
+		{
+			printf("%7u  rejected\n", u32BaudRate);
+			u32Errors++;
+			continue;
+		}
+
+		u32DL = (sTestUART.DLM << 8) | sTestUART.DLL;
+		u32MulVal = sTestUART.FDR >> 4;
+		u32DivAddVal = sTestUART.FDR & 0x0F;
+		if ((u32DL == 0) || (u32MulVal == 0) || (u32DivAddVal >= u32MulVal) ||
+			((u32DivAddVal != 0) && (u32DL < 3)))
+		{
+			printf("%7u  illegal setting DL %u FDR %02X\n", u32BaudRate, u32DL, sTestUART.FDR);
+			u32Errors++;
+			continue;
+		}
+
+		dActual = dRate(u32DL, u32MulVal, u32DivAddVal);
+		dError = (dActual - u32BaudRate) * 100.0 / u32BaudRate;
+		dBest = dBestError(u32BaudRate);
+		printf("%7u  %4u %4u  %9u  %6u  %7.0f  %+6.3f%%\n", u32BaudRate, sTestUART.DLL,
+			   sTestUART.DLM, u32DivAddVal, u32MulVal, dActual, dError);
+
+		if (fabs(dError) > TEST_MAX_ERROR_PERCENT)
+		{
+			printf("%7u  error above %.1f%%\n", u32BaudRate, TEST_MAX_ERROR_PERCENT);
+			u32Errors++;
+		}
+		if (fabs(dError) > (dBest + TEST_SEARCH_SLACK_PERCENT))
+		{
+			printf("%7u  a setting with %.3f%% error exists\n", u32BaudRate, dBest);
+			u32Errors++;
+		}
+	}
+
+	/* Rates that cannot be generated must be refused */
+	if ((u32UARTBaudRateSupported(0) != 0) || (u32UARTBaudRateSupported(4000000) != 0))
+	{
+		printf("Unreachable rate accepted\n");
+		u32Errors++;
+	}
+
+	printf("uart_test: %u rates, %s\n", (uint32_t)BAUD_RATE_COUNT, u32Errors ? "FAILED" : "ok");
+	return u32Errors ? 1 : 0;
+}
@@ -0,0 +1,241 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Serial port opened for low latency, non-blocking use.
+ *
+ *****************************************************************************/
+#include <fcntl.h>
+#include <linux/serial.h>
+#include <sys/ioctl.h>
+#include <termios.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+#include "serial_port.h"
+
+namespace xmodem
+{
+
+/* Local functions */
+static speed_t sBaudConstant(uint32_t u32Baud);
+
+/*****************************************************************************
+ ** Function name:	~SerialPort
+ **
+ ** Descriptions:	Closes the port.
+ **
+ *****************************************************************************/
+SerialPort::~SerialPort()
+{
+	vClose();
+}
+
+/*****************************************************************************
+ ** Function name:	bOpen
+ **
+ ** Descriptions:	Opens a port in raw mode without flow control. Reads
+ ** 				return whatever has arrived without waiting (VMIN and
+ ** 				VTIME zero) and the driver is asked to pass characters on
+ ** 				without delay (ASYNC_LOW_LATENCY, where supported). Input
+ ** 				is not flushed as that could discard a poll.
+ **
+ ** Parameters:	    sPath - Device.
+ ** 				u32Baud - Line rate.
+ ** 				sError - Returns a description of any failure.
+ **
+ ** Returned value: true on success.
+ **
+ *****************************************************************************/
+bool SerialPort::bOpen(const std::string &sPath, uint32_t u32Baud, std::string &sError)
+{
+	struct termios sTermios;
+	struct serial_struct sSerial;
+
+	vClose();
+	if (!bBaudSupported(u32Baud))
+	{
+		sError = "unsupported baud rate " + std::to_string(u32Baud);
+		return false;
+	}
+
+	iPortFd = open(sPath.c_str(), O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+	if (iPortFd < 0)
+	{
+		sError = sPath + ": " + strerror(errno);
+		return false;
+	}
+	sPortPath = sPath;
+
+	if (tcgetattr(iPortFd, &sTermios) != 0)
+	{
+		sError = sPath + ": " + strerror(errno);
+		vClose();
+		return false;
+	}
+	cfmakeraw(&sTermios);
+	sTermios.c_cflag |= (CLOCAL | CREAD);
+	sTermios.c_cflag &= ~(CRTSCTS | CSTOPB);
+	sTermios.c_iflag &= ~(IXON | IXOFF | IXANY);
+	sTermios.c_cc[VMIN] = 0;
+	sTermios.c_cc[VTIME] = 0;
+	cfsetispeed(&sTermios, sBaudConstant(u32Baud));
+	cfsetospeed(&sTermios, sBaudConstant(u32Baud));
+	if (tcsetattr(iPortFd, TCSANOW, &sTermios) != 0)
+	{
+		sError = sPath + ": " + strerror(errno);
+		vClose();
+		return false;
+	}
+	u32LineBaud = u32Baud;
+
+	/* Not supported by every driver (or pseudo terminals), only a hint */
+	if (ioctl(iPortFd, TIOCGSERIAL, &sSerial) == 0)
+	{
+		sSerial.flags |= ASYNC_LOW_LATENCY;
+		(void)ioctl(iPortFd, TIOCSSERIAL, &sSerial);
+	}
+	return true;
+}
+
+/*****************************************************************************
+ ** Function name:	vClose
+ **
+ ** Descriptions:	Closes the port if open.
+ **
+ *****************************************************************************/
+void SerialPort::vClose()
+{
+	if (iPortFd >= 0)
+	{
+		close(iPortFd);
+		iPortFd = -1;
+	}
+	u32LineBaud = 0;
+}
+
+/*****************************************************************************
+ ** Function name:	bSetBaud
+ **
+ ** Descriptions:	Changes the line rate immediately, without waiting for
+ ** 				output to drain or flushing input.
+ **
+ ** Parameters:	    u32Baud - Line rate.
+ **
+ ** Returned value: true on success.
+ **
+ *****************************************************************************/
+bool SerialPort::bSetBaud(uint32_t u32Baud)
+{
+	struct termios sTermios;
+
+	if (!bBaudSupported(u32Baud) || (tcgetattr(iPortFd, &sTermios) != 0))
+	{
+		return false;
+	}
+	cfsetispeed(&sTermios, sBaudConstant(u32Baud));
+	cfsetospeed(&sTermios, sBaudConstant(u32Baud));
+	if (tcsetattr(iPortFd, TCSANOW, &sTermios) != 0)
+	{
+		return false;
+	}
+	u32LineBaud = u32Baud;
+	return true;
+}
+
+/*****************************************************************************
+ ** Function name:	iRead
+ **
+ ** Descriptions:	Reads whatever has been received.
+ **
+ ** Parameters:	    pu8Buffer - Buffer.
+ ** 				uLen - Buffer size.
+ **
+ ** Returned value: Number of characters read (0 if none are waiting), or
+ ** 				-1 if the port has failed.
+ **
+ *****************************************************************************/
+ssize_t SerialPort::iRead(uint8_t *pu8Buffer, size_t uLen)
+{
+	ssize_t iLen = read(iPortFd, pu8Buffer, uLen);
+
+	if ((iLen < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+	{
+		iLen = 0;
+	}
+	else if ((iLen == 0) && (uLen != 0))
+	{
+		/* End of file rather than no data, the port has hung up */
+		errno = EIO;
+		iLen = -1;
+	}
+	return iLen;
+}
+
+/*****************************************************************************
+ ** Function name:	iWrite
+ **
+ ** Descriptions:	Queues characters for transmission.
+ **
+ ** Parameters:	    pu8Buffer - Characters.
+ ** 				uLen - Number of characters.
+ **
+ ** Returned value: Number of characters queued (0 if the driver's buffer is
+ ** 				full), or -1 if the port has failed.
+ **
+ *****************************************************************************/
+ssize_t SerialPort::iWrite(const uint8_t *pu8Buffer, size_t uLen)
+{
+	ssize_t iLen = write(iPortFd, pu8Buffer, uLen);
+
+	if ((iLen < 0) && ((errno == EAGAIN) || (errno == EINTR)))
+	{
+		iLen = 0;
+	}
+	return iLen;
+}
+
+/*****************************************************************************
+ ** Function name:	bBaudSupported
+ **
+ ** Descriptions:	Checks whether a rate can be set, the bootloader offers
+ ** 				rates from 9600 to 921600 baud.
+ **
+ *****************************************************************************/
+bool SerialPort::bBaudSupported(uint32_t u32Baud)
+{
+	return sBaudConstant(u32Baud) != B0;
+}
+
+/*****************************************************************************
+ ** Function name:	sBaudConstant
+ **
+ ** Descriptions:	Converts a baud rate to its termios constant.
+ **
+ ** Parameters:	    u32Baud - Baud rate.
+ **
+ ** Returned value: termios constant, or B0 if the rate is not supported.
+ **
+ *****************************************************************************/
+static speed_t sBaudConstant(uint32_t u32Baud)
+{
+	switch (u32Baud)
+	{
+		case 9600: return B9600;
+		case 19200: return B19200;
+		case 38400: return B38400;
+		case 57600: return B57600;
+		case 115200: return B115200;
+		case 230400: return B230400;
+		case 460800: return B460800;
+		case 921600: return B921600;
+		default: return B0;
+	}
+}
+
+} /* namespace xmodem */
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
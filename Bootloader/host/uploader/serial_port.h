@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Serial port opened for low latency, non-blocking use by the
+ * 				uploader. Also works with the host simulator's pseudo
+ * 				terminal.
+ *
+ *****************************************************************************/
+#ifndef __SERIAL_PORT_H
+#define __SERIAL_PORT_H
+
+#include <sys/types.h>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+namespace xmodem
+{
+
+class SerialPort
+{
+public:
+	SerialPort() = default;
+	~SerialPort();
+	SerialPort(const SerialPort &) = delete;
+	SerialPort &operator=(const SerialPort &) = delete;
+
+	bool bOpen(const std::string &sPath, uint32_t u32Baud, std::string &sError);
+	void vClose();
+	bool bSetBaud(uint32_t u32Baud);
+
+	/* Non-blocking, return the number of characters transferred or -1 */
+	ssize_t iRead(uint8_t *pu8Buffer, size_t uLen);
+	ssize_t iWrite(const uint8_t *pu8Buffer, size_t uLen);
+
+	int iFd() const { return iPortFd; }
+	uint32_t u32Baud() const { return u32LineBaud; }
+	const std::string &sPath() const { return sPortPath; }
+
+	static bool bBaudSupported(uint32_t u32Baud);
+
+private:
+	int iPortFd = -1;
+	uint32_t u32LineBaud = 0;
+	std::string sPortPath;
+};
+
+} /* namespace xmodem */
+
+#endif /* end __SERIAL_PORT_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
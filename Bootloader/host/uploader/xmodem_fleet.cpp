@@ -0,0 +1,544 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Uploads the same application image to many boards at once,
+ * 				one serial port each. Every port runs its own session and
+ * 				a single thread services them all from one epoll set, so
+ * 				the host's work per packet does not grow with the number
+ * 				of ports and each line runs as fast as it would alone.
+ *
+ * 				Usage: xmodem_fleet [-b baud] [-s start] [-a] [-y] [-G | -W]
+ * 				                    [-z | -d base] [-l | -1] [-t timeout]
+ * 				                    [-r retries] [-R attempts] [-j] [-q]
+ * 				                    image port...
+ *
+ * 				-b  Rate to negotiate before the first packet.
+ * 				-s  Rate the bootloaders start at (default 9600).
+ * 				-a  Bootloaders are built with XMODEM_AUTOBAUD.
+ * 				-y  Send a YMODEM header with the file name and size.
+ * 				-G  Ask to stream, an error fails the attempt.
+ * 				-W  Ask for a sliding window.
+ * 				-z  Compress the image.
+ * 				-d  Send a patch against the base image installed on every
+ * 				    board, not with -G or -W.
+ * 				-l  1K packets only.
+ * 				-1  128 byte packets only.
+ * 				-t  Seconds to wait for each bootloader to poll.
+ * 				-r  Attempts at each packet before a session fails.
+ * 				-R  Sessions started on a port before it is reported as
+ * 				    failed (default 3).
+ * 				-j  Print the summary as JSON lines, one per port then
+ * 				    one for the fleet.
+ * 				-q  No progress report.
+ *
+ *****************************************************************************/
+#include <sys/epoll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <vector>
+#include "serial_port.h"
+#include "xmodem_image.h"
+#include "xmodem_session.h"
+
+using namespace xmodem;
+
+/* Interval between progress reports */
+#define PROGRESS_PERIOD_ms			1000
+
+/* Events collected per epoll_wait() */
+#define MAX_EVENTS					64
+
+struct Port
+{
+	std::string sPath;
+	SerialPort sPort;
+	std::unique_ptr<Session> pSession;
+	uint32_t u32Attempts = 0;
+	bool bActive = false;				/* Session in progress */
+	bool bOk = false;
+	bool bWatchingOutput = false;		/* EPOLLOUT requested */
+	std::string sError;
+	Clock::time_point sStart;
+	Clock::time_point sEnd;
+};
+
+/* Local functions */
+static bool bStartSession(Port &rPort, const Image &rImage, const SessionOptions &rOptions, Clock::time_point sNow);
+static void vService(int iEpollFd, Port &rPort, uint32_t u32Index, Clock::time_point sNow);
+static void vFinish(int iEpollFd, Port &rPort, const Image &rImage, const SessionOptions &rOptions,
+					uint32_t u32MaxAttempts, bool bQuiet, Clock::time_point sNow);
+static void vProgress(const std::vector<Port> &rPorts);
+static void vReport(const std::vector<Port> &rPorts, const Image &rImage, Clock::duration sElapsed, bool bJson);
+static const char *pcPortName(const Port &rPort);
+static uint64_t u64Micros(Clock::duration sDuration);
+
+/*****************************************************************************
+ ** Function name:	main
+ **
+ ** Descriptions:	Parses the command line, uploads the image to every port
+ ** 				and prints a summary.
+ **
+ ** Parameters:	    Command line.
+ **
+ ** Returned value: 0 if every port was updated, otherwise 1.
+ **
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+	SessionOptions sOptions;
+	Image::Packing ePacking = Image::Packing::Mixed;
+	bool bPack = false;
+	std::string sBasePath;
+	uint32_t u32MaxAttempts = 3;
+	bool bJson = false;
+	bool bQuiet = false;
+	std::string sError;
+	int iOpt;
+
+	while ((iOpt = getopt(argc, argv, "b:s:ayGWzd:l1t:r:R:jq")) != -1)
+	{
+		switch (iOpt)
+		{
+			case 'b': sOptions.u32Baud = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 's': sOptions.u32StartBaud = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 'a': sOptions.bAutoBaud = true; break;
+			case 'y': sOptions.bYmodem = true; break;
+			case 'G': sOptions.bStream = true; break;
+			case 'W': sOptions.bWindow = true; break;
+			case 'z': bPack = true; break;
+			case 'd': sBasePath = optarg; break;
+			case 'l': ePacking = Image::Packing::Long; break;
+			case '1': ePacking = Image::Packing::Short; break;
+			case 't': sOptions.u32ConnectTimeout_ms = (uint32_t)strtoul(optarg, nullptr, 0) * 1000; break;
+			case 'r': sOptions.u32MaxRetries = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 'R': u32MaxAttempts = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 'j': bJson = true; break;
+			case 'q': bQuiet = true; break;
+			default:
+				argc = 0;
+				break;
+		}
+	}
+	if ((argc - optind) < 2)
+	{
+		fprintf(stderr, "usage: %s [-b baud] [-s start] [-a] [-y] [-G | -W] [-z | -d base] [-l | -1] [-t timeout] [-r retries] [-R attempts] [-j] [-q] image port...\n", argv[0]);
+		return 1;
+	}
+	if (sOptions.bStream && sOptions.bWindow)
+	{
+		fprintf(stderr, "xmodem_fleet: -G and -W cannot be combined\n");
+		return 1;
+	}
+	if (!sBasePath.empty() && (sOptions.bStream || sOptions.bWindow || bPack))
+	{
+		fprintf(stderr, "xmodem_fleet: -d cannot be combined with -G, -W or -z\n");
+		return 1;
+	}
+	if (!SerialPort::bBaudSupported(sOptions.u32StartBaud) ||
+		((sOptions.u32Baud != 0) && !SerialPort::bBaudSupported(sOptions.u32Baud)))
+	{
+		fprintf(stderr, "xmodem_fleet: unsupported baud rate\n");
+		return 1;
+	}
+	u32MaxAttempts = std::max<uint32_t>(u32MaxAttempts, 1);
+
+	Image sImage;
+
+	if (!sImage.bLoad(argv[optind], ePacking, bPack, sBasePath, sError))
+	{
+		fprintf(stderr, "xmodem_fleet: %s\n", sError.c_str());
+		return 1;
+	}
+
+	int iEpollFd = epoll_create1(EPOLL_CLOEXEC);
+
+	if (iEpollFd < 0)
+	{
+		perror("epoll_create1");
+		return 1;
+	}
+
+	/* Ports never move once opened, the epoll data is the index */
+	std::vector<Port> asPorts((size_t)(argc - optind - 1));
+	Clock::time_point sFleetStart = Clock::now();
+	size_t uActive = 0;
+
+	for (size_t i = 0; i < asPorts.size(); i++)
+	{
+		Port &rPort = asPorts[i];
+		struct epoll_event sEvent = {};
+
+		rPort.sPath = argv[optind + 1 + i];
+		rPort.sStart = sFleetStart;
+		rPort.sEnd = sFleetStart;
+		if (!rPort.sPort.bOpen(rPort.sPath, sOptions.u32StartBaud, rPort.sError))
+		{
+			continue;
+		}
+		sEvent.events = EPOLLIN;
+		sEvent.data.u32 = (uint32_t)i;
+		if (epoll_ctl(iEpollFd, EPOLL_CTL_ADD, rPort.sPort.iFd(), &sEvent) != 0)
+		{
+			rPort.sError = "epoll_ctl failed";
+			continue;
+		}
+		if (bStartSession(rPort, sImage, sOptions, sFleetStart))
+		{
+			uActive++;
+		}
+	}
+
+	Clock::time_point sNextProgress = sFleetStart + std::chrono::milliseconds(PROGRESS_PERIOD_ms);
+	struct epoll_event asEvents[MAX_EVENTS];
+	uint8_t au8Rx[2048];
+
+	while (uActive != 0)
+	{
+		Clock::time_point sNow = Clock::now();
+		Clock::time_point sWake = sNextProgress;
+
+		/* Queue output and find the earliest deadline */
+		for (size_t i = 0; i < asPorts.size(); i++)
+		{
+			if (asPorts[i].bActive)
+			{
+				vService(iEpollFd, asPorts[i], (uint32_t)i, sNow);
+				sWake = std::min(sWake, asPorts[i].pSession->sDeadline());
+			}
+		}
+
+		int iWait_ms = 0;
+
+		if (sWake > sNow)
+		{
+			/* Round up so that the deadline has passed on waking */
+			iWait_ms = (int)((u64Micros(sWake - sNow) + 999) / 1000);
+		}
+
+		int iEvents = epoll_wait(iEpollFd, asEvents, MAX_EVENTS, iWait_ms);
+
+		sNow = Clock::now();
+		for (int e = 0; e < iEvents; e++)
+		{
+			Port &rPort = asPorts[asEvents[e].data.u32];
+
+			if (!rPort.bActive || !(asEvents[e].events & (EPOLLIN | EPOLLERR | EPOLLHUP)))
+			{
+				continue;
+			}
+
+			ssize_t iLen = rPort.sPort.iRead(au8Rx, sizeof(au8Rx));
+
+			if (iLen < 0)
+			{
+				/* Port has gone, retrying would not help */
+				rPort.sError = "read failed";
+				rPort.u32Attempts = u32MaxAttempts;
+			}
+			else
+			{
+				rPort.pSession->vReceive(au8Rx, (size_t)iLen, sNow);
+			}
+		}
+
+		/* Deadlines, then ports whose session has ended */
+		for (size_t i = 0; i < asPorts.size(); i++)
+		{
+			Port &rPort = asPorts[i];
+
+			if (!rPort.bActive)
+			{
+				continue;
+			}
+			if (!rPort.pSession->bFinished() && (sNow >= rPort.pSession->sDeadline()))
+			{
+				rPort.pSession->vTimeout(sNow);
+			}
+			if (rPort.pSession->bFinished() || !rPort.sError.empty())
+			{
+				vFinish(iEpollFd, rPort, sImage, sOptions, u32MaxAttempts, bQuiet, sNow);
+				if (!rPort.bActive)
+				{
+					uActive--;
+				}
+			}
+		}
+
+		if (!bQuiet && (sNow >= sNextProgress))
+		{
+			vProgress(asPorts);
+			sNextProgress = sNow + std::chrono::milliseconds(PROGRESS_PERIOD_ms);
+		}
+	}
+
+	close(iEpollFd);
+	vReport(asPorts, sImage, Clock::now() - sFleetStart, bJson);
+	return std::all_of(asPorts.begin(), asPorts.end(), [](const Port &rPort) { return rPort.bOk; }) ? 0 : 1;
+}
+
+/*****************************************************************************
+ ** Function name:	bStartSession
+ **
+ ** Descriptions:	Starts a new session on a port at the starting rate.
+ **
+ ** Parameters:	    rPort - Open port.
+ ** 				rImage - Image to upload.
+ ** 				rOptions - Session options.
+ ** 				sNow - Current time.
+ **
+ ** Returned value: true if the session was started.
+ **
+ *****************************************************************************/
+static bool bStartSession(Port &rPort, const Image &rImage, const SessionOptions &rOptions, Clock::time_point sNow)
+{
+	if (!rPort.sPort.bSetBaud(rOptions.u32StartBaud))
+	{
+		rPort.sError = "cannot set baud rate";
+		return false;
+	}
+	rPort.pSession.reset(new Session(rImage, rOptions));
+	rPort.pSession->vStart(sNow);
+	rPort.u32Attempts++;
+	rPort.bActive = true;
+	rPort.sStart = sNow;
+	return true;
+}
+
+/*****************************************************************************
+ ** Function name:	vService
+ **
+ ** Descriptions:	Applies the session's line rate and writes its output,
+ ** 				asking epoll for write readiness only while output
+ ** 				remains.
+ **
+ ** Parameters:	    iEpollFd - epoll set holding the port.
+ ** 				rPort - Port with an active session.
+ ** 				u32Index - Position of the port, the epoll data.
+ ** 				sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vService(int iEpollFd, Port &rPort, uint32_t u32Index, Clock::time_point sNow)
+{
+	Session &rSession = *rPort.pSession;
+
+	if ((rSession.u32LineBaud() != rPort.sPort.u32Baud()) && !rPort.sPort.bSetBaud(rSession.u32LineBaud()))
+	{
+		rPort.sError = "cannot set baud rate";
+		return;
+	}
+
+	if (rSession.uOutputLen() != 0)
+	{
+		ssize_t iLen = rPort.sPort.iWrite(rSession.pu8Output(), rSession.uOutputLen());
+
+		if (iLen < 0)
+		{
+			rPort.sError = "write failed";
+			return;
+		}
+		rSession.vWritten((size_t)iLen, sNow);
+	}
+
+	bool bWatch = (rSession.uOutputLen() != 0);
+
+	if (bWatch != rPort.bWatchingOutput)
+	{
+		struct epoll_event sEvent = {};
+
+		sEvent.events = bWatch ? (EPOLLIN | EPOLLOUT) : EPOLLIN;
+		sEvent.data.u32 = u32Index;
+		(void)epoll_ctl(iEpollFd, EPOLL_CTL_MOD, rPort.sPort.iFd(), &sEvent);
+		rPort.bWatchingOutput = bWatch;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vFinish
+ **
+ ** Descriptions:	Handles the end of a port's session, starting another if
+ ** 				it failed and attempts remain.
+ **
+ ** Parameters:	    iEpollFd - epoll set holding the port.
+ ** 				rPort - Port.
+ ** 				rImage - Image to upload.
+ ** 				rOptions - Session options.
+ ** 				u32MaxAttempts - Sessions allowed per port.
+ ** 				bQuiet - Do not report progress.
+ ** 				sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vFinish(int iEpollFd, Port &rPort, const Image &rImage, const SessionOptions &rOptions,
+					uint32_t u32MaxAttempts, bool bQuiet, Clock::time_point sNow)
+{
+	if (rPort.sError.empty() && (rPort.pSession->eState() == Session::State::Done))
+	{
+		rPort.bOk = true;
+	}
+	else
+	{
+		if (rPort.sError.empty())
+		{
+			rPort.sError = rPort.pSession->sError();
+		}
+		if (!bQuiet)
+		{
+			fprintf(stderr, "%s: attempt %lu failed, %s\n", pcPortName(rPort), (unsigned long)rPort.u32Attempts,
+					rPort.sError.c_str());
+		}
+		if (rPort.u32Attempts < u32MaxAttempts)
+		{
+			rPort.sError.clear();
+			if (bStartSession(rPort, rImage, rOptions, sNow))
+			{
+				return;
+			}
+		}
+	}
+
+	rPort.bActive = false;
+	rPort.sEnd = sNow;
+	(void)epoll_ctl(iEpollFd, EPOLL_CTL_DEL, rPort.sPort.iFd(), nullptr);
+	if (!bQuiet)
+	{
+		fprintf(stderr, "%s: %s\n", pcPortName(rPort), rPort.bOk ? "updated" : "failed");
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vProgress
+ **
+ ** Descriptions:	Prints a line with the progress of every port.
+ **
+ *****************************************************************************/
+static void vProgress(const std::vector<Port> &rPorts)
+{
+	for (const Port &rPort : rPorts)
+	{
+		if (rPort.bActive)
+		{
+			fprintf(stderr, "%s %s %zu/%zu  ", pcPortName(rPort), Session::pcStateName(rPort.pSession->eState()),
+					rPort.pSession->uPacketsAcked(), rPort.pSession->uPacketCount());
+		}
+		else
+		{
+			fprintf(stderr, "%s %s  ", pcPortName(rPort), rPort.bOk ? "updated" : "failed");
+		}
+	}
+	fprintf(stderr, "\n");
+}
+
+/*****************************************************************************
+ ** Function name:	vReport
+ **
+ ** Descriptions:	Prints the result of each port and the fleet on stdout.
+ ** 				Throughput is image bytes over the time from the first
+ ** 				packet to the end of the final session; the fleet's is
+ ** 				the image bytes delivered to every port over the elapsed
+ ** 				time.
+ **
+ ** Parameters:	    rPorts - Ports.
+ ** 				rImage - Image uploaded.
+ ** 				sElapsed - Time for the whole fleet.
+ ** 				bJson - Print JSON lines rather than a table.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vReport(const std::vector<Port> &rPorts, const Image &rImage, Clock::duration sElapsed, bool bJson)
+{
+	size_t uOk = 0;
+	uint64_t u64Elapsed_us = u64Micros(sElapsed);
+
+	if (!bJson)
+	{
+		printf("%-16s %-7s %5s %9s %9s %5s %8s %9s %9s\n", "port", "result", "tries", "time_s", "bytes/s",
+			   "naks", "timeouts", "rtt_mean", "rtt_p95");
+	}
+	for (const Port &rPort : rPorts)
+	{
+		SessionStats sStats;
+
+		if (rPort.pSession)
+		{
+			sStats = rPort.pSession->rStats();
+		}
+
+		SampleSummary sRtt = sSummarise(sStats.au32Rtt_us);
+		uint64_t u64Total_us = u64Micros(rPort.sEnd - rPort.sStart);
+		uint64_t u64Transfer_us = (sStats.sFirstPacket != Clock::time_point()) ? u64Micros(sStats.sEnd - sStats.sFirstPacket) : 0;
+		double dThroughput = (u64Transfer_us != 0) ? ((double)sStats.uBytesAcked * 1e6 / (double)u64Transfer_us) : 0.0;
+
+		uOk += rPort.bOk ? 1 : 0;
+		if (bJson)
+		{
+			printf("{\"port\":\"%s\",\"ok\":%d,\"attempts\":%lu,\"total_us\":%llu,\"transfer_us\":%llu,"
+				   "\"throughput_Bps\":%.0f,\"sent\":%lu,\"naks\":%lu,\"timeouts\":%lu,\"fallbacks\":%lu,"
+				   "\"rtt_mean\":%lu,\"rtt_p95\":%lu,\"rtt_max\":%lu,\"error\":\"%s\"}\n",
+				   rPort.sPath.c_str(), rPort.bOk ? 1 : 0, (unsigned long)rPort.u32Attempts,
+				   (unsigned long long)u64Total_us, (unsigned long long)u64Transfer_us, dThroughput,
+				   (unsigned long)sStats.u32PacketsSent, (unsigned long)sStats.u32Naks,
+				   (unsigned long)sStats.u32Timeouts, (unsigned long)sStats.u32Fallbacks,
+				   (unsigned long)sRtt.u32Mean, (unsigned long)sRtt.u32P95, (unsigned long)sRtt.u32Max,
+				   rPort.bOk ? "" : rPort.sError.c_str());
+		}
+		else
+		{
+			printf("%-16s %-7s %5lu %9.3f %9.0f %5lu %8lu %9lu %9lu%s%s\n", pcPortName(rPort),
+				   rPort.bOk ? "ok" : "failed", (unsigned long)rPort.u32Attempts, (double)u64Total_us / 1e6,
+				   dThroughput, (unsigned long)sStats.u32Naks, (unsigned long)sStats.u32Timeouts,
+				   (unsigned long)sRtt.u32Mean, (unsigned long)sRtt.u32P95,
+				   rPort.bOk ? "" : "  ", rPort.bOk ? "" : rPort.sError.c_str());
+		}
+	}
+
+	double dAggregate = (u64Elapsed_us != 0) ? ((double)(rImage.uSize() * uOk) * 1e6 / (double)u64Elapsed_us) : 0.0;
+
+	if (bJson)
+	{
+		printf("{\"ports\":%zu,\"ok\":%zu,\"failed\":%zu,\"size\":%zu,\"elapsed_us\":%llu,\"aggregate_Bps\":%.0f}\n",
+			   rPorts.size(), uOk, rPorts.size() - uOk, rImage.uSize(), (unsigned long long)u64Elapsed_us, dAggregate);
+	}
+	else
+	{
+		printf("%zu ports, %zu updated, %zu failed, %.3f s, %.0f bytes/s in total\n", rPorts.size(), uOk,
+			   rPorts.size() - uOk, (double)u64Elapsed_us / 1e6, dAggregate);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	pcPortName
+ **
+ ** Descriptions:	Short name of a port for reports, the device path
+ ** 				without /dev/.
+ **
+ *****************************************************************************/
+static const char *pcPortName(const Port &rPort)
+{
+	const std::string &sPath = rPort.sPath;
+
+	return (sPath.compare(0, 5, "/dev/") == 0) ? (sPath.c_str() + 5) : sPath.c_str();
+}
+
+/*****************************************************************************
+ ** Function name:	u64Micros
+ **
+ ** Descriptions:	Converts a duration to microseconds.
+ **
+ *****************************************************************************/
+static uint64_t u64Micros(Clock::duration sDuration)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(sDuration).count();
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
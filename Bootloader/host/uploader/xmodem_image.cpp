@@ -0,0 +1,331 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Application image prepared for upload.
+ *
+ *****************************************************************************/
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <array>
+#include <cerrno>
+#include <cstring>
+#include "xmodem_image.h"
+#include "xmodem_pack.h"
+#include "xmodem_protocol.h"
+
+namespace xmodem
+{
+
+/* Local functions */
+static bool bReadFile(const std::string &sPath, std::vector<uint8_t> &au8Data, std::string &sError);
+
+/*****************************************************************************
+ ** Function name:	u16Crc16
+ **
+ ** Descriptions:	Table driven CRC-16, see xmodem_protocol.h.
+ **
+ *****************************************************************************/
+uint16_t u16Crc16(const uint8_t *pu8Data, size_t uLen, uint16_t u16CRC)
+{
+	static const std::array<uint16_t, 256> au16Table = []
+	{
+		std::array<uint16_t, 256> au16Entries;
+
+		for (uint32_t i = 0; i < 256; i++)
+		{
+			uint16_t u16Entry = (uint16_t)(i << 8);
+
+			for (uint32_t j = 0; j < 8; j++)
+			{
+				u16Entry = (u16Entry & 0x8000) ? (uint16_t)((u16Entry << 1) ^ 0x1021) : (uint16_t)(u16Entry << 1);
+			}
+			au16Entries[i] = u16Entry;
+		}
+		return au16Entries;
+	}();
+
+	while (uLen-- != 0)
+	{
+		u16CRC = (uint16_t)((u16CRC << 8) ^ au16Table[(u16CRC >> 8) ^ *pu8Data++]);
+	}
+	return u16CRC;
+}
+
+/*****************************************************************************
+ ** Function name:	bLoad
+ **
+ ** Descriptions:	Maps an image file and frames it into packets numbered
+ ** 				from 1. With Packing::Mixed the image is sent in 1K
+ ** 				packets, except that a tail which takes fewer characters
+ ** 				(counting the ACK for each packet) as 128 byte packets is
+ ** 				sent that way, which also keeps the padding programmed
+ ** 				after the image short. The YMODEM header packets are
+ ** 				framed too, named after the file and giving the size of
+ ** 				the image (unpacked, if compressed or patched). An image
+ ** 				that does not compress is sent as it is, as is one that
+ ** 				a patch would not make smaller or that is too large to
+ ** 				be patched in place.
+ **
+ ** Parameters:	    sPath - Image file (raw binary, linked for 0x1000).
+ ** 				ePacking - Packet sizes to use.
+ ** 				bPack - Compress the image.
+ ** 				sBasePath - Image installed on the device, to send a
+ ** 				patch against it, or empty.
+ ** 				sError - Returns a description of any failure.
+ **
+ ** Returned value: true on success.
+ **
+ *****************************************************************************/
+bool Image::bLoad(const std::string &sPath, Packing ePacking, bool bPack, const std::string &sBasePath,
+				  std::string &sError)
+{
+	struct stat sStat;
+	int iFd = open(sPath.c_str(), O_RDONLY);
+
+	au8Frames.clear();
+	auFrameOffsets.clear();
+	auDataLens.clear();
+	uImageLen = 0;
+	uSentLen = 0;
+	eSent = Encoding::Raw;
+
+	if (iFd < 0)
+	{
+		sError = sPath + ": " + strerror(errno);
+		return false;
+	}
+	if (fstat(iFd, &sStat) != 0)
+	{
+		sError = sPath + ": " + strerror(errno);
+		close(iFd);
+		return false;
+	}
+	if ((sStat.st_size == 0) || ((size_t)sStat.st_size > MAX_IMAGE_LEN))
+	{
+		sError = sPath + ": image must be 1 to " + std::to_string(MAX_IMAGE_LEN) + " bytes";
+		close(iFd);
+		return false;
+	}
+
+	uImageLen = (size_t)sStat.st_size;
+	void *pvMap = mmap(nullptr, uImageLen, PROT_READ, MAP_PRIVATE, iFd, 0);
+	close(iFd);
+	if (pvMap == MAP_FAILED)
+	{
+		sError = sPath + ": " + strerror(errno);
+		uImageLen = 0;
+		return false;
+	}
+
+	const uint8_t *pu8Image = static_cast<const uint8_t *>(pvMap);
+	std::vector<uint8_t> au8Encoded;
+	size_t uOffset = 0;
+	uint8_t u8Seq = 1;
+
+	if (bPack)
+	{
+		au8Encoded = au8Pack(pu8Image, uImageLen);
+		eSent = Encoding::Packed;
+	}
+	else if (!sBasePath.empty())
+	{
+		std::vector<uint8_t> au8Base;
+
+		if (!bReadFile(sBasePath, au8Base, sError))
+		{
+			munmap(pvMap, uImageLen);
+			uImageLen = 0;
+			return false;
+		}
+		if ((au8Base.size() <= DELTA_MAX_LEN) && (uImageLen <= DELTA_MAX_LEN))
+		{
+			au8Encoded = au8Delta(au8Base.data(), au8Base.size(), pu8Image, uImageLen);
+			eSent = Encoding::Patch;
+		}
+	}
+
+	uSentLen = uImageLen;
+	if ((eSent != Encoding::Raw) && (au8Encoded.size() < uImageLen))
+	{
+		pu8Image = au8Encoded.data();
+		uSentLen = au8Encoded.size();
+	}
+	else
+	{
+		eSent = Encoding::Raw;
+	}
+
+	au8Frames.reserve(uSentLen + LONG_PAYLOAD_LEN + (((uSentLen / SHORT_PAYLOAD_LEN) + 1) * (HEADER_LEN + CRC_LEN)));
+	while (uOffset < uSentLen)
+	{
+		size_t uRemaining = uSentLen - uOffset;
+		uint32_t u32Payload = LONG_PAYLOAD_LEN;
+
+		if (ePacking == Packing::Short)
+		{
+			u32Payload = SHORT_PAYLOAD_LEN;
+		}
+		else if ((ePacking == Packing::Mixed) && (uRemaining < LONG_PAYLOAD_LEN))
+		{
+			size_t uShortPackets = (uRemaining + SHORT_PAYLOAD_LEN - 1) / SHORT_PAYLOAD_LEN;
+
+			if ((uShortPackets * (SHORT_PAYLOAD_LEN + HEADER_LEN + CRC_LEN + 1)) <
+				(LONG_PAYLOAD_LEN + HEADER_LEN + CRC_LEN + 1))
+			{
+				u32Payload = SHORT_PAYLOAD_LEN;
+			}
+		}
+
+		size_t uLen = (uRemaining < u32Payload) ? uRemaining : u32Payload;
+
+		vAddPacket(&pu8Image[uOffset], uLen, u32Payload, u8Seq++);
+		uOffset += uLen;
+	}
+
+	munmap(pvMap, uImageLen);
+
+	/* Name without its directory, cut short to leave room for the size */
+	std::string sName = sPath.substr(sPath.find_last_of('/') + 1);
+	std::string sSize = std::to_string(uImageLen);
+
+	sName.resize(std::min(sName.size(), (size_t)SHORT_PAYLOAD_LEN - sSize.size() - 2));
+	vFrameBatchPacket(au8BatchStart, sName + '\0' + sSize);
+	vFrameBatchPacket(au8BatchEnd, std::string());
+	return true;
+}
+
+/*****************************************************************************
+ ** Function name:	uPacketLen
+ **
+ ** Descriptions:	Length of a framed packet.
+ **
+ ** Parameters:	    uIndex - Packet index, from 0.
+ **
+ ** Returned value: Number of characters.
+ **
+ *****************************************************************************/
+size_t Image::uPacketLen(size_t uIndex) const
+{
+	return (au8Frames[auFrameOffsets[uIndex]] == STX) ?
+		   (LONG_PAYLOAD_LEN + HEADER_LEN + CRC_LEN) : (SHORT_PAYLOAD_LEN + HEADER_LEN + CRC_LEN);
+}
+
+/*****************************************************************************
+ ** Function name:	vAddPacket
+ **
+ ** Descriptions:	Frames a packet, padding the payload with PAD_CHAR.
+ **
+ ** Parameters:	    pu8Data - Image data.
+ ** 				uLen - Number of image bytes.
+ ** 				u32Payload - SHORT_PAYLOAD_LEN or LONG_PAYLOAD_LEN.
+ ** 				u8Seq - Packet number.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Image::vAddPacket(const uint8_t *pu8Data, size_t uLen, uint32_t u32Payload, uint8_t u8Seq)
+{
+	size_t uStart = au8Frames.size();
+
+	auFrameOffsets.push_back(uStart);
+	auDataLens.push_back(uLen);
+
+	au8Frames.push_back((u32Payload == LONG_PAYLOAD_LEN) ? STX : SOH);
+	au8Frames.push_back(u8Seq);
+	au8Frames.push_back((uint8_t)~u8Seq);
+	au8Frames.insert(au8Frames.end(), pu8Data, pu8Data + uLen);
+	au8Frames.insert(au8Frames.end(), u32Payload - uLen, PAD_CHAR);
+
+	uint16_t u16CRC = u16Crc16(&au8Frames[uStart + HEADER_LEN], u32Payload);
+
+	au8Frames.push_back((uint8_t)(u16CRC >> 8));
+	au8Frames.push_back((uint8_t)u16CRC);
+}
+
+/*****************************************************************************
+ ** Function name:	vFrameBatchPacket
+ **
+ ** Descriptions:	Frames a YMODEM packet 0, padding the payload with
+ ** 				zeros.
+ **
+ ** Parameters:	    pu8Frame - Returns the frame, uBatchPacketLen() long.
+ ** 				sHeader - Payload, no more than SHORT_PAYLOAD_LEN.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Image::vFrameBatchPacket(uint8_t *pu8Frame, const std::string &sHeader)
+{
+	pu8Frame[0] = SOH;
+	pu8Frame[1] = 0;
+	pu8Frame[2] = 0xFF;
+	memset(&pu8Frame[HEADER_LEN], 0, SHORT_PAYLOAD_LEN);
+	memcpy(&pu8Frame[HEADER_LEN], sHeader.data(), sHeader.size());
+
+	uint16_t u16CRC = u16Crc16(&pu8Frame[HEADER_LEN], SHORT_PAYLOAD_LEN);
+
+	pu8Frame[HEADER_LEN + SHORT_PAYLOAD_LEN] = (uint8_t)(u16CRC >> 8);
+	pu8Frame[HEADER_LEN + SHORT_PAYLOAD_LEN + 1] = (uint8_t)u16CRC;
+}
+
+/*****************************************************************************
+ ** Function name:	bReadFile
+ **
+ ** Descriptions:	Reads an image file.
+ **
+ ** Parameters:	    sPath - Image file.
+ ** 				au8Data - Returns the contents.
+ ** 				sError - Returns a description of any failure.
+ **
+ ** Returned value: true on success.
+ **
+ *****************************************************************************/
+static bool bReadFile(const std::string &sPath, std::vector<uint8_t> &au8Data, std::string &sError)
+{
+	struct stat sStat;
+	int iFd = open(sPath.c_str(), O_RDONLY);
+	size_t uOffset = 0;
+
+	if ((iFd < 0) || (fstat(iFd, &sStat) != 0))
+	{
+		sError = sPath + ": " + strerror(errno);
+		if (iFd >= 0)
+		{
+			close(iFd);
+		}
+		return false;
+	}
+	if ((sStat.st_size == 0) || ((size_t)sStat.st_size > MAX_IMAGE_LEN))
+	{
+		sError = sPath + ": image must be 1 to " + std::to_string(MAX_IMAGE_LEN) + " bytes";
+		close(iFd);
+		return false;
+	}
+
+	au8Data.resize((size_t)sStat.st_size);
+	while (uOffset < au8Data.size())
+	{
+		ssize_t iLen = read(iFd, &au8Data[uOffset], au8Data.size() - uOffset);
+
+		if (iLen <= 0)
+		{
+			sError = sPath + ": " + ((iLen < 0) ? strerror(errno) : "file changed while reading");
+			close(iFd);
+			return false;
+		}
+		uOffset += (size_t)iLen;
+	}
+	close(iFd);
+	return true;
+}
+
+} /* namespace xmodem */
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
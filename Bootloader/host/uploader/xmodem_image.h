@@ -0,0 +1,86 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Application image prepared for upload. The image file is
+ * 				mapped and every packet is framed, with its CRC, before the
+ * 				transfer starts so that nothing but a write is needed when
+ * 				the bootloader acknowledges a packet. The image may be
+ * 				compressed first, or replaced by a patch against the
+ * 				installed image.
+ *
+ *****************************************************************************/
+#ifndef __XMODEM_IMAGE_H
+#define __XMODEM_IMAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "xmodem_protocol.h"
+
+namespace xmodem
+{
+
+class Image
+{
+public:
+	/* Packet sizes to use */
+	enum class Packing
+	{
+		Mixed,			/* 1K packets, short packets for the tail when shorter */
+		Long,			/* 1K packets only */
+		Short			/* 128 byte packets only */
+	};
+
+	/* Form the image is sent in */
+	enum class Encoding
+	{
+		Raw,			/* As it is */
+		Packed,			/* Compressed */
+		Patch			/* Patch against the installed image */
+	};
+
+	bool bLoad(const std::string &sPath, Packing ePacking, bool bPack, const std::string &sBasePath,
+			   std::string &sError);
+
+	size_t uSize() const { return uImageLen; }
+
+	/* Bytes sent, fewer than the image if compressed or patched */
+	size_t uSentSize() const { return uSentLen; }
+	Encoding eEncoding() const { return eSent; }
+	size_t uPacketCount() const { return auFrameOffsets.size(); }
+
+	/* Framed packet, header to CRC */
+	const uint8_t *pu8Packet(size_t uIndex) const { return &au8Frames[auFrameOffsets[uIndex]]; }
+	size_t uPacketLen(size_t uIndex) const;
+
+	/* Bytes carried by a packet, excluding padding */
+	size_t uPacketData(size_t uIndex) const { return auDataLens[uIndex]; }
+
+	/* YMODEM packet 0, the file name and size or (bEnd) the empty header
+	   that ends the batch */
+	const uint8_t *pu8BatchPacket(bool bEnd) const { return bEnd ? &au8BatchEnd[0] : &au8BatchStart[0]; }
+	static constexpr size_t uBatchPacketLen() { return SHORT_PAYLOAD_LEN + HEADER_LEN + CRC_LEN; }
+
+private:
+	void vAddPacket(const uint8_t *pu8Data, size_t uLen, uint32_t u32Payload, uint8_t u8Seq);
+	static void vFrameBatchPacket(uint8_t *pu8Frame, const std::string &sHeader);
+
+	size_t uImageLen = 0;
+	size_t uSentLen = 0;
+	Encoding eSent = Encoding::Raw;
+	std::vector<uint8_t> au8Frames;
+	std::vector<size_t> auFrameOffsets;
+	std::vector<size_t> auDataLens;
+	uint8_t au8BatchStart[SHORT_PAYLOAD_LEN + HEADER_LEN + CRC_LEN];
+	uint8_t au8BatchEnd[SHORT_PAYLOAD_LEN + HEADER_LEN + CRC_LEN];
+};
+
+} /* namespace xmodem */
+
+#endif /* end __XMODEM_IMAGE_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
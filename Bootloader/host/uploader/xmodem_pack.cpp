@@ -0,0 +1,315 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Packs an application image for upload.
+ *
+ *****************************************************************************/
+#include <algorithm>
+#include <cstring>
+#include <unordered_map>
+#include "xmodem_pack.h"
+#include "xmodem_protocol.h"
+
+namespace xmodem
+{
+
+/* Unpacked bytes allowed per span of packed data. The bootloader programs
+   what a packet unpacks to before the UART receive buffer has to take the
+   next one, 4K for a 1K packet (4 blocks, about 16 ms) keeps well inside the
+   time the buffer lasts at 921600 baud. */
+#define PACK_SPAN_LEN				SHORT_PAYLOAD_LEN
+#define PACK_SPAN_OUTPUT			(4 * PACK_SPAN_LEN)
+
+/* Shortest copy worth a patch command, a copy command takes 4 bytes */
+#define DELTA_MIN_COPY				6
+
+/* Earlier copies of a sequence of base bytes looked at for each position */
+#define DELTA_CANDIDATES			32
+
+/* Local functions */
+static size_t uLongestMatch(const uint8_t *pu8Image, size_t uLen, size_t uPos, size_t &uDistance);
+static size_t uCopyLength(const uint8_t *pu8Base, size_t uBaseLen, const uint8_t *pu8Image, size_t uLen,
+						  size_t uPos, size_t uSource);
+static void vPutWord(std::vector<uint8_t> &au8Data, uint32_t u32Word);
+
+/*****************************************************************************
+ ** Function name:	au8Pack
+ **
+ ** Descriptions:	Compresses an image, see xmodem_pack.h. Matches are
+ ** 				chosen greedily, except that a literal is sent instead
+ ** 				when a longer match starts at the next byte.
+ **
+ *****************************************************************************/
+std::vector<uint8_t> au8Pack(const uint8_t *pu8Image, size_t uLen)
+{
+	std::vector<uint8_t> au8Packed;
+	size_t uFlagsPos = 0;
+	uint32_t u32Items = 8;
+	size_t uSpan = 0;
+	size_t uSpanOutput = 0;
+	size_t uPos = 0;
+
+	au8Packed.reserve(LZSS_HEADER_LEN + uLen + (uLen / 8) + 1);
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		au8Packed.push_back((uint8_t)(uLen >> (8 * i)));
+	}
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		au8Packed.push_back((uint8_t)(LZSS_MAGIC >> (8 * i)));
+	}
+
+	while (uPos < uLen)
+	{
+		size_t uDistance = 0;
+		size_t uMatch = uLongestMatch(pu8Image, uLen, uPos, uDistance);
+		size_t uNextDistance;
+
+		if ((uMatch >= LZSS_MIN_MATCH) && (uLongestMatch(pu8Image, uLen, uPos + 1, uNextDistance) > uMatch))
+		{
+			uMatch = 0;
+		}
+
+		/* A match is unpacked at its second byte, shortened (or replaced by a
+		   literal) if that span has unpacked enough already */
+		size_t uItemPos = au8Packed.size() + ((u32Items == 8) ? 1 : 0);
+		size_t uEnd = uItemPos + 1;
+
+		if ((uEnd / PACK_SPAN_LEN) == uSpan)
+		{
+			uMatch = std::min(uMatch, (uSpanOutput < PACK_SPAN_OUTPUT) ? (PACK_SPAN_OUTPUT - uSpanOutput) : (size_t)0);
+		}
+		if (uMatch < LZSS_MIN_MATCH)
+		{
+			uEnd = uItemPos;
+		}
+		if ((uEnd / PACK_SPAN_LEN) != uSpan)
+		{
+			uSpan = uEnd / PACK_SPAN_LEN;
+			uSpanOutput = 0;
+		}
+
+		if (u32Items == 8)
+		{
+			uFlagsPos = au8Packed.size();
+			au8Packed.push_back(0);
+			u32Items = 0;
+		}
+		if (uMatch >= LZSS_MIN_MATCH)
+		{
+			uint32_t u32Code = (uint32_t)(uDistance - 1) | ((uint32_t)(uMatch - LZSS_MIN_MATCH) << 10);
+
+			au8Packed.push_back((uint8_t)u32Code);
+			au8Packed.push_back((uint8_t)(u32Code >> 8));
+		}
+		else
+		{
+			uMatch = 1;
+			au8Packed[uFlagsPos] |= (uint8_t)(1 << u32Items);
+			au8Packed.push_back(pu8Image[uPos]);
+		}
+		u32Items++;
+		uSpanOutput += uMatch;
+		uPos += uMatch;
+	}
+	return au8Packed;
+}
+
+/*****************************************************************************
+ ** Function name:	au8Delta
+ **
+ ** Descriptions:	Generates a patch, see xmodem_pack.h. Copies are chosen
+ ** 				greedily from the same position in the base, the
+ ** 				distance of the previous copy (code moved by an insertion
+ ** 				or deletion) and base positions that start with the same
+ ** 				four bytes, preferring the same position so that the
+ ** 				bootloader can leave unchanged sectors alone. The base is
+ ** 				overwritten a sector at a time as the patch is applied,
+ ** 				so copies only read the sector being written or later
+ ** 				ones.
+ **
+ *****************************************************************************/
+std::vector<uint8_t> au8Delta(const uint8_t *pu8Base, size_t uBaseLen, const uint8_t *pu8Image, size_t uLen)
+{
+	std::vector<uint8_t> au8Patch;
+	std::unordered_map<uint32_t, std::vector<size_t>> mSequences;
+	size_t uLiterals = 0;
+	size_t uPos = 0;
+	ptrdiff_t iLastDistance = 0;
+
+	vPutWord(au8Patch, (uint32_t)uLen);
+	vPutWord(au8Patch, DELTA_MAGIC);
+	vPutWord(au8Patch, (uint32_t)uBaseLen);
+	vPutWord(au8Patch, (uint32_t)u16Crc16(pu8Base, uBaseLen) | ((uint32_t)u16Crc16(pu8Image, uLen) << 16));
+
+	for (size_t i = 0; (i + 4) <= uBaseLen; i++)
+	{
+		uint32_t u32Key;
+
+		memcpy(&u32Key, &pu8Base[i], sizeof(u32Key));
+		mSequences[u32Key].push_back(i);
+	}
+
+	while (uPos < uLen)
+	{
+		size_t uSectorEnd = std::min(((uPos / DELTA_SECTOR_LEN) + 1) * DELTA_SECTOR_LEN, uLen);
+		size_t uSource = uPos;
+		size_t uCopy = uCopyLength(pu8Base, uBaseLen, pu8Image, uLen, uPos, uPos);
+
+		if ((uPos + uCopy) < uSectorEnd)
+		{
+			std::vector<size_t> auCandidates(1, (size_t)((ptrdiff_t)uPos + iLastDistance));
+
+			if ((uPos + 4) <= uLen)
+			{
+				uint32_t u32Key;
+
+				memcpy(&u32Key, &pu8Image[uPos], sizeof(u32Key));
+				auto iSequence = mSequences.find(u32Key);
+				if (iSequence != mSequences.end())
+				{
+					/* Only those the bootloader can still read */
+					auto iFirst = std::lower_bound(iSequence->second.begin(), iSequence->second.end(),
+												   uPos - (uPos % DELTA_SECTOR_LEN));
+
+					for (size_t i = 0; (i < DELTA_CANDIDATES) && (iFirst != iSequence->second.end()); i++)
+					{
+						auCandidates.push_back(*iFirst++);
+					}
+				}
+			}
+			for (size_t uCandidate : auCandidates)
+			{
+				size_t uLength = uCopyLength(pu8Base, uBaseLen, pu8Image, uLen, uPos, uCandidate);
+
+				if (uLength > uCopy)
+				{
+					uCopy = uLength;
+					uSource = uCandidate;
+				}
+			}
+		}
+
+		if (uCopy >= DELTA_MIN_COPY)
+		{
+			size_t uCount = uCopy - 1;
+			int16_t i16Distance = (int16_t)((ptrdiff_t)uSource - (ptrdiff_t)uPos);
+
+			uLiterals = 0;
+			au8Patch.push_back((uint8_t)(DELTA_COPY | (uCount >> 8)));
+			au8Patch.push_back((uint8_t)uCount);
+			au8Patch.push_back((uint8_t)i16Distance);
+			au8Patch.push_back((uint8_t)((uint16_t)i16Distance >> 8));
+			iLastDistance = i16Distance;
+			uPos += uCopy;
+		}
+		else
+		{
+			/* Literal, added to the run before it while there is room */
+			if ((uLiterals == 0) || (uLiterals == DELTA_MAX_LITERALS))
+			{
+				uLiterals = 0;
+				au8Patch.push_back(0);
+			}
+			au8Patch[au8Patch.size() - uLiterals - 1] = (uint8_t)uLiterals;
+			au8Patch.push_back(pu8Image[uPos++]);
+			uLiterals++;
+		}
+	}
+	return au8Patch;
+}
+
+/*****************************************************************************
+ ** Function name:	uLongestMatch
+ **
+ ** Descriptions:	Finds the longest earlier copy of the bytes at a
+ ** 				position, within LZSS_MAX_DISTANCE. Copies may overlap
+ ** 				the position, the bootloader copies a byte at a time.
+ **
+ ** Parameters:	    pu8Image - Image.
+ ** 				uLen - Image length.
+ ** 				uPos - Position.
+ ** 				uDistance - Returns how far back the copy starts.
+ **
+ ** Returned value: Length of the copy, up to LZSS_MAX_MATCH, 0 if none.
+ **
+ *****************************************************************************/
+static size_t uLongestMatch(const uint8_t *pu8Image, size_t uLen, size_t uPos, size_t &uDistance)
+{
+	size_t uBest = 0;
+	size_t uLimit = std::min(LZSS_MAX_MATCH, uLen - std::min(uPos, uLen));
+
+	for (size_t d = 1; (d <= std::min(uPos, LZSS_MAX_DISTANCE)) && (uBest < uLimit); d++)
+	{
+		size_t n = 0;
+
+		while ((n < uLimit) && (pu8Image[uPos - d + n] == pu8Image[uPos + n]))
+		{
+			n++;
+		}
+		if (n > uBest)
+		{
+			uBest = n;
+			uDistance = d;
+		}
+	}
+	return uBest;
+}
+
+/*****************************************************************************
+ ** Function name:	uCopyLength
+ **
+ ** Descriptions:	Measures how much of the new image at a position can be
+ ** 				copied from a base position, stopping where the base
+ ** 				would already have been overwritten.
+ **
+ ** Parameters:	    pu8Base - Base image.
+ ** 				uBaseLen - Base image length.
+ ** 				pu8Image - New image.
+ ** 				uLen - New image length.
+ ** 				uPos - Position in the new image.
+ ** 				uSource - Position in the base.
+ **
+ ** Returned value: Length of the copy, up to DELTA_MAX_COPY, 0 if none.
+ **
+ *****************************************************************************/
+static size_t uCopyLength(const uint8_t *pu8Base, size_t uBaseLen, const uint8_t *pu8Image, size_t uLen,
+						  size_t uPos, size_t uSource)
+{
+	size_t n = 0;
+
+	while ((n < DELTA_MAX_COPY) && ((uPos + n) < uLen) && ((uSource + n) < uBaseLen) &&
+		   (((uSource + n) / DELTA_SECTOR_LEN) >= ((uPos + n) / DELTA_SECTOR_LEN)) &&
+		   (pu8Base[uSource + n] == pu8Image[uPos + n]))
+	{
+		n++;
+	}
+	return n;
+}
+
+/*****************************************************************************
+ ** Function name:	vPutWord
+ **
+ ** Descriptions:	Appends a word, least significant byte first.
+ **
+ ** Parameters:	    au8Data - Data.
+ ** 				u32Word - Word.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vPutWord(std::vector<uint8_t> &au8Data, uint32_t u32Word)
+{
+	for (uint32_t i = 0; i < 4; i++)
+	{
+		au8Data.push_back((uint8_t)(u32Word >> (8 * i)));
+	}
+}
+
+} /* namespace xmodem */
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
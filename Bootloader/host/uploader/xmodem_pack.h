@@ -0,0 +1,55 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Packs an application image into the compressed form the
+ * 				bootloader unpacks as it programs flash, or into a patch
+ * 				against the installed image (see main.c).
+ *
+ *****************************************************************************/
+#ifndef __XMODEM_PACK_H
+#define __XMODEM_PACK_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace xmodem
+{
+
+/*****************************************************************************
+ ** Function name:	au8Pack
+ **
+ ** Descriptions:	Compresses an image with LZSS.
+ **
+ ** Parameters:	    pu8Image - Image.
+ ** 				uLen - Image length, no more than MAX_IMAGE_LEN.
+ **
+ ** Returned value: Compressed image, header included.
+ **
+ *****************************************************************************/
+std::vector<uint8_t> au8Pack(const uint8_t *pu8Image, size_t uLen);
+
+/*****************************************************************************
+ ** Function name:	au8Delta
+ **
+ ** Descriptions:	Generates a patch that turns one image into another.
+ **
+ ** Parameters:	    pu8Base - Installed image.
+ ** 				uBaseLen - Installed image length, no more than
+ ** 				DELTA_MAX_LEN.
+ ** 				pu8Image - New image.
+ ** 				uLen - New image length, no more than DELTA_MAX_LEN.
+ **
+ ** Returned value: Patch, header included.
+ **
+ *****************************************************************************/
+std::vector<uint8_t> au8Delta(const uint8_t *pu8Base, size_t uBaseLen, const uint8_t *pu8Image, size_t uLen);
+
+} /* namespace xmodem */
+
+#endif /* end __XMODEM_PACK_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
@@ -0,0 +1,95 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Protocol constants shared with the bootloader's XMODEM-1K
+ * 				client (xmodem1k.c, profile.h and main.c), for the host
+ * 				side uploader.
+ *
+ *****************************************************************************/
+#ifndef __XMODEM_PROTOCOL_H
+#define __XMODEM_PROTOCOL_H
+
+#include <cstddef>
+#include <cstdint>
+
+namespace xmodem
+{
+
+/* Protocol characters */
+constexpr uint8_t SOH = 0x01;
+constexpr uint8_t STX = 0x02;
+constexpr uint8_t EOT = 0x04;
+constexpr uint8_t ACK = 0x06;
+constexpr uint8_t NAK = 0x15;
+constexpr uint8_t CAN = 0x18;
+constexpr uint8_t POLL = 0x43;				/* 'C' */
+constexpr uint8_t BAUD_QUERY = 0x42;		/* 'B', see xmodem1k.c */
+constexpr uint8_t STREAM_POLL = 0x47;		/* 'G', see xmodem1k.c */
+constexpr uint8_t PROFILE_QUERY = 0x50;		/* 'P', see profile.h */
+constexpr uint8_t WINDOW_QUERY = 0x57;		/* 'W', see xmodem1k.c */
+constexpr uint8_t PAD_CHAR = 0x1A;
+
+/* Packet layout */
+constexpr uint32_t SHORT_PAYLOAD_LEN = 128;
+constexpr uint32_t LONG_PAYLOAD_LEN = 1024;
+constexpr uint32_t HEADER_LEN = 3;
+constexpr uint32_t CRC_LEN = 2;
+
+/* Compressed image layout, see main.c */
+constexpr uint32_t LZSS_MAGIC = 0x315A4C42;			/* "BLZ1" */
+constexpr size_t LZSS_HEADER_LEN = 8;
+constexpr size_t LZSS_MIN_MATCH = 3;
+constexpr size_t LZSS_MAX_MATCH = LZSS_MIN_MATCH + 63;
+constexpr size_t LZSS_MAX_DISTANCE = 1024;
+
+/* Patch layout, see main.c */
+constexpr uint32_t DELTA_MAGIC = 0x31444C42;			/* "BLD1" */
+constexpr size_t DELTA_HEADER_LEN = 16;
+constexpr uint8_t DELTA_COPY = 0x80;
+constexpr size_t DELTA_MAX_LITERALS = DELTA_COPY;
+constexpr size_t DELTA_MAX_COPY = 0x8000;
+constexpr size_t DELTA_SECTOR_LEN = 0x1000;
+constexpr size_t DELTA_MAX_LEN = 0x6000;			/* Up to the scratch sector */
+
+/* Bootloader timing and limits */
+constexpr uint32_t POLL_PERIOD_ms = 3000;
+constexpr uint32_t DEFAULT_BAUD_RATE = 9600;
+constexpr uint32_t MAX_IMAGE_LEN = 0x7000 - 16;		/* APP_MAX_LEN */
+
+/* Profiling counter names, in the order sent in the summary frame, and
+   the unit of each counter's second value (event counters record an
+   amount rather than a time, or nothing) */
+constexpr const char *PROFILE_COUNTER_NAMES[] =
+{
+	"crc_calc", "iap_copy", "iap_compare", "iap_erase", "uart_wait", "app_check", "resync",
+	"line_error", "uart_overrun", "uart_framing", "uart_break", "uart_dropped", "irq_direct", "irq_tramp"
+};
+constexpr const char *PROFILE_COUNTER_UNITS[] =
+{
+	"us", "us", "us", "us", "us", "us", "chars",
+	"chars", nullptr, nullptr, nullptr, nullptr, "cycles", "cycles"
+};
+
+/*****************************************************************************
+ ** Function name:	u16Crc16
+ **
+ ** Descriptions:	CRC-16 (CCITT polynomial, zero initial value) as used
+ ** 				for packets and the bootloader's frames.
+ **
+ ** Parameters:	    pu8Data - Data.
+ ** 				uLen - Number of bytes.
+ ** 				u16CRC - CRC of any preceding data.
+ **
+ ** Returned value: CRC.
+ **
+ *****************************************************************************/
+uint16_t u16Crc16(const uint8_t *pu8Data, size_t uLen, uint16_t u16CRC = 0);
+
+} /* namespace xmodem */
+
+#endif /* end __XMODEM_PROTOCOL_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
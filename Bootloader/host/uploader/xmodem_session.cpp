@@ -0,0 +1,1047 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: One upload to the bootloader's XMODEM-1K client.
+ *
+ *****************************************************************************/
+#include <algorithm>
+#include <numeric>
+#include "xmodem_session.h"
+
+namespace xmodem
+{
+
+/* Time allowed for frames sent by the bootloader to arrive, and for the
+   poll that follows a change of rate */
+#define FRAME_TIMEOUT_ms			1000
+#define CONFIRM_TIMEOUT_ms			(POLL_PERIOD_ms + 500)
+
+/* Autobaud character, resent until the bootloader polls. Carriage return
+   has the start bit followed by a single 1 bit the bootloader measures. */
+#define AUTOBAUD_CHAR				0x0D
+#define AUTOBAUD_PERIOD_ms			1000
+
+/* Negotiations attempted before staying at the starting rate */
+#define MAX_NEGOTIATIONS			2
+
+/* Bits per character on the line (start, 8 data, stop) */
+#define BITS_PER_CHAR				10
+
+/* Time allowed in a window beyond the packets on the line, for the
+   bootloader to program a sector and notice a gap before answering */
+#define WINDOW_SLACK_ms				250
+
+/* Local functions */
+static uint32_t u32Micros(Clock::duration sDuration);
+static uint32_t u32LE32(const uint8_t *pu8Data);
+
+/*****************************************************************************
+ ** Function name:	Session
+ **
+ ** Descriptions:	Prepares an upload, nothing happens until vStart().
+ **
+ ** Parameters:	    rImage - Image, must outlive the session.
+ ** 				rOptions - Options.
+ **
+ *****************************************************************************/
+Session::Session(const Image &rImage, const SessionOptions &rOptions)
+	: rImg(rImage), sOpts(rOptions), u32Line(rOptions.u32StartBaud)
+{
+	sStats.au32Rtt_us.reserve(rImage.uPacketCount() + 1);
+	sStats.au32Turnaround_us.reserve(rImage.uPacketCount() + 1);
+}
+
+/*****************************************************************************
+ ** Function name:	vStart
+ **
+ ** Descriptions:	Starts waiting for the bootloader to poll, prompting it
+ ** 				to measure the rate first if it uses autobaud.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vStart(Clock::time_point sNow)
+{
+	sStats.sStart = sNow;
+	sConnectDeadline = sNow + std::chrono::milliseconds(sOpts.u32ConnectTimeout_ms);
+	vEnter(State::Connecting, sNow, sOpts.bAutoBaud ? AUTOBAUD_PERIOD_ms : sOpts.u32ConnectTimeout_ms);
+	if (sOpts.bAutoBaud)
+	{
+		au8Control[0] = AUTOBAUD_CHAR;
+		vSendControl(au8Control, 1);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vReceive
+ **
+ ** Descriptions:	Handles characters read from the port.
+ **
+ ** Parameters:	    pu8Data - Characters.
+ ** 				uLen - Number of characters.
+ ** 				sNow - Time they were read.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vReceive(const uint8_t *pu8Data, size_t uLen, Clock::time_point sNow)
+{
+	for (size_t i = 0; (i < uLen) && !bFinished(); i++)
+	{
+		vHandle(pu8Data[i], sNow);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vWritten
+ **
+ ** Descriptions:	Records output written to the port. The response time
+ ** 				of a packet is measured from its last character, and the
+ ** 				host's turnaround from the response to that point. The
+ ** 				response deadline allows for output still queued.
+ **
+ ** Parameters:	    uLen - Number of characters written.
+ ** 				sNow - Time of the write.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vWritten(size_t uLen, Clock::time_point sNow)
+{
+	/* The driver may queue far more than a packet while streaming, nothing
+	   can be answered until it has gone out at the line rate */
+	sLineIdle = std::max(sLineIdle, sNow) +
+				std::chrono::microseconds(((uint64_t)uLen * BITS_PER_CHAR * 1000000) / u32Line);
+
+	uTxDone += uLen;
+	if (uTxDone < uTxLen)
+	{
+		return;
+	}
+	sWriteDone = sNow;
+	if (bTimeTurnaround)
+	{
+		sStats.au32Turnaround_us.push_back(u32Micros(sNow - sResponseRead));
+		bTimeTurnaround = false;
+	}
+
+	/* Streamed packets are not acknowledged, the bootloader cancels the
+	   transfer if one is bad */
+	if ((eCurrent == State::Sending) && bStreaming && !bConfirmPending)
+	{
+		sStats.uBytesAcked += rImg.uPacketData(uPacket);
+		uPacket++;
+		if (uPacket < rImg.uPacketCount())
+		{
+			vSendPacket(sNow);
+		}
+		else
+		{
+			vEnter(State::Ending, sNow, sOpts.u32ResponseTimeout_ms);
+			au8Control[0] = EOT;
+			vSendControl(au8Control, 1);
+		}
+		return;
+	}
+
+	/* In a window the next packet follows straight away, responses are
+	   due from the end of the latest on the line */
+	if ((eCurrent == State::Sending) && (u32Window != 0))
+	{
+		asSent[uTxPacket] = sNow;
+		sNextDeadline = sLineIdle + std::chrono::milliseconds(bConfirmPending ? CONFIRM_TIMEOUT_ms : u32WindowTimeout_ms());
+		vSendWindow(sNow);
+		return;
+	}
+
+	/* Response deadline runs from the end of the packet on the line */
+	if ((eCurrent == State::Sending) || (eCurrent == State::Header) ||
+		(eCurrent == State::Ending) || (eCurrent == State::Closing))
+	{
+		uint32_t u32Timeout_ms = bConfirmPending ? CONFIRM_TIMEOUT_ms : sOpts.u32ResponseTimeout_ms;
+
+		sNextDeadline = sLineIdle + std::chrono::milliseconds(u32Timeout_ms);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vTimeout
+ **
+ ** Descriptions:	Handles the deadline passing.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vTimeout(Clock::time_point sNow)
+{
+	switch (eCurrent)
+	{
+		case State::Connecting:
+			if (sNow >= sConnectDeadline)
+			{
+				vFail("no poll from the bootloader", sNow);
+			}
+			else if (sConnectDeadline != Clock::time_point::max())
+			{
+				/* Bootloader may have missed the autobaud character */
+				vEnter(State::Connecting, sNow, AUTOBAUD_PERIOD_ms);
+				au8Control[0] = AUTOBAUD_CHAR;
+				vSendControl(au8Control, 1);
+			}
+			else if (++u32Retries > sOpts.u32MaxRetries)
+			{
+				vFail("bootloader stopped polling", sNow);
+			}
+			else
+			{
+				sStats.u32Timeouts++;
+				vEnter(State::Connecting, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+			}
+			break;
+
+		case State::Negotiating:
+		case State::Selecting:
+			/* Bootloader abandons negotiation and polls at the starting rate */
+			sStats.u32Timeouts++;
+			vFallBack(sNow);
+			break;
+
+		case State::Sending:
+		case State::Header:
+			sStats.u32Timeouts++;
+			if (bStreaming && !bConfirmPending && (eCurrent == State::Sending))
+			{
+				/* Packet not written in time, a partial packet cannot be
+				   followed by a whole one */
+				vFail("port stalled while streaming", sNow);
+			}
+			else if (bConfirmPending)
+			{
+				/* Nothing understood at the negotiated rate */
+				vFallBack(sNow);
+			}
+			else
+			{
+				vRetry(sNow);
+			}
+			break;
+
+		case State::Ending:
+			sStats.u32Timeouts++;
+			vRetry(sNow);
+			break;
+
+		case State::Closing:
+			/* Image was acknowledged, the bootloader gives up waiting for
+			   the end of the batch too */
+			sStats.u32Timeouts++;
+			vFinish(sNow);
+			break;
+
+		case State::Profile:
+			/* Transfer itself succeeded */
+			sStats.sEnd = sNow;
+			vEnter(State::Done, sNow, 0);
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vHandle
+ **
+ ** Descriptions:	Handles a received character.
+ **
+ ** Parameters:	    u8Data - Character.
+ ** 				sNow - Time it was read.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vHandle(uint8_t u8Data, Clock::time_point sNow)
+{
+	switch (eCurrent)
+	{
+		case State::Connecting:
+			if (bWindowAsked && (u32Window == 0) && (!au8Frame.empty() || (u8Data == WINDOW_QUERY)))
+			{
+				/* WINDOW_QUERY, the window and its complement. The bootloader
+				   then waits for packets as it would after a poll. */
+				au8Frame.push_back(u8Data);
+				if (au8Frame.size() < 3)
+				{
+					break;
+				}
+				if (((au8Frame[1] ^ au8Frame[2]) == 0xFF) && (au8Frame[1] != 0))
+				{
+					u32Window = au8Frame[1];
+					sStats.u32Window = u32Window;
+					asSent.resize(rImg.uPacketCount());
+					vPolled(sNow);
+				}
+				else
+				{
+					/* Bootloader drops the window and polls if nothing arrives */
+					au8Frame.clear();
+				}
+			}
+			else if ((u8Data == POLL) || (u8Data == STREAM_POLL))
+			{
+				if (u8Data == STREAM_POLL)
+				{
+					bStreaming = true;
+					sStats.bStreamed = true;
+				}
+				vPolled(sNow);
+			}
+			break;
+
+		case State::Negotiating:
+		case State::Profile:
+			vFrameByte(u8Data, sNow);
+			break;
+
+		case State::Selecting:
+			if (uOutputLen() != 0)
+			{
+				/* Selection not yet written */
+			}
+			else if (u8Data == ACK)
+			{
+				/* Bootloader has switched, it polls at the new rate but the
+				   first packet need not wait for that */
+				bConfirmPending = true;
+				sStats.sFirstPacket = sNow;
+				vSendPacket(sNow);
+				u32Line = sOpts.u32Baud;
+			}
+			else if (u8Data == NAK)
+			{
+				/* Rate refused, carry on at the current one */
+				u32Negotiations = MAX_NEGOTIATIONS;
+				vEnter(State::Connecting, sNow, POLL_PERIOD_ms);
+			}
+			break;
+
+		case State::Sending:
+		case State::Header:
+		case State::Ending:
+			if (u32Window != 0)
+			{
+				vWindowByte(u8Data, sNow);
+				break;
+			}
+			if (bStreaming && !bConfirmPending && (eCurrent == State::Sending))
+			{
+				/* Nothing is acknowledged while streaming, the bootloader
+				   only gives up */
+				if ((u8Data == CAN) && (++u32Cancels >= 2))
+				{
+					vFail("transfer cancelled by the bootloader", sNow);
+				}
+				break;
+			}
+			if (uOutputLen() != 0)
+			{
+				/* Cannot be a response to output not yet written, most likely
+				   the poll sent at the old rate after a change */
+				break;
+			}
+			if (u8Data == ACK)
+			{
+				sStats.au32Rtt_us.push_back(u32Micros(sNow - sWriteDone));
+				u32Retries = 0;
+				u32Cancels = 0;
+				if (eCurrent == State::Ending)
+				{
+					if (sOpts.bYmodem)
+					{
+						/* Bootloader polls for the end of the batch */
+						vEnter(State::Closing, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+					}
+					else
+					{
+						vFinish(sNow);
+					}
+					break;
+				}
+
+				bConfirmPending = false;
+				if (eCurrent == State::Header)
+				{
+					/* Bootloader polls for packet 1 */
+					bHeaderAcked = true;
+					vEnter(State::Connecting, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+					break;
+				}
+				sStats.uBytesAcked += rImg.uPacketData(uPacket);
+				uPacket++;
+				sResponseRead = sNow;
+				bTimeTurnaround = true;
+				if (uPacket < rImg.uPacketCount())
+				{
+					vSendPacket(sNow);
+				}
+				else
+				{
+					vEnter(State::Ending, sNow, sOpts.u32ResponseTimeout_ms);
+					au8Control[0] = EOT;
+					vSendControl(au8Control, 1);
+				}
+			}
+			else if (u8Data == NAK)
+			{
+				sStats.au32Rtt_us.push_back(u32Micros(sNow - sWriteDone));
+				sStats.u32Naks++;
+				u32Cancels = 0;
+				sResponseRead = sNow;
+				bTimeTurnaround = true;
+				vRetry(sNow);
+			}
+			else if (u8Data == CAN)
+			{
+				if (++u32Cancels >= 2)
+				{
+					vFail((eCurrent == State::Header) ? "image refused by the bootloader" :
+						  "transfer cancelled by the bootloader", sNow);
+				}
+			}
+			else if (bConfirmPending && (u8Data != POLL) && (u8Data != STREAM_POLL))
+			{
+				/* Not the poll at the new rate, so probably the bootloader
+				   polling at the starting rate as the first packet kept
+				   arriving corrupt */
+				vFallBack(sNow);
+			}
+			break;
+
+		case State::Closing:
+			if (uOutputLen() != 0)
+			{
+				/* Empty header not yet written */
+			}
+			else if ((u8Data == POLL) || (u8Data == STREAM_POLL) || (u8Data == NAK))
+			{
+				vEnter(State::Closing, sNow, sOpts.u32ResponseTimeout_ms);
+				vSendControl(rImg.pu8BatchPacket(true), Image::uBatchPacketLen());
+				sStats.u32PacketsSent++;
+			}
+			else if (u8Data == ACK)
+			{
+				vFinish(sNow);
+			}
+			break;
+
+		default:
+			break;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vPolled
+ **
+ ** Descriptions:	Handles a poll, or the window being agreed: asks to
+ ** 				stream or for a window, negotiates the rate or sends the
+ ** 				next packet.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vPolled(Clock::time_point sNow)
+{
+	sConnectDeadline = Clock::time_point::max();
+	if (sOpts.bStream && !bStreamAsked && (!sOpts.bYmodem || bHeaderAcked))
+	{
+		/* Ask before negotiating, the bootloader erases ahead of
+		   the image (only what it needs once it has the YMODEM
+		   header) and polls with STREAM_POLL, or as usual if it
+		   does not stream */
+		bStreamAsked = true;
+		vEnter(State::Connecting, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+		au8Control[0] = STREAM_POLL;
+		vSendControl(au8Control, 1);
+	}
+	else if (sOpts.bWindow && !bWindowAsked && (!sOpts.bYmodem || bHeaderAcked))
+	{
+		/* Asked when streaming would be, the bootloader replies with the
+		   window once it has erased ahead, or polls as usual */
+		bWindowAsked = true;
+		au8Frame.clear();
+		vEnter(State::Connecting, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+		au8Control[0] = WINDOW_QUERY;
+		vSendControl(au8Control, 1);
+	}
+	else if ((sOpts.u32Baud != 0) && (sOpts.u32Baud != u32Line) && (u32Negotiations < MAX_NEGOTIATIONS))
+	{
+		u32Negotiations++;
+		au8Frame.clear();
+		vEnter(State::Negotiating, sNow, FRAME_TIMEOUT_ms);
+		au8Control[0] = BAUD_QUERY;
+		vSendControl(au8Control, 1);
+	}
+	else
+	{
+		if ((uPacket == 0) && !bHeaderAcked)
+		{
+			sStats.sFirstPacket = sNow;
+		}
+		vSendPacket(sNow);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vWindowByte
+ **
+ ** Descriptions:	Handles a response in a window, ACK or NAK followed by a
+ ** 				packet number. ACK acknowledges the packet and all those
+ ** 				before it (EOT if it is the number after the last packet),
+ ** 				NAK asks for the packet alone to be sent again. Responses
+ ** 				to packets not yet sent, or already acknowledged, are
+ ** 				stale and ignored.
+ **
+ ** Parameters:	    u8Data - Character.
+ ** 				sNow - Time it was read.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vWindowByte(uint8_t u8Data, Clock::time_point sNow)
+{
+	if (bConfirmPending && (uOutputLen() != 0))
+	{
+		/* Cannot be a response to output not yet written, most likely the
+		   poll sent at the old rate after a change */
+		return;
+	}
+	if (u8Response == 0)
+	{
+		if ((u8Data == ACK) || (u8Data == NAK))
+		{
+			u8Response = u8Data;
+		}
+		else if ((u8Data == CAN) && (++u32Cancels >= 2))
+		{
+			vFail("transfer cancelled by the bootloader", sNow);
+		}
+		else if (bConfirmPending && (u8Data != CAN) && (u8Data != POLL))
+		{
+			/* Not the poll at the new rate, so probably the bootloader
+			   polling at the starting rate as the first packet kept
+			   arriving corrupt */
+			vFallBack(sNow);
+		}
+		return;
+	}
+
+	uint8_t u8Cmd = u8Response;
+	size_t uIdx = uPacket + (uint8_t)(u8Data - (uint8_t)(uPacket + 1));
+	bool bIdle = (uOutputLen() == 0);
+
+	u8Response = 0;
+	if (eCurrent == State::Ending)
+	{
+		if (uIdx != rImg.uPacketCount())
+		{
+			/* Late response to a packet */
+		}
+		else if (u8Cmd == ACK)
+		{
+			sStats.au32Rtt_us.push_back(u32Micros(sNow - sWriteDone));
+			u32Retries = 0;
+			u32Cancels = 0;
+			if (sOpts.bYmodem)
+			{
+				/* Bootloader polls for the end of the batch */
+				vEnter(State::Closing, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+			}
+			else
+			{
+				vFinish(sNow);
+			}
+		}
+		else
+		{
+			sStats.u32Naks++;
+			vRetry(sNow);
+		}
+		return;
+	}
+	if (uIdx >= uNextSend)
+	{
+		return;
+	}
+
+	u32Cancels = 0;
+	if (u8Cmd == ACK)
+	{
+		sStats.au32Rtt_us.push_back(u32Micros(sNow - asSent[uIdx]));
+		while (uPacket <= uIdx)
+		{
+			sStats.uBytesAcked += rImg.uPacketData(uPacket);
+			uPacket++;
+		}
+		u32Retries = 0;
+		bConfirmPending = false;
+	}
+	else
+	{
+		sStats.u32Naks++;
+		if (++u32Retries > sOpts.u32MaxRetries)
+		{
+			vFail("packet " + std::to_string(uIdx + 1) + " not acknowledged", sNow);
+			return;
+		}
+		if (std::find(auResend.begin(), auResend.end(), uIdx) == auResend.end())
+		{
+			auResend.push_back(uIdx);
+		}
+	}
+	sNextDeadline = std::max(sNow, sLineIdle) + std::chrono::milliseconds(u32WindowTimeout_ms());
+
+	vSendWindow(sNow);
+	if (bIdle && (uOutputLen() != 0))
+	{
+		sResponseRead = sNow;
+		bTimeTurnaround = true;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vFrameByte
+ **
+ ** Descriptions:	Collects the rate list ('B') or profiling summary ('P').
+ ** 				Both frames are the query character, a count of entries,
+ ** 				the entries (4 or 8 bytes each) and a CRC of everything
+ ** 				after the query character, most significant byte first.
+ ** 				Polls seen before the frame starts are skipped.
+ **
+ ** Parameters:	    u8Data - Character.
+ ** 				sNow - Time it was read.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vFrameByte(uint8_t u8Data, Clock::time_point sNow)
+{
+	uint8_t u8Query = (eCurrent == State::Negotiating) ? BAUD_QUERY : PROFILE_QUERY;
+	size_t uEntryLen = (eCurrent == State::Negotiating) ? 4 : 8;
+
+	if (au8Frame.empty() && (u8Data != u8Query))
+	{
+		return;
+	}
+	au8Frame.push_back(u8Data);
+	if ((au8Frame.size() < 2) || (au8Frame.size() < (2 + (au8Frame[1] * uEntryLen) + CRC_LEN)))
+	{
+		return;
+	}
+
+	size_t uLen = au8Frame.size() - CRC_LEN;
+	uint16_t u16CRC = (uint16_t)((au8Frame[uLen] << 8) | au8Frame[uLen + 1]);
+
+	if (u16Crc16(&au8Frame[1], uLen - 1) != u16CRC)
+	{
+		/* Give up on the extra, the upload itself is unaffected */
+		if (eCurrent == State::Negotiating)
+		{
+			sStats.u32Timeouts++;
+			vFallBack(sNow);
+		}
+		else
+		{
+			sStats.sEnd = sNow;
+			vEnter(State::Done, sNow, 0);
+		}
+		return;
+	}
+
+	if (eCurrent == State::Profile)
+	{
+		for (size_t i = 0; i < au8Frame[1]; i++)
+		{
+			sStats.asProfile.emplace_back(u32LE32(&au8Frame[2 + (i * 8)]), u32LE32(&au8Frame[6 + (i * 8)]));
+		}
+		sStats.sEnd = sNow;
+		vEnter(State::Done, sNow, 0);
+		return;
+	}
+
+	/* Exact rate if offered, else the fastest offered below it */
+	int iSelected = -1;
+	uint32_t u32Best = 0;
+
+	for (size_t i = 0; i < au8Frame[1]; i++)
+	{
+		uint32_t u32Rate = u32LE32(&au8Frame[2 + (i * 4)]);
+
+		if ((u32Rate <= sOpts.u32Baud) && (u32Rate > u32Best))
+		{
+			u32Best = u32Rate;
+			iSelected = (int)i;
+		}
+	}
+	if ((iSelected < 0) || (u32Best == u32Line))
+	{
+		/* Nothing better offered, an invalid selection gets a NAK and the
+		   bootloader carries on polling */
+		u32Negotiations = MAX_NEGOTIATIONS;
+		iSelected = 0xFF;
+	}
+	sOpts.u32Baud = u32Best;
+	au8Control[0] = (uint8_t)iSelected;
+	au8Control[1] = (uint8_t)~iSelected;
+	vEnter((iSelected == 0xFF) ? State::Connecting : State::Selecting, sNow,
+		   (iSelected == 0xFF) ? POLL_PERIOD_ms : FRAME_TIMEOUT_ms);
+	vSendControl(au8Control, 2);
+}
+
+/*****************************************************************************
+ ** Function name:	vSendPacket
+ **
+ ** Descriptions:	Queues the next unacknowledged packet, or the YMODEM
+ ** 				header ahead of packet 1, its response deadline starts
+ ** 				once it has been written. In a window every packet from
+ ** 				the next unacknowledged one is sent again.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vSendPacket(Clock::time_point sNow)
+{
+	sNextDeadline = sNow + std::chrono::milliseconds(sOpts.u32ResponseTimeout_ms);
+	if (sOpts.bYmodem && !bHeaderAcked)
+	{
+		eCurrent = State::Header;
+		pu8Tx = rImg.pu8BatchPacket(false);
+		uTxLen = Image::uBatchPacketLen();
+	}
+	else if (u32Window != 0)
+	{
+		sNextDeadline = sNow + std::chrono::milliseconds(u32WindowTimeout_ms());
+		eCurrent = State::Sending;
+		uNextSend = uPacket;
+		auResend.clear();
+		u8Response = 0;
+		vSendControl(au8Control, 0);
+		vSendWindow(sNow);
+		return;
+	}
+	else
+	{
+		eCurrent = State::Sending;
+		pu8Tx = rImg.pu8Packet(uPacket);
+		uTxLen = rImg.uPacketLen(uPacket);
+	}
+	uTxDone = 0;
+	sStats.u32PacketsSent++;
+}
+
+/*****************************************************************************
+ ** Function name:	vSendWindow
+ **
+ ** Descriptions:	Once the port has taken the previous packet, queues the
+ ** 				next in a window: one that has been asked for again, else
+ ** 				the next new packet while fewer than the window are
+ ** 				outstanding (one until a negotiated rate is proven). EOT
+ ** 				follows once every packet has been acknowledged.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vSendWindow(Clock::time_point sNow)
+{
+	size_t uLimit = std::min(uPacket + (bConfirmPending ? 1 : u32Window), rImg.uPacketCount());
+
+	if (uOutputLen() != 0)
+	{
+		return;
+	}
+	auResend.erase(std::remove_if(auResend.begin(), auResend.end(),
+								  [this](size_t uIdx) { return uIdx < uPacket; }), auResend.end());
+	if (!auResend.empty())
+	{
+		uTxPacket = auResend.front();
+		auResend.erase(auResend.begin());
+	}
+	else if (uNextSend < uLimit)
+	{
+		uTxPacket = uNextSend++;
+	}
+	else
+	{
+		if (uPacket == rImg.uPacketCount())
+		{
+			vEnter(State::Ending, sNow, sOpts.u32ResponseTimeout_ms);
+			au8Control[0] = EOT;
+			vSendControl(au8Control, 1);
+		}
+		return;
+	}
+	pu8Tx = rImg.pu8Packet(uTxPacket);
+	uTxLen = rImg.uPacketLen(uTxPacket);
+	uTxDone = 0;
+	sStats.u32PacketsSent++;
+}
+
+/*****************************************************************************
+ ** Function name:	u32WindowTimeout_ms
+ **
+ ** Descriptions:	Time to wait for a response in a window before sending
+ ** 				the oldest outstanding packet again: half as long again
+ ** 				as the window takes on the line, plus WINDOW_SLACK_ms.
+ ** 				A packet lost on a noisy line then costs a fraction of a
+ ** 				second at the higher rates rather than the full response
+ ** 				timeout, which remains the upper limit.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Timeout in milliseconds.
+ **
+ *****************************************************************************/
+uint32_t Session::u32WindowTimeout_ms() const
+{
+	uint64_t u64Wire_ms = ((uint64_t)u32Window * rImg.uPacketLen(0) * BITS_PER_CHAR * 1000) / u32Line;
+
+	return (uint32_t)std::min<uint64_t>(sOpts.u32ResponseTimeout_ms, ((u64Wire_ms * 3) / 2) + WINDOW_SLACK_ms);
+}
+
+/*****************************************************************************
+ ** Function name:	vSendControl
+ **
+ ** Descriptions:	Queues control characters, replacing any output that has
+ ** 				not been written.
+ **
+ ** Parameters:	    pu8Data - Characters, held by the session.
+ ** 				uLen - Number of characters.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vSendControl(const uint8_t *pu8Data, size_t uLen)
+{
+	pu8Tx = pu8Data;
+	uTxLen = uLen;
+	uTxDone = 0;
+}
+
+/*****************************************************************************
+ ** Function name:	vFinish
+ **
+ ** Descriptions:	Ends a successful transfer, reading the profiling frame
+ ** 				if asked to.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vFinish(Clock::time_point sNow)
+{
+	if (sOpts.bProfile)
+	{
+		au8Frame.clear();
+		vEnter(State::Profile, sNow, sOpts.u32ResponseTimeout_ms);
+	}
+	else
+	{
+		sStats.sEnd = sNow;
+		vEnter(State::Done, sNow, 0);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vFallBack
+ **
+ ** Descriptions:	Returns to the starting rate after a failed negotiation
+ ** 				and waits for the bootloader, which does the same, to
+ ** 				poll. The packet in flight was not accepted so it is sent
+ ** 				again, after asking for the window again.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vFallBack(Clock::time_point sNow)
+{
+	if (u32Line != sOpts.u32StartBaud)
+	{
+		sStats.u32Fallbacks++;
+	}
+	bConfirmPending = false;
+	bTimeTurnaround = false;
+	u32Line = sOpts.u32StartBaud;
+
+	/* Bootloader drops the window if it times out, ask again */
+	bWindowAsked = false;
+	u32Window = 0;
+	sStats.u32Window = 0;
+	vSendControl(au8Control, 0);
+	vEnter(State::Connecting, sNow, POLL_PERIOD_ms + FRAME_TIMEOUT_ms);
+}
+
+/*****************************************************************************
+ ** Function name:	vRetry
+ **
+ ** Descriptions:	Resends the packet, header or EOT in flight.
+ **
+ ** Parameters:	    sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vRetry(Clock::time_point sNow)
+{
+	if (++u32Retries > sOpts.u32MaxRetries)
+	{
+		vFail((eCurrent == State::Ending) ? std::string("EOT not acknowledged") :
+			  (eCurrent == State::Header) ? std::string("YMODEM header not acknowledged") :
+			  ("packet " + std::to_string(uPacket + 1) + " not acknowledged"), sNow);
+		return;
+	}
+	if (eCurrent == State::Ending)
+	{
+		vEnter(State::Ending, sNow, sOpts.u32ResponseTimeout_ms);
+		au8Control[0] = EOT;
+		vSendControl(au8Control, 1);
+	}
+	else
+	{
+		vSendPacket(sNow);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vFail
+ **
+ ** Descriptions:	Ends the session unsuccessfully.
+ **
+ ** Parameters:	    sReason - Description of the failure.
+ ** 				sNow - Current time.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vFail(const std::string &sReason, Clock::time_point sNow)
+{
+	sFailure = sReason;
+	sStats.sEnd = sNow;
+	vSendControl(au8Control, 0);
+	vEnter(State::Failed, sNow, 0);
+}
+
+/*****************************************************************************
+ ** Function name:	vEnter
+ **
+ ** Descriptions:	Changes state and sets the deadline.
+ **
+ ** Parameters:	    eState - New state.
+ ** 				sNow - Current time.
+ ** 				u32Timeout_ms - Time allowed in the state.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void Session::vEnter(State eState, Clock::time_point sNow, uint32_t u32Timeout_ms)
+{
+	eCurrent = eState;
+	sNextDeadline = (u32Timeout_ms != 0) ? (sNow + std::chrono::milliseconds(u32Timeout_ms)) : Clock::time_point::max();
+	if ((eState == State::Connecting) && (sNextDeadline > sConnectDeadline))
+	{
+		sNextDeadline = sConnectDeadline;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	pcStateName
+ **
+ ** Descriptions:	Name of a state, for progress reports.
+ **
+ *****************************************************************************/
+const char *Session::pcStateName(State eState)
+{
+	switch (eState)
+	{
+		case State::Connecting: return "connecting";
+		case State::Negotiating: return "negotiating";
+		case State::Selecting: return "selecting";
+		case State::Header: return "header";
+		case State::Sending: return "sending";
+		case State::Ending: return "ending";
+		case State::Closing: return "closing";
+		case State::Profile: return "profile";
+		case State::Done: return "done";
+		case State::Failed: return "failed";
+	}
+	return "unknown";
+}
+
+/*****************************************************************************
+ ** Function name:	sSummarise
+ **
+ ** Descriptions:	Summarises times recorded by a session.
+ **
+ ** Parameters:	    au32Samples - Times, in any order.
+ **
+ ** Returned value: Summary, all zero if there are no samples.
+ **
+ *****************************************************************************/
+SampleSummary sSummarise(std::vector<uint32_t> au32Samples)
+{
+	SampleSummary sResult;
+
+	if (!au32Samples.empty())
+	{
+		std::sort(au32Samples.begin(), au32Samples.end());
+		sResult.u32Min = au32Samples.front();
+		sResult.u32Max = au32Samples.back();
+		/* Nearest rank, as the benchmark: the smallest sample that at least
+		   95% of the samples do not exceed, the maximum below 20 samples */
+		sResult.u32P95 = au32Samples[(((au32Samples.size() * 95) + 99) / 100) - 1];
+		sResult.u32Mean = (uint32_t)(std::accumulate(au32Samples.begin(), au32Samples.end(), (uint64_t)0) / au32Samples.size());
+	}
+	return sResult;
+}
+
+/*****************************************************************************
+ ** Function name:	u32Micros
+ **
+ ** Descriptions:	Converts a duration to microseconds.
+ **
+ *****************************************************************************/
+static uint32_t u32Micros(Clock::duration sDuration)
+{
+	return (uint32_t)std::chrono::duration_cast<std::chrono::microseconds>(sDuration).count();
+}
+
+/*****************************************************************************
+ ** Function name:	u32LE32
+ **
+ ** Descriptions:	Reads a little endian 32-bit value.
+ **
+ *****************************************************************************/
+static uint32_t u32LE32(const uint8_t *pu8Data)
+{
+	return (uint32_t)pu8Data[0] | ((uint32_t)pu8Data[1] << 8) |
+		   ((uint32_t)pu8Data[2] << 16) | ((uint32_t)pu8Data[3] << 24);
+}
+
+} /* namespace xmodem */
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
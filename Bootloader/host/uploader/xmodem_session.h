@@ -0,0 +1,175 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: One upload to the bootloader's XMODEM-1K client, as an event
+ * 				driven state machine. The session does no I/O itself: the
+ * 				caller passes in received characters and the time, writes
+ * 				the session's output, sets the port to the session's line
+ * 				rate and calls back when the deadline passes. This lets a
+ * 				single thread drive any number of sessions.
+ *
+ *****************************************************************************/
+#ifndef __XMODEM_SESSION_H
+#define __XMODEM_SESSION_H
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+#include "xmodem_image.h"
+#include "xmodem_protocol.h"
+
+namespace xmodem
+{
+
+using Clock = std::chrono::steady_clock;
+
+struct SessionOptions
+{
+	uint32_t u32StartBaud = DEFAULT_BAUD_RATE;	/* Rate the bootloader starts at */
+	uint32_t u32Baud = 0;						/* Rate to negotiate, 0 to keep the start rate */
+	bool bAutoBaud = false;						/* Bootloader built with XMODEM_AUTOBAUD */
+	bool bProfile = false;						/* Read the profiling frame after EOT */
+	bool bYmodem = false;						/* Send the file name and size first */
+	bool bStream = false;						/* Ask to send without waiting for ACKs */
+	bool bWindow = false;						/* Ask to keep several packets outstanding */
+	uint32_t u32ConnectTimeout_ms = 30000;		/* Wait for the first poll */
+	uint32_t u32ResponseTimeout_ms = 10000;		/* Wait for a response to a packet */
+	uint32_t u32MaxRetries = 10;				/* Consecutive failures of one packet */
+};
+
+struct SessionStats
+{
+	uint32_t u32PacketsSent = 0;				/* Including retransmissions */
+	uint32_t u32Naks = 0;
+	uint32_t u32Timeouts = 0;
+	uint32_t u32Fallbacks = 0;					/* Negotiated rate abandoned */
+	bool bStreamed = false;						/* Bootloader accepted streaming */
+	uint32_t u32Window = 0;						/* Packets outstanding, 0 for one at a time */
+	size_t uBytesAcked = 0;						/* Image bytes acknowledged */
+	std::vector<uint32_t> au32Rtt_us;			/* Packet written to response read */
+	std::vector<uint32_t> au32Turnaround_us;	/* Response read to next packet written */
+	Clock::time_point sStart;
+	Clock::time_point sFirstPacket;
+	Clock::time_point sEnd;
+	std::vector<std::pair<uint32_t, uint32_t>> asProfile;	/* Count and time_us per counter */
+};
+
+/* Minimum, mean, 95th percentile and maximum of a set of times */
+struct SampleSummary
+{
+	uint32_t u32Min = 0;
+	uint32_t u32Mean = 0;
+	uint32_t u32P95 = 0;
+	uint32_t u32Max = 0;
+};
+
+SampleSummary sSummarise(std::vector<uint32_t> au32Samples);
+
+class Session
+{
+public:
+	enum class State
+	{
+		Connecting,			/* Waiting for a poll */
+		Negotiating,		/* Waiting for the bootloader's list of rates */
+		Selecting,			/* Waiting for the rate selection to be acknowledged */
+		Header,				/* Waiting for the YMODEM header to be acknowledged */
+		Sending,			/* Waiting for packets to be acknowledged */
+		Ending,				/* Waiting for EOT to be acknowledged */
+		Closing,			/* Ending the YMODEM batch */
+		Profile,			/* Waiting for the profiling frame */
+		Done,
+		Failed
+	};
+
+	Session(const Image &rImage, const SessionOptions &rOptions);
+
+	void vStart(Clock::time_point sNow);
+	void vReceive(const uint8_t *pu8Data, size_t uLen, Clock::time_point sNow);
+	void vTimeout(Clock::time_point sNow);
+
+	/* vTimeout() must be called once this has passed */
+	Clock::time_point sDeadline() const { return sNextDeadline; }
+
+	/* Output waiting to be written, vWritten() reports progress */
+	const uint8_t *pu8Output() const { return pu8Tx + uTxDone; }
+	size_t uOutputLen() const { return uTxLen - uTxDone; }
+	void vWritten(size_t uLen, Clock::time_point sNow);
+
+	/* Rate the port must be set to before the output is written */
+	uint32_t u32LineBaud() const { return u32Line; }
+
+	State eState() const { return eCurrent; }
+	bool bFinished() const { return (eCurrent == State::Done) || (eCurrent == State::Failed); }
+	const std::string &sError() const { return sFailure; }
+	const SessionStats &rStats() const { return sStats; }
+	size_t uPacketsAcked() const { return uPacket; }
+	size_t uPacketCount() const { return rImg.uPacketCount(); }
+
+	static const char *pcStateName(State eState);
+
+private:
+	void vHandle(uint8_t u8Data, Clock::time_point sNow);
+	void vPolled(Clock::time_point sNow);
+	void vFrameByte(uint8_t u8Data, Clock::time_point sNow);
+	void vWindowByte(uint8_t u8Data, Clock::time_point sNow);
+	void vSendPacket(Clock::time_point sNow);
+	void vSendWindow(Clock::time_point sNow);
+	uint32_t u32WindowTimeout_ms() const;
+	void vSendControl(const uint8_t *pu8Data, size_t uLen);
+	void vFinish(Clock::time_point sNow);
+	void vSelectRate(Clock::time_point sNow);
+	void vFallBack(Clock::time_point sNow);
+	void vRetry(Clock::time_point sNow);
+	void vFail(const std::string &sReason, Clock::time_point sNow);
+	void vEnter(State eState, Clock::time_point sNow, uint32_t u32Timeout_ms);
+
+	const Image &rImg;
+	SessionOptions sOpts;
+	SessionStats sStats;
+	State eCurrent = State::Connecting;
+	std::string sFailure;
+	uint32_t u32Line;
+
+	Clock::time_point sNextDeadline;
+	Clock::time_point sConnectDeadline;
+	Clock::time_point sWriteDone;				/* Last character of the output written */
+	Clock::time_point sLineIdle;				/* Output written has left the line */
+	Clock::time_point sResponseRead;			/* Response that triggered the output */
+	bool bTimeTurnaround = false;
+
+	/* Output */
+	const uint8_t *pu8Tx = nullptr;
+	size_t uTxLen = 0;
+	size_t uTxDone = 0;
+	uint8_t au8Control[4];
+
+	size_t uPacket = 0;							/* Next packet to be acknowledged */
+	uint32_t u32Retries = 0;
+	uint32_t u32Cancels = 0;
+	uint32_t u32Negotiations = 0;
+	bool bConfirmPending = false;				/* Negotiated rate not yet proven */
+	bool bHeaderAcked = false;					/* YMODEM header accepted */
+	bool bStreamAsked = false;
+	bool bStreaming = false;					/* Bootloader polls with STREAM_POLL */
+	bool bWindowAsked = false;
+	uint32_t u32Window = 0;						/* Agreed with the bootloader, 0 if none */
+	size_t uNextSend = 0;						/* First packet of the window not yet sent */
+	size_t uTxPacket = 0;						/* Packet being written */
+	std::vector<size_t> auResend;				/* Packets asked for again */
+	std::vector<Clock::time_point> asSent;		/* Time each packet was last written */
+	uint8_t u8Response = 0;						/* ACK or NAK waiting for its packet number */
+	std::vector<uint8_t> au8Frame;				/* Rate list, window or profiling frame */
+};
+
+} /* namespace xmodem */
+
+#endif /* end __XMODEM_SESSION_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
@@ -0,0 +1,352 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Uploads an application image to the bootloader. Every packet
+ * 				is framed before the transfer starts and the port is driven
+ * 				without blocking, so a packet is written as soon as the
+ * 				previous one is acknowledged. The time from writing each
+ * 				packet to its response and the host's own turnaround are
+ * 				reported with the bootloader's profiling counters if built
+ * 				with BOOTLOADER_PROFILE.
+ *
+ * 				Usage: xmodem_upload [-b baud] [-s start] [-a] [-P] [-y]
+ * 				                     [-G | -W] [-z | -d base] [-l | -1]
+ * 				                     [-t timeout] [-r retries] [-j] [-q]
+ * 				                     port image
+ *
+ * 				-b  Rate to negotiate before the first packet.
+ * 				-s  Rate the bootloader starts at (default 9600).
+ * 				-a  Bootloader is built with XMODEM_AUTOBAUD.
+ * 				-P  Read the profiling counters after the transfer.
+ * 				-y  Send a YMODEM header with the file name and size, so
+ * 				    that the bootloader can refuse an image too large
+ * 				    before erasing anything and checks the exact length.
+ * 				-G  Ask to stream, sending packets without waiting for
+ * 				    each ACK. Any error cancels the transfer.
+ * 				-W  Ask for a sliding window, keeping as many packets
+ * 				    outstanding as the bootloader allows. Only packets
+ * 				    that fail are sent again.
+ * 				-z  Compress the image, the bootloader unpacks it as it
+ * 				    programs flash. Sent as it is if it does not compress.
+ * 				-d  Send a patch against the base image, which must be the
+ * 				    one installed (the bootloader checks its CRC). Sent
+ * 				    whole if the patch is no smaller, or either image
+ * 				    reaches the last sector, which the bootloader needs
+ * 				    to patch in place. Cannot be combined with -G or -W,
+ * 				    as those erase the image before it is sent. If the
+ * 				    transfer fails part way the whole image must be sent.
+ * 				-l  1K packets only, by default the tail of the image is
+ * 				    sent in 128 byte packets when that is quicker.
+ * 				-1  128 byte packets only.
+ * 				-t  Seconds to wait for the bootloader to poll.
+ * 				-r  Attempts at each packet before giving up.
+ * 				-j  Print the summary as JSON.
+ * 				-q  No progress report.
+ *
+ * 				Times are in microseconds. rtt is measured from writing a
+ * 				packet to reading its response, turnaround from reading a
+ * 				response to writing the next packet.
+ *
+ *****************************************************************************/
+#include <poll.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include "serial_port.h"
+#include "xmodem_image.h"
+#include "xmodem_session.h"
+
+using namespace xmodem;
+
+/* Local functions */
+static bool bRun(SerialPort &rPort, Session &rSession, bool bQuiet);
+static void vReport(const Session &rSession, const Image &rImage, uint32_t u32Baud, bool bJson);
+static uint64_t u64Micros(Clock::duration sDuration);
+
+/*****************************************************************************
+ ** Function name:	main
+ **
+ ** Descriptions:	Parses the command line, uploads the image and prints a
+ ** 				summary.
+ **
+ ** Parameters:	    Command line.
+ **
+ ** Returned value: 0 if the upload succeeded, otherwise 1.
+ **
+ *****************************************************************************/
+int main(int argc, char *argv[])
+{
+	SessionOptions sOptions;
+	Image::Packing ePacking = Image::Packing::Mixed;
+	bool bPack = false;
+	std::string sBasePath;
+	bool bJson = false;
+	bool bQuiet = false;
+	std::string sError;
+	int iOpt;
+
+	while ((iOpt = getopt(argc, argv, "b:s:aPyGWzd:l1t:r:jq")) != -1)
+	{
+		switch (iOpt)
+		{
+			case 'b': sOptions.u32Baud = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 's': sOptions.u32StartBaud = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 'a': sOptions.bAutoBaud = true; break;
+			case 'P': sOptions.bProfile = true; break;
+			case 'y': sOptions.bYmodem = true; break;
+			case 'G': sOptions.bStream = true; break;
+			case 'W': sOptions.bWindow = true; break;
+			case 'z': bPack = true; break;
+			case 'd': sBasePath = optarg; break;
+			case 'l': ePacking = Image::Packing::Long; break;
+			case '1': ePacking = Image::Packing::Short; break;
+			case 't': sOptions.u32ConnectTimeout_ms = (uint32_t)strtoul(optarg, nullptr, 0) * 1000; break;
+			case 'r': sOptions.u32MaxRetries = (uint32_t)strtoul(optarg, nullptr, 0); break;
+			case 'j': bJson = true; break;
+			case 'q': bQuiet = true; break;
+			default:
+				argc = 0;
+				break;
+		}
+	}
+	if ((argc - optind) != 2)
+	{
+		fprintf(stderr, "usage: %s [-b baud] [-s start] [-a] [-P] [-y] [-G | -W] [-z | -d base] [-l | -1] [-t timeout] [-r retries] [-j] [-q] port image\n", argv[0]);
+		return 1;
+	}
+	if (sOptions.bStream && sOptions.bWindow)
+	{
+		fprintf(stderr, "xmodem_upload: -G and -W cannot be combined\n");
+		return 1;
+	}
+	if (!sBasePath.empty() && (sOptions.bStream || sOptions.bWindow || bPack))
+	{
+		fprintf(stderr, "xmodem_upload: -d cannot be combined with -G, -W or -z\n");
+		return 1;
+	}
+	if (!SerialPort::bBaudSupported(sOptions.u32StartBaud) ||
+		((sOptions.u32Baud != 0) && !SerialPort::bBaudSupported(sOptions.u32Baud)))
+	{
+		fprintf(stderr, "xmodem_upload: unsupported baud rate\n");
+		return 1;
+	}
+
+	Image sImage;
+	SerialPort sPort;
+
+	if (!sImage.bLoad(argv[optind + 1], ePacking, bPack, sBasePath, sError) ||
+		!sPort.bOpen(argv[optind], sOptions.u32StartBaud, sError))
+	{
+		fprintf(stderr, "xmodem_upload: %s\n", sError.c_str());
+		return 1;
+	}
+
+	Session sSession(sImage, sOptions);
+	bool bOk = bRun(sPort, sSession, bQuiet);
+
+	if (!bOk)
+	{
+		fprintf(stderr, "xmodem_upload: %s\n", sSession.sError().c_str());
+	}
+	vReport(sSession, sImage, sPort.u32Baud(), bJson);
+	return bOk ? 0 : 1;
+}
+
+/*****************************************************************************
+ ** Function name:	bRun
+ **
+ ** Descriptions:	Drives a session over a port until it finishes. The line
+ ** 				rate is changed before any output the session queues
+ ** 				after asking for a new rate.
+ **
+ ** Parameters:	    rPort - Open port.
+ ** 				rSession - Session, not yet started.
+ ** 				bQuiet - Do not report progress.
+ **
+ ** Returned value: true if the upload succeeded.
+ **
+ *****************************************************************************/
+static bool bRun(SerialPort &rPort, Session &rSession, bool bQuiet)
+{
+	uint8_t au8Rx[2048];
+	size_t uReported = (size_t)-1;
+
+	rSession.vStart(Clock::now());
+	while (!rSession.bFinished())
+	{
+		if ((rSession.u32LineBaud() != rPort.u32Baud()) && !rPort.bSetBaud(rSession.u32LineBaud()))
+		{
+			fprintf(stderr, "xmodem_upload: cannot set %lu baud\n", (unsigned long)rSession.u32LineBaud());
+			return false;
+		}
+
+		if (rSession.uOutputLen() != 0)
+		{
+			ssize_t iLen = rPort.iWrite(rSession.pu8Output(), rSession.uOutputLen());
+
+			if (iLen < 0)
+			{
+				perror(rPort.sPath().c_str());
+				return false;
+			}
+			rSession.vWritten((size_t)iLen, Clock::now());
+		}
+
+		struct pollfd sPoll = {rPort.iFd(), POLLIN, 0};
+		struct timespec sWait = {0, 0};
+		Clock::time_point sNow = Clock::now();
+
+		if (rSession.uOutputLen() != 0)
+		{
+			sPoll.events |= POLLOUT;
+		}
+		if (rSession.sDeadline() > sNow)
+		{
+			uint64_t u64Wait_us = u64Micros(rSession.sDeadline() - sNow);
+
+			u64Wait_us = std::min<uint64_t>(u64Wait_us, 1000000);
+			sWait.tv_sec = (time_t)(u64Wait_us / 1000000);
+			sWait.tv_nsec = (long)((u64Wait_us % 1000000) * 1000);
+		}
+
+		if (ppoll(&sPoll, 1, &sWait, nullptr) < 0)
+		{
+			continue;
+		}
+		if (sPoll.revents & (POLLIN | POLLERR | POLLHUP))
+		{
+			ssize_t iLen = rPort.iRead(au8Rx, sizeof(au8Rx));
+
+			if (iLen < 0)
+			{
+				perror(rPort.sPath().c_str());
+				return false;
+			}
+			rSession.vReceive(au8Rx, (size_t)iLen, Clock::now());
+		}
+
+		sNow = Clock::now();
+		if (!rSession.bFinished() && (sNow >= rSession.sDeadline()))
+		{
+			rSession.vTimeout(sNow);
+		}
+
+		if (!bQuiet && (rSession.uPacketsAcked() != uReported))
+		{
+			uReported = rSession.uPacketsAcked();
+			fprintf(stderr, "\r%s %zu/%zu packets", rPort.sPath().c_str(), uReported, rSession.uPacketCount());
+		}
+	}
+	if (!bQuiet)
+	{
+		fprintf(stderr, "\n");
+	}
+	return rSession.eState() == Session::State::Done;
+}
+
+/*****************************************************************************
+ ** Function name:	vReport
+ **
+ ** Descriptions:	Prints the summary of an upload on stdout.
+ **
+ ** Parameters:	    rSession - Finished session.
+ ** 				rImage - Image uploaded.
+ ** 				u32Baud - Final line rate.
+ ** 				bJson - Print a JSON object rather than text.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vReport(const Session &rSession, const Image &rImage, uint32_t u32Baud, bool bJson)
+{
+	const SessionStats &rStats = rSession.rStats();
+	SampleSummary sRtt = sSummarise(rStats.au32Rtt_us);
+	SampleSummary sTurnaround = sSummarise(rStats.au32Turnaround_us);
+	uint64_t u64Total_us = u64Micros(rStats.sEnd - rStats.sStart);
+	uint64_t u64Transfer_us = (rStats.sFirstPacket != Clock::time_point()) ? u64Micros(rStats.sEnd - rStats.sFirstPacket) : 0;
+	double dThroughput = (u64Transfer_us != 0) ? ((double)rStats.uBytesAcked * 1e6 / (double)u64Transfer_us) : 0.0;
+	size_t uCounters = std::min(rStats.asProfile.size(), sizeof(PROFILE_COUNTER_NAMES) / sizeof(PROFILE_COUNTER_NAMES[0]));
+
+	if (bJson)
+	{
+		printf("{\"ok\":%d,\"size\":%zu,\"sent_size\":%zu,\"packets\":%zu,\"baud\":%lu,\"sent\":%lu,\"naks\":%lu,\"timeouts\":%lu,\"fallbacks\":%lu,\"streamed\":%d,\"window\":%lu,"
+			   "\"total_us\":%llu,\"transfer_us\":%llu,\"throughput_Bps\":%.0f,"
+			   "\"rtt_min\":%lu,\"rtt_mean\":%lu,\"rtt_p95\":%lu,\"rtt_max\":%lu,"
+			   "\"turnaround_min\":%lu,\"turnaround_mean\":%lu,\"turnaround_p95\":%lu,\"turnaround_max\":%lu",
+			   (rSession.eState() == Session::State::Done) ? 1 : 0, rImage.uSize(), rImage.uSentSize(), rImage.uPacketCount(),
+			   (unsigned long)u32Baud, (unsigned long)rStats.u32PacketsSent, (unsigned long)rStats.u32Naks,
+			   (unsigned long)rStats.u32Timeouts, (unsigned long)rStats.u32Fallbacks, rStats.bStreamed ? 1 : 0, (unsigned long)rStats.u32Window,
+			   (unsigned long long)u64Total_us, (unsigned long long)u64Transfer_us, dThroughput,
+			   (unsigned long)sRtt.u32Min, (unsigned long)sRtt.u32Mean, (unsigned long)sRtt.u32P95, (unsigned long)sRtt.u32Max,
+			   (unsigned long)sTurnaround.u32Min, (unsigned long)sTurnaround.u32Mean,
+			   (unsigned long)sTurnaround.u32P95, (unsigned long)sTurnaround.u32Max);
+		for (size_t i = 0; i < uCounters; i++)
+		{
+			printf(",\"%s_count\":%lu", PROFILE_COUNTER_NAMES[i], (unsigned long)rStats.asProfile[i].first);
+			if (PROFILE_COUNTER_UNITS[i] != nullptr)
+			{
+				printf(",\"%s_%s\":%lu", PROFILE_COUNTER_NAMES[i], PROFILE_COUNTER_UNITS[i],
+					   (unsigned long)rStats.asProfile[i].second);
+			}
+		}
+		printf("}\n");
+		return;
+	}
+
+	if (rImage.eEncoding() == Image::Encoding::Packed)
+	{
+		printf("image       %zu bytes packed to %zu in %zu packets at %lu baud\n", rImage.uSize(), rImage.uSentSize(),
+			   rImage.uPacketCount(), (unsigned long)u32Baud);
+	}
+	else if (rImage.eEncoding() == Image::Encoding::Patch)
+	{
+		printf("image       %zu bytes as a %zu byte patch in %zu packets at %lu baud\n", rImage.uSize(), rImage.uSentSize(),
+			   rImage.uPacketCount(), (unsigned long)u32Baud);
+	}
+	else
+	{
+		printf("image       %zu bytes in %zu packets at %lu baud\n", rImage.uSize(), rImage.uPacketCount(), (unsigned long)u32Baud);
+	}
+	std::string sMode = rStats.bStreamed ? std::string(" streamed") :
+						(rStats.u32Window != 0) ? (" in a window of " + std::to_string(rStats.u32Window)) : std::string();
+
+	printf("sent        %lu packets%s, %lu NAKs, %lu timeouts, %lu fallbacks\n", (unsigned long)rStats.u32PacketsSent,
+		   sMode.c_str(), (unsigned long)rStats.u32Naks, (unsigned long)rStats.u32Timeouts,
+		   (unsigned long)rStats.u32Fallbacks);
+	printf("time        %.3f s total, %.3f s transfer, %.0f bytes/s\n", (double)u64Total_us / 1e6,
+		   (double)u64Transfer_us / 1e6, dThroughput);
+	printf("rtt         min %lu mean %lu p95 %lu max %lu us\n", (unsigned long)sRtt.u32Min,
+		   (unsigned long)sRtt.u32Mean, (unsigned long)sRtt.u32P95, (unsigned long)sRtt.u32Max);
+	printf("turnaround  min %lu mean %lu p95 %lu max %lu us\n", (unsigned long)sTurnaround.u32Min,
+		   (unsigned long)sTurnaround.u32Mean, (unsigned long)sTurnaround.u32P95, (unsigned long)sTurnaround.u32Max);
+	for (size_t i = 0; i < uCounters; i++)
+	{
+		if (PROFILE_COUNTER_UNITS[i] != nullptr)
+		{
+			printf("%-11s %lu calls, %lu %s\n", PROFILE_COUNTER_NAMES[i], (unsigned long)rStats.asProfile[i].first,
+				   (unsigned long)rStats.asProfile[i].second, PROFILE_COUNTER_UNITS[i]);
+		}
+		else
+		{
+			printf("%-11s %lu\n", PROFILE_COUNTER_NAMES[i], (unsigned long)rStats.asProfile[i].first);
+		}
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	u64Micros
+ **
+ ** Descriptions:	Converts a duration to microseconds.
+ **
+ *****************************************************************************/
+static uint64_t u64Micros(Clock::duration sDuration)
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::microseconds>(sDuration).count();
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
@@ -22,6 +22,7 @@
  * use without further testing or modification.
  *****************************************************************************/
 #include "IAP.h"
+#include "profile.h"
 #include <LPC11xx.h>
 
 /* IAP Command Definitions */
@@ -34,9 +35,12 @@
 #define	IAP_CMD_COMPARE					56
 #define	IAP_CMD_REINVOKE_ISP			57
 
-/* IAP boot ROM location and access function */
+/* IAP boot ROM location and access function, the host simulation build
+   supplies its own */
 #define IAP_ROM_LOCATION				0x1FFF1FF1UL
+#ifndef IAP_EXECUTE_CMD
 #define IAP_EXECUTE_CMD(a, b)			((void (*)())(IAP_ROM_LOCATION))(a, b)
+#endif
 
 /*****************************************************************************
 ** Function name:	u32IAP_PrepareSectors
@@ -92,6 +96,7 @@ uint32_t u32IAP_CopyRAMToFlash(uint32_t u32DstAddr, uint32_t u32SrcAddr, uint32_
 {
 	uint32_t au32Result[3];
 	uint32_t au32Command[5];
+	PROFILE_ENTER(u32StartTicks);
 
 	au32Command[0] = IAP_CMD_COPY_RAM_TO_FLASH;
 	au32Command[1] = u32DstAddr;
@@ -100,6 +105,7 @@ uint32_t u32IAP_CopyRAMToFlash(uint32_t u32DstAddr, uint32_t u32SrcAddr, uint32_
 	au32Command[4] = SystemCoreClock / 1000UL;	/* Core clock frequency in kHz */
 
 	IAP_EXECUTE_CMD(au32Command, au32Result);
+	PROFILE_EXIT(PROFILE_IAP_COPY, u32StartTicks);
 
 	return au32Result[0];
 }
@@ -127,12 +133,15 @@ uint32_t u32IAP_EraseSectors(uint32_t u32StartSector, uint32_t u32EndSector)
 	}
 	else
 	{
+		PROFILE_ENTER(u32StartTicks);
+
 		au32Command[0] = IAP_CMD_ERASE_SECTORS;
 		au32Command[1] = u32StartSector;
 		au32Command[2] = u32EndSector;
 		au32Command[3] = SystemCoreClock / 1000UL;	/* Core clock frequency in kHz */
 
 		IAP_EXECUTE_CMD(au32Command, au32Result);
+		PROFILE_EXIT(PROFILE_IAP_ERASE, u32StartTicks);
 
 		u32Status = au32Result[0];
 	}
@@ -174,8 +183,8 @@ uint32_t u32IAP_BlankCheckSectors(uint32_t u32StartSector, uint32_t u32EndSector
 
 		if (au32Result[0] == IAP_STA_SECTOR_NOT_BLANK)
 		{
-			*pu32Result       = au32Result[0];
-			*(pu32Result + 1) = au32Result[1];
+			*pu32Result       = au32Result[1];
+			*(pu32Result + 1) = au32Result[2];
 		}
 		u32Status = au32Result[0];
 	}
@@ -247,6 +256,7 @@ uint32_t u32IAP_Compare(uint32_t u32DstAddr, uint32_t u32SrcAddr, uint32_t u32Le
 {
 	uint32_t au32Result[3];
 	uint32_t au32Command[5];
+	PROFILE_ENTER(u32StartTicks);
 
 	au32Command[0] = IAP_CMD_COMPARE;
 	au32Command[1] = u32DstAddr;
@@ -254,6 +264,7 @@ uint32_t u32IAP_Compare(uint32_t u32DstAddr, uint32_t u32SrcAddr, uint32_t u32Le
 	au32Command[3] = u32Len;
 
 	IAP_EXECUTE_CMD(au32Command, au32Result);
+	PROFILE_EXIT(PROFILE_IAP_COMPARE, u32StartTicks);
 
 	if (au32Result[0] == IAP_STA_COMPARE_ERROR)
 	{
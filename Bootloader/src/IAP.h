@@ -45,6 +45,13 @@
 #define IAP_FLASH_PAGE_SIZE_BYTES							256
 #define IAP_FLASH_PAGE_SIZE_WORDS							(IAP_FLASH_PAGE_SIZE_BYTES >> 2)
 
+/* Pointer through which flash memory at a given address is read, flash is
+   directly addressable on the device but may be substituted (e.g. by the
+   host simulation build) */
+#ifndef IAP_FLASH_PTR
+#define IAP_FLASH_PTR(addr)									((const void *)(addr))
+#endif
+
 void vIAP_ReinvokeISP(void);
 uint32_t u32IAP_ReadPartID(uint32_t *pu32PartID);
 uint32_t u32IAP_ReadBootVersion(uint32_t *pu32Major, uint32_t *pu32Minor);
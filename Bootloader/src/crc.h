@@ -27,6 +27,7 @@
 #include <stdint.h>
 
 uint16_t u16CRC_Calc16(const uint8_t *pu8Data, int16_t u16Len);
+uint16_t u16CRC_Update16(uint16_t u16CRC, uint8_t u8Data);
 
 #endif /* end __CRC_H */
 /*****************************************************************************
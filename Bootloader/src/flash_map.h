@@ -0,0 +1,39 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Flash memory layout, where the bootloader ends and the user
+ * 				application starts. Shared with the host simulator.
+ *
+ * Copyright(C) 2010, NXP Semiconductor
+ * All rights reserved.
+ *
+ *****************************************************************************
+ * Software that is described herein is for illustrative purposes only
+ * which provides customers with programming information regarding the
+ * products. This software is supplied "AS IS" without any warranties.
+ * NXP Semiconductors assumes no responsibility or liability for the
+ * use of the software, conveys no license or title under any patent,
+ * copyright, or mask work right to the product. NXP Semiconductors
+ * reserves the right to make changes in the software without
+ * notification. NXP Semiconductors also make no representation or
+ * warranty that such application will be suitable for the specified
+ * use without further testing or modification.
+ *****************************************************************************/
+#ifndef __FLASH_MAP_H
+#define __FLASH_MAP_H
+
+/* Define flash memory address at which user application is located */
+#define APP_START_ADDR						0x00001000UL
+#define APP_END_ADDR						0x00008000UL
+
+/* Define the flash sectors used by the application */
+#define APP_START_SECTOR					1
+#define APP_END_SECTOR						7
+#define FLASH_SECTOR_SIZE					0x1000UL
+
+#endif /* end __FLASH_MAP_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
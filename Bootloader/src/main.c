@@ -3,10 +3,11 @@
  *
  * Project: 	NXP LPC1100 Secondary Bootloader Example
  *
- * Description:	Secondary bootloader that permanently resides in sector zero
+ * Description:	Secondary bootloader that permanently resides in sector zero of
  * 				flash memory. Uses UART0 and the XMODEM 1K protocol to load
- * 				an new application into sectors 1 onwards. Also redirects
- * 				interrupts to the functions contained in the application
+ * 				an new application into sectors 1 onwards. Also maps a RAM
+ * 				copy of the application vector table to address zero so
+ * 				that interrupts go directly to the application handlers.
  *
  * Copyright(C) 2010, NXP Semiconductor
  * All rights reserved.
@@ -26,51 +27,182 @@
 #include <LPC11xx.h>
 #include "IAP.h"
 #include "crc.h"
+#include "flash_map.h"
+#include "profile.h"
+#include "uart.h"
 #include "xmodem1k.h"
 
-/* Define flash memory address at which user application is located */
-#define APP_START_ADDR						0x00001000UL
-#define APP_END_ADDR						0x00008000UL
-
-/* Define the flash sectors used by the application */
-#define APP_START_SECTOR					1
-#define APP_END_SECTOR						7
-
-/* Define location in flash memory that contains the application valid check value */
-#define APP_VALID_CHECK_ADDR				0x00007FFCUL
-
-/* Prototypes for functions that re-direct interrupts to handlers specified
-   in application vector table. Implemented as naked functions as they do not
-   need to store anything on the stack, they simply change the value of the
-   program counter. */
-void NMI_Handler(void) __attribute__ (( naked ));
-void HardFault_Handler(void) __attribute__ (( naked ));
-void SVCall_Handler(void) __attribute__ (( naked ));
-void PendSV_Handler(void) __attribute__ (( naked ));
-void SysTick_Handler(void) __attribute__ (( naked ));
-void WAKEUP_IRQHandler(void) __attribute__ (( naked ));
-void I2C_IRQHandler(void) __attribute__ (( naked ));
-void TIMER16_0_IRQHandler(void) __attribute__ (( naked ));
-void TIMER16_1_IRQHandler(void) __attribute__ (( naked ));
-void TIMER32_0_IRQHandler(void) __attribute__ (( naked ));
-void TIMER32_1_IRQHandler(void) __attribute__ (( naked ));
-void SSP_IRQHandler(void) __attribute__ (( naked ));
-void UART_IRQHandler(void) __attribute__ (( naked ));
-void USB_IRQHandler(void) __attribute__ (( naked ));
-void USB_FIQHandler(void) __attribute__ (( naked ));
-void ADC_IRQHandler(void) __attribute__ (( naked ));
-void WDT_IRQHandler(void) __attribute__ (( naked ));
-void BOD_IRQHandler(void) __attribute__ (( naked ));
-void FMC_IRQHandler(void) __attribute__ (( naked ));
-void PIOINT3_IRQHandler(void) __attribute__ (( naked ));
-void PIOINT2_IRQHandler(void) __attribute__ (( naked ));
-void PIOINT1_IRQHandler(void) __attribute__ (( naked ));
-void PIOINT0_IRQHandler(void) __attribute__ (( naked ));
+/* Image header written by the bootloader at the end of the application area
+   once a new application has been programmed. The CRC and header version
+   occupy the last word of flash, so an application that clears that word
+   forces the bootloader to run at the next reset. */
+typedef struct
+{
+	uint32_t u32Magic;					/* IMAGE_HEADER_MAGIC */
+	uint32_t u32Length;					/* Number of bytes occupied by the image */
+	uint32_t u32EntryPoint;				/* Application reset vector */
+	uint16_t u16CRC;					/* CRC of u32Length bytes from APP_START_ADDR */
+	uint16_t u16Version;				/* IMAGE_HEADER_VERSION */
+} tImageHeader;
+
+#define IMAGE_HEADER_MAGIC					0x4D494C42UL	/* "BLIM" */
+#define IMAGE_HEADER_VERSION				1
+
+/* Define location in flash memory that contains the image header */
+#define IMAGE_HEADER_ADDR					(APP_END_ADDR - sizeof(tImageHeader))
+
+/* Largest image that can be stored in front of the image header */
+#define APP_MAX_LEN							(IMAGE_HEADER_ADDR - APP_START_ADDR)
+
+/* Character used by the server to pad the final packet of a transfer */
+#define XMODEM_PAD_CHAR						0x1A
+
+/* Baud rate the XMODEM client starts at, and falls back to if a faster rate
+   negotiated with the server does not work */
+#define BOOTLOADER_BAUD_RATE				9600
+
+/* Set to 1 to build in the decoder for compressed images, without it they
+   are refused (by size with a YMODEM header, otherwise by the application
+   check at the next reset). It does not fit in the first sector beside the
+   rest of the bootloader, see the flash layout in README.md. */
+#ifndef BOOTLOADER_LZSS
+#define BOOTLOADER_LZSS						0
+#endif
+
+/* Compressed image, as packed by the uploader. LZSS_HEADER_LEN bytes hold
+   the unpacked length and LZSS_MAGIC, where an application holds its initial
+   stack pointer and reset vector, followed by items in groups of up to eight,
+   each group preceded by a byte of flags used least significant bit first. A
+   set flag is a literal byte, a clear one a match of two bytes, low byte
+   first: the distance back less one in the low 10 bits and the length less
+   LZSS_MIN_MATCH in the top 6. Matches reach back no further than the 1K
+   block being gathered and the block programmed before it, so the history
+   is read from there and needs no further RAM. */
+#define LZSS_MAGIC							0x315A4C42UL	/* "BLZ1" */
+#define LZSS_HEADER_LEN						8
+#define LZSS_MIN_MATCH						3
+
+/* Set to 1 to build in patching of the installed application, without it
+   patches are refused in the same way as compressed images. Like the
+   decoder it needs more than the first sector. Patching needs the last
+   sector as scratch, only applications linked short of it can be patched
+   (see the application linker files). */
+#ifndef BOOTLOADER_DELTA
+#define BOOTLOADER_DELTA					0
+#endif
+
+/* Patch against the installed application, as generated by the uploader.
+   DELTA_HEADER_LEN bytes hold the patched length, DELTA_MAGIC, the base
+   length, and the CRCs of the base and the patched image (base in the low
+   half word), followed by commands. A command byte below DELTA_COPY is
+   followed by that many plus one literal bytes. Otherwise it and the next
+   byte hold the length less one of a copy from the base image (top 7 bits
+   in the command byte), and the two bytes after that the signed distance,
+   low byte first, from the position being written to the base data copied.
+   The image is patched in place, each sector that changes is saved to the
+   scratch sector before it is erased, so a copy may read the base from the
+   sector being written or any later one, never an earlier one. Sectors a
+   copy leaves unchanged are not erased or programmed. Each sector that
+   changes costs the scratch sector an extra erase and program, so it wears
+   once for every patched sector of every update. The scratch sector also
+   holds the image header, which is lost at the first changed sector: a
+   reset part way through a patch leaves a mix of old and new sectors that
+   the bootloader does not start, and the image has to be sent whole. */
+#define DELTA_MAGIC							0x31444C42UL	/* "BLD1" */
+#define DELTA_HEADER_LEN					16
+#define DELTA_COPY							0x80
+#define DELTA_SCRATCH_SECTOR				APP_END_SECTOR
+#define DELTA_SCRATCH_ADDR					(DELTA_SCRATCH_SECTOR * FLASH_SECTOR_SIZE)
+
+/* Largest base or patched image, both must leave the scratch sector free */
+#define DELTA_MAX_LEN						(DELTA_SCRATCH_ADDR - APP_START_ADDR)
+
+/* Number of entries in the vector table, 16 system exceptions plus 32 IRQs */
+#define VECTOR_TABLE_ENTRIES				48
+
+/* SYSMEMREMAP value that maps the bottom 512 bytes of RAM to address zero */
+#define SYSMEMREMAP_USER_RAM				0x01
+
+/* Functions that must keep running while flash memory is unavailable are
+   linked into RAM, the startup code copies them there with the data */
+#ifndef BOOTLOADER_RAMFUNC
+#define BOOTLOADER_RAMFUNC					__attribute__ ((section(".data.ramfunc")))
+#endif
+
+/* Vector table mapped to address zero by SYSMEMREMAP. The linker script
+   places the "vtable" section at the start of RAM. While the bootloader task
+   is running it keeps the UART interrupt serviceable when flash memory is
+   unavailable during IAP operations. Before the application is started it
+   is loaded with the application vector table, the application must not
+   use the bottom VECTOR_TABLE_ENTRIES words of RAM or change SYSMEMREMAP. */
+static void (*apfnRamVectors[VECTOR_TABLE_ENTRIES])(void) __attribute__ ((section("vtable")));
 
 static void vBootLoader_Task(void);
+static void vBootLoader_StartApp(void);
+static void vBootLoader_RamTrap(void) BOOTLOADER_RAMFUNC;
 static uint32_t u32BootLoader_AppPresent(void);
-static uint32_t u32Bootloader_WriteCRC(uint16_t u16CRC);
+static uint32_t u32Bootloader_WriteCRC(uint16_t u16CRC, uint32_t u32Length);
 static uint32_t u32BootLoader_ProgramFlash(uint8_t *pu8Data, uint16_t u16Len);
+#if XMODEM_YMODEM
+static uint32_t u32BootLoader_ImageSize(const char *pcName, uint32_t u32Size);
+#endif
+#if XMODEM_STREAMING || XMODEM_WINDOW
+static uint32_t u32BootLoader_PrepareStream(void);
+#endif
+static uint32_t u32BootLoader_WriteBlock(uint32_t u32Addr, const uint8_t *pu8Data, uint32_t u32Len);
+static uint32_t u32BootLoader_EnsureErased(uint32_t u32Sector);
+#if BOOTLOADER_LZSS
+static uint32_t u32BootLoader_Unpack(const uint8_t *pu8Data, uint32_t u32Len);
+#endif
+#if BOOTLOADER_DELTA
+static uint32_t u32BootLoader_Patch(const uint8_t *pu8Data, uint32_t u32Len);
+static uint32_t u32BootLoader_PatchCopy(uint32_t u32Count, uint32_t u32Source);
+static uint32_t u32BootLoader_PatchSector(void);
+#endif
+#if BOOTLOADER_LZSS || BOOTLOADER_DELTA
+static uint32_t u32BootLoader_PutByte(uint8_t u8Data);
+#endif
+
+/* Address at which the next received byte will be programmed */
+static uint32_t u32NextFlashWriteAddr = APP_START_ADDR;
+
+/* Image size sent by the server ahead of the data (YMODEM), 0 if unknown */
+static uint32_t u32ImageSize = 0;
+
+/* Received data is programmed in blocks of this size, the largest IAP copy
+   size that divides a sector. Data that does not fill a block is gathered
+   here until it does. */
+#define FLASH_BLOCK_SIZE					1024
+static uint8_t au8FlashBlock[FLASH_BLOCK_SIZE] __attribute__ ((aligned(4)));
+
+/* Bit per sector, set once the sector is known to be erased for this update */
+static uint32_t u32ErasedSectors = 0;
+
+#if BOOTLOADER_LZSS
+/* Unpacked length of a compressed image, 0 while receiving a plain one */
+static uint32_t u32PackedImageLen = 0;
+
+/* Decoder state between packets: flags not yet used above a marker bit, and
+   the first byte of a match (with bit 8 set) if the second is still to come */
+static uint32_t u32LzssFlags = 1;
+static uint32_t u32LzssMatch = 0;
+#endif
+
+#if BOOTLOADER_DELTA
+/* Length of the image being patched, 0 while receiving a plain one, and of
+   the base it is patched from */
+static uint32_t u32PatchedImageLen = 0;
+static uint32_t u32DeltaBaseLen = 0;
+
+/* Expected CRC of the patched image */
+static uint16_t u16DeltaCRC = 0;
+
+/* Command state between packets: literal bytes still to come, and the bytes
+   of a copy command received so far */
+static uint32_t u32DeltaLiterals = 0;
+static uint32_t u32DeltaCmdLen = 0;
+static uint8_t au8DeltaCmd[4];
+#endif
 
 /*****************************************************************************
  ** Function name:  main
@@ -88,6 +220,12 @@ int main(void)
 	   from the startup code. SystemInit() and chip settings are defined
 	   in the CMSIS system_<part family>.c file. */
 
+#if BOOTLOADER_PROFILE
+	/* Start the profiling timer ahead of the application check, which is
+	   profiled too */
+	vProfileInit();
+#endif
+
 	/* Verify if a valid user application is present in the upper sectors
 	   of flash memory. */
 	if (u32BootLoader_AppPresent() == 0)
@@ -104,18 +242,7 @@ int main(void)
 	else
 	{
 		/* Valid application located in the next sector(s) of flash so execute */
-
-		/* Load main stack pointer with application stack pointer initial value,
-		   stored at first location of application area */
-		asm volatile("ldr r0, =0x1000");
-		asm volatile("ldr r0, [r0]");
-		asm volatile("mov sp, r0");
-
-		/* Load program counter with application reset vector address, located at
-		   second word of application area. */
-		asm volatile("ldr r0, =0x1004");
-		asm volatile("ldr r0, [r0]");
-		asm volatile("mov pc, r0");
+		vBootLoader_StartApp();
 
 		/* User application execution should now start and never return here.... */
 	}
@@ -126,8 +253,11 @@ int main(void)
 /*****************************************************************************
  ** Function name:  vBootLoader_Task
  **
- ** Description:	Erases application flash area and starts XMODEM client so
- ** 				that new application can be downloaded.
+ ** Description:	Starts XMODEM client so that new application can be
+ ** 				downloaded. Sectors are erased as the image reaches them,
+ ** 				or before a streamed transfer starts.
+ ** 				If the transfer is cancelled no CRC is written, so the
+ ** 				bootloader runs again after the reset.
  **
  ** Parameters:	    None
  **
@@ -136,46 +266,140 @@ int main(void)
  *****************************************************************************/
 static void vBootLoader_Task(void)
 {
-	/* Erase the application flash area so it is ready to be reprogrammed with the new application */
-	if (u32IAP_PrepareSectors(APP_START_SECTOR, APP_END_SECTOR) == IAP_STA_CMD_SUCCESS)
+	uint32_t i;
+	uint32_t (*pu32HeaderCallback)(const char *pcName, uint32_t u32Size) = 0;
+	uint32_t (*pu32StreamCallback)(void) = 0;
+
+	/* Build the RAM vector table, only the UART interrupt is used by the
+	   bootloader, anything else traps in RAM. */
+	for (i = 0; i < VECTOR_TABLE_ENTRIES; i++)
 	{
-		if (u32IAP_EraseSectors(APP_START_SECTOR, APP_END_SECTOR) == IAP_STA_CMD_SUCCESS)
-		{
-			uint16_t u16CRC = 0;
+		apfnRamVectors[i] = &vBootLoader_RamTrap;
+	}
+	apfnRamVectors[16 + UART_IRQn] = &vUARTIRQHandler;
 
-			/* Start the xmodem client, this function only returns when a
-			   transfer is complete. Pass it pointer to function that will
-			   handle received data packets */
-			vXmodem1k_Client(&u32BootLoader_ProgramFlash);
+	/* Map the RAM vector table to address zero */
+	LPC_SYSCON->SYSMEMREMAP = SYSMEMREMAP_USER_RAM;
 
-			/* Programming is now complete, calculate the CRC of the flash image */
-			u16CRC = u16CRC_Calc16((const uint8_t *)APP_START_ADDR, (APP_END_ADDR - APP_START_ADDR - 4));
+#if BOOTLOADER_PROFILE
+	/* Time interrupt entry through the table, reported with the counters */
+	vProfileIRQLatency(&apfnRamVectors[0]);
+#endif
 
-			/* Write the CRC value into the last 16-bit location of flash, this
-			   will be used to check for a valid application at startup  */
-			(void)u32Bootloader_WriteCRC(u16CRC);
+#if XMODEM_YMODEM
+	/* Learn the image size from a YMODEM header */
+	pu32HeaderCallback = &u32BootLoader_ImageSize;
+#endif
+#if XMODEM_STREAMING || XMODEM_WINDOW
+	/* Accept packets back to back once flash has been erased for them */
+	pu32StreamCallback = &u32BootLoader_PrepareStream;
+#endif
+
+	/* Start the xmodem client, this function only returns when a transfer is
+	   complete or has been cancelled. Pass it pointer to function that will
+	   handle received data packets. Application sectors are erased by that
+	   function when first written, so polling starts straight away, or all
+	   at once if the server streams. */
+	if (u32Xmodem1k_Client(&u32BootLoader_ProgramFlash, pu32HeaderCallback,
+						   pu32StreamCallback, BOOTLOADER_BAUD_RATE) != 0)
+	{
+		uint16_t u16CRC = 0;
+		uint32_t u32Length;
+
+		/* Programming is now complete, the image occupies everything
+		   received up to the header (the exact size, if it was sent) */
+		u32Length = u32NextFlashWriteAddr - APP_START_ADDR;
+		if (u32Length > APP_MAX_LEN)
+		{
+			u32Length = APP_MAX_LEN;
+		}
+
+		/* Calculate the CRC of the flash image */
+		u16CRC = u16CRC_Calc16((const uint8_t *)IAP_FLASH_PTR(APP_START_ADDR), u32Length);
+
+		/* Write the image header to the end of flash, this will be used to
+		   check for a valid application at startup. A short image may not
+		   have reached the header sector, which can still hold old data. */
+		if (u32BootLoader_EnsureErased(APP_END_SECTOR) != 0)
+		{
+			(void)u32Bootloader_WriteCRC(u16CRC, u32Length);
 		}
 	}
+
+#if BOOTLOADER_PROFILE
+	/* Report where the update time went, the server listens for this after
+	   its EOT has been acknowledged */
+	vProfileSend();
+#endif
+}
+
+/*****************************************************************************
+ ** Function name:  vBootLoader_StartApp
+ **
+ ** Description:	Copies the application vector table to RAM, maps it to
+ ** 				address zero and jumps to the application reset handler
+ ** 				with the application's initial stack pointer.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None, does not return.
+ **
+ *****************************************************************************/
+static void vBootLoader_StartApp(void)
+{
+	uint32_t i;
+	const uint32_t *pu32AppVectors = (const uint32_t *)IAP_FLASH_PTR(APP_START_ADDR);
+
+	for (i = 0; i < VECTOR_TABLE_ENTRIES; i++)
+	{
+		apfnRamVectors[i] = (void (*)(void))pu32AppVectors[i];
+	}
+
+	/* Application interrupts are now taken directly from the RAM copy */
+	LPC_SYSCON->SYSMEMREMAP = SYSMEMREMAP_USER_RAM;
+
+#if BOOTLOADER_PROFILE
+	/* The application starts with the profiling timer in its reset state */
+	vProfileStop();
+#endif
+
+#ifdef BOOTLOADER_START_APP
+	/* Substituted by builds that cannot run the application */
+	BOOTLOADER_START_APP(pu32AppVectors);
+#else
+	/* Load main stack pointer with application stack pointer initial value,
+	   stored at first location of application area, then load program
+	   counter with application reset vector address, located at second
+	   word. One statement, so nothing uses the stack once it has moved. */
+	asm volatile("ldr r0, [%0]\n\t"
+				 "mov sp, r0\n\t"
+				 "ldr r0, [%0, #4]\n\t"
+				 "mov pc, r0"
+				 : : "l" (pu32AppVectors) : "r0");
+#endif
 }
 
 /*****************************************************************************
  ** Function name:	u32Bootloader_WriteCRC
  **
- ** Description:	Writes a 16-bit CRC value to the last location in flash
- ** 				memory, the bootloader uses this value to check for a valid
+ ** Description:	Writes the image header, containing the image length and
+ ** 				16-bit CRC value, to the last locations in flash memory.
+ ** 				The bootloader uses the header to check for a valid
  ** 				application at startup.
  **
  ** Parameters:	    u16CRC - CRC value to be written to flash
+ ** 				u32Length - Number of bytes covered by the CRC
  **
  ** Returned value: 1 if CRC written to flash successfully, otherwise 0.
  **
  *****************************************************************************/
-static uint32_t u32Bootloader_WriteCRC(uint16_t u16CRC)
+static uint32_t u32Bootloader_WriteCRC(uint16_t u16CRC, uint32_t u32Length)
 {
 	uint32_t i;
 	uint32_t u32Result = 0;
 	uint32_t a32DummyData[IAP_FLASH_PAGE_SIZE_WORDS];
-	uint32_t *pu32Mem = (uint32_t *)(APP_END_ADDR - IAP_FLASH_PAGE_SIZE_BYTES);
+	const uint32_t *pu32Mem = (const uint32_t *)IAP_FLASH_PTR(APP_END_ADDR - IAP_FLASH_PAGE_SIZE_BYTES);
+	tImageHeader *psHeader = (tImageHeader *)&a32DummyData[IAP_FLASH_PAGE_SIZE_WORDS - (sizeof(tImageHeader) / 4)];
 
 	/* First copy the data that is currently present in the last page of
 	   flash into a temporary buffer */
@@ -184,12 +408,16 @@ static uint32_t u32Bootloader_WriteCRC(uint16_t u16CRC)
 		a32DummyData[i] = *pu32Mem++;
 	}
 
-	/* Set the CRC value to be written back */
-	a32DummyData[IAP_FLASH_PAGE_SIZE_WORDS - 1] = (uint32_t)u16CRC;
+	/* Set the header values to be written back */
+	psHeader->u32Magic = IMAGE_HEADER_MAGIC;
+	psHeader->u32Length = u32Length;
+	psHeader->u32EntryPoint = *(const uint32_t *)IAP_FLASH_PTR(APP_START_ADDR + 4);
+	psHeader->u16CRC = u16CRC;
+	psHeader->u16Version = IMAGE_HEADER_VERSION;
 
 	if (u32IAP_PrepareSectors(APP_END_SECTOR, APP_END_SECTOR) == IAP_STA_CMD_SUCCESS)
 	{
-		/* Now write the data back, only the CRC bits have changed */
+		/* Now write the data back, only the header bits have changed */
 		if (u32IAP_CopyRAMToFlash((APP_END_ADDR - IAP_FLASH_PAGE_SIZE_BYTES),
 				                  (uint32_t)a32DummyData,
 				                  IAP_FLASH_PAGE_SIZE_BYTES) == IAP_STA_CMD_SUCCESS)
@@ -203,497 +431,688 @@ static uint32_t u32Bootloader_WriteCRC(uint16_t u16CRC)
 /*****************************************************************************
  ** Function name:	u32BootLoader_ProgramFlash
  **
- ** Description:
+ ** Description:	Programs received data into the next free location of the
+ ** 				application area. Data is gathered into FLASH_BLOCK_SIZE
+ ** 				blocks so that flash is written with the largest IAP copy
+ ** 				size, blocks that arrive whole and aligned are written
+ ** 				straight from the packet buffer. Any partly filled block
+ ** 				is written when called with no data at the end of the
+ ** 				transfer. A compressed image, recognised by its first
+ ** 				packet, is unpacked into the blocks instead, and a patch
+ ** 				is applied to the installed application.
  **
- ** Parameters:	    None
+ ** Parameters:	    pu8Data - Pointer to packet data, word aligned, or null
+ ** 				to write out the remaining data.
+ ** 				u16Len - Number of bytes of packet data.
  **
  ** Returned value: 0 if programming failed, otherwise 1.
  **
  *****************************************************************************/
 static uint32_t u32BootLoader_ProgramFlash(uint8_t *pu8Data, uint16_t u16Len)
 {
-	uint32_t u32Result = 0;
+	uint32_t i;
+	uint32_t u32Offset;
+	uint32_t u32Result = 1;
 
-	static uint32_t u32NextFlashWriteAddr = APP_START_ADDR;
+	if (pu8Data == 0)
+	{
+		/* End of transfer, pad the data still held to the smallest IAP copy
+		   size that holds it and write it out */
+		u32Offset = (u32NextFlashWriteAddr - APP_START_ADDR) % FLASH_BLOCK_SIZE;
+		if ((u32ImageSize != 0) && ((u32NextFlashWriteAddr - APP_START_ADDR) != u32ImageSize))
+		{
+			/* Server ended the transfer short of the size it sent */
+			u32Result = 0;
+		}
+#if BOOTLOADER_LZSS
+		else if ((u32PackedImageLen != 0) && ((u32NextFlashWriteAddr - APP_START_ADDR) != u32PackedImageLen))
+		{
+			/* Compressed image ended before it had all been unpacked */
+			u32Result = 0;
+		}
+#endif
+#if BOOTLOADER_DELTA
+		else if ((u32PatchedImageLen != 0) && ((u32NextFlashWriteAddr - APP_START_ADDR) != u32PatchedImageLen))
+		{
+			/* Patch ended before the whole image had been produced */
+			u32Result = 0;
+		}
+		else if ((u32PatchedImageLen != 0) &&
+				 ((u32ErasedSectors & (1UL << ((u32NextFlashWriteAddr - 1) / FLASH_SECTOR_SIZE))) == 0))
+		{
+			/* The last sector was left unchanged (patched sectors are
+			   erased before they are written), nothing is held */
+		}
+#endif
+		else if (u32Offset != 0)
+		{
+			uint32_t u32CopyLen = IAP_FLASH_PAGE_SIZE_BYTES;
 
-	if ((pu8Data != 0) && (u16Len != 0))
+			while (u32CopyLen < u32Offset)
+			{
+				u32CopyLen *= 2;
+			}
+			for (i = u32Offset; i < u32CopyLen; i++)
+			{
+				au8FlashBlock[i] = 0xFF;
+			}
+			u32Result = u32BootLoader_WriteBlock(u32NextFlashWriteAddr - u32Offset, au8FlashBlock, u32CopyLen);
+		}
+#if BOOTLOADER_DELTA
+		/* Check the outcome of patching before the header makes it valid */
+		if ((u32Result != 0) && (u32PatchedImageLen != 0) &&
+			(u16CRC_Calc16((const uint8_t *)IAP_FLASH_PTR(APP_START_ADDR), u32PatchedImageLen) != u16DeltaCRC))
+		{
+			u32Result = 0;
+		}
+#endif
+	}
+#if BOOTLOADER_LZSS
+	else if ((u32PackedImageLen != 0) ||
+			 ((u32NextFlashWriteAddr == APP_START_ADDR) && (u16Len >= LZSS_HEADER_LEN) &&
+			  (((const uint32_t *)pu8Data)[1] == LZSS_MAGIC)))
+	{
+		if (u32PackedImageLen == 0)
+		{
+			/* Start of a compressed image, which must fit and agree with the
+			   size from any YMODEM header */
+			u32PackedImageLen = ((const uint32_t *)pu8Data)[0];
+			if ((u32PackedImageLen == 0) || (u32PackedImageLen > APP_MAX_LEN) ||
+				((u32ImageSize != 0) && (u32ImageSize != u32PackedImageLen)))
+			{
+				u32Result = 0;
+			}
+			pu8Data += LZSS_HEADER_LEN;
+			u16Len -= LZSS_HEADER_LEN;
+		}
+		if (u32Result != 0)
+		{
+			u32Result = u32BootLoader_Unpack(pu8Data, u16Len);
+		}
+	}
+#endif
+#if BOOTLOADER_DELTA
+	else if ((u32PatchedImageLen != 0) ||
+			 ((u32NextFlashWriteAddr == APP_START_ADDR) && (u16Len >= DELTA_HEADER_LEN) &&
+			  (((const uint32_t *)pu8Data)[1] == DELTA_MAGIC)))
 	{
-		/* Prepare the flash application sectors for reprogramming */
-		if (u32IAP_PrepareSectors(APP_START_SECTOR, APP_END_SECTOR) == IAP_STA_CMD_SUCCESS)
+		if (u32PatchedImageLen == 0)
 		{
-			/* Ensure that amount of data written to flash is at minimum the
-			   size of a flash page */
-			if (u16Len < IAP_FLASH_PAGE_SIZE_BYTES)
+			/* Start of a patch, both images must leave the scratch sector
+			   free and the base must be what is in flash. A stream or window
+			   has had the application sectors erased ahead of it (see
+			   u32BootLoader_PrepareStream) so there is no base left to patch.
+			   Otherwise nothing has been erased yet, and a patch that is
+			   refused leaves the installed application as it is. */
+			u32PatchedImageLen = ((const uint32_t *)pu8Data)[0];
+			u32DeltaBaseLen = ((const uint32_t *)pu8Data)[2];
+			u16DeltaCRC = (uint16_t)(((const uint32_t *)pu8Data)[3] >> 16);
+			if ((u32ErasedSectors != 0) ||
+				(u32PatchedImageLen == 0) || (u32PatchedImageLen > DELTA_MAX_LEN) ||
+				((u32ImageSize != 0) && (u32ImageSize != u32PatchedImageLen)) ||
+				(u32DeltaBaseLen == 0) || (u32DeltaBaseLen > DELTA_MAX_LEN) ||
+				(u16CRC_Calc16((const uint8_t *)IAP_FLASH_PTR(APP_START_ADDR), u32DeltaBaseLen) !=
+				 (uint16_t)((const uint32_t *)pu8Data)[3]))
 			{
-				u16Len = IAP_FLASH_PAGE_SIZE_BYTES;
+				u32Result = 0;
 			}
+			pu8Data += DELTA_HEADER_LEN;
+			u16Len -= DELTA_HEADER_LEN;
+		}
+		if (u32Result != 0)
+		{
+			u32Result = u32BootLoader_Patch(pu8Data, u16Len);
+		}
+	}
+#endif
+	else
+	{
+		/* Padding beyond a known image size is not programmed, nor covered by
+		   the CRC */
+		if ((u32ImageSize != 0) && ((u32NextFlashWriteAddr + u16Len) > (APP_START_ADDR + u32ImageSize)))
+		{
+			u16Len = (u32NextFlashWriteAddr < (APP_START_ADDR + u32ImageSize)) ?
+					 (uint16_t)((APP_START_ADDR + u32ImageSize) - u32NextFlashWriteAddr) : 0;
+		}
 
-			/* Write the data to flash */
-			if (u32IAP_CopyRAMToFlash(u32NextFlashWriteAddr, (uint32_t)pu8Data, u16Len) == IAP_STA_CMD_SUCCESS)
+		/* The image must not run into the image header, the final packet may only
+		   extend over it with padding. Replace that padding with erased values
+		   so that the header can still be programmed. */
+		if ((u32NextFlashWriteAddr + u16Len) > IMAGE_HEADER_ADDR)
+		{
+			if (u32NextFlashWriteAddr + u16Len > APP_END_ADDR)
+			{
+				u32Result = 0;
+			}
+			for (i = IMAGE_HEADER_ADDR - u32NextFlashWriteAddr; (u32Result != 0) && (i < u16Len); i++)
 			{
-				/* Check that the write was successful */
-				if (u32IAP_Compare(u32NextFlashWriteAddr, (uint32_t)pu8Data, u16Len, 0) == IAP_STA_CMD_SUCCESS)
+				if ((pu8Data[i] != XMODEM_PAD_CHAR) && (pu8Data[i] != 0xFF))
 				{
-					/* Write was successful */
-					u32NextFlashWriteAddr += u16Len;
-					u32Result = 1;
+					u32Result = 0;
+				}
+				else
+				{
+					pu8Data[i] = 0xFF;
 				}
 			}
 		}
+
+		while ((u32Result != 0) && (u16Len != 0))
+		{
+			uint32_t u32Chunk;
+
+			u32Offset = (u32NextFlashWriteAddr - APP_START_ADDR) % FLASH_BLOCK_SIZE;
+
+			if ((u32Offset == 0) && (u16Len >= FLASH_BLOCK_SIZE) && (((uint32_t)pu8Data & 0x03) == 0))
+			{
+				/* Whole block, no need to copy it */
+				u32Chunk = FLASH_BLOCK_SIZE;
+				u32Result = u32BootLoader_WriteBlock(u32NextFlashWriteAddr, pu8Data, FLASH_BLOCK_SIZE);
+			}
+			else
+			{
+				/* Add to the block being gathered, writing it once full */
+				u32Chunk = FLASH_BLOCK_SIZE - u32Offset;
+				if (u32Chunk > u16Len)
+				{
+					u32Chunk = u16Len;
+				}
+				for (i = 0; i < u32Chunk; i++)
+				{
+					au8FlashBlock[u32Offset + i] = pu8Data[i];
+				}
+				if ((u32Offset + u32Chunk) == FLASH_BLOCK_SIZE)
+				{
+					u32Result = u32BootLoader_WriteBlock(u32NextFlashWriteAddr - u32Offset, au8FlashBlock, FLASH_BLOCK_SIZE);
+				}
+			}
+
+			u32NextFlashWriteAddr += u32Chunk;
+			pu8Data += u32Chunk;
+			u16Len -= u32Chunk;
+		}
 	}
 	return (u32Result);
 }
 
+#if BOOTLOADER_LZSS
 /*****************************************************************************
- ** Function name:  u32BootLoader_AppPresent
+ ** Function name:	u32BootLoader_Unpack
  **
- ** Description:	Checks if an application is present by comparing CRC of
- ** 				flash contents with value present at last location in flash.
+ ** Description:	Decodes compressed image data into the flash blocks. The
+ ** 				decoder stops at the unpacked length, so the padding of
+ ** 				the final packet is ignored.
  **
- ** Parameters:	    None
+ ** Parameters:	    pu8Data - Pointer to compressed data.
+ ** 				u32Len - Number of bytes.
  **
- ** Returned value: 1 if application present, otherwise 0.
+ ** Returned value: 0 if the data is invalid or programming failed,
+ ** 				otherwise 1.
  **
  *****************************************************************************/
-static uint32_t u32BootLoader_AppPresent(void)
+static uint32_t u32BootLoader_Unpack(const uint8_t *pu8Data, uint32_t u32Len)
 {
-	uint16_t u16CRC = 0;
-	uint32_t u32AppPresent = 0;
-	uint16_t *pu16AppCRC = (uint16_t *)(APP_END_ADDR - 4);
+	uint32_t u32Result = 1;
+	uint32_t u32EndAddr = APP_START_ADDR + u32PackedImageLen;
 
-	/* Check if a CRC value is present in application flash area */
-	if (*pu16AppCRC != 0xFFFFUL)
+	while ((u32Result != 0) && (u32Len != 0) && (u32NextFlashWriteAddr < u32EndAddr))
 	{
-		/* Memory occupied by application CRC is not blank so calculate CRC of
-		   image in application area of flash memory, and check against this
-		   CRC.. */
-		u16CRC = u16CRC_Calc16((const uint8_t *)APP_START_ADDR, (APP_END_ADDR - APP_START_ADDR - 4));
+		uint32_t u32Data = *pu8Data++;
 
-		if (*pu16AppCRC == u16CRC)
+		u32Len--;
+		if (u32LzssFlags == 1)
 		{
-			u32AppPresent = 1;
+			/* Flags for the next eight items */
+			u32LzssFlags = u32Data | 0x100;
+		}
+		else if ((u32LzssFlags & 1) != 0)
+		{
+			u32LzssFlags >>= 1;
+			u32Result = u32BootLoader_PutByte((uint8_t)u32Data);
+		}
+		else if (u32LzssMatch == 0)
+		{
+			u32LzssMatch = u32Data | 0x100;
+		}
+		else
+		{
+			uint32_t u32Distance = (((u32Data & 0x03) << 8) | (u32LzssMatch & 0xFF)) + 1;
+			uint32_t u32Count = (u32Data >> 2) + LZSS_MIN_MATCH;
+
+			u32LzssFlags >>= 1;
+			u32LzssMatch = 0;
+			if ((u32Distance > (u32NextFlashWriteAddr - APP_START_ADDR)) ||
+				((u32NextFlashWriteAddr + u32Count) > u32EndAddr))
+			{
+				/* Before the start of the image, or beyond its end */
+				u32Result = 0;
+			}
+			while ((u32Result != 0) && (u32Count-- != 0))
+			{
+				/* Earlier bytes of the block being gathered are in RAM, those
+				   before it have been programmed */
+				uint32_t u32Addr = u32NextFlashWriteAddr - u32Distance;
+				uint32_t u32BlockAddr = u32NextFlashWriteAddr - ((u32NextFlashWriteAddr - APP_START_ADDR) % FLASH_BLOCK_SIZE);
+
+				u32Result = u32BootLoader_PutByte((u32Addr >= u32BlockAddr) ? au8FlashBlock[u32Addr - u32BlockAddr] :
+												  *(const uint8_t *)IAP_FLASH_PTR(u32Addr));
+			}
 		}
 	}
-	return u32AppPresent;
+	return u32Result;
 }
+#endif
 
+#if BOOTLOADER_DELTA
 /*****************************************************************************
- *
- *                      Interrupt redirection functions
- *
- *****************************************************************************/
-/*****************************************************************************
- ** Function name:   NMI_Handler
+ ** Function name:	u32BootLoader_Patch
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Applies patch commands to the installed application. The
+ ** 				commands stop at the patched length, so the padding of
+ ** 				the final packet is ignored.
  **
- ** Parameters:	     None
+ ** Parameters:	    pu8Data - Pointer to patch commands.
+ ** 				u32Len - Number of bytes.
  **
- ** Returned value:  None
+ ** Returned value: 0 if the patch is invalid or programming failed,
+ ** 				otherwise 1.
  **
  *****************************************************************************/
-void NMI_Handler(void)
+static uint32_t u32BootLoader_Patch(const uint8_t *pu8Data, uint32_t u32Len)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1008");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	uint32_t u32Result = 1;
+	uint32_t u32EndAddr = APP_START_ADDR + u32PatchedImageLen;
 
-/*****************************************************************************
- ** Function name:   HardFault_Handler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void HardFault_Handler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x100C");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	while ((u32Result != 0) && (u32Len != 0) && (u32NextFlashWriteAddr < u32EndAddr))
+	{
+		uint32_t u32Data = *pu8Data++;
 
-/*****************************************************************************
- ** Function name:   SVCall_Handler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void SVCall_Handler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x102C");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+		u32Len--;
+		if (u32DeltaLiterals != 0)
+		{
+			u32DeltaLiterals--;
+			if (((u32NextFlashWriteAddr - APP_START_ADDR) % FLASH_SECTOR_SIZE) == 0)
+			{
+				u32Result = u32BootLoader_PatchSector();
+			}
+			if (u32Result != 0)
+			{
+				u32Result = u32BootLoader_PutByte((uint8_t)u32Data);
+			}
+		}
+		else if ((u32DeltaCmdLen == 0) && (u32Data < DELTA_COPY))
+		{
+			u32DeltaLiterals = u32Data + 1;
+		}
+		else
+		{
+			au8DeltaCmd[u32DeltaCmdLen++] = (uint8_t)u32Data;
+			if (u32DeltaCmdLen == sizeof(au8DeltaCmd))
+			{
+				uint32_t u32Count = ((((uint32_t)au8DeltaCmd[0] & 0x7F) << 8) | au8DeltaCmd[1]) + 1;
+				int32_t i32Distance = (int16_t)(au8DeltaCmd[2] | ((uint32_t)au8DeltaCmd[3] << 8));
 
-/*****************************************************************************
- ** Function name:   PendSV_Handler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- ******************************************************************************/
-void PendSV_Handler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1038");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+				u32DeltaCmdLen = 0;
+				u32Result = u32BootLoader_PatchCopy(u32Count, (u32NextFlashWriteAddr - APP_START_ADDR) + i32Distance);
+			}
+		}
+	}
+	return u32Result;
 }
 
 /*****************************************************************************
- ** Function name:   SysTick_Handler
+ ** Function name:	u32BootLoader_PatchCopy
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Copies base image data into the image being patched.
+ ** 				Whole sectors copied to where they already are are left
+ ** 				as they are.
  **
- ** Parameters:	     None
+ ** Parameters:	    u32Count - Number of bytes.
+ ** 				u32Source - Offset of the data in the base image.
  **
- ** Returned value:  None
+ ** Returned value: 0 if the copy is invalid or programming failed,
+ ** 				otherwise 1.
  **
  *****************************************************************************/
-void SysTick_Handler(void)
+static uint32_t u32BootLoader_PatchCopy(uint32_t u32Count, uint32_t u32Source)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x103C");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	uint32_t u32Result = 1;
+	uint32_t u32EndAddr = APP_START_ADDR + u32PatchedImageLen;
 
-/*****************************************************************************
- ** Function name:   WAKEUP_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- ******************************************************************************/
-void WAKEUP_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1040");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	if (((u32NextFlashWriteAddr + u32Count) > u32EndAddr) ||
+		(u32Source >= u32DeltaBaseLen) || (u32Count > (u32DeltaBaseLen - u32Source)))
+	{
+		/* Beyond the end of either image */
+		u32Result = 0;
+	}
+	while ((u32Result != 0) && (u32Count != 0))
+	{
+		uint32_t u32Offset = u32NextFlashWriteAddr - APP_START_ADDR;
+		uint32_t u32Addr = APP_START_ADDR + u32Source;
 
-/*****************************************************************************
- ** Function name:   I2C_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void I2C_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x107C");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+		if ((u32Offset % FLASH_SECTOR_SIZE) == 0)
+		{
+			uint32_t u32SectorLen = u32EndAddr - u32NextFlashWriteAddr;
 
-/*****************************************************************************
- ** Function name:   TIMER16_0_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void TIMER16_0_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1080");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+			if (u32SectorLen > FLASH_SECTOR_SIZE)
+			{
+				u32SectorLen = FLASH_SECTOR_SIZE;
+			}
+			if ((u32Source == u32Offset) && (u32Count >= u32SectorLen))
+			{
+				/* Sector unchanged */
+				u32NextFlashWriteAddr += u32SectorLen;
+				u32Source += u32SectorLen;
+				u32Count -= u32SectorLen;
+			}
+			else
+			{
+				u32Result = u32BootLoader_PatchSector();
+			}
+		}
 
-/*****************************************************************************
- ** Function name:   TIMER16_1_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void TIMER16_1_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1084");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+		if ((u32Result == 0) || (u32Count == 0) || (u32Offset != (u32NextFlashWriteAddr - APP_START_ADDR)))
+		{
+			/* Nothing more to copy here */
+		}
+		else if ((u32Source / FLASH_SECTOR_SIZE) < (u32Offset / FLASH_SECTOR_SIZE))
+		{
+			/* Base data already overwritten */
+			u32Result = 0;
+		}
+		else
+		{
+			/* The base of the sector being written has been saved */
+			if ((u32Source / FLASH_SECTOR_SIZE) == (u32Offset / FLASH_SECTOR_SIZE))
+			{
+				u32Addr = DELTA_SCRATCH_ADDR + (u32Source % FLASH_SECTOR_SIZE);
+			}
+			u32Result = u32BootLoader_PutByte(*(const uint8_t *)IAP_FLASH_PTR(u32Addr));
+			u32Source++;
+			u32Count--;
+		}
+	}
+	return u32Result;
 }
 
 /*****************************************************************************
- ** Function name:   TIMER32_0_IRQHandler
+ ** Function name:	u32BootLoader_PatchSector
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Saves the base data of the sector about to be written
+ ** 				to the scratch sector, from where it is copied, then
+ ** 				erases the sector.
  **
- ** Parameters:	     None
+ ** Parameters:	    None
  **
- ** Returned value:  None
+ ** Returned value: 0 if programming failed, otherwise 1.
  **
  *****************************************************************************/
-void TIMER32_0_IRQHandler(void)
+static uint32_t u32BootLoader_PatchSector(void)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1088");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	uint32_t i;
+	uint32_t u32Offset;
+	uint32_t u32Result = 1;
 
-/*****************************************************************************
- ** Function name:   TIMER32_1_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void TIMER32_1_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x108C");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	if ((u32NextFlashWriteAddr - APP_START_ADDR) < u32DeltaBaseLen)
+	{
+		/* The scratch sector holds the previous sector, erase it again */
+		u32ErasedSectors &= ~(1UL << DELTA_SCRATCH_SECTOR);
+		for (u32Offset = 0; (u32Result != 0) && (u32Offset < FLASH_SECTOR_SIZE); u32Offset += FLASH_BLOCK_SIZE)
+		{
+			const uint8_t *pu8Base = (const uint8_t *)IAP_FLASH_PTR(u32NextFlashWriteAddr + u32Offset);
 
-/*****************************************************************************
- ** Function name:   SSP_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void SSP_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1090");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+			for (i = 0; i < FLASH_BLOCK_SIZE; i++)
+			{
+				au8FlashBlock[i] = pu8Base[i];
+			}
+			u32Result = u32BootLoader_WriteBlock(DELTA_SCRATCH_ADDR + u32Offset, au8FlashBlock, FLASH_BLOCK_SIZE);
+		}
 
-/*****************************************************************************
- ** Function name:   UART_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void UART_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1094");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+		/* Not erased as far as the image header is concerned */
+		u32ErasedSectors &= ~(1UL << DELTA_SCRATCH_SECTOR);
+	}
+	if (u32Result != 0)
+	{
+		u32Result = u32BootLoader_EnsureErased(u32NextFlashWriteAddr / FLASH_SECTOR_SIZE);
+	}
+	return u32Result;
 }
+#endif
 
+#if BOOTLOADER_LZSS || BOOTLOADER_DELTA
 /*****************************************************************************
- ** Function name:   USB_IRQHandler
+ ** Function name:	u32BootLoader_PutByte
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Adds an unpacked or patched byte to the block being
+ ** 				gathered, writing the block once full.
  **
- ** Parameters:	     None
+ ** Parameters:	    u8Data - Byte.
  **
- ** Returned value:  None
+ ** Returned value: 0 if programming failed, otherwise 1.
  **
  *****************************************************************************/
-void USB_IRQHandler(void)
+static uint32_t u32BootLoader_PutByte(uint8_t u8Data)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x1098");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	uint32_t u32Result = 1;
+	uint32_t u32Offset = (u32NextFlashWriteAddr - APP_START_ADDR) % FLASH_BLOCK_SIZE;
 
-/*****************************************************************************
- ** Function name:   USB_FIQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void USB_FIQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x109C");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	au8FlashBlock[u32Offset] = u8Data;
+	u32NextFlashWriteAddr++;
+	if (u32Offset == (FLASH_BLOCK_SIZE - 1))
+	{
+		u32Result = u32BootLoader_WriteBlock(u32NextFlashWriteAddr - FLASH_BLOCK_SIZE, au8FlashBlock, FLASH_BLOCK_SIZE);
+	}
+	return u32Result;
 }
+#endif
 
+#if XMODEM_YMODEM
 /*****************************************************************************
- ** Function name:   ADC_IRQHandler
+ ** Function name:	u32BootLoader_ImageSize
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Accepts the file announced by a YMODEM header if it fits
+ ** 				in the application area. Called before anything has been
+ ** 				erased or programmed, so an image that is too large is
+ ** 				refused without touching the current application. The
+ ** 				size of a compressed image is its unpacked size, that of
+ ** 				a patch the size of the patched image.
  **
- ** Parameters:	     None
+ ** Parameters:	    pcName - File name, not used.
+ ** 				u32Size - Image size in bytes, 0 if not sent.
  **
- ** Returned value:  None
+ ** Returned value: 1 to accept the image, 0 to refuse it.
  **
  *****************************************************************************/
-void ADC_IRQHandler(void)
+static uint32_t u32BootLoader_ImageSize(const char *pcName, uint32_t u32Size)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10A0");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	uint32_t u32Result = 0;
 
-/*****************************************************************************
- ** Function name:   WDT_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void WDT_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10A4");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	(void)pcName;
+	if (u32Size <= APP_MAX_LEN)
+	{
+		u32ImageSize = u32Size;
+		u32Result = 1;
+	}
+	return u32Result;
 }
+#endif
 
+#if XMODEM_STREAMING || XMODEM_WINDOW
 /*****************************************************************************
- ** Function name:   BOD_IRQHandler
+ ** Function name:	u32BootLoader_PrepareStream
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Erases the sectors the image will occupy before the
+ ** 				server starts streaming or sending through a sliding
+ ** 				window. A sector erase stalls the CPU for longer than the
+ ** 				UART receive buffer lasts at the faster rates, and such a
+ ** 				server does not wait for each packet to be written. The
+ ** 				size from a YMODEM header limits the sectors erased,
+ ** 				without one every application sector is erased.
  **
- ** Parameters:	     None
+ ** Parameters:	    None
  **
- ** Returned value:  None
+ ** Returned value: 1 to accept streaming or a window, 0 to refuse.
  **
  *****************************************************************************/
-void BOD_IRQHandler(void)
+static uint32_t u32BootLoader_PrepareStream(void)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10A8");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
-}
+	uint32_t u32Sector;
+	uint32_t u32LastSector = APP_END_SECTOR;
+	uint32_t u32Result = 1;
 
-/*****************************************************************************
- ** Function name:   FMC_IRQHandler
- **
- ** Description:	 Redirects CPU to application defined handler
- **
- ** Parameters:	     None
- **
- ** Returned value:  None
- **
- *****************************************************************************/
-void FMC_IRQHandler(void)
-{
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10AC");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	if (u32ImageSize != 0)
+	{
+		u32LastSector = (APP_START_ADDR + u32ImageSize - 1) / FLASH_SECTOR_SIZE;
+	}
+	for (u32Sector = APP_START_SECTOR; (u32Sector <= u32LastSector) && (u32Result != 0); u32Sector++)
+	{
+		u32Result = u32BootLoader_EnsureErased(u32Sector);
+	}
+	return u32Result;
 }
+#endif
 
 /*****************************************************************************
- ** Function name:   PIOINT3_IRQHandler
+ ** Function name:	u32BootLoader_WriteBlock
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Programs and verifies a block of flash, erasing its
+ ** 				sector first if this is the first write to it. The block
+ ** 				must not cross a sector boundary.
  **
- ** Parameters:	     None
+ ** Parameters:	    u32Addr - Flash address, aligned to u32Len.
+ ** 				pu8Data - Pointer to data, word aligned.
+ ** 				u32Len - 256, 512 or 1024 bytes.
  **
- ** Returned value:  None
+ ** Returned value: 0 if programming failed, otherwise 1.
  **
  *****************************************************************************/
-void PIOINT3_IRQHandler(void)
+static uint32_t u32BootLoader_WriteBlock(uint32_t u32Addr, const uint8_t *pu8Data, uint32_t u32Len)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10B0");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	uint32_t u32Result = 0;
+	uint32_t u32Sector = u32Addr / FLASH_SECTOR_SIZE;
+
+	/* Only the sector being written is prepared */
+	if ((u32BootLoader_EnsureErased(u32Sector) != 0) &&
+		(u32IAP_PrepareSectors(u32Sector, u32Sector) == IAP_STA_CMD_SUCCESS))
+	{
+		/* Write the data to flash */
+		if (u32IAP_CopyRAMToFlash(u32Addr, (uint32_t)pu8Data, u32Len) == IAP_STA_CMD_SUCCESS)
+		{
+			/* Check that the write was successful */
+			if (u32IAP_Compare(u32Addr, (uint32_t)pu8Data, u32Len, 0) == IAP_STA_CMD_SUCCESS)
+			{
+				u32Result = 1;
+			}
+		}
+	}
+	return (u32Result);
 }
 
 /*****************************************************************************
- ** Function name:   PIOINT2_IRQHandler
+ ** Function name:	u32BootLoader_EnsureErased
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Erases an application sector the first time it is needed
+ ** 				during an update. Sectors that are already blank are not
+ ** 				erased, saving the erase time.
  **
- ** Parameters:	     None
+ ** Parameters:	    u32Sector - Sector number, APP_START_SECTOR to
+ ** 				APP_END_SECTOR.
  **
- ** Returned value:  None
+ ** Returned value: 1 if the sector is erased, otherwise 0.
  **
  *****************************************************************************/
-void PIOINT2_IRQHandler(void)
+static uint32_t u32BootLoader_EnsureErased(uint32_t u32Sector)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10B4");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	uint32_t u32Result = 0;
+	uint32_t au32BlankResult[2];
+
+	if ((u32Sector >= APP_START_SECTOR) && (u32Sector <= APP_END_SECTOR))
+	{
+		if ((u32ErasedSectors & (1UL << u32Sector)) != 0)
+		{
+			u32Result = 1;
+		}
+		else if (u32IAP_BlankCheckSectors(u32Sector, u32Sector, au32BlankResult) == IAP_STA_CMD_SUCCESS)
+		{
+			/* Already blank */
+			u32Result = 1;
+		}
+		else if (u32IAP_PrepareSectors(u32Sector, u32Sector) == IAP_STA_CMD_SUCCESS)
+		{
+			if (u32IAP_EraseSectors(u32Sector, u32Sector) == IAP_STA_CMD_SUCCESS)
+			{
+				u32Result = 1;
+			}
+		}
+
+		if (u32Result != 0)
+		{
+			u32ErasedSectors |= (1UL << u32Sector);
+		}
+	}
+	return u32Result;
 }
 
 /*****************************************************************************
- ** Function name:   PIOINT1_IRQHandler
+ ** Function name:  u32BootLoader_AppPresent
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Checks if an application is present by validating the
+ ** 				image header at the end of flash and comparing the CRC of
+ ** 				the bytes occupied by the image with the header CRC.
  **
- ** Parameters:	     None
+ ** Parameters:	    None
  **
- ** Returned value:  None
+ ** Returned value: 1 if application present, otherwise 0.
  **
  *****************************************************************************/
-void PIOINT1_IRQHandler(void)
+static uint32_t u32BootLoader_AppPresent(void)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10B8");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	uint16_t u16CRC = 0;
+	uint32_t u32AppPresent = 0;
+	const tImageHeader *psHeader = (const tImageHeader *)IAP_FLASH_PTR(IMAGE_HEADER_ADDR);
+	uint32_t u32EntryPoint = *(const uint32_t *)IAP_FLASH_PTR(APP_START_ADDR + 4);
+	PROFILE_ENTER(u32StartTicks);
+
+	/* Check if a valid header is present in application flash area, and that
+	   it describes the image actually in flash */
+	if ((psHeader->u32Magic == IMAGE_HEADER_MAGIC) &&
+		(psHeader->u16Version == IMAGE_HEADER_VERSION) &&
+		(psHeader->u32Length > 8) &&
+		(psHeader->u32Length <= APP_MAX_LEN) &&
+		(psHeader->u32EntryPoint == u32EntryPoint) &&
+		(u32EntryPoint >= APP_START_ADDR) &&
+		(u32EntryPoint < (APP_START_ADDR + psHeader->u32Length)))
+	{
+		/* Calculate CRC of the bytes occupied by the image, and check against
+		   the header CRC.. */
+		u16CRC = u16CRC_Calc16((const uint8_t *)IAP_FLASH_PTR(APP_START_ADDR), psHeader->u32Length);
+
+		if (psHeader->u16CRC == u16CRC)
+		{
+			u32AppPresent = 1;
+		}
+	}
+	PROFILE_EXIT(PROFILE_APP_CHECK, u32StartTicks);
+	return u32AppPresent;
 }
 
 /*****************************************************************************
- ** Function name:   PIOINT0_IRQHandler
+ ** Function name:  vBootLoader_RamTrap
  **
- ** Description:	 Redirects CPU to application defined handler
+ ** Description:	Handler for unexpected exceptions while the RAM vector
+ ** 				table is mapped. Located in RAM so that it can be
+ ** 				fetched while flash memory is busy.
  **
- ** Parameters:	     None
+ ** Parameters:	    None
  **
- ** Returned value:  None
+ ** Returned value: None
  **
  *****************************************************************************/
-void PIOINT0_IRQHandler(void)
+static void vBootLoader_RamTrap(void)
 {
-	/* Re-direct interrupt, get handler address from application vector table */
-	asm volatile("ldr r0, =0x10BC");
-	asm volatile("ldr r0, [r0]");
-	asm volatile("mov pc, r0");
+	while (1)
+	{
+	}
 }
 
 /*****************************************************************************
@@ -0,0 +1,324 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Optional profiling counters recording how often, and for how
+ * 				long, the bootloader's time consuming operations run.
+ *
+ * Copyright(C) 2010, NXP Semiconductor
+ * All rights reserved.
+ *
+ *****************************************************************************
+ * Software that is described herein is for illustrative purposes only
+ * which provides customers with programming information regarding the
+ * products. This software is supplied "AS IS" without any warranties.
+ * NXP Semiconductors assumes no responsibility or liability for the
+ * use of the software, conveys no license or title under any patent,
+ * copyright, or mask work right to the product. NXP Semiconductors
+ * reserves the right to make changes in the software without
+ * notification. NXP Semiconductors also make no representation or
+ * warranty that such application will be suitable for the specified
+ * use without further testing or modification.
+ *****************************************************************************/
+#include "crc.h"
+#include "profile.h"
+#include "uart.h"
+
+#if BOOTLOADER_PROFILE
+
+#if PROFILE_IRQ_LATENCY
+#include <LPC11xx.h>
+
+/* SysTick's entry in the vector table */
+#define PROFILE_SYSTICK_VECTOR		15
+/* Interrupts timed through each path */
+#define PROFILE_LATENCY_SAMPLES		16
+/* SysTick period in core clock cycles, long enough for the probe to be
+   waiting in its loop when the counter wraps */
+#define PROFILE_LATENCY_RELOAD		1000
+/* SysTick CTRL: core clock, interrupt and counter enabled */
+#define PROFILE_SYSTICK_START		0x07
+
+static void vProfileSysTick(void);
+static void vProfileTrampoline(void) __attribute__ ((naked));
+
+/* Handler the trampoline loads from flash, as the redirection handlers the
+   bootloader used before the RAM vector table loaded each application
+   handler from the application's vector table */
+static void (* const pfnProfileTarget)(void) __attribute__ ((used)) = &vProfileSysTick;
+
+/* Entry latency of the last SysTick interrupt, zero until it is taken */
+static volatile uint32_t u32LatencyCycles;
+#endif
+
+typedef struct
+{
+	uint32_t u32Count;					/* Number of times the operation ran */
+	uint32_t u32Ticks;					/* Total time in microseconds */
+} tProfileCounter;
+
+static tProfileCounter asProfileCounters[PROFILE_COUNTER_COUNT];
+
+/* Set while waiting for a character, from the time given */
+static uint32_t u32UARTWaiting = 0;
+static uint32_t u32UARTWaitStart;
+
+/*****************************************************************************
+ ** Function name:	vProfileInit
+ **
+ ** Descriptions:	Clears the counters and starts the free running timer.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileInit(void)
+{
+	uint32_t i;
+
+	for (i = 0; i < PROFILE_COUNTER_COUNT; i++)
+	{
+		asProfileCounters[i].u32Count = 0;
+		asProfileCounters[i].u32Ticks = 0;
+	}
+	u32UARTWaiting = 0;
+	vTimerTicksStart();
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileStop
+ **
+ ** Descriptions:	Stops the free running timer, returning it to its reset
+ ** 				state for the application.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileStop(void)
+{
+	vTimerTicksStop();
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileAdd
+ **
+ ** Descriptions:	Records one run of a profiled operation. Called through
+ ** 				PROFILE_EXIT().
+ **
+ ** Parameters:	    u32Counter - PROFILE_ counter.
+ ** 				u32StartTicks - Timer value when the operation started.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileAdd(uint32_t u32Counter, uint32_t u32StartTicks)
+{
+	uint32_t u32Ticks = u32TimerTicks() - u32StartTicks;
+
+	asProfileCounters[u32Counter].u32Count++;
+	asProfileCounters[u32Counter].u32Ticks += u32Ticks;
+
+	/* The operation ran between polls of the UART, so was not time spent
+	   waiting for a character */
+	if (u32UARTWaiting != 0)
+	{
+		u32UARTWaitStart += u32Ticks;
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileUARTPoll
+ **
+ ** Descriptions:	Times the waits for received characters. Called through
+ ** 				PROFILE_UART_POLL() each time the receive buffer is read,
+ ** 				a wait runs from the first read that finds it empty to
+ ** 				the next read that returns a character.
+ **
+ ** Parameters:	    u32Received - Number of characters read.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileUARTPoll(uint32_t u32Received)
+{
+	if (u32Received == 0)
+	{
+		if (u32UARTWaiting == 0)
+		{
+			u32UARTWaitStart = u32TimerTicks();
+			u32UARTWaiting = 1;
+		}
+	}
+	else if (u32UARTWaiting != 0)
+	{
+		u32UARTWaiting = 0;
+		vProfileAdd(PROFILE_UART_WAIT, u32UARTWaitStart);
+	}
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileEvent
+ **
+ ** Descriptions:	Records an event that is counted rather than timed.
+ ** 				Called through PROFILE_EVENT().
+ **
+ ** Parameters:	    u32Counter - PROFILE_ counter.
+ ** 				u32Amount - Added to the counter's second value.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileEvent(uint32_t u32Counter, uint32_t u32Amount)
+{
+	asProfileCounters[u32Counter].u32Count++;
+	asProfileCounters[u32Counter].u32Ticks += u32Amount;
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileSend
+ **
+ ** Descriptions:	Sends the summary frame described in profile.h. The CRC
+ ** 				is accumulated a character at a time so that sending the
+ ** 				frame does not change the PROFILE_CRC_CALC counter.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileSend(void)
+{
+	uint8_t au8Frame[2 + (PROFILE_COUNTER_COUNT * 8) + 2];
+	uint32_t u32Len = 0;
+	uint32_t i;
+	uint16_t u16FrameCRC = 0;
+
+	/* Counted by the UART's interrupt handler, which cannot call out of RAM */
+	asProfileCounters[PROFILE_UART_OVERRUN].u32Count = u32UARTErrorCount(UART_ERROR_OVERRUN);
+	asProfileCounters[PROFILE_UART_FRAMING].u32Count = u32UARTErrorCount(UART_ERROR_FRAMING);
+	asProfileCounters[PROFILE_UART_BREAK].u32Count = u32UARTErrorCount(UART_ERROR_BREAK);
+	asProfileCounters[PROFILE_UART_DROPPED].u32Count = u32UARTErrorCount(UART_ERROR_DROPPED);
+
+	au8Frame[u32Len++] = PROFILE_QUERY;
+	au8Frame[u32Len++] = PROFILE_COUNTER_COUNT;
+	for (i = 0; i < PROFILE_COUNTER_COUNT; i++)
+	{
+		uint32_t u32Count = asProfileCounters[i].u32Count;
+		uint32_t u32Time_us = asProfileCounters[i].u32Ticks;
+
+		au8Frame[u32Len++] = (uint8_t)(u32Count);
+		au8Frame[u32Len++] = (uint8_t)(u32Count >> 8);
+		au8Frame[u32Len++] = (uint8_t)(u32Count >> 16);
+		au8Frame[u32Len++] = (uint8_t)(u32Count >> 24);
+		au8Frame[u32Len++] = (uint8_t)(u32Time_us);
+		au8Frame[u32Len++] = (uint8_t)(u32Time_us >> 8);
+		au8Frame[u32Len++] = (uint8_t)(u32Time_us >> 16);
+		au8Frame[u32Len++] = (uint8_t)(u32Time_us >> 24);
+	}
+
+	for (i = 1; i < u32Len; i++)
+	{
+		u16FrameCRC = u16CRC_Update16(u16FrameCRC, au8Frame[i]);
+	}
+	au8Frame[u32Len++] = (uint8_t)(u16FrameCRC >> 8);
+	au8Frame[u32Len++] = (uint8_t)(u16FrameCRC);
+
+	vUARTSend(&au8Frame[0], u32Len);
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileIRQLatency
+ **
+ ** Descriptions:	Measures interrupt entry latency through the RAM vector
+ ** 				table, directly and through a trampoline equivalent to
+ ** 				the redirection handlers the RAM vector table replaced
+ ** 				(literal load, load of the handler address from flash,
+ ** 				MOV PC). SysTick is started from the core clock and the
+ ** 				handler reads how far the counter has run since it
+ ** 				wrapped and pended the interrupt, which is the latency
+ ** 				to within a cycle. Each path's samples and total cycles
+ ** 				are added to its PROFILE_IRQ_ counter, the difference
+ ** 				between the means is the trampoline's cost per interrupt.
+ ** 				Called before the first poll, while the line is quiet.
+ **
+ ** Parameters:	    ppfnVectors - Vector table mapped to address zero.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vProfileIRQLatency(void (**ppfnVectors)(void))
+{
+#if PROFILE_IRQ_LATENCY
+	void (*pfnSaved)(void) = ppfnVectors[PROFILE_SYSTICK_VECTOR];
+	uint32_t u32Counter;
+	uint32_t i;
+
+	for (u32Counter = PROFILE_IRQ_DIRECT; u32Counter <= PROFILE_IRQ_TRAMPOLINE; u32Counter++)
+	{
+		ppfnVectors[PROFILE_SYSTICK_VECTOR] =
+			(u32Counter == PROFILE_IRQ_DIRECT) ? &vProfileSysTick : &vProfileTrampoline;
+
+		for (i = 0; i < PROFILE_LATENCY_SAMPLES; i++)
+		{
+			u32LatencyCycles = 0;
+			SysTick->LOAD = PROFILE_LATENCY_RELOAD;
+			SysTick->VAL = 0;
+			SysTick->CTRL = PROFILE_SYSTICK_START;
+			while (u32LatencyCycles == 0);
+			vProfileEvent(u32Counter, u32LatencyCycles);
+		}
+	}
+	ppfnVectors[PROFILE_SYSTICK_VECTOR] = pfnSaved;
+#else
+	(void)ppfnVectors;
+#endif
+}
+
+#if PROFILE_IRQ_LATENCY
+/*****************************************************************************
+ ** Function name:	vProfileSysTick
+ **
+ ** Descriptions:	SysTick handler for vProfileIRQLatency(). Records the
+ ** 				cycles counted since the wrap and stops the counter.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vProfileSysTick(void)
+{
+	uint32_t u32Value = SysTick->VAL;
+
+	SysTick->CTRL = 0;
+	u32LatencyCycles = PROFILE_LATENCY_RELOAD - u32Value;
+}
+
+/*****************************************************************************
+ ** Function name:	vProfileTrampoline
+ **
+ ** Descriptions:	Redirects to vProfileSysTick() the way the removed
+ ** 				handlers redirected to the application.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vProfileTrampoline(void)
+{
+	asm volatile("ldr r0, =pfnProfileTarget");
+	asm volatile("ldr r0, [r0]");
+	asm volatile("mov pc, r0");
+}
+#endif
+
+#endif /* BOOTLOADER_PROFILE */
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
@@ -0,0 +1,100 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Optional profiling counters recording how often, and for how
+ * 				long, the bootloader's time consuming operations run.
+ *
+ * Copyright(C) 2010, NXP Semiconductor
+ * All rights reserved.
+ *
+ *****************************************************************************
+ * Software that is described herein is for illustrative purposes only
+ * which provides customers with programming information regarding the
+ * products. This software is supplied "AS IS" without any warranties.
+ * NXP Semiconductors assumes no responsibility or liability for the
+ * use of the software, conveys no license or title under any patent,
+ * copyright, or mask work right to the product. NXP Semiconductors
+ * reserves the right to make changes in the software without
+ * notification. NXP Semiconductors also make no representation or
+ * warranty that such application will be suitable for the specified
+ * use without further testing or modification.
+ *****************************************************************************/
+#ifndef __PROFILE_H
+#define __PROFILE_H
+
+#include <stdint.h>
+#include "timer.h"
+
+/* Set to 1 to build the profiling counters into the bootloader. Each
+   profiled operation then costs two reads of a free running timer. */
+#ifndef BOOTLOADER_PROFILE
+#define BOOTLOADER_PROFILE			0
+#endif
+
+/* Counters, in the order they are sent in the summary frame */
+#define PROFILE_CRC_CALC			0		/* u16CRC_Calc16() */
+#define PROFILE_IAP_COPY			1		/* u32IAP_CopyRAMToFlash() */
+#define PROFILE_IAP_COMPARE			2		/* u32IAP_Compare() */
+#define PROFILE_IAP_ERASE			3		/* u32IAP_EraseSectors() */
+#define PROFILE_UART_WAIT			4		/* Waiting for a received character */
+#define PROFILE_APP_CHECK			5		/* Startup application check */
+#define PROFILE_RESYNC				6		/* Search for a packet header (event) */
+#define PROFILE_LINE_ERROR			7		/* Packet rejected for a line error (event) */
+#define PROFILE_UART_OVERRUN		8		/* UART_ERROR_ counters (event) */
+#define PROFILE_UART_FRAMING		9
+#define PROFILE_UART_BREAK			10
+#define PROFILE_UART_DROPPED		11
+#define PROFILE_IRQ_DIRECT			12		/* Interrupt entry latency probe (event) */
+#define PROFILE_IRQ_TRAMPOLINE		13
+#define PROFILE_COUNTER_COUNT		14
+
+/* Set to 0 where SysTick cannot be used to time interrupt entry, the
+   PROFILE_IRQ_ counters are then left at zero */
+#ifndef PROFILE_IRQ_LATENCY
+#define PROFILE_IRQ_LATENCY			1
+#endif
+
+/* Summary frame, sent at the end of an update or when the server sends
+   PROFILE_QUERY instead of starting a packet:
+
+   PROFILE_QUERY, the number of counters (N), N pairs of 32-bit little
+   endian values (number of times the operation ran, total time in
+   microseconds) and a CRC (MSB first) of the count and values.
+
+   Time spent in other profiled operations while waiting for a character
+   is not included in PROFILE_UART_WAIT. PROFILE_APP_CHECK includes the
+   CRC calculation it makes. Event counters record an amount in place of
+   the time: for PROFILE_RESYNC and PROFILE_LINE_ERROR, the number of
+   characters discarded. The PROFILE_UART_ counters are copied from the
+   UART's receive error counters and have no second value (zero).
+   PROFILE_IRQ_DIRECT and PROFILE_IRQ_TRAMPOLINE record the SysTick
+   samples taken by vProfileIRQLatency() and their total entry latency in
+   core clock cycles, see profile.c. */
+#define PROFILE_QUERY				0x50	/* 'P' */
+
+#if BOOTLOADER_PROFILE
+#define PROFILE_ENTER(t)			uint32_t t = u32TimerTicks()
+#define PROFILE_EXIT(u32Counter, t)	vProfileAdd((u32Counter), (t))
+#define PROFILE_UART_POLL(u32Rx)	vProfileUARTPoll(u32Rx)
+#define PROFILE_EVENT(u32Counter, u32Amount)	vProfileEvent((u32Counter), (u32Amount))
+
+void vProfileInit(void);
+void vProfileStop(void);
+void vProfileAdd(uint32_t u32Counter, uint32_t u32StartTicks);
+void vProfileUARTPoll(uint32_t u32Received);
+void vProfileEvent(uint32_t u32Counter, uint32_t u32Amount);
+void vProfileSend(void);
+void vProfileIRQLatency(void (**ppfnVectors)(void));
+#else
+#define PROFILE_ENTER(t)
+#define PROFILE_EXIT(u32Counter, t)
+#define PROFILE_UART_POLL(u32Rx)
+#define PROFILE_EVENT(u32Counter, u32Amount)
+#endif
+
+#endif /* end __PROFILE_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
@@ -0,0 +1,181 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Provides the timeouts used by the Xmodem1K client and the
+ * 				free running tick count used by the profiling counters.
+ *
+ * Copyright(C) 2010, NXP Semiconductor
+ * All rights reserved.
+ *
+ *****************************************************************************
+ * Software that is described herein is for illustrative purposes only
+ * which provides customers with programming information regarding the
+ * products. This software is supplied "AS IS" without any warranties.
+ * NXP Semiconductors assumes no responsibility or liability for the
+ * use of the software, conveys no license or title under any patent,
+ * copyright, or mask work right to the product. NXP Semiconductors
+ * reserves the right to make changes in the software without
+ * notification. NXP Semiconductors also make no representation or
+ * warranty that such application will be suitable for the specified
+ * use without further testing or modification.
+ *****************************************************************************/
+#include <LPC11xx.h>
+#include "timer.h"
+
+/* Timer 0 counts allowed between characters, see vTimerStartGap() */
+static uint32_t u32GapTicks;
+
+/*****************************************************************************
+ ** Function name:	vTimerStart
+ **
+ ** Descriptions:	Starts a one shot timeout using 32-bit timer 0. Any
+ ** 				timeout already running is restarted.
+ **
+ ** Parameters:	    u32Periodms - Timeout period in milliseconds.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerStart(uint32_t u32Periodms)
+{
+	/* Enable the timer clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1UL << 9);
+
+	/* Configure the timer so that we can poll for a match */
+	LPC_TMR32B0->TCR = 0x02;		/* reset timer */
+	LPC_TMR32B0->PR  = 0x00;		/* set prescaler to zero */
+	LPC_TMR32B0->MR0 = u32Periodms * ((SystemCoreClock / (LPC_TMR32B0->PR + 1)) / 1000UL);
+	LPC_TMR32B0->IR  = 0xFF;		/* reset all interrupts */
+	LPC_TMR32B0->MCR = 0x04;		/* stop timer on match */
+	LPC_TMR32B0->TCR = 0x01;		/* start timer */
+}
+
+/*****************************************************************************
+ ** Function name:	u32TimerExpired
+ **
+ ** Descriptions:	Checks whether the timeout started by vTimerStart() has
+ ** 				expired. The timer stops itself on the match.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: 1 if the timeout has expired, otherwise 0.
+ **
+ *****************************************************************************/
+uint32_t u32TimerExpired(void)
+{
+	return ((LPC_TMR32B0->TCR & 0x01) == 0) ? 1 : 0;
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerStartGap
+ **
+ ** Descriptions:	Starts a one shot timeout using 32-bit timer 0 that also
+ ** 				expires if vTimerRestartGap() is not called often enough.
+ ** 				MR1 holds the overall period and MR0 the end of the
+ ** 				current gap, the timer stops on either match so that
+ ** 				u32TimerExpired() covers both.
+ **
+ ** Parameters:	    u32Periodms - Timeout period in milliseconds.
+ ** 				u32Gapus - Longest gap between restarts in microseconds.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerStartGap(uint32_t u32Periodms, uint32_t u32Gapus)
+{
+	/* Enable the timer clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1UL << 9);
+
+	u32GapTicks = u32Gapus * (SystemCoreClock / 1000000UL);
+
+	LPC_TMR32B0->TCR = 0x02;		/* reset timer */
+	LPC_TMR32B0->PR  = 0x00;		/* set prescaler to zero */
+	LPC_TMR32B0->MR0 = u32GapTicks;
+	LPC_TMR32B0->MR1 = u32Periodms * (SystemCoreClock / 1000UL);
+	LPC_TMR32B0->IR  = 0xFF;		/* reset all interrupts */
+	LPC_TMR32B0->MCR = 0x24;		/* stop timer on MR0 or MR1 match */
+	LPC_TMR32B0->TCR = 0x01;		/* start timer */
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerRestartGap
+ **
+ ** Descriptions:	Moves the end of the gap started by vTimerStartGap() on
+ ** 				from now. Cheap enough to call for every character. Has
+ ** 				no effect once the timeout has expired.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerRestartGap(void)
+{
+	LPC_TMR32B0->MR0 = LPC_TMR32B0->TC + u32GapTicks;
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerTicksStart
+ **
+ ** Descriptions:	Starts 32-bit timer 1 counting up at TIMER_TICK_HZ. It
+ ** 				runs freely, wrapping after about 71 minutes, so that
+ ** 				intervals can be measured by reading it twice.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerTicksStart(void)
+{
+	/* Enable the timer clock */
+	LPC_SYSCON->SYSAHBCLKCTRL |= (1UL << 10);
+
+	LPC_TMR32B1->TCR = 0x02;		/* reset timer */
+	LPC_TMR32B1->PR  = (SystemCoreClock / TIMER_TICK_HZ) - 1;
+	LPC_TMR32B1->MCR = 0x00;		/* no action on match, free running */
+	LPC_TMR32B1->IR  = 0xFF;		/* reset all interrupts */
+	LPC_TMR32B1->TCR = 0x01;		/* start timer */
+}
+
+/*****************************************************************************
+ ** Function name:	vTimerTicksStop
+ **
+ ** Descriptions:	Stops the timer started by vTimerTicksStart() and returns
+ ** 				it to its reset state.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+void vTimerTicksStop(void)
+{
+	LPC_TMR32B1->TCR = 0x02;		/* hold timer in reset */
+	LPC_TMR32B1->PR  = 0x00;
+	LPC_TMR32B1->TCR = 0x00;
+
+	/* Disable the timer clock */
+	LPC_SYSCON->SYSAHBCLKCTRL &= ~(1UL << 10);
+}
+
+/*****************************************************************************
+ ** Function name:	u32TimerTicks
+ **
+ ** Descriptions:	Reads the free running tick count.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Ticks since vTimerTicksStart() was called.
+ **
+ *****************************************************************************/
+uint32_t u32TimerTicks(void)
+{
+	return LPC_TMR32B1->TC;
+}
+
+/*****************************************************************************
+ **                            End Of File
+ *****************************************************************************/
@@ -0,0 +1,44 @@
+/*****************************************************************************
+ * $Id$
+ *
+ * Project: 	NXP LPC1100 Secondary Bootloader Example
+ *
+ * Description: Provides the timeouts used by the Xmodem1K client and the
+ * 				free running tick count used by the profiling counters.
+ *
+ * Copyright(C) 2010, NXP Semiconductor
+ * All rights reserved.
+ *
+ *****************************************************************************
+ * Software that is described herein is for illustrative purposes only
+ * which provides customers with programming information regarding the
+ * products. This software is supplied "AS IS" without any warranties.
+ * NXP Semiconductors assumes no responsibility or liability for the
+ * use of the software, conveys no license or title under any patent,
+ * copyright, or mask work right to the product. NXP Semiconductors
+ * reserves the right to make changes in the software without
+ * notification. NXP Semiconductors also make no representation or
+ * warranty that such application will be suitable for the specified
+ * use without further testing or modification.
+ *****************************************************************************/
+#ifndef __TIMER_H
+#define __TIMER_H
+
+#include <stdint.h>
+
+void vTimerStart(uint32_t u32Periodms);
+uint32_t u32TimerExpired(void);
+void vTimerStartGap(uint32_t u32Periodms, uint32_t u32Gapus);
+void vTimerRestartGap(void);
+
+/* Rate of the free running tick count, one tick per microsecond */
+#define TIMER_TICK_HZ				1000000UL
+
+void vTimerTicksStart(void);
+void vTimerTicksStop(void);
+uint32_t u32TimerTicks(void);
+
+#endif /* end __TIMER_H */
+/*****************************************************************************
+**                            End Of File
+******************************************************************************/
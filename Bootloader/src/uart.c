@@ -21,6 +21,7 @@
  * use without further testing or modification.
  *****************************************************************************/
 #include <LPC11xx.h>
+#include "profile.h"
 #include "uart.h"
 
 /* UART line status register (LSR) bit definitions */
@@ -33,6 +34,54 @@
 #define LSR_TEMT	0x40
 #define LSR_RXFE	0x80
 
+/* Largest acceptable difference between the requested and the generated
+   baud rate, in parts per thousand of the requested rate */
+#define UART_MAX_BAUD_ERROR_PPT		15
+
+/* Largest fractional divider MULVAL tried, at most 15. With the 48MHz UART
+   clock the divisor latch alone is within 0.2% of every standard rate up to
+   230400, so only it is searched unless this is raised for faster rates
+   (XMODEM_NEGOTIATE offers up to 921600) or other clocks */
+#ifndef UART_FDR_MULVAL_MAX
+#define UART_FDR_MULVAL_MAX		1
+#endif
+
+/* UART interrupt enable register (IER) bit definitions */
+#define IER_RBR		0x01
+
+/* UART auto-baud control register (ACR) bit definitions */
+#define ACR_START			0x001
+#define ACR_MODE			0x002
+#define ACR_AUTORESTART		0x004
+#define ACR_ABEOINTCLR		0x100
+#define ACR_ABTOINTCLR		0x200
+
+/* Size of the software receive buffer, must be a power of two. Sized to hold
+   the characters that arrive while the CPU is stalled by an IAP operation.
+   A sector erase (about 100ms) can overlap the whole of the next 1K packet
+   (1029 characters) at the faster negotiated rates. */
+#define UART_RX_BUFFER_SIZE		2048
+#define UART_RX_BUFFER_MASK		(UART_RX_BUFFER_SIZE - 1)
+
+/* Functions that must keep running while flash memory is unavailable (during
+   IAP erase and program operations) are linked into RAM. The startup code
+   copies them there along with the rest of the initialized data. */
+#define UART_RAMFUNC	__attribute__ ((section(".data.ramfunc")))
+
+/* Receive ring buffer, written by the interrupt handler and read by
+   u8UARTReceive(). Head and tail are free running and only ever written by
+   one side each so no locking is required. */
+static volatile uint8_t au8RxRingBuffer[UART_RX_BUFFER_SIZE];
+static volatile uint32_t u32RxHead = 0;
+static volatile uint32_t u32RxTail = 0;
+
+/* Receive errors, counted by the interrupt handler */
+static volatile uint32_t au32RxErrors[UART_ERROR_COUNT];
+
+/* Local functions */
+static uint32_t u32UARTGetPClk(void);
+static uint32_t u32UARTCalcDivisors(uint32_t u32BaudRate, uint32_t *pu32DL, uint32_t *pu32FDR);
+
 /*****************************************************************************
 ** Function name:	vUARTInit
 **
@@ -46,10 +95,9 @@
 *****************************************************************************/
 void vUARTInit(uint32_t u32BaudRate)
 {
-	uint32_t Fdiv;
 	uint32_t regVal;
 
-	/* Not using interrupts */
+	/* Keep the interrupt disabled until the UART is configured */
 	NVIC_DisableIRQ(UART_IRQn);
 
 	/* UART I/O config */
@@ -62,14 +110,9 @@ void vUARTInit(uint32_t u32BaudRate)
 	LPC_SYSCON->SYSAHBCLKCTRL |= (1<<12);
 	LPC_SYSCON->UARTCLKDIV = 0x1;     /* divided by 1 */
 
-	LPC_UART->LCR = 0x83;             /* 8 bits, no Parity, 1 Stop bit */
-	regVal = LPC_SYSCON->UARTCLKDIV;
-	Fdiv = (((SystemCoreClock/LPC_SYSCON->SYSAHBCLKDIV)/regVal)/16)/u32BaudRate ;	/*baud rate */
-
-	LPC_UART->DLM = Fdiv / 256;
-	LPC_UART->DLL = Fdiv % 256;
-	LPC_UART->LCR = 0x03;		/* DLAB = 0 */
-	LPC_UART->FCR = 0x07;		/* Enable and reset TX and RX FIFO. */
+	LPC_UART->LCR = 0x03;             /* 8 bits, no Parity, 1 Stop bit */
+	(void)u32UARTSetBaudRate(u32BaudRate);
+	LPC_UART->FCR = 0x87;		/* Enable and reset TX and RX FIFO, RX trigger level 8 characters. */
 
 	/* Read to clear the line status. */
 	regVal = LPC_UART->LSR;
@@ -81,12 +124,275 @@ void vUARTInit(uint32_t u32BaudRate)
 	{
 		regVal = LPC_UART->RBR;	/* Dump data from RX FIFO */
 	}
+
+	/* Start with an empty receive buffer */
+	u32RxHead = 0;
+	u32RxTail = 0;
+
+	/* Receive data is collected by the interrupt handler, the vector must
+	   already point at vUARTIRQHandler() before the interrupt is enabled. */
+	LPC_UART->IER = IER_RBR;
+	NVIC_EnableIRQ(UART_IRQn);
+}
+
+/*****************************************************************************
+** Function name:	u32UARTSetBaudRate
+**
+** Descriptions:	Change the UART0 baud rate, using the divisor latch and
+** 					fractional divider setting that gives the smallest error.
+** 					Waits for any transmission in progress to complete.
+**
+** Parameters:		u32BaudRate - UART baudrate
+**
+** Returned value:	1 if the rate was set, 0 if it cannot be generated within
+** 					UART_MAX_BAUD_ERROR_PPT of the requested rate.
+**
+*****************************************************************************/
+uint32_t u32UARTSetBaudRate(uint32_t u32BaudRate)
+{
+	uint32_t u32DL;
+	uint32_t u32FDR;
+	uint32_t u32Result = 0;
+
+	if (u32UARTCalcDivisors(u32BaudRate, &u32DL, &u32FDR) != 0)
+	{
+		/* Do not corrupt a character that is still being sent */
+		while ((LPC_UART->LSR & LSR_TEMT) == 0);
+
+		LPC_UART->LCR = 0x83;		/* DLAB = 1 */
+		LPC_UART->DLM = u32DL / 256;
+		LPC_UART->DLL = u32DL % 256;
+		LPC_UART->FDR = u32FDR;
+		LPC_UART->LCR = 0x03;		/* DLAB = 0 */
+		u32Result = 1;
+	}
+	return u32Result;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTBaudRateSupported
+**
+** Descriptions:	Check whether a baud rate can be generated from the
+** 					current UART clock.
+**
+** Parameters:		u32BaudRate - UART baudrate
+**
+** Returned value:	1 if u32UARTSetBaudRate() would accept the rate, else 0.
+**
+*****************************************************************************/
+uint32_t u32UARTBaudRateSupported(uint32_t u32BaudRate)
+{
+	uint32_t u32DL;
+	uint32_t u32FDR;
+
+	return u32UARTCalcDivisors(u32BaudRate, &u32DL, &u32FDR);
+}
+
+/*****************************************************************************
+** Function name:	vUARTAutoBaudStart
+**
+** Descriptions:	Start measuring the baud rate of the next character
+** 					received, using the auto-baud unit in mode 0. The start
+** 					bit and bit 0 are timed, so the character must have
+** 					bit 0 set and bit 1 clear (e.g. SOH or carriage return).
+** 					Characters received until the measurement completes
+** 					are meaningless and should be ignored.
+**
+** Parameters:		None
+**
+** Returned value:	None
+**
+*****************************************************************************/
+void vUARTAutoBaudStart(void)
+{
+	/* Measurement is made with the fractional divider disabled */
+	LPC_UART->FDR = 0x10;
+	LPC_UART->ACR = ACR_ABEOINTCLR | ACR_ABTOINTCLR;
+
+	/* Mode 0, restart if a character does not match the expected pattern */
+	LPC_UART->ACR = ACR_START | ACR_AUTORESTART;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTAutoBaudResult
+**
+** Descriptions:	Check for completion of an auto-baud measurement. Once
+** 					complete the divisor latch holds the measured value and
+** 					the receive buffers are emptied, losing the timed
+** 					character.
+**
+** Parameters:		None
+**
+** Returned value:	Measured baud rate, 0 if the measurement has not completed.
+**
+*****************************************************************************/
+uint32_t u32UARTAutoBaudResult(void)
+{
+	uint32_t u32Rate = 0;
+	uint32_t u32DL;
+
+	if ((LPC_UART->ACR & ACR_START) == 0)
+	{
+		LPC_UART->ACR = ACR_ABEOINTCLR | ACR_ABTOINTCLR;
+
+		LPC_UART->LCR = 0x83;		/* DLAB = 1 */
+		u32DL = (LPC_UART->DLM << 8) | LPC_UART->DLL;
+		LPC_UART->LCR = 0x03;		/* DLAB = 0 */
+
+		if (u32DL != 0)
+		{
+			u32Rate = u32UARTGetPClk() / (16 * u32DL);
+		}
+
+		/* Discard anything received before or during the measurement */
+		LPC_UART->FCR = 0x83;		/* Reset RX FIFO, RX trigger level 8 characters. */
+		u32RxTail = u32RxHead;
+	}
+	return u32Rate;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTGetPClk
+**
+** Descriptions:	Get the frequency of the clock supplied to the UART.
+**
+** Parameters:		None
+**
+** Returned value:	UART clock in Hz.
+**
+*****************************************************************************/
+static uint32_t u32UARTGetPClk(void)
+{
+	return (SystemCoreClock / LPC_SYSCON->SYSAHBCLKDIV) / LPC_SYSCON->UARTCLKDIV;
+}
+
+/*****************************************************************************
+** Function name:	u32UARTCalcDivisors
+**
+** Descriptions:	Search the fractional divider settings (MULVAL 1 to
+** 					UART_FDR_MULVAL_MAX, DIVADDVAL 0 to MULVAL - 1) for the
+** 					one that, with the nearest divisor latch value, gives
+** 					the baud rate closest to that requested:
+**
+** 					baud = PCLK / (16 * DL * (1 + DIVADDVAL / MULVAL))
+**
+** Parameters:		u32BaudRate - UART baudrate
+** 					pu32DL - Divisor latch value (DLM:DLL).
+** 					pu32FDR - Fractional divider register value.
+**
+** Returned value:	1 if a setting within UART_MAX_BAUD_ERROR_PPT of the
+** 					requested rate was found, otherwise 0.
+**
+*****************************************************************************/
+static uint32_t u32UARTCalcDivisors(uint32_t u32BaudRate, uint32_t *pu32DL, uint32_t *pu32FDR)
+{
+	uint32_t u32PClk;
+	uint32_t u32MulVal;
+	uint32_t u32DivAddVal;
+	uint32_t u32BestError = 0xFFFFFFFFUL;
+
+	/* Clock supplied to the UART */
+	u32PClk = u32UARTGetPClk();
+
+	if (u32BaudRate != 0)
+	{
+		for (u32MulVal = 1; u32MulVal <= UART_FDR_MULVAL_MAX; u32MulVal++)
+		{
+			for (u32DivAddVal = 0; u32DivAddVal < u32MulVal; u32DivAddVal++)
+			{
+				uint32_t u32Div = 16 * u32BaudRate * (u32MulVal + u32DivAddVal);
+				uint32_t u32DL = ((u32PClk * u32MulVal) + (u32Div / 2)) / u32Div;
+				uint32_t u32Actual;
+				uint32_t u32Error;
+
+				/* Divisor latch must fit in DLM:DLL, and be at least 3 when the
+				   fractional divider is in use */
+				if ((u32DL == 0) || (u32DL > 0xFFFF) || ((u32DivAddVal != 0) && (u32DL < 3)))
+				{
+					continue;
+				}
+
+				u32Actual = (u32PClk * u32MulVal) / (16 * u32DL * (u32MulVal + u32DivAddVal));
+				u32Error = (u32Actual > u32BaudRate) ? (u32Actual - u32BaudRate) : (u32BaudRate - u32Actual);
+
+				if (u32Error < u32BestError)
+				{
+					u32BestError = u32Error;
+					*pu32DL = u32DL;
+					*pu32FDR = (u32MulVal << 4) | u32DivAddVal;
+				}
+			}
+		}
+	}
+	return ((u32BestError != 0xFFFFFFFFUL) &&
+			((u32BestError * 1000) <= (u32BaudRate * UART_MAX_BAUD_ERROR_PPT))) ? 1 : 0;
 }
 
 /*****************************************************************************
-** Function name:	vUARTReceive
+** Function name:	vUARTIRQHandler
 **
-** Descriptions:	Reads received data from UART0 FIFO
+** Descriptions:	UART0 interrupt handler. Moves all characters from the
+** 					receive FIFO into the receive ring buffer, counting line
+** 					errors. Located in RAM so that it can run while IAP
+** 					operations are in progress.
+**
+** Parameters:		None
+**
+** Returned value:	None
+**
+*****************************************************************************/
+UART_RAMFUNC void vUARTIRQHandler(void)
+{
+	uint32_t u32Head = u32RxHead;
+	uint32_t u32LSR;
+
+	/* Reading IIR acknowledges the interrupt, both the receive data available
+	   and character timeout interrupts are serviced by emptying the FIFO */
+	(void)LPC_UART->IIR;
+
+	/* The error bits describe the character at the head of the FIFO and are
+	   cleared by reading LSR, so it is read once per character */
+	while ((u32LSR = LPC_UART->LSR) & LSR_RDR)
+	{
+		uint8_t u8Data = LPC_UART->RBR;
+
+		if ((u32LSR & (LSR_OE | LSR_FE | LSR_BI)) != 0)
+		{
+			if ((u32LSR & LSR_OE) != 0)
+			{
+				au32RxErrors[UART_ERROR_OVERRUN]++;
+			}
+			if ((u32LSR & LSR_BI) != 0)
+			{
+				au32RxErrors[UART_ERROR_BREAK]++;
+			}
+			else if ((u32LSR & LSR_FE) != 0)
+			{
+				au32RxErrors[UART_ERROR_FRAMING]++;
+			}
+			au32RxErrors[UART_ERROR_ANY]++;
+		}
+
+		/* Store character unless the ring buffer is full, in which case it
+		   is dropped and counted so that the packet can be rejected */
+		if ((u32Head - u32RxTail) < UART_RX_BUFFER_SIZE)
+		{
+			au8RxRingBuffer[u32Head & UART_RX_BUFFER_MASK] = u8Data;
+			u32Head++;
+		}
+		else
+		{
+			au32RxErrors[UART_ERROR_DROPPED]++;
+			au32RxErrors[UART_ERROR_ANY]++;
+		}
+	}
+	u32RxHead = u32Head;
+}
+
+/*****************************************************************************
+** Function name:	u8UARTReceive
+**
+** Descriptions:	Reads received data from the UART0 receive ring buffer
 **
 ** Parameters:		pu8Buffer - Pointer to buffer in which received characters
 ** 					are to be stored.
@@ -97,15 +403,35 @@ void vUARTInit(uint32_t u32BaudRate)
 uint8_t u8UARTReceive(uint8_t *pu8Buffer)
 {
 	uint8_t u8Len = 0;
+	uint32_t u32Tail = u32RxTail;
 
-	if (LPC_UART->LSR & LSR_RDR)
+	if (u32Tail != u32RxHead)
 	{
-		*pu8Buffer = LPC_UART->RBR;
+		*pu8Buffer = au8RxRingBuffer[u32Tail & UART_RX_BUFFER_MASK];
+		u32RxTail = u32Tail + 1;
 		u8Len++;
 	}
+	PROFILE_UART_POLL(u8Len);
 	return u8Len;
 }
 
+/*****************************************************************************
+** Function name:	u32UARTErrorCount
+**
+** Descriptions:	Reads a receive error counter. The counters run freely,
+** 					so errors during a period are found by comparing the
+** 					value at its start and end.
+**
+** Parameters:		u32Error - UART_ERROR_ counter.
+**
+** Returned value:	Number of errors since reset.
+**
+*****************************************************************************/
+uint32_t u32UARTErrorCount(uint32_t u32Error)
+{
+	return au32RxErrors[u32Error];
+}
+
 /*****************************************************************************
 ** Function name:	vUARTSend
 **
@@ -25,8 +25,23 @@
 
 #include <stdint.h>
 
+/* Receive errors counted since reset, see u32UARTErrorCount(). Parity errors
+   are not counted as the UART is set up without parity. */
+#define UART_ERROR_OVERRUN		0		/* Receive FIFO overrun, characters lost */
+#define UART_ERROR_FRAMING		1		/* Character with a bad stop bit */
+#define UART_ERROR_BREAK		2		/* Break condition on the line */
+#define UART_ERROR_DROPPED		3		/* Receive buffer full, character lost */
+#define UART_ERROR_ANY			4		/* Characters affected by any of the above */
+#define UART_ERROR_COUNT		5
+
 void vUARTInit(uint32_t u32BaudRate);
+uint32_t u32UARTSetBaudRate(uint32_t u32BaudRate);
+uint32_t u32UARTBaudRateSupported(uint32_t u32BaudRate);
+void vUARTAutoBaudStart(void);
+uint32_t u32UARTAutoBaudResult(void);
+void vUARTIRQHandler(void);
 uint8_t u8UARTReceive(uint8_t *pu8Buffer);
+uint32_t u32UARTErrorCount(uint32_t u32Error);
 void vUARTSend(uint8_t *pu8Buffer, uint32_t u32Len);
 
 #endif /* end __UART_H */
@@ -22,6 +22,8 @@
  *****************************************************************************/
 #include <LPC11xx.h>
 #include "crc.h"
+#include "profile.h"
+#include "timer.h"
 #include "uart.h"
 #include "xmodem1k.h"
 
@@ -31,55 +33,276 @@
 #define EOT							0x04
 #define ACK							0x06
 #define NAK							0x15
+#define CAN							0x18
 #define POLL						0x43
+#define BAUD_QUERY					0x42
+#define STREAM_POLL					0x47
+#define WINDOW_QUERY				0x57
 
 /* Internal state machine */
 #define STATE_IDLE					0
 #define STATE_CONNECTING			1
 #define STATE_RECEIVING				2
+#define STATE_NEGOTIATING			3
 
 /* Define the rate at which the server will be polled when starting a transfer */
 #define POLL_PERIOD_ms				3000
 
-/* Define packet timeout period (maximum time to receive a packet) */
-#define PACKET_TIMEOUT_PERIOD_ms	7000
+/* Damaged first packets accepted at a newly negotiated rate before giving up
+   on it, a line that loses the odd character still gets the faster rate */
+#ifndef BAUD_CONFIRM_ATTEMPTS
+#define BAUD_CONFIRM_ATTEMPTS		3
+#endif
 
-/* Baud rate to be used by UART interface */
-#define BAUD_RATE					9600
+/* Baud rate negotiation, performed before the first packet:
+
+   1. Instead of starting a packet in response to a poll, the server sends
+      BAUD_QUERY.
+   2. The client replies with BAUD_QUERY, the number of rates it supports
+      (N), N 32-bit little endian rates and a CRC (MSB first) of the count
+      and rates.
+   3. The server sends the index of the chosen rate followed by its one's
+      complement. The client replies with ACK at the current rate, or NAK if
+      the selection is invalid, and both sides switch to the chosen rate.
+   4. The client polls at the new rate. A damaged first packet is NAKed at
+      the new rate and sent again, after BAUD_CONFIRM_ATTEMPTS damaged
+      packets, or if nothing resembling a packet arrives by the end of the
+      poll period, both sides fall back to the rate the client was started
+      at.
+
+   Servers that do not send BAUD_QUERY are unaffected. */
+
+/* YMODEM batch header. When the caller supplies a header callback the server
+   may start with packet 0 in place of packet 1, holding the file name (NUL
+   terminated) and its size in decimal, optionally followed by a space and
+   further fields. The client acknowledges it, passes the name and size to
+   the callback (cancelling the transfer if it refuses them) and polls for
+   packet 1. Once the server's EOT has been acknowledged the client polls
+   again and the server ends the batch with a packet 0 holding an empty name.
+   Only one file is received, the client cancels a second. */
+
+/* Streaming, as YMODEM-G. In reply to a poll the server may send STREAM_POLL
+   to ask for streaming. If the caller supplies a stream callback and it
+   accepts, having prepared for packets arriving back to back (by erasing
+   flash in advance, for instance), the client polls with STREAM_POLL in place
+   of POLL from then on, otherwise it polls as usual. The server then sends
+   the rest of the file without waiting: the client only acknowledges packet
+   0, the first packet at a newly negotiated rate and EOT. A packet that
+   cannot be accepted cancels the transfer (CAN CAN), the server has to start
+   again from the beginning. */
+
+/* Sliding window. In reply to a poll the server may send WINDOW_QUERY. If the
+   caller supplies a stream callback and it accepts (packets arrive back to
+   back, as when streaming) the client replies with WINDOW_QUERY, the number
+   of packets (K) the server may have outstanding and its one's complement,
+   and the server starts sending without waiting for another poll, otherwise
+   the client polls as usual. From then on every packet is answered
+   with two characters: ACK and the number of the latest packet received in
+   order (acknowledging it and all those before it), or NAK and the number of
+   a packet that has to be sent again. Packets up to K - 1 ahead of a missing
+   one are held until it arrives, so only the missing packet is resent. The
+   client acknowledges EOT with ACK and the number following the last packet.
+   Packet 0 and the first packet at a newly negotiated rate are still sent
+   one at a time. If no packet arrives before the next poll the window lapses.
+   Servers that do not send WINDOW_QUERY are unaffected.
+
+   Each extension is only built in when its switch in xmodem1k.h is set. */
+
+/* Set to 1 to lock onto the server's baud rate instead of starting at a
+   fixed rate. The first character the server sends (which must have bit 0
+   set and bit 1 clear, e.g. SOH or carriage return) is timed by the UART
+   auto-baud unit and lost, the client then polls at the nearest offered
+   rate. The server must send that character unprompted as no polls are
+   sent until the rate is known. */
+#ifndef XMODEM_AUTOBAUD
+#define XMODEM_AUTOBAUD				0
+#endif
+
+/* Set to 1 to give up on a packet as soon as the UART reports one of its
+   characters lost or damaged, answering it when its end is due rather than
+   waiting for its CRC or, with characters lost, for its timeout */
+#ifndef XMODEM_LINE_ERRORS
+#define XMODEM_LINE_ERRORS			0
+#endif
+
+/* Rates offered to the server, or locked onto */
+#if XMODEM_NEGOTIATE || XMODEM_AUTOBAUD
+static const uint32_t au32BaudRates[] = {9600, 19200, 38400, 57600, 115200, 230400, 460800, 921600};
+#define BAUD_RATE_COUNT				(sizeof(au32BaudRates) / sizeof(au32BaudRates[0]))
+#endif
+
+/* Each packet of a sliding window needs its own receive buffer: the two used
+   for ping-pong reception are all that fit in 8K of RAM beside the UART
+   receive buffer, the flash block and the stack, a device with more RAM can
+   offer a larger window. */
+#if (XMODEM_WINDOW == 1) || ((XMODEM_WINDOW & (XMODEM_WINDOW - 1)) != 0)
+#error "XMODEM_WINDOW must be 0 or a power of two"
+#endif
+
+/* Timeouts while a packet is being received, scaled to the line rate so
+   that a lost character costs one retransmission rather than a stalled
+   transfer. A packet may take PACKET_TIMEOUT_PERCENT of its time on the
+   line and characters may be up to CHAR_TIMEOUT_CHARS character times
+   apart. Both allow some slack for the server and for USB serial adapters,
+   which deliver characters in bursts. On expiry the input is purged and
+   the packet is NAKed. Once a packet has been answered the server has as
+   long as a long packet is allowed to start the next, if the line stays
+   silent the response is taken to have been lost and the next packet is
+   NAKed, and NAKed again each time that period passes. */
+#ifndef PACKET_TIMEOUT_PERCENT
+#define PACKET_TIMEOUT_PERCENT		150
+#endif
+#define PACKET_TIMEOUT_SLACK_ms		100
+#ifndef CHAR_TIMEOUT_CHARS
+#define CHAR_TIMEOUT_CHARS			16
+#endif
+#define CHAR_TIMEOUT_SLACK_us		20000
+
+/* Bits per character on the line (start, 8 data, stop) */
+#define BITS_PER_CHAR				10
 
 /* Size of packet payloads and header */
 #define LONG_PACKET_PAYLOAD_LEN		1024
 #define SHORT_PACKET_PAYLOAD_LEN	128
 #define PACKET_HEADER_LEN			3
 
-/* Buffer in which received data is stored, must be aligned on a word boundary
+/* Number of packet receive buffers. Each packet is received into the buffer
+   selected by its number, so the buffers are used in turn (ping-pong) and a
+   packet can be acknowledged and written to flash while the next one is being
+   received, or held until a missing packet ahead of it has been resent. */
+#if XMODEM_WINDOW > 2
+#define RX_BUFFER_COUNT				XMODEM_WINDOW
+#else
+#define RX_BUFFER_COUNT				2
+#endif
+#define RX_BUFFER_IDX(u8Seq)		((uint32_t)(u8Seq) & (RX_BUFFER_COUNT - 1))
+
+/* Buffers in which received data is stored, must be aligned on a word boundary
    as point to this array is going to be passed to IAP routines (which require
    word alignment). */
-static uint8_t au8RxBuffer[LONG_PACKET_PAYLOAD_LEN] __attribute__ ((aligned(4)));
+static uint8_t au8RxBuffer[RX_BUFFER_COUNT][LONG_PACKET_PAYLOAD_LEN] __attribute__ ((aligned(4)));
+
+/* Length (0 if the buffer is free) and number of the packet held in each
+   buffer, written to flash in order once all packets before it have arrived */
+static uint16_t au16RxLen[RX_BUFFER_COUNT];
+static uint8_t au8RxSeq[RX_BUFFER_COUNT];
 
 /* Local functions */
-static void vTimerStart(uint32_t u32Periodms);
+static void vXmodem1k_Cancel(void);
+#if XMODEM_NEGOTIATE || XMODEM_AUTOBAUD
+static uint32_t u32Xmodem1k_BaudRate(uint32_t u32Index);
+#endif
+#if XMODEM_AUTOBAUD
+static uint32_t u32Xmodem1k_NearestBaudRate(uint32_t u32Measured);
+#endif
+#if XMODEM_NEGOTIATE
+static void vXmodem1k_SendBaudRates(void);
+#endif
+static uint32_t u32Xmodem1k_HeaderPlausible(const uint8_t *pu8Header, uint32_t u32Len,
+										   uint8_t u8NextSeq, uint32_t u32RepeatAllowed,
+										   uint32_t u32Window);
+static void vXmodem1k_Respond(uint8_t u8Cmd, uint8_t u8Seq, uint32_t u32Window);
+static uint32_t u32Xmodem1k_WritePending(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len),
+										 uint8_t *pu8WriteSeq, uint32_t u32Count);
+static void vXmodem1k_StartPacketTimeout(uint32_t u32PktLen, uint32_t u32LineRate);
+static void vXmodem1k_StartIdleTimeout(uint32_t u32LineRate);
+#if XMODEM_LINE_ERRORS
+static uint32_t u32Xmodem1k_CharsLost(void);
+#endif
+#if XMODEM_YMODEM
+static uint32_t u32Xmodem1k_ParseHeader(const uint8_t *pu8Data, uint32_t u32Len, uint32_t *pu32Size);
+#endif
+static uint32_t u32Xmodem1k_Purge(void);
 
 /*****************************************************************************
- ** Function name:
+ ** Function name:	u32Xmodem1k_Client
  **
- ** Descriptions:
+ ** Descriptions:	Receives a file using the Xmodem1K protocol. Each packet
+ ** 				is acknowledged as soon as its CRC has been verified and is
+ ** 				then passed to the callback, in order, while the next packet
+ ** 				is being received into another buffer. As the sender has
+ ** 				already been told the packet was good, a callback failure
+ ** 				cancels the transfer.
  **
- ** Parameters:	    None
+ ** Parameters:	    pu32Xmodem1kRxPacketCallback - Function that handles each
+ ** 				received packet, returns 0 on failure. Called with a
+ ** 				null pointer once the server ends the transfer.
+ ** 				pu32Xmodem1kRxHeaderCallback - Function that is given
+ ** 				the file name and size (0 if not sent) from a YMODEM
+ ** 				header, returns 0 to refuse the file. Null to accept
+ ** 				plain XMODEM transfers only.
+ ** 				pu32Xmodem1kStreamCallback - Function that prepares for
+ ** 				packets arriving back to back when the server asks to
+ ** 				stream or for a sliding window, returns 0 to refuse. Null
+ ** 				to refuse both.
+ ** 				u32BaudRate - Baud rate to be used by UART interface until
+ ** 				the server negotiates a faster one, and to fall back to.
+ ** 				Replaced by the detected rate when XMODEM_AUTOBAUD is set.
  **
- ** Returned value:  None
+ ** Returned value: 1 if the transfer completed, 0 if it was cancelled.
  **
  *****************************************************************************/
-void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len))
+uint32_t u32Xmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len),
+							uint32_t (*pu32Xmodem1kRxHeaderCallback)(const char *pcName, uint32_t u32Size),
+							uint32_t (*pu32Xmodem1kStreamCallback)(void),
+							uint32_t u32BaudRate)
 {
 	uint32_t u32InProgress = 1;
+	uint32_t u32Result = 0;
 	uint32_t u32State = STATE_IDLE;
-	uint32_t u32ByteCount;
-	uint32_t u32PktLen;
-	uint16_t u16CRC;
+	uint32_t u32ByteCount = 0;
+	uint32_t u32PktLen = 0;
+	uint32_t u32RxBufferIdx = 0;
+	uint32_t u32Store = 0;
+	uint32_t u32Window = 1;
+	uint32_t u32Naked = 0;
+	uint16_t u16CRC = 0;
+	uint16_t u16RunningCRC = 0;
+	uint32_t u32BaudConfirmPending = 0;
+	uint32_t u32LineRate = u32BaudRate;
+	uint32_t u32PacketsAccepted = 0;
+	uint32_t u32Resyncing = 0;
+	uint32_t u32Discarded = 0;
+#if XMODEM_LINE_ERRORS
+	uint32_t u32LineErrors = 0;
+	uint32_t u32LineLost = 0;
+	uint32_t u32LineError = 0;
+#endif
+	uint32_t u32Rejected = 0;
+	uint32_t u32Ymodem = 0;
+	uint32_t u32BatchEnd = 0;
+	uint32_t u32Streaming = 0;
+	uint8_t u8NextSeq = 1;
+	uint8_t u8WriteSeq = 1;
+	uint8_t u8EndSeq = 0;
+	uint8_t u8PacketSeq = 0;
+	uint8_t au8Header[PACKET_HEADER_LEN];
+#if XMODEM_NEGOTIATE
+	uint8_t au8BaudSelect[2];
+#endif
+#if XMODEM_AUTOBAUD
+	uint32_t u32AutoBaudPending = 1;
+#endif
+#if !XMODEM_YMODEM
+	/* Packet 0 is not expected */
+	pu32Xmodem1kRxHeaderCallback = 0;
+#endif
+#if !XMODEM_STREAMING && !XMODEM_WINDOW
+	(void)pu32Xmodem1kStreamCallback;
+#endif
+
+	for (u32RxBufferIdx = 0; u32RxBufferIdx < RX_BUFFER_COUNT; u32RxBufferIdx++)
+	{
+		au16RxLen[u32RxBufferIdx] = 0;
+	}
 
 	/* Prepare UART0 for RX/TX */
-	vUARTInit(BAUD_RATE);
+	vUARTInit(u32BaudRate);
+#if XMODEM_AUTOBAUD
+	/* Wait for the server's first character before polling */
+	vUARTAutoBaudStart();
+	u32State = STATE_CONNECTING;
+#endif
 
 	while(u32InProgress)
 	{
@@ -88,7 +311,7 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 			case STATE_IDLE:
 			{
 				/* Send command to server indicating we are ready to receive */
-				uint8_t u8Cmd = POLL;
+				uint8_t u8Cmd = (u32Streaming != 0) ? STREAM_POLL : POLL;
 				vUARTSend(&u8Cmd, 1);
 
 				/* Start timeout to send another poll if we do not get a response */
@@ -103,6 +326,36 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 			{
 				uint8_t u8Data;
 
+#if XMODEM_AUTOBAUD
+				if (u32AutoBaudPending != 0)
+				{
+					uint32_t u32Rate = u32UARTAutoBaudResult();
+
+					if (u32Rate != 0)
+					{
+						u32Rate = u32Xmodem1k_NearestBaudRate(u32Rate);
+						if (u32Rate != 0)
+						{
+							/* Locked on, this becomes the starting rate */
+							u32BaudRate = u32Rate;
+							u32LineRate = u32Rate;
+							u32AutoBaudPending = 0;
+							(void)u32UARTSetBaudRate(u32BaudRate);
+							u32State = STATE_IDLE;
+						}
+						else
+						{
+							/* Not a rate we offer, wait for another character */
+							vUARTAutoBaudStart();
+						}
+					}
+
+					/* Polls are not sent until the rate is known, the divisor
+					   is not valid for transmission during the measurement */
+					break;
+				}
+#endif
+
 				/* Check if a character has been received on the UART */
 				if (u8UARTReceive(&u8Data))
 				{
@@ -119,21 +372,102 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 							/* SOH indicates short payload packet is being transmitted */
 							u32PktLen = SHORT_PACKET_PAYLOAD_LEN;
 						}
+						au8Header[0] = u8Data;
 						u32ByteCount = 1;
+						u16RunningCRC = 0;
+#if XMODEM_LINE_ERRORS
+						u32LineErrors = u32UARTErrorCount(UART_ERROR_ANY);
+						u32LineLost = u32Xmodem1k_CharsLost();
+#endif
 
 						/* Start packet timeout */
-						vTimerStart(PACKET_TIMEOUT_PERIOD_ms);
+						vXmodem1k_StartPacketTimeout(u32PktLen, u32LineRate);
 
 						/* Wait for a further characters */
 						u32State = STATE_RECEIVING;
 					}
+					else if ((u8Data == EOT) && (u32BatchEnd != 0))
+					{
+						/* Our acknowledgement of the end of the file was lost */
+						vXmodem1k_Respond(ACK, u8EndSeq, u32Window);
+					}
+#if XMODEM_NEGOTIATE
+					else if (u8Data == BAUD_QUERY)
+					{
+						/* Server wants to change baud rate, tell it what we support
+						   and wait for its choice */
+						vXmodem1k_SendBaudRates();
+						vTimerStart(POLL_PERIOD_ms);
+						u32ByteCount = 0;
+						u32State = STATE_NEGOTIATING;
+					}
+#endif
+#if XMODEM_STREAMING
+					else if ((u8Data == STREAM_POLL) && (pu32Xmodem1kStreamCallback != 0) && (u32BatchEnd == 0))
+					{
+						/* Server wants to stream, poll again once ready (or
+						   straight away with POLL if the receiver refuses) */
+						if (pu32Xmodem1kStreamCallback() != 0)
+						{
+							u32Streaming = 1;
+						}
+						u32State = STATE_IDLE;
+					}
+#endif
+#if XMODEM_WINDOW
+					else if ((u8Data == WINDOW_QUERY) && (pu32Xmodem1kStreamCallback != 0) && (u32BatchEnd == 0))
+					{
+						/* Server wants a sliding window. Once ready for packets
+						   back to back tell it how many may be outstanding and
+						   wait for the first of them, or poll straight away if
+						   the receiver refuses. */
+						if (pu32Xmodem1kStreamCallback() != 0)
+						{
+							uint8_t au8Cmd[3] = {WINDOW_QUERY, XMODEM_WINDOW, (uint8_t)~XMODEM_WINDOW};
+							vUARTSend(&au8Cmd[0], sizeof(au8Cmd));
+							u32Window = XMODEM_WINDOW;
+							vTimerStart(POLL_PERIOD_ms);
+						}
+						else
+						{
+							u32State = STATE_IDLE;
+						}
+					}
+#endif
+#if BOOTLOADER_PROFILE
+					else if (u8Data == PROFILE_QUERY)
+					{
+						/* Server wants the profiling counters, the next packet
+						   or poll follows as usual */
+						vProfileSend();
+					}
+#endif
 				}
 				else /* No data received yet, check poll command timeout */
 				{
-					if ((LPC_TMR32B0->TCR & 0x01) == 0)
+					if ((u32TimerExpired() != 0) && (u32BatchEnd != 0))
+					{
+						/* The file is complete, the server has not ended the
+						   batch but there is nothing more to wait for */
+						u32InProgress = 0;
+					}
+					else if (u32TimerExpired() != 0)
 					{
+						/* Nothing heard at a newly negotiated rate, return to the
+						   starting rate which the server also falls back to */
+						if (u32BaudConfirmPending != 0)
+						{
+							(void)u32UARTSetBaudRate(u32BaudRate);
+							u32LineRate = u32BaudRate;
+							u32BaudConfirmPending = 0;
+						}
+
+						/* A window the server has not used (its reply may have
+						   been lost) lapses, the server takes POLL as a refusal */
+						u32Window = 1;
+
 						/* Timeout expired following poll command transmission so try again.. */
-						uint8_t u8Cmd = POLL;
+						uint8_t u8Cmd = (u32Streaming != 0) ? STREAM_POLL : POLL;
 						vUARTSend(&u8Cmd, 1);
 
 						/* Restart timeout to send another poll if we do not get a response */
@@ -143,6 +477,49 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 			}
 			break;
 
+#if XMODEM_NEGOTIATE
+			case STATE_NEGOTIATING:
+			{
+				uint8_t u8Data;
+
+				/* Collect the index of the selected rate and its complement */
+				if (u8UARTReceive(&u8Data))
+				{
+					au8BaudSelect[u32ByteCount++] = u8Data;
+
+					if (u32ByteCount == sizeof(au8BaudSelect))
+					{
+						uint32_t u32NewRate = u32Xmodem1k_BaudRate(au8BaudSelect[0]);
+						uint8_t u8Cmd = NAK;
+
+						if (((au8BaudSelect[0] ^ au8BaudSelect[1]) == 0xFF) && (u32NewRate != 0))
+						{
+							/* Acknowledge at the current rate then switch, the link
+							   is only trusted once a good packet has arrived */
+							u8Cmd = ACK;
+							vUARTSend(&u8Cmd, 1);
+							(void)u32UARTSetBaudRate(u32NewRate);
+							u32BaudConfirmPending = (u32NewRate != u32BaudRate) ? BAUD_CONFIRM_ATTEMPTS : 0;
+							u32LineRate = u32NewRate;
+						}
+						else
+						{
+							vUARTSend(&u8Cmd, 1);
+						}
+
+						/* Poll, at the new rate if it was changed */
+						u32State = STATE_IDLE;
+					}
+				}
+				else if (u32TimerExpired() != 0)
+				{
+					/* Server did not make a choice, carry on polling */
+					u32State = STATE_IDLE;
+				}
+			}
+			break;
+#endif
+
 			case STATE_RECEIVING:
 			{
 				uint8_t u8Data;
@@ -150,51 +527,207 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 				/* Check if a character has been received on the UART */
 				if (u8UARTReceive(&u8Data))
 				{
+					/* Line is active, the gap before the next character starts now */
+					vTimerRestartGap();
+
 					/* Position of received byte determines action we take */
-					if (u32ByteCount == 0)
+					if (u32ByteCount < PACKET_HEADER_LEN)
 					{
-						/* Expecting a start of packet character */
-						if ((u8Data == STX) || (u8Data == SOH))
+						/* Expecting a start of packet character, the packet number and
+						   its complement. EOT is only accepted in place of a packet,
+						   not in the middle of noise, nor straight after a rejected
+						   packet: in a window that may have run into the next one,
+						   whose number follows on from where it was cut short. */
+						if ((u32ByteCount == 0) && (u32Resyncing == 0) && (u32Rejected == 0) && (u8Data == EOT))
 						{
-							if (u8Data == STX)
+							/* Server indicating transmission is complete, the last
+							   packets must reach flash before the transfer is confirmed,
+							   then the callback is told that no more data follows */
+							if ((u32Xmodem1k_WritePending(pu32Xmodem1kRxPacketCallback, &u8WriteSeq,
+														  (uint8_t)(u8NextSeq - u8WriteSeq)) == 0) ||
+								(pu32Xmodem1kRxPacketCallback(0, 0) == 0))
 							{
-								/* STX indicates long payload packet is being transmitted */
-								u32PktLen = LONG_PACKET_PAYLOAD_LEN;
+								vXmodem1k_Cancel();
+
+								/* Close xmodem client */
+								u32InProgress = 0;
 							}
 							else
 							{
-								/* SOH indicates short payload packet is being transmitted */
-								u32PktLen = SHORT_PACKET_PAYLOAD_LEN;
-							}
-							u32ByteCount = 1;
+								vXmodem1k_Respond(ACK, u8NextSeq, u32Window);
+								u32Result = 1;
 
-							/* Start packet timeout */
-							vTimerStart(PACKET_TIMEOUT_PERIOD_ms);
-						}
-						else if (u8Data == EOT)
-						{
-							/* Server indicating transmission is complete */
-							uint8_t u8Cmd = ACK;
-							vUARTSend(&u8Cmd, 1);
-
-							/* Close xmodem client */
-							u32InProgress = 0;
+								if (u32Ymodem != 0)
+								{
+									/* Poll for the packet 0 that ends the batch */
+									u32BatchEnd = 1;
+									u32PacketsAccepted = 0;
+									u8EndSeq = u8NextSeq;
+									u8NextSeq = 1;
+									u8WriteSeq = 1;
+									u32ByteCount = 0;
+									u32State = STATE_IDLE;
+								}
+								else
+								{
+									/* Close xmodem client */
+									u32InProgress = 0;
+								}
+							}
 						}
 						else
 						{
-							/* TODO - Unexpected character, do what...? */
+							uint32_t i;
+
+							au8Header[u32ByteCount++] = u8Data;
+
+							/* Line noise, or the rest of a packet whose header was
+							   rejected. Drop the oldest character until what is left
+							   could start a packet in the window (or a repeat of one
+							   already received, if its ACK was lost), so that a packet
+							   following the noise is received rather than timed out. */
+							while ((u32ByteCount != 0) &&
+								   (u32Xmodem1k_HeaderPlausible(&au8Header[0], u32ByteCount, u8NextSeq,
+																((u32PacketsAccepted != 0) || (pu32Xmodem1kRxHeaderCallback != 0)),
+																u32Window) == 0))
+							{
+								if (u32Resyncing == 0)
+								{
+									/* Give up, and NAK, once the line goes quiet or
+									   a long packet's time has passed */
+									u32Resyncing = 1;
+									u32Discarded = 0;
+									vXmodem1k_StartPacketTimeout(LONG_PACKET_PAYLOAD_LEN, u32LineRate);
+								}
+								for (i = 1; i < u32ByteCount; i++)
+								{
+									au8Header[i - 1] = au8Header[i];
+								}
+								u32ByteCount--;
+								u32Discarded++;
+							}
+
+							if ((u32ByteCount == 1) && (u32Resyncing == 0))
+							{
+								/* Start packet timeout */
+								u32PktLen = (au8Header[0] == STX) ? LONG_PACKET_PAYLOAD_LEN : SHORT_PACKET_PAYLOAD_LEN;
+								vXmodem1k_StartPacketTimeout(u32PktLen, u32LineRate);
+#if XMODEM_LINE_ERRORS
+								u32LineErrors = u32UARTErrorCount(UART_ERROR_ANY);
+								u32LineLost = u32Xmodem1k_CharsLost();
+#endif
+							}
+							else if (u32ByteCount == PACKET_HEADER_LEN)
+							{
+								/* STX indicates long payload packet is being transmitted,
+								   SOH a short one */
+								u32PktLen = (au8Header[0] == STX) ? LONG_PACKET_PAYLOAD_LEN : SHORT_PACKET_PAYLOAD_LEN;
+								u8PacketSeq = au8Header[1];
+								u16RunningCRC = 0;
+								u32RxBufferIdx = RX_BUFFER_IDX(u8PacketSeq);
+								u32Store = 1;
+
+								if ((u32PacketsAccepted != 0) &&
+									((uint8_t)(u8NextSeq - u8PacketSeq - 1) < u32Window))
+								{
+									/* Already accepted, only the CRC is needed */
+									u32Store = 0;
+								}
+#if XMODEM_WINDOW
+								/* Only a window can run into a buffer still in use,
+								   otherwise the packet before has been written */
+								else if ((au16RxLen[u32RxBufferIdx] != 0) && (au8RxSeq[u32RxBufferIdx] == u8PacketSeq))
+								{
+									/* Already held until a missing packet arrives */
+									u32Store = 0;
+								}
+								else if (au16RxLen[u32RxBufferIdx] != 0)
+								{
+									if ((uint8_t)(au8RxSeq[u32RxBufferIdx] - u8WriteSeq) >= (uint8_t)(u8NextSeq - u8WriteSeq))
+									{
+										/* Held for another packet outside the window,
+										   only a misbehaving server sends this */
+										u32Store = 0;
+									}
+									else if (u32Xmodem1k_WritePending(pu32Xmodem1kRxPacketCallback, &u8WriteSeq,
+																	  (uint8_t)(au8RxSeq[u32RxBufferIdx] - u8WriteSeq) + 1) == 0)
+									{
+										/* The buffer holds an accepted packet that had to
+										   be written first, it has already been
+										   acknowledged so the transfer cannot be
+										   recovered */
+										vXmodem1k_Cancel();
+										u32InProgress = 0;
+									}
+								}
+#endif
+
+								if (u32Resyncing != 0)
+								{
+									/* Found after noise, time the packet from here */
+									PROFILE_EVENT(PROFILE_RESYNC, u32Discarded);
+									u32Resyncing = 0;
+									vXmodem1k_StartPacketTimeout(u32PktLen, u32LineRate);
+#if XMODEM_LINE_ERRORS
+									u32LineErrors = u32UARTErrorCount(UART_ERROR_ANY);
+									u32LineLost = u32Xmodem1k_CharsLost();
+#endif
+								}
+							}
 						}
 					}
-					else if (u32ByteCount == 1)
-					{
-						/* Byte 1 is the packet number - should be different from last one we received */
-						u32ByteCount++;
-					}
-					else if (u32ByteCount == 2)
+#if XMODEM_LINE_ERRORS
+					else if ((u32LineError != 0) || (u32UARTErrorCount(UART_ERROR_ANY) != u32LineErrors))
 					{
-						/* Byte 2 is the packet number inverted - check for error with last byte */
+						/* A character of this packet has been lost or damaged on
+						   the line, so the CRC cannot match. Stop storing and NAK
+						   at the end of the packet, allowing for the characters
+						   known to be lost, or once the line is quiet if more were
+						   lost and the end never arrives. */
+						if (u32LineError == 0)
+						{
+							u32LineError = 1;
+							u32Discarded = 0;
+						}
+						u32Discarded++;
 						u32ByteCount++;
+
+						if ((u32ByteCount + (u32Xmodem1k_CharsLost() - u32LineLost)) >= (PACKET_HEADER_LEN + u32PktLen + 2))
+						{
+							PROFILE_EVENT(PROFILE_LINE_ERROR, u32Discarded);
+							u32LineError = 0;
+							u32ByteCount = 0;
+							u32Rejected = 1;
+
+							if ((u32BaudConfirmPending != 0) && (--u32BaudConfirmPending == 0))
+							{
+								/* First packet at a newly negotiated rate is still
+								   bad, fall back as for a CRC error */
+								(void)u32UARTSetBaudRate(u32BaudRate);
+								u32LineRate = u32BaudRate;
+								u32State = STATE_IDLE;
+							}
+							else if ((u32Streaming != 0) && (u32BaudConfirmPending == 0))
+							{
+								/* A streaming server cannot resend */
+								vXmodem1k_Cancel();
+								u32InProgress = 0;
+							}
+							else
+							{
+								vXmodem1k_Respond(NAK, u8PacketSeq, u32Window);
+								if (u8PacketSeq == u8NextSeq)
+								{
+									u32Naked = 1;
+								}
+								if ((u32Naked == 0) || (u32Window == 1))
+								{
+									vXmodem1k_StartIdleTimeout(u32LineRate);
+								}
+							}
+						}
 					}
+#endif
 					else if (((u32ByteCount == 131 ) && (u32PktLen == SHORT_PACKET_PAYLOAD_LEN)) ||
 							 ((u32ByteCount == 1027) && (u32PktLen == LONG_PACKET_PAYLOAD_LEN)))
 					{
@@ -211,45 +744,237 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 						u16CRC <<= 8;
 						u16CRC  |= u8Data;
 
-						/* Check the received CRC against the CRC we generate on the packet data */
-						if (u16CRC_Calc16(&au8RxBuffer[0], u32PktLen) == u16CRC)
+						/* Check the received CRC against the CRC accumulated as the packet
+						   data arrived */
+#if XMODEM_YMODEM
+						if ((u16RunningCRC == u16CRC) && (u8PacketSeq == 0) && (u32PacketsAccepted == 0))
 						{
-							uint8_t u8Cmd;
+							/* Packet 0 ahead of packet 1 is a YMODEM header (or a
+							   repeat of it) */
+							const uint8_t *pu8Header = &au8RxBuffer[u32RxBufferIdx][0];
+							uint32_t u32Size = 0;
+							uint8_t u8Cmd = ACK;
 
-							/* Have now received full packet, call handler BEFORE sending ACK to application
-							   can process data before more is sent. */
-							if (pu32Xmodem1kRxPacketCallback(&au8RxBuffer[0], u32PktLen) != 0)
+							u32BaudConfirmPending = 0;
+							if (pu8Header[0] == 0)
 							{
-								/* Packet handled successfully, send ACK to server indicating we are ready for next packet */
-								u8Cmd = ACK;
+								/* No file name, the end of the batch */
 								vUARTSend(&u8Cmd, 1);
+								u32InProgress = 0;
+							}
+							else if ((u32BatchEnd != 0) ||
+									 (u32Xmodem1k_ParseHeader(pu8Header, u32PktLen, &u32Size) == 0) ||
+									 (pu32Xmodem1kRxHeaderCallback((const char *)pu8Header, u32Size) == 0))
+							{
+								/* A second file, or one that cannot be accepted,
+								   before anything has been written for it */
+								vXmodem1k_Cancel();
+								u32InProgress = 0;
 							}
 							else
 							{
-								/* Something went wrong with packet handler, all we can do is send NAK causing the
-								   packet to be retransmitted by the server.. */
-								u8Cmd = NAK;
+								/* Poll for packet 1 */
 								vUARTSend(&u8Cmd, 1);
+								u32Ymodem = 1;
+								u32State = STATE_IDLE;
+							}
+						}
+						else if ((u16RunningCRC == u16CRC) && (u32Store == 0))
+#else
+						if ((u16RunningCRC == u16CRC) && (u32Store == 0))
+#endif
+						{
+							/* Repeat of a packet which has already been received.
+							   Acknowledge again what has been received in order,
+							   without storing it. */
+							vXmodem1k_Respond(ACK, (uint8_t)(u8NextSeq - 1), u32Window);
+						}
+						else if (u16RunningCRC == u16CRC)
+						{
+							uint8_t u8FirstSeq = u8NextSeq;
+
+							/* Hold the packet, then queue it for writing along with
+							   any held behind it if it is the next one in order */
+							au16RxLen[u32RxBufferIdx] = (uint16_t)u32PktLen;
+							au8RxSeq[u32RxBufferIdx] = u8PacketSeq;
+							while ((au16RxLen[RX_BUFFER_IDX(u8NextSeq)] != 0) &&
+								   (au8RxSeq[RX_BUFFER_IDX(u8NextSeq)] == u8NextSeq))
+							{
+								u8NextSeq++;
+								u32PacketsAccepted++;
+							}
+
+							if ((u8NextSeq != u8FirstSeq) &&
+								(u32Xmodem1k_WritePending(pu32Xmodem1kRxPacketCallback, &u8WriteSeq,
+														  (uint8_t)(u8NextSeq - u8WriteSeq) - 1) == 0))
+							{
+								/* Earlier packets are normally written while the line is
+								   idle, if that has not happened yet they must be written
+								   now so that what the server sends next (one packet, or a
+								   window's worth) fits in the UART receive buffer while the
+								   latest is written. They have already been acknowledged
+								   so the transfer cannot be recovered. */
+								vXmodem1k_Cancel();
+								u32InProgress = 0;
+							}
+							else if (u8NextSeq != u8FirstSeq)
+							{
+								/* Acknowledge straight away so that the server sends
+								   the next packet while this one is written to flash.
+								   A streaming server is not waiting, except to learn
+								   that a newly negotiated rate works. */
+								if ((u32Streaming == 0) || (u32BaudConfirmPending != 0))
+								{
+									vXmodem1k_Respond(ACK, (uint8_t)(u8NextSeq - 1), u32Window);
+								}
+								u32Naked = 0;
+
+								/* Link works at the current rate */
+								u32BaudConfirmPending = 0;
 							}
+							else if (u32Naked == 0)
+							{
+								/* Ahead of a packet that has been lost, ask for that
+								   one alone unless it has been asked for already
+								   (the server also times out) */
+								vXmodem1k_Respond(NAK, u8NextSeq, u32Window);
+								u32Naked = 1;
+							}
+						}
+						else if ((u32BaudConfirmPending != 0) && (--u32BaudConfirmPending == 0))
+						{
+							/* First packet at a newly negotiated rate is corrupt
+							   time after time, drop back to the starting rate
+							   without answering (the server does the same when
+							   its response timeout expires) */
+							(void)u32UARTSetBaudRate(u32BaudRate);
+							u32LineRate = u32BaudRate;
+							u32State = STATE_IDLE;
+						}
+						else if ((u32Streaming != 0) && (u32BaudConfirmPending == 0))
+						{
+							/* A streaming server cannot resend, though it waits
+							   for the first packet at a new rate to be answered */
+							vXmodem1k_Cancel();
+							u32InProgress = 0;
 						}
 						else /* Error CRC calculated does not match that received */
 						{
-							/* Indicate problem to server - should result in packet being resent.. */
-							uint8_t u8Cmd = NAK;
-							vUARTSend(&u8Cmd, 1);
+							/* Indicate problem to server - should result in packet being resent,
+							   at a newly negotiated rate too as the packet did get through.. */
+							vXmodem1k_Respond(NAK, u8PacketSeq, u32Window);
+							if (u8PacketSeq == u8NextSeq)
+							{
+								u32Naked = 1;
+							}
 						}
+						u32Rejected = (u16RunningCRC != u16CRC) ? 1 : 0;
 						u32ByteCount = 0;
+
+						/* Wait for the next packet. A packet asked for again in a
+						   window is asked for once more as soon as the line goes
+						   quiet, on the timeout already running. */
+						if ((u32Naked == 0) || (u32Window == 1))
+						{
+							vXmodem1k_StartIdleTimeout(u32LineRate);
+						}
 					}
 					else
 					{
-						/* Must be payload data so store */
-						au8RxBuffer[u32ByteCount - PACKET_HEADER_LEN] = u8Data;
+						/* Must be payload data so store, and add it to the packet CRC
+						   while waiting for the next character */
+						if (u32Store != 0)
+						{
+							au8RxBuffer[u32RxBufferIdx][u32ByteCount - PACKET_HEADER_LEN] = u8Data;
+						}
+						u16RunningCRC = u16CRC_Update16(u16RunningCRC, u8Data);
 						u32ByteCount++;
 					}
 				}
-				else
+				else if (u8WriteSeq != u8NextSeq)
+				{
+					/* No data waiting, use the gap to write the oldest accepted
+					   packet to flash. Characters that arrive meanwhile are held
+					   in the UART receive buffer. */
+					if (u32Xmodem1k_WritePending(pu32Xmodem1kRxPacketCallback, &u8WriteSeq, 1) == 0)
+					{
+						/* Packet has already been acknowledged, abort the transfer */
+						vXmodem1k_Cancel();
+						u32InProgress = 0;
+					}
+
+					/* Time spent writing is not the server's, restart the
+					   timeout for any packet being received */
+					if (u32Resyncing != 0)
+					{
+						vXmodem1k_StartPacketTimeout(LONG_PACKET_PAYLOAD_LEN, u32LineRate);
+					}
+					else if (u32ByteCount != 0)
+					{
+						vXmodem1k_StartPacketTimeout(u32PktLen, u32LineRate);
+					}
+					else
+					{
+						vXmodem1k_StartIdleTimeout(u32LineRate);
+					}
+				}
+				else if (u32TimerExpired() != 0)
 				{
-					/* TODO - Check packet timeout */
+					/* Packet incomplete and the line has gone quiet (or the
+					   packet is taking too long), a character has been lost.
+					   Rejected packets and noise are also answered here, once
+					   the line is quiet. In a window, a packet that has been
+					   asked for again and not arrived by the time the line is
+					   quiet has been lost too. Between packets, the server
+					   has not sent the next one in time and the response to
+					   the last has been lost. */
+					uint8_t u8LostSeq = (u32ByteCount >= PACKET_HEADER_LEN) ? u8PacketSeq : u8NextSeq;
+					uint32_t u32HeaderSeen = (u32ByteCount >= PACKET_HEADER_LEN) ? 1 : 0;
+
+					u32Discarded += u32Xmodem1k_Purge();
+					u32Rejected = 0;
+					if (u32Resyncing != 0)
+					{
+						PROFILE_EVENT(PROFILE_RESYNC, u32Discarded);
+						u32Resyncing = 0;
+					}
+#if XMODEM_LINE_ERRORS
+					else if (u32LineError != 0)
+					{
+						PROFILE_EVENT(PROFILE_LINE_ERROR, u32Discarded);
+						u32LineError = 0;
+					}
+#endif
+					u32ByteCount = 0;
+
+					if ((u32BaudConfirmPending != 0) &&
+						((u32HeaderSeen == 0) || (--u32BaudConfirmPending == 0)))
+					{
+						/* Nothing intelligible at a newly negotiated rate, or
+						   the first packet cut short time after time, fall
+						   back as for a corrupt first packet */
+						(void)u32UARTSetBaudRate(u32BaudRate);
+						u32LineRate = u32BaudRate;
+						u32BaudConfirmPending = 0;
+						u32State = STATE_IDLE;
+					}
+					else if ((u32Streaming != 0) && (u32BaudConfirmPending == 0))
+					{
+						/* A streaming server cannot resend */
+						vXmodem1k_Cancel();
+						u32InProgress = 0;
+					}
+					else
+					{
+						/* Ask for the packet again, and in a window once more if
+						   the line stays quiet */
+						vXmodem1k_Respond(NAK, u8LostSeq, u32Window);
+						if (u8LostSeq == u8NextSeq)
+						{
+							u32Naked = 1;
+						}
+						vXmodem1k_StartIdleTimeout(u32LineRate);
+					}
 				}
 			}
 			break;
@@ -258,30 +983,354 @@ void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data,
 				break;
 		}
 	}
+	return u32Result;
 }
 
+#if XMODEM_NEGOTIATE || XMODEM_AUTOBAUD
 /*****************************************************************************
- ** Function name:
+ ** Function name:	u32Xmodem1k_BaudRate
  **
- ** Descriptions:
+ ** Descriptions:	Looks up a rate offered to the server during negotiation.
+ ** 				Only rates that the UART can generate are offered.
  **
- ** Parameters:	     None
+ ** Parameters:	    u32Index - Position of the rate in the offered list.
  **
- ** Returned value:  None
+ ** Returned value: Baud rate, or 0 if the index is out of range.
  **
  *****************************************************************************/
-static void vTimerStart(uint32_t u32Periodms)
+static uint32_t u32Xmodem1k_BaudRate(uint32_t u32Index)
 {
-	/* Enable the timer clock */
-	LPC_SYSCON->SYSAHBCLKCTRL |= (1UL << 9);
-
-	/* Configure the timer so that we can poll for a match */
-	LPC_TMR32B0->TCR = 0x02;		/* reset timer */
-	LPC_TMR32B0->PR  = 0x00;		/* set prescaler to zero */
-	LPC_TMR32B0->MR0 = u32Periodms * ((SystemCoreClock / (LPC_TMR32B0->PR + 1)) / 1000UL);
-	LPC_TMR32B0->IR  = 0xFF;		/* reset all interrupts */
-	LPC_TMR32B0->MCR = 0x04;		/* stop timer on match */
-	LPC_TMR32B0->TCR = 0x01;		/* start timer */
+	uint32_t i;
+	uint32_t u32Rate = 0;
+
+	for (i = 0; i < BAUD_RATE_COUNT; i++)
+	{
+		if (u32UARTBaudRateSupported(au32BaudRates[i]) != 0)
+		{
+			if (u32Index == 0)
+			{
+				u32Rate = au32BaudRates[i];
+				break;
+			}
+			u32Index--;
+		}
+	}
+	return u32Rate;
+}
+#endif
+
+#if XMODEM_AUTOBAUD
+/*****************************************************************************
+ ** Function name:	u32Xmodem1k_NearestBaudRate
+ **
+ ** Descriptions:	Finds the offered rate closest to a measured baud rate.
+ ** 				The auto-baud unit only uses the integer divider so its
+ ** 				result can be several percent away from the true rate.
+ **
+ ** Parameters:	    u32Measured - Baud rate reported by the auto-baud unit.
+ **
+ ** Returned value: Offered baud rate, or 0 if none is within 1/16 of the
+ ** 				measured rate.
+ **
+ *****************************************************************************/
+static uint32_t u32Xmodem1k_NearestBaudRate(uint32_t u32Measured)
+{
+	uint32_t i;
+	uint32_t u32Rate;
+	uint32_t u32Error;
+	uint32_t u32BestRate = 0;
+	uint32_t u32BestError = 0xFFFFFFFFUL;
+
+	for (i = 0; (u32Rate = u32Xmodem1k_BaudRate(i)) != 0; i++)
+	{
+		u32Error = (u32Rate > u32Measured) ? (u32Rate - u32Measured) : (u32Measured - u32Rate);
+		if (u32Error < u32BestError)
+		{
+			u32BestError = u32Error;
+			u32BestRate = u32Rate;
+		}
+	}
+	return ((u32BestError * 16) <= u32BestRate) ? u32BestRate : 0;
+}
+#endif
+
+#if XMODEM_NEGOTIATE
+/*****************************************************************************
+ ** Function name:	vXmodem1k_SendBaudRates
+ **
+ ** Descriptions:	Sends the list of baud rates offered to the server.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vXmodem1k_SendBaudRates(void)
+{
+	uint8_t au8Frame[2 + (BAUD_RATE_COUNT * 4) + 2];
+	uint32_t u32Len = 2;
+	uint32_t u32Count = 0;
+	uint32_t u32Rate;
+	uint16_t u16FrameCRC;
+
+	while ((u32Rate = u32Xmodem1k_BaudRate(u32Count)) != 0)
+	{
+		au8Frame[u32Len++] = (uint8_t)(u32Rate);
+		au8Frame[u32Len++] = (uint8_t)(u32Rate >> 8);
+		au8Frame[u32Len++] = (uint8_t)(u32Rate >> 16);
+		au8Frame[u32Len++] = (uint8_t)(u32Rate >> 24);
+		u32Count++;
+	}
+	au8Frame[0] = BAUD_QUERY;
+	au8Frame[1] = (uint8_t)u32Count;
+
+	u16FrameCRC = u16CRC_Calc16(&au8Frame[1], u32Len - 1);
+	au8Frame[u32Len++] = (uint8_t)(u16FrameCRC >> 8);
+	au8Frame[u32Len++] = (uint8_t)(u16FrameCRC);
+
+	vUARTSend(&au8Frame[0], u32Len);
+}
+#endif
+
+/*****************************************************************************
+ ** Function name:	u32Xmodem1k_HeaderPlausible
+ **
+ ** Descriptions:	Checks whether the start of a packet header could belong
+ ** 				to a packet expected next: a start of packet character,
+ ** 				a packet number in the window (or one of the last ones,
+ ** 				when a repeat is allowed) and its complement.
+ **
+ ** Parameters:	    pu8Header - Header characters received so far.
+ ** 				u32Len - Number of characters, 1 to PACKET_HEADER_LEN.
+ ** 				u8NextSeq - Number of the next packet.
+ ** 				u32RepeatAllowed - Non-zero once a packet has been
+ ** 				acknowledged.
+ ** 				u32Window - Number of packets the server may have
+ ** 				outstanding, 1 unless a sliding window is in use.
+ **
+ ** Returned value: 1 if the characters could start the packet, else 0.
+ **
+ *****************************************************************************/
+static uint32_t u32Xmodem1k_HeaderPlausible(const uint8_t *pu8Header, uint32_t u32Len,
+										   uint8_t u8NextSeq, uint32_t u32RepeatAllowed,
+										   uint32_t u32Window)
+{
+	if ((pu8Header[0] != SOH) && (pu8Header[0] != STX))
+	{
+		return 0;
+	}
+	if ((u32Len > 1) && ((uint8_t)(pu8Header[1] - u8NextSeq) >= u32Window) &&
+		(((uint8_t)(u8NextSeq - pu8Header[1] - 1) >= u32Window) || (u32RepeatAllowed == 0)))
+	{
+		return 0;
+	}
+	if ((u32Len > 2) && ((pu8Header[1] ^ pu8Header[2]) != 0xFF))
+	{
+		return 0;
+	}
+	return 1;
+}
+
+/*****************************************************************************
+ ** Function name:	vXmodem1k_Respond
+ **
+ ** Descriptions:	Answers a packet. In a sliding window the packet number
+ ** 				follows, otherwise the character is sent alone.
+ **
+ ** Parameters:	    u8Cmd - ACK or NAK.
+ ** 				u8Seq - Packet number.
+ ** 				u32Window - Number of packets the server may have
+ ** 				outstanding, 1 unless a sliding window is in use.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vXmodem1k_Respond(uint8_t u8Cmd, uint8_t u8Seq, uint32_t u32Window)
+{
+	uint8_t au8Cmd[2];
+
+	au8Cmd[0] = u8Cmd;
+	au8Cmd[1] = u8Seq;
+	vUARTSend(&au8Cmd[0], (u32Window > 1) ? 2 : 1);
+}
+
+/*****************************************************************************
+ ** Function name:	u32Xmodem1k_WritePending
+ **
+ ** Descriptions:	Passes accepted packets to the callback, oldest first,
+ ** 				freeing their buffers.
+ **
+ ** Parameters:	    pu32Xmodem1kRxPacketCallback - Function that handles
+ ** 				each packet, returns 0 on failure.
+ ** 				pu8WriteSeq - Number of the oldest packet not yet
+ ** 				written, advanced past those written.
+ ** 				u32Count - Number of packets to write.
+ **
+ ** Returned value: 0 if the callback failed, otherwise 1.
+ **
+ *****************************************************************************/
+static uint32_t u32Xmodem1k_WritePending(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len),
+										 uint8_t *pu8WriteSeq, uint32_t u32Count)
+{
+	uint32_t u32Result = 1;
+
+	while ((u32Count != 0) && (u32Result != 0))
+	{
+		uint32_t u32Idx = RX_BUFFER_IDX(*pu8WriteSeq);
+
+		u32Result = pu32Xmodem1kRxPacketCallback(&au8RxBuffer[u32Idx][0], au16RxLen[u32Idx]);
+		au16RxLen[u32Idx] = 0;
+		(*pu8WriteSeq)++;
+		u32Count--;
+	}
+	return u32Result;
+}
+
+/*****************************************************************************
+ ** Function name:	vXmodem1k_StartPacketTimeout
+ **
+ ** Descriptions:	Starts the timeouts for a packet, see
+ ** 				PACKET_TIMEOUT_PERCENT and CHAR_TIMEOUT_CHARS.
+ **
+ ** Parameters:	    u32PktLen - Payload length.
+ ** 				u32LineRate - Current baud rate.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vXmodem1k_StartPacketTimeout(uint32_t u32PktLen, uint32_t u32LineRate)
+{
+	/* Time for one character, rounded up */
+	uint32_t u32Charus = ((BITS_PER_CHAR * 1000000UL) + u32LineRate - 1) / u32LineRate;
+	uint32_t u32Packetus = (u32PktLen + PACKET_HEADER_LEN + 2) * u32Charus;
+
+	vTimerStartGap(((u32Packetus / 1000) * PACKET_TIMEOUT_PERCENT / 100) + PACKET_TIMEOUT_SLACK_ms,
+				   (CHAR_TIMEOUT_CHARS * u32Charus) + CHAR_TIMEOUT_SLACK_us);
+}
+
+/*****************************************************************************
+ ** Function name:	vXmodem1k_StartIdleTimeout
+ **
+ ** Descriptions:	Starts the timeout for the next packet to begin, the
+ ** 				time allowed for a long packet with no limit on the gap.
+ **
+ ** Parameters:	    u32LineRate - Current baud rate.
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vXmodem1k_StartIdleTimeout(uint32_t u32LineRate)
+{
+	uint32_t u32Charus = ((BITS_PER_CHAR * 1000000UL) + u32LineRate - 1) / u32LineRate;
+	uint32_t u32Packetus = (LONG_PACKET_PAYLOAD_LEN + PACKET_HEADER_LEN + 2) * u32Charus;
+	uint32_t u32Idlems = ((u32Packetus / 1000) * PACKET_TIMEOUT_PERCENT / 100) + PACKET_TIMEOUT_SLACK_ms;
+
+	vTimerStartGap(u32Idlems, u32Idlems * 1000);
+}
+
+#if XMODEM_LINE_ERRORS
+/*****************************************************************************
+ ** Function name:	u32Xmodem1k_CharsLost
+ **
+ ** Descriptions:	Counts received characters that never reached the
+ ** 				receive buffer. An overrun loses at least one character,
+ ** 				it is counted as one.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Free running count of lost characters.
+ **
+ *****************************************************************************/
+static uint32_t u32Xmodem1k_CharsLost(void)
+{
+	return u32UARTErrorCount(UART_ERROR_OVERRUN) + u32UARTErrorCount(UART_ERROR_DROPPED);
+}
+#endif
+
+#if XMODEM_YMODEM
+/*****************************************************************************
+ ** Function name:	u32Xmodem1k_ParseHeader
+ **
+ ** Descriptions:	Reads the size from a YMODEM header packet, the decimal
+ ** 				number following the file name. A size too large to
+ ** 				represent is returned as 0xFFFFFFFF.
+ **
+ ** Parameters:	    pu8Data - Packet payload.
+ ** 				u32Len - Payload length.
+ ** 				pu32Size - Returns the size, 0 if the server did not
+ ** 				send one.
+ **
+ ** Returned value: 1 if the file name is terminated within the packet,
+ ** 				else 0.
+ **
+ *****************************************************************************/
+static uint32_t u32Xmodem1k_ParseHeader(const uint8_t *pu8Data, uint32_t u32Len, uint32_t *pu32Size)
+{
+	uint32_t i = 0;
+	uint32_t u32Size = 0;
+
+	while ((i < u32Len) && (pu8Data[i] != 0))
+	{
+		i++;
+	}
+	if (i == u32Len)
+	{
+		return 0;
+	}
+
+	for (i++; (i < u32Len) && (pu8Data[i] >= '0') && (pu8Data[i] <= '9'); i++)
+	{
+		if (u32Size > ((0xFFFFFFFFUL - 9) / 10))
+		{
+			u32Size = 0xFFFFFFFFUL;
+			break;
+		}
+		u32Size = (u32Size * 10) + (pu8Data[i] - '0');
+	}
+	*pu32Size = u32Size;
+	return 1;
+}
+#endif
+
+/*****************************************************************************
+ ** Function name:	u32Xmodem1k_Purge
+ **
+ ** Descriptions:	Discards received characters, called once the line has
+ ** 				been quiet so that the remains of a broken packet are not
+ ** 				taken for the start of the next.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: Number of characters discarded.
+ **
+ *****************************************************************************/
+static uint32_t u32Xmodem1k_Purge(void)
+{
+	uint8_t u8Data;
+	uint32_t u32Count = 0;
+
+	while (u8UARTReceive(&u8Data) != 0)
+	{
+		u32Count++;
+	}
+	return u32Count;
+}
+
+/*****************************************************************************
+ ** Function name:	vXmodem1k_Cancel
+ **
+ ** Descriptions:	Tells the server the transfer has been abandoned.
+ **
+ ** Parameters:	    None
+ **
+ ** Returned value: None
+ **
+ *****************************************************************************/
+static void vXmodem1k_Cancel(void)
+{
+	uint8_t au8Cmd[2] = {CAN, CAN};
+
+	vUARTSend(&au8Cmd[0], sizeof(au8Cmd));
 }
 
 /*****************************************************************************
@@ -25,7 +25,36 @@
 
 #include <stdint.h>
 
-void vXmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len));
+/* Protocol extensions, described in xmodem1k.c. Each is left out unless
+   set, a server that asks for it is then answered as by a client without
+   it. The default build leaves them all out so that the bootloader fits the
+   first 4K sector of flash, see the flash layout in README.md. */
+
+/* Set to 1 to offer the server faster baud rates */
+#ifndef XMODEM_NEGOTIATE
+#define XMODEM_NEGOTIATE			0
+#endif
+
+/* Set to 1 to accept a YMODEM batch header, which gives the image size */
+#ifndef XMODEM_YMODEM
+#define XMODEM_YMODEM				0
+#endif
+
+/* Set to 1 to accept streaming, as YMODEM-G */
+#ifndef XMODEM_STREAMING
+#define XMODEM_STREAMING			0
+#endif
+
+/* Packets the server may have outstanding in a sliding window, a power of
+   two, 0 to refuse a window */
+#ifndef XMODEM_WINDOW
+#define XMODEM_WINDOW				0
+#endif
+
+uint32_t u32Xmodem1k_Client(uint32_t (*pu32Xmodem1kRxPacketCallback)(uint8_t *pu8Data, uint16_t u16Len),
+							uint32_t (*pu32Xmodem1kRxHeaderCallback)(const char *pcName, uint32_t u32Size),
+							uint32_t (*pu32Xmodem1kStreamCallback)(void),
+							uint32_t u32BaudRate);
 
 #endif /* end __XMODEM1K_H */
 /*****************************************************************************